@@ -0,0 +1,43 @@
+#include "Graph.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+/** Print the usage of compile_graph, and exit */
+void usage() {
+  fprintf(stderr,
+    "usage: compile_graph [output]\n"
+    "  output  The graph image to write (default: %s)\n",
+    GRAPH_IMAGE);
+  exit(1);
+}
+
+/*
+ * Reads the mutation graph from its text files (VOCAB_FILE, GRAPH_FILE and
+ * PRIVATIVE_FILE), and compiles it into a single binary image, which
+ * ReadGraph() memory maps in place of parsing the text files. This moves
+ * the cost of parsing, sorting and indexing the graph from every server
+ * start to a one-off build step.
+ */
+int32_t main( int32_t argc, char *argv[] ) {
+  string path = string(GRAPH_IMAGE);
+  if (argc > 2 || (argc == 2 && strncmp(argv[1], "--", 2) == 0)) {
+    usage();
+  } else if (argc == 2) {
+    path = string(argv[1]);
+  }
+  if (path.empty()) {
+    usage();
+  }
+
+  Graph* graph = ReadTextGraph();
+  fprintf(stderr, "Writing graph image to %s...\n", path.c_str());
+  writeGraphImage(*graph, path);
+  fprintf(stderr, "Done.\n");
+  delete graph;
+  return 0;
+}
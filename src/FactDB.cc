@@ -1,13 +1,860 @@
 #include "FactDB.h"
 
+#include "NumaFactDB.h"
+#include "TieredFactDB.h"
 #include "Utils.h"
 
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
 using namespace btree;
 
 #define CHUNK_SIZE 1048576
+/** The number of facts a SortedKBReader buffers at a time */
+#define READ_CHUNK_SIZE 65536
+
+/**
+ * A knowledge base stored as a memory mapped sorted KB file.
+ * Facts are never copied into the heap: a lookup binary searches the
+ * (small, and quickly resident) fence index, and then a single fence block
+ * of the fact array.
+ */
+class SortedFactDB : public FactDB {
+ public:
+  SortedFactDB(void* mapping, const uint64_t& mappingSize,
+               const sorted_kb_header* header)
+      : mapping(mapping), mappingSize(mappingSize),
+        facts((const uint64_t*) (((const char*) mapping) + header->factsOffset)),
+        fences((const uint64_t*) (((const char*) mapping) + header->fenceOffset)),
+        count(header->count), fenceCount(header->fenceCount),
+        fenceStride(header->fenceStride) { }
+
+  ~SortedFactDB() {
+    munmap(mapping, mappingSize);
+  }
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    if (count == 0 || fact < fences[0]) {
+      return false;
+    }
+    // (find the block this fact would be in)
+    const uint64_t block =
+      (upper_bound(fences, fences + fenceCount, fact) - fences) - 1;
+    // (search the block)
+    const uint64_t* begin = facts + block * fenceStride;
+    const uint64_t* end = facts + min(count, (block + 1) * fenceStride);
+    return binary_search(begin, end, fact);
+  }
+
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return count; }
+
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const {
+    for (uint64_t i = 0; i < count; ++i) {
+      callback(facts[i]);
+    }
+  }
+
+ private:
+  void* mapping;
+  const uint64_t mappingSize;
+  const uint64_t* facts;
+  const uint64_t* fences;
+  const uint64_t count;
+  const uint64_t fenceCount;
+  const uint64_t fenceStride;
+};
+
+/**
+ * A knowledge base stored as a memory mapped Elias-Fano encoded KB file
+ * (see elias_fano_kb_header). A lookup jumps to the nearest sampled bucket
+ * in the upper bits, skips forward to the fact's bucket with popcounts, and
+ * then compares the low bits of the (typically one or two) facts in that
+ * bucket.
+ */
+class EliasFanoFactDB : public FactDB {
+ public:
+  EliasFanoFactDB(void* mapping, const uint64_t& mappingSize,
+                  const elias_fano_kb_header* header)
+      : mapping(mapping), mappingSize(mappingSize),
+        lows((const uint64_t*) (((const char*) mapping) + header->lowOffset)),
+        upper((const uint64_t*) (((const char*) mapping) + header->upperOffset)),
+        samples((const uint64_t*) (((const char*) mapping) + header->sampleOffset)),
+        count(header->count), lowBits(header->lowBits),
+        lowMask((0x1ul << header->lowBits) - 1),
+        sampleStride(header->sampleStride) { }
+
+  ~EliasFanoFactDB() {
+    munmap(mapping, mappingSize);
+  }
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    if (count == 0) {
+      return false;
+    }
+    const uint64_t bucket = fact >> lowBits;
+    const uint64_t low = fact & lowMask;
+    uint64_t position = bucketStart(bucket);
+    uint64_t index = position - bucket;
+    // (scan the facts in the bucket; their low bits are sorted)
+    while ((upper[position >> 6] >> (position & 63)) & 0x1) {
+      const uint64_t candidate = lowAt(index);
+      if (candidate >= low) {
+        return candidate == low;
+      }
+      position += 1;
+      index += 1;
+    }
+    return false;
+  }
+
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return count; }
+
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const {
+    uint64_t bucket = 0;
+    uint64_t position = 0;
+    for (uint64_t index = 0; index < count; ++position) {
+      if ((upper[position >> 6] >> (position & 63)) & 0x1) {
+        callback((bucket << lowBits) | lowAt(index));
+        index += 1;
+      } else {
+        bucket += 1;
+      }
+    }
+  }
+
+ private:
+  void* mapping;
+  const uint64_t mappingSize;
+  const uint64_t* lows;
+  const uint64_t* upper;
+  const uint64_t* samples;
+  const uint64_t count;
+  const uint32_t lowBits;
+  const uint64_t lowMask;
+  const uint64_t sampleStride;
+
+  /** The low bits of the fact at the given index. */
+  inline uint64_t lowAt(const uint64_t& index) const {
+    const uint64_t offset = index * lowBits;
+    const uint64_t word = offset >> 6;
+    const uint32_t shift = offset & 63;
+    uint64_t value = lows[word] >> shift;
+    if (shift + lowBits > 64) {
+      value |= lows[word + 1] << (64 - shift);
+    }
+    return value & lowMask;
+  }
+
+  /**
+   * The position in the upper bits of the first fact in the given bucket;
+   * that is, the position just after the bucket'th zero.
+   */
+  inline uint64_t bucketStart(const uint64_t& bucket) const {
+    const uint64_t position = samples[bucket / sampleStride];
+    uint64_t zerosToSkip = bucket % sampleStride;
+    if (zerosToSkip == 0) {
+      return position;
+    }
+    uint64_t word = position >> 6;
+    uint64_t zeros = ~upper[word] & (~0x0ul << (position & 63));
+    while (true) {
+      const uint64_t available = __builtin_popcountll(zeros);
+      if (available >= zerosToSkip) {
+        for (uint64_t i = 1; i < zerosToSkip; ++i) {
+          zeros &= zeros - 1;  // (clear the lowest zero)
+        }
+        return (word << 6) + __builtin_ctzll(zeros) + 1;
+      }
+      zerosToSkip -= available;
+      word += 1;
+      zeros = ~upper[word];
+    }
+  }
+};
+
+/**
+ * A knowledge base stored as a memory mapped Eytzinger layout KB file
+ * (see eytzinger_kb_header). A lookup descends the implicit tree without
+ * branching on the comparison, and prefetches the cache line holding the
+ * slot's descendants three levels down, so that the memory latency of
+ * successive levels overlaps rather than being paid once per level.
+ */
+class EytzingerFactDB : public FactDB {
+ public:
+  EytzingerFactDB(void* mapping, const uint64_t& mappingSize,
+                  const eytzinger_kb_header* header)
+      : mapping(mapping), mappingSize(mappingSize),
+        facts((const uint64_t*) (((const char*) mapping) + header->factsOffset)),
+        count(header->count) { }
+
+  ~EytzingerFactDB() {
+    munmap(mapping, mappingSize);
+  }
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    uint64_t k = 1;
+    while (k <= count) {
+      __builtin_prefetch(facts + 8 * k);
+      k = 2 * k + (facts[k] < fact);
+    }
+    // (undo the right turns taken after the last left turn; this lands on
+    //  the smallest fact >= the query, or 0 if there is no such fact)
+    k >>= __builtin_ffsll(~k);
+    return k != 0 && facts[k] == fact;
+  }
+
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return count; }
+
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const {
+    // (in-order traversal of the implicit tree)
+    uint64_t k = 1;
+    while (true) {
+      while (2 * k <= count) {
+        k = 2 * k;
+      }
+      while (k > 0 && k <= count) {
+        callback(facts[k]);
+        if (2 * k + 1 <= count) {
+          k = 2 * k + 1;
+          break;
+        }
+        // (climb while we are a right child, then once more)
+        while (k & 0x1) {
+          k >>= 1;
+        }
+        k >>= 1;
+      }
+      if (k == 0 || k > count) {
+        return;
+      }
+    }
+  }
+
+ private:
+  void* mapping;
+  const uint64_t mappingSize;
+  const uint64_t* facts;
+  const uint64_t count;
+};
+
+/** The number of bits stored in a block of a perfect hash KB */
+#define PERFECT_HASH_BITS_PER_BLOCK 448
+/** The number of words in a block: a rank word, plus the bits */
+#define PERFECT_HASH_WORDS_PER_BLOCK 8
+/** The value returned by perfect_hash_index::slot() for unknown facts */
+#define PERFECT_HASH_NO_SLOT 0xfffffffffffffffful
+
+/** A level of a perfect hash KB; see perfect_hash_kb_header */
+struct perfect_hash_level {
+  uint64_t firstBlock;
+  uint64_t numBits;
+};
+
+/**
+ * The read-only structure of a minimal perfect hash, shared by the writer
+ * (which builds it in memory) and PerfectHashFactDB (which maps it from
+ * disk). See perfect_hash_kb_header.
+ */
+struct perfect_hash_index {
+  const perfect_hash_level* levels;
+  uint32_t numLevels;
+  const uint64_t* blocks;
+  const uint64_t* fallback;
+  uint64_t fallbackCount;
+  /** The number of facts placed in the levels, before the fallback facts */
+  uint64_t placedCount;
+
+  /** The position of a fact within a level's bits. */
+  static inline uint64_t position(const uint64_t& fact, const uint32_t& level,
+                                  const uint64_t& numBits) {
+    uint64_t h = fact + (level + 1) * 0x9e3779b97f4a7c15ul;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdul;
+    h ^= h >> 33;
+    return (uint64_t) (((__uint128_t) h * numBits) >> 64);
+  }
+
+  /**
+   * The slot of a fact, or an arbitrary slot if the fact is not in the KB
+   * (or, rarely, PERFECT_HASH_NO_SLOT).
+   */
+  inline uint64_t slot(const uint64_t& fact) const {
+    for (uint32_t level = 0; level < numLevels; ++level) {
+      const uint64_t pos = position(fact, level, levels[level].numBits);
+      const uint64_t* block = blocks + PERFECT_HASH_WORDS_PER_BLOCK *
+        (levels[level].firstBlock + pos / PERFECT_HASH_BITS_PER_BLOCK);
+      const uint32_t offset = pos % PERFECT_HASH_BITS_PER_BLOCK;
+      const uint32_t wordIndex = 1 + (offset >> 6);
+      const uint64_t word = block[wordIndex];
+      if ((word >> (offset & 63)) & 0x1) {
+        uint64_t rank = block[0];
+        for (uint32_t i = 1; i < wordIndex; ++i) {
+          rank += __builtin_popcountll(block[i]);
+        }
+        return rank +
+          __builtin_popcountll(word & ((0x1ul << (offset & 63)) - 1));
+      }
+    }
+    const uint64_t* found =
+      lower_bound(fallback, fallback + fallbackCount, fact);
+    if (found != fallback + fallbackCount && *found == fact) {
+      return placedCount + (found - fallback);
+    }
+    return PERFECT_HASH_NO_SLOT;
+  }
+};
+
+/** The fingerprint of a fact, stored in its perfect hash slot */
+inline uint32_t perfectHashFingerprint(const uint64_t& fact,
+                                       const uint32_t& bits) {
+  uint64_t h = fact ^ 0xc2b2ae3d27d4eb4ful;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ul;
+  h ^= h >> 32;
+  return (uint32_t) (h >> (64 - bits));
+}
+
+/**
+ * A knowledge base stored as a memory mapped minimal perfect hash of
+ * fingerprints (see perfect_hash_kb_header). The facts themselves are not
+ * stored, so a fact not in the KB is reported as present with probability
+ * 2^-fingerprintBits, and the KB cannot be enumerated.
+ */
+class PerfectHashFactDB : public FactDB {
+ public:
+  PerfectHashFactDB(void* mapping, const uint64_t& mappingSize,
+                    const perfect_hash_kb_header* header)
+      : mapping(mapping), mappingSize(mappingSize),
+        fingerprints(((const uint8_t*) mapping) + header->fingerprintOffset),
+        count(header->count), fingerprintBits(header->fingerprintBits) {
+    const char* base = (const char*) mapping;
+    index.levels = (const perfect_hash_level*) (base + header->levelsOffset);
+    index.numLevels = header->numLevels;
+    index.blocks = (const uint64_t*) (base + header->blocksOffset);
+    index.fallback = (const uint64_t*) (base + header->fallbackOffset);
+    index.fallbackCount = header->fallbackCount;
+    index.placedCount = header->count - header->fallbackCount;
+  }
+
+  ~PerfectHashFactDB() {
+    munmap(mapping, mappingSize);
+  }
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    const uint64_t slot = index.slot(fact);
+    if (slot >= count) {
+      return false;
+    }
+    const uint32_t fingerprint = perfectHashFingerprint(fact, fingerprintBits);
+    switch (fingerprintBits) {
+      case 8:
+        return fingerprints[slot] == fingerprint;
+      case 16:
+        return ((const uint16_t*) fingerprints)[slot] == fingerprint;
+      default:
+        return ((const uint32_t*) fingerprints)[slot] == fingerprint;
+    }
+  }
+
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return count; }
+
+  /** {@inheritDoc} */
+  virtual void forEach(
+      std::function<void(const uint64_t&)> /*callback*/) const {
+    fprintf(stderr, "Cannot enumerate the facts of a perfect hash KB!\n");
+    exit(1);
+  }
+
+  /** {@inheritDoc} */
+  virtual bool enumerable() const { return false; }
+
+ private:
+  void* mapping;
+  const uint64_t mappingSize;
+  perfect_hash_index index;
+  const uint8_t* fingerprints;
+  const uint64_t count;
+  const uint32_t fingerprintBits;
+};
+
+//
+// PremiseKB::add()
+//
+void PremiseKB::add(const uint64_t& fact) {
+  uint64_t* position = lower_bound(facts, facts + count, fact);
+  if (position != facts + count && *position == fact) {
+    return;  // duplicate
+  }
+  const uint64_t index = position - facts;
+  if (count == capacity) {
+    uint64_t* larger = (uint64_t*) malloc(2 * capacity * sizeof(uint64_t));
+    memcpy(larger, facts, count * sizeof(uint64_t));
+    if (facts != inlineFacts) { free(facts); }
+    facts = larger;
+    capacity *= 2;
+  }
+  memmove(facts + index + 1, facts + index, (count - index) * sizeof(uint64_t));
+  facts[index] = fact;
+  count += 1;
+}
+
+//
+// SortedKBWriter::SortedKBWriter()
+//
+SortedKBWriter::SortedKBWriter(const string& path, const uint32_t& fenceStride)
+    : path(path), fenceStride(fenceStride), deltaLogOffset(0), count(0),
+      last(0), bufferSize(0) {
+  file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open KB file for writing: %s!\n", path.c_str());
+    exit(1);
+  }
+  // (reserve space for the header; it is written on close())
+  sorted_kb_header header;
+  memset(&header, 0, sizeof(sorted_kb_header));
+  if (fwrite(&header, sizeof(sorted_kb_header), 1, file) != 1) {
+    failWrite();
+  }
+  buffer = (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t));
+  if (buffer == NULL) {
+    fprintf(stderr, "Out of memory writing KB file: %s!\n", path.c_str());
+    exit(1);
+  }
+}
+
+//
+// SortedKBWriter::~SortedKBWriter()
+//
+SortedKBWriter::~SortedKBWriter() {
+  if (file != NULL) {
+    close();
+  }
+  free(buffer);
+}
+
+//
+// SortedKBWriter::failWrite()
+//
+void SortedKBWriter::failWrite() {
+  fprintf(stderr, "Could not write to KB file: %s!\n", path.c_str());
+  fclose(file);
+  unlink(path.c_str());
+  exit(1);
+}
+
+//
+// SortedKBWriter::flushBuffer()
+//
+void SortedKBWriter::flushBuffer() {
+  if (fwrite(buffer, sizeof(uint64_t), bufferSize, file) != bufferSize) {
+    failWrite();
+  }
+  bufferSize = 0;
+}
+
+//
+// SortedKBWriter::append()
+//
+void SortedKBWriter::append(const uint64_t& fact) {
+  if (count > 0) {
+    if (fact == last) {
+      return;  // duplicate
+    }
+    if (fact < last) {
+      fprintf(stderr, "Facts appended out of order to %s: %lu after %lu\n",
+              path.c_str(), fact, last);
+      exit(1);
+    }
+  }
+  if (count % fenceStride == 0) {
+    fences.push_back(fact);
+  }
+  buffer[bufferSize] = fact;
+  bufferSize += 1;
+  if (bufferSize == CHUNK_SIZE) {
+    flushBuffer();
+  }
+  last = fact;
+  count += 1;
+}
+
+//
+// SortedKBWriter::close()
+//
+void SortedKBWriter::close() {
+  // Write the facts + fences
+  flushBuffer();
+  if (fwrite(fences.data(), sizeof(uint64_t), fences.size(), file) !=
+        fences.size()) {
+    failWrite();
+  }
+  // Write the header
+  sorted_kb_header header;
+  memset(&header, 0, sizeof(sorted_kb_header));
+  header.magic = SORTED_KB_MAGIC;
+  header.version = SORTED_KB_VERSION;
+  header.fenceStride = fenceStride;
+  header.count = count;
+  header.fenceCount = fences.size();
+  header.factsOffset = sizeof(sorted_kb_header);
+  header.fenceOffset = sizeof(sorted_kb_header) + count * sizeof(uint64_t);
+  header.deltaLogOffset = deltaLogOffset;
+  if (fseek(file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(sorted_kb_header), 1, file) != 1 ||
+      fflush(file) != 0 || ferror(file)) {
+    failWrite();
+  }
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Could not finish writing KB file: %s!\n", path.c_str());
+    unlink(path.c_str());
+    exit(1);
+  }
+  file = NULL;
+}
+
+//
+// SortedKBReader::SortedKBReader()
+//
+SortedKBReader::SortedKBReader(const string& path)
+    : path(path), index(0), bufferSize(0), bufferPos(0) {
+  file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open KB file %s!\n", path.c_str());
+    exit(1);
+  }
+  struct stat stats;
+  fstat(fileno(file), &stats);
+  if (fread(&header, sizeof(sorted_kb_header), 1, file) != 1 ||
+      header.magic != SORTED_KB_MAGIC) {
+    fprintf(stderr, "Not a sorted KB file: %s!\n", path.c_str());
+    exit(1);
+  }
+  if (header.version != SORTED_KB_VERSION) {
+    fprintf(stderr, "Unknown KB version in %s: %u (expected %u)\n",
+            path.c_str(), header.version, SORTED_KB_VERSION);
+    exit(1);
+  }
+  if (header.factsOffset + header.count * sizeof(uint64_t) >
+        (uint64_t) stats.st_size) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    exit(1);
+  }
+  fseek(file, header.factsOffset, SEEK_SET);
+  buffer = (uint64_t*) malloc(READ_CHUNK_SIZE * sizeof(uint64_t));
+}
+
+//
+// SortedKBReader::~SortedKBReader()
+//
+SortedKBReader::~SortedKBReader() {
+  fclose(file);
+  free(buffer);
+}
+
+//
+// SortedKBReader::fillBuffer()
+//
+void SortedKBReader::fillBuffer() {
+  const uint64_t toRead = min((uint64_t) READ_CHUNK_SIZE, header.count - index);
+  if (fread(buffer, sizeof(uint64_t), toRead, file) != toRead) {
+    fprintf(stderr, "Could not read from KB file: %s!\n", path.c_str());
+    exit(1);
+  }
+  bufferSize = toRead;
+  bufferPos = 0;
+}
+
+//
+// BloomFilter::BloomFilter()
+//
+BloomFilter::BloomFilter(const uint64_t& count, const uint32_t& bitsPerFact)
+    : mapping(NULL), mappingSize(0) {
+  memset(&header, 0, sizeof(bloom_filter_header));
+  header.magic = BLOOM_FILTER_MAGIC;
+  header.bitsPerFact = bitsPerFact;
+  // (the optimal number of hashes is bitsPerFact * ln(2))
+  header.numHashes = max(1u, min(16u,
+    (uint32_t) (((double) bitsPerFact) * 0.6931 + 0.5)));
+  header.numBlocks = max(1ul,
+    (count * bitsPerFact + BLOOM_BITS_PER_BLOCK - 1) / BLOOM_BITS_PER_BLOCK);
+  header.kbSize = count;
+  const uint64_t bytes = header.numBlocks * BLOOM_WORDS_PER_BLOCK * sizeof(uint64_t);
+  if (posix_memalign((void**) &blocks, CACHE_LINE_SIZE, bytes) != 0) {
+    fprintf(stderr, "Out of memory allocating Bloom filter (%lu bytes)!\n",
+            bytes);
+    exit(1);
+  }
+  memset(blocks, 0, bytes);
+}
+
+//
+// BloomFilter::~BloomFilter()
+//
+BloomFilter::~BloomFilter() {
+  if (mapping != NULL) {
+    munmap(mapping, mappingSize);
+  } else {
+    free(blocks);
+  }
+}
+
+//
+// BloomFilter::expectedFalsePositiveRate()
+//
+double BloomFilter::expectedFalsePositiveRate() const {
+  const double k = header.numHashes;
+  const double n = header.kbSize;
+  const double m = ((double) header.numBlocks) * BLOOM_BITS_PER_BLOCK;
+  return pow(1.0 - exp(-k * n / m), k);
+}
+
+//
+// BloomFilter::write()
+//
+bool BloomFilter::write(const string& path, const uint64_t& kbModifiedTime) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    return false;
+  }
+  bloom_filter_header toWrite = header;
+  toWrite.kbModifiedTime = kbModifiedTime;
+  const uint64_t numWords = header.numBlocks * BLOOM_WORDS_PER_BLOCK;
+  bool ok = fwrite(&toWrite, sizeof(bloom_filter_header), 1, file) == 1 &&
+            fwrite(blocks, sizeof(uint64_t), numWords, file) == numWords;
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    unlink(path.c_str());
+  }
+  return ok;
+}
+
+//
+// BloomFilter::read()
+//
+BloomFilter* BloomFilter::read(const string& path,
+                               const uint64_t& kbSize,
+                               const uint64_t& kbModifiedTime,
+                               const uint32_t& bitsPerFact) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat stats;
+  fstat(fd, &stats);
+  const uint64_t fileSize = stats.st_size;
+  if (fileSize < sizeof(bloom_filter_header)) {
+    close(fd);
+    return NULL;
+  }
+  void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping keeps the file open
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+  const bloom_filter_header* header = (const bloom_filter_header*) mapping;
+  if (header->magic != BLOOM_FILTER_MAGIC ||
+      header->kbSize != kbSize ||
+      header->kbModifiedTime != kbModifiedTime ||
+      header->bitsPerFact != bitsPerFact ||
+      header->numBlocks == 0 ||
+      sizeof(bloom_filter_header) +
+        header->numBlocks * BLOOM_WORDS_PER_BLOCK * sizeof(uint64_t) != fileSize) {
+    munmap(mapping, fileSize);
+    return NULL;
+  }
+  BloomFilter* filter = new BloomFilter();
+  filter->header = *header;
+  filter->blocks = (uint64_t*) (((char*) mapping) + sizeof(bloom_filter_header));
+  filter->mapping = mapping;
+  filter->mappingSize = fileSize;
+  return filter;
+}
+
+//
+// EliasFanoKBWriter::EliasFanoKBWriter()
+//
+EliasFanoKBWriter::EliasFanoKBWriter(const string& path,
+                                     const uint64_t& maxCount,
+                                     const uint32_t& sampleStride)
+    : path(path), maxCount(maxCount), sampleStride(sampleStride),
+      count(0), last(0), nextSampledBucket(0), lowWord(0), lowWordBits(0),
+      bufferSize(0), lowWordsWritten(0) {
+  // (choose lowBits = floor(log2(2^64 / maxCount)), leaving ~maxCount buckets)
+  uint32_t log2Count = 1;
+  while (log2Count < 63 && (0x1ul << log2Count) < maxCount) {
+    log2Count += 1;
+  }
+  lowBits = 64 - log2Count;
+  numBuckets = 0x1ul << log2Count;
+  upper.resize((maxCount + numBuckets) / 64 + 1, 0);
+  file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open KB file for writing: %s!\n", path.c_str());
+    exit(1);
+  }
+  // (reserve space for the header; it is written on close())
+  elias_fano_kb_header header;
+  memset(&header, 0, sizeof(elias_fano_kb_header));
+  if (fwrite(&header, sizeof(elias_fano_kb_header), 1, file) != 1) {
+    failWrite();
+  }
+  buffer = (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t));
+  if (buffer == NULL) {
+    fprintf(stderr, "Out of memory writing KB file: %s!\n", path.c_str());
+    exit(1);
+  }
+}
+
+//
+// EliasFanoKBWriter::~EliasFanoKBWriter()
+//
+EliasFanoKBWriter::~EliasFanoKBWriter() {
+  if (file != NULL) {
+    close();
+  }
+  free(buffer);
+}
+
+//
+// EliasFanoKBWriter::failWrite()
+//
+void EliasFanoKBWriter::failWrite() {
+  fprintf(stderr, "Could not write to KB file: %s!\n", path.c_str());
+  fclose(file);
+  unlink(path.c_str());
+  exit(1);
+}
+
+//
+// EliasFanoKBWriter::flushBuffer()
+//
+void EliasFanoKBWriter::flushBuffer() {
+  if (fwrite(buffer, sizeof(uint64_t), bufferSize, file) != bufferSize) {
+    failWrite();
+  }
+  bufferSize = 0;
+}
+
+//
+// EliasFanoKBWriter::appendLowWord()
+//
+void EliasFanoKBWriter::appendLowWord(const uint64_t& word) {
+  buffer[bufferSize] = word;
+  bufferSize += 1;
+  lowWordsWritten += 1;
+  if (bufferSize == CHUNK_SIZE) {
+    flushBuffer();
+  }
+}
+
+//
+// EliasFanoKBWriter::append()
+//
+void EliasFanoKBWriter::append(const uint64_t& fact) {
+  if (count > 0) {
+    if (fact == last) {
+      return;  // duplicate
+    }
+    if (fact < last) {
+      fprintf(stderr, "Facts appended out of order to %s: %lu after %lu\n",
+              path.c_str(), fact, last);
+      exit(1);
+    }
+  }
+  if (count == maxCount) {
+    fprintf(stderr, "Too many facts appended to %s (expected at most %lu)\n",
+            path.c_str(), maxCount);
+    exit(1);
+  }
+  // (sample the start of any buckets up to and including this one)
+  const uint64_t bucket = fact >> lowBits;
+  while (nextSampledBucket <= bucket) {
+    samples.push_back(nextSampledBucket + count);
+    nextSampledBucket += sampleStride;
+  }
+  // (upper bits)
+  const uint64_t position = bucket + count;
+  upper[position >> 6] |= (0x1ul << (position & 63));
+  // (low bits)
+  const uint64_t low = fact & ((0x1ul << lowBits) - 1);
+  lowWord |= low << lowWordBits;
+  if (lowWordBits + lowBits >= 64) {
+    appendLowWord(lowWord);
+    lowWord = lowWordBits == 0 ? 0 : (low >> (64 - lowWordBits));
+    lowWordBits = lowWordBits + lowBits - 64;
+  } else {
+    lowWordBits += lowBits;
+  }
+  last = fact;
+  count += 1;
+}
+
+//
+// EliasFanoKBWriter::close()
+//
+void EliasFanoKBWriter::close() {
+  // Write the remaining low bits, plus a padding word so that readers can
+  // always load the word following a fact's low bits
+  if (lowWordBits > 0) {
+    appendLowWord(lowWord);
+  }
+  appendLowWord(0);
+  flushBuffer();
+  // Write the upper bits + sampled index
+  while (nextSampledBucket < numBuckets) {
+    samples.push_back(nextSampledBucket + count);
+    nextSampledBucket += sampleStride;
+  }
+  const uint64_t upperWords = (count + numBuckets) / 64 + 1;
+  if (fwrite(upper.data(), sizeof(uint64_t), upperWords, file) !=
+        upperWords ||
+      fwrite(samples.data(), sizeof(uint64_t), samples.size(), file) !=
+        samples.size()) {
+    failWrite();
+  }
+  // Write the header
+  elias_fano_kb_header header;
+  memset(&header, 0, sizeof(elias_fano_kb_header));
+  header.magic = ELIAS_FANO_KB_MAGIC;
+  header.version = ELIAS_FANO_KB_VERSION;
+  header.lowBits = lowBits;
+  header.count = count;
+  header.numBuckets = numBuckets;
+  header.sampleStride = sampleStride;
+  header.lowOffset = sizeof(elias_fano_kb_header);
+  header.upperOffset = header.lowOffset + lowWordsWritten * sizeof(uint64_t);
+  header.sampleOffset = header.upperOffset + upperWords * sizeof(uint64_t);
+  if (fseek(file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(elias_fano_kb_header), 1, file) != 1 ||
+      fflush(file) != 0 || ferror(file)) {
+    failWrite();
+  }
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Could not finish writing KB file: %s!\n", path.c_str());
+    unlink(path.c_str());
+    exit(1);
+  }
+  file = NULL;
+}
 
 //
 // Append To KB
@@ -20,40 +867,1017 @@ void appendToKB(const uint64_t* factStream,
   }
 }
 
-const btree_set<uint64_t>* readKB(string path) {
+/**
+ * Sort an array of facts with the given number of threads: each thread
+ * sorts a contiguous slice, and the slices are then merged pairwise
+ * (again in parallel) until a single sorted run remains.
+ */
+void parallelSort(uint64_t* facts, const uint64_t& count,
+                  const uint32_t& numThreads) {
+  if (numThreads <= 1 || count < CHUNK_SIZE) {
+    sort(facts, facts + count);
+    return;
+  }
+  // (sort slices)
+  vector<uint64_t> bounds(numThreads + 1);
+  for (uint32_t i = 0; i <= numThreads; ++i) {
+    bounds[i] = (count * i) / numThreads;
+  }
+  vector<thread> threads;
+  for (uint32_t i = 0; i < numThreads; ++i) {
+    threads.push_back(thread([facts, &bounds, i]() -> void {
+      sort(facts + bounds[i], facts + bounds[i + 1]);
+    }));
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  // (merge slices)
+  for (uint32_t width = 1; width < numThreads; width *= 2) {
+    threads.clear();
+    for (uint32_t i = 0; i + width < numThreads; i += 2 * width) {
+      const uint64_t begin = bounds[i];
+      const uint64_t middle = bounds[i + width];
+      const uint64_t end = bounds[min(i + 2 * width, numThreads)];
+      threads.push_back(thread([facts, begin, middle, end]() -> void {
+        inplace_merge(facts + begin, facts + middle, facts + end);
+      }));
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+      iter->join();
+    }
+  }
+}
+
+//
+// Bulk load a KB
+//
+btree_set<uint64_t>* bulkLoadKB(uint64_t* facts, const uint64_t& count,
+                                const uint32_t& numThreads) {
+  parallelSort(facts, count, numThreads);
+  const uint64_t uniqueCount = unique(facts, facts + count) - facts;
+  // Inserting sorted facts hints each insert at end(); the btree then
+  // appends to the rightmost leaf, and biases its splits so that every
+  // node it leaves behind is full.
   btree_set<uint64_t>* kb = new btree_set<uint64_t>();
+  kb->insert(facts, facts + uniqueCount);
+  return kb;
+}
 
-  // Open the KB file
-  FILE* file;
-  file = fopen(path.c_str(), "r");
+/**
+ * Lay out sorted facts in Eytzinger order: an in-order traversal of the
+ * implicit tree rooted at slot k visits the facts in sorted order.
+ */
+void eytzingerLayout(const uint64_t* sorted, uint64_t* slots,
+                     uint64_t* next, const uint64_t& k, const uint64_t& count) {
+  if (k <= count) {
+    eytzingerLayout(sorted, slots, next, 2 * k, count);
+    slots[k] = sorted[*next];
+    *next += 1;
+    eytzingerLayout(sorted, slots, next, 2 * k + 1, count);
+  }
+}
+
+/**
+ * Write sorted, unique facts to an Eytzinger layout KB file.
+ */
+void writeEytzingerKB(const string& path, const uint64_t* facts,
+                      const uint64_t& count) {
+  uint64_t* slots = (uint64_t*) malloc((count + 1) * sizeof(uint64_t));
+  if (slots == NULL) {
+    fprintf(stderr, "Out of memory writing KB (%lu facts)!\n", count);
+    exit(1);
+  }
+  slots[0] = 0;
+  uint64_t next = 0;
+  eytzingerLayout(facts, slots, &next, 1, count);
+  eytzinger_kb_header header;
+  memset(&header, 0, sizeof(eytzinger_kb_header));
+  header.magic = EYTZINGER_KB_MAGIC;
+  header.version = EYTZINGER_KB_VERSION;
+  header.count = count;
+  header.factsOffset = sizeof(eytzinger_kb_header);
+  FILE* file = fopen(path.c_str(), "wb");
   if (file == NULL) {
-    fprintf(stderr, "Can't open KB file %s!\n", path.c_str());
+    fprintf(stderr, "Can't open KB file for writing: %s!\n", path.c_str());
+    exit(1);
+  }
+  if (fwrite(&header, sizeof(eytzinger_kb_header), 1, file) != 1 ||
+      fwrite(slots, sizeof(uint64_t), count + 1, file) != count + 1 ||
+      fclose(file) != 0) {
+    fprintf(stderr, "Could not write to KB file: %s!\n", path.c_str());
+    unlink(path.c_str());
+    exit(1);
+  }
+  free(slots);
+}
+
+/**
+ * Write sorted, unique facts to a perfect hash KB file.
+ */
+void writePerfectHashKB(const string& path, const uint64_t* facts,
+                        const uint64_t& count, const uint32_t& fingerprintBits) {
+  if (fingerprintBits != 8 && fingerprintBits != 16 && fingerprintBits != 32) {
+    fprintf(stderr, "Invalid fingerprint width: %u (must be 8, 16 or 32)\n",
+            fingerprintBits);
+    exit(1);
+  }
+  // Build the levels; the facts which collide in a level move to the next
+  vector<perfect_hash_level> levels;
+  vector<uint64_t> blocks;
+  vector<uint64_t> remaining(facts, facts + count);
+  vector<uint64_t> collided;
+  while (!remaining.empty() && levels.size() < PERFECT_HASH_KB_MAX_LEVELS) {
+    const uint32_t level = levels.size();
+    // (twice as many bits as facts, in whole blocks)
+    const uint64_t numBlocks = max(1ul, (2 * remaining.size() +
+      PERFECT_HASH_BITS_PER_BLOCK - 1) / PERFECT_HASH_BITS_PER_BLOCK);
+    perfect_hash_level descriptor;
+    descriptor.firstBlock = blocks.size() / PERFECT_HASH_WORDS_PER_BLOCK;
+    descriptor.numBits = numBlocks * PERFECT_HASH_BITS_PER_BLOCK;
+    levels.push_back(descriptor);
+    vector<uint64_t> seen((descriptor.numBits + 63) / 64, 0);
+    vector<uint64_t> collisions((descriptor.numBits + 63) / 64, 0);
+    for (auto iter = remaining.begin(); iter != remaining.end(); ++iter) {
+      const uint64_t pos =
+        perfect_hash_index::position(*iter, level, descriptor.numBits);
+      if (seen[pos >> 6] & (0x1ul << (pos & 63))) {
+        collisions[pos >> 6] |= (0x1ul << (pos & 63));
+      }
+      seen[pos >> 6] |= (0x1ul << (pos & 63));
+    }
+    // (lay out the bits landed on by exactly one fact in blocks)
+    blocks.resize(blocks.size() + numBlocks * PERFECT_HASH_WORDS_PER_BLOCK, 0);
+    uint64_t* levelBlocks =
+      blocks.data() + descriptor.firstBlock * PERFECT_HASH_WORDS_PER_BLOCK;
+    collided.clear();
+    for (auto iter = remaining.begin(); iter != remaining.end(); ++iter) {
+      const uint64_t pos =
+        perfect_hash_index::position(*iter, level, descriptor.numBits);
+      if (collisions[pos >> 6] & (0x1ul << (pos & 63))) {
+        collided.push_back(*iter);
+      } else {
+        const uint32_t offset = pos % PERFECT_HASH_BITS_PER_BLOCK;
+        levelBlocks[PERFECT_HASH_WORDS_PER_BLOCK * (pos / PERFECT_HASH_BITS_PER_BLOCK) +
+                    1 + (offset >> 6)] |= (0x1ul << (offset & 63));
+      }
+    }
+    remaining.swap(collided);
+  }
+  // Compute the cumulative ranks
+  const uint64_t numBlocks = blocks.size() / PERFECT_HASH_WORDS_PER_BLOCK;
+  uint64_t rank = 0;
+  for (uint64_t b = 0; b < numBlocks; ++b) {
+    uint64_t* block = blocks.data() + b * PERFECT_HASH_WORDS_PER_BLOCK;
+    block[0] = rank;
+    for (uint32_t i = 1; i < PERFECT_HASH_WORDS_PER_BLOCK; ++i) {
+      rank += __builtin_popcountll(block[i]);
+    }
+  }
+  // (facts are sorted, so the leftover facts are too)
+  perfect_hash_index index;
+  index.levels = levels.data();
+  index.numLevels = levels.size();
+  index.blocks = blocks.data();
+  index.fallback = remaining.data();
+  index.fallbackCount = remaining.size();
+  index.placedCount = rank;
+  // Compute the fingerprints
+  const uint32_t fingerprintBytes = fingerprintBits / 8;
+  vector<uint8_t> fingerprints(count * fingerprintBytes, 0);
+  for (uint64_t i = 0; i < count; ++i) {
+    const uint64_t slot = index.slot(facts[i]);
+    const uint32_t fingerprint =
+      perfectHashFingerprint(facts[i], fingerprintBits);
+    memcpy(fingerprints.data() + slot * fingerprintBytes, &fingerprint,
+           fingerprintBytes);  // (little-endian)
+  }
+
+  // Write the file
+  perfect_hash_kb_header header;
+  memset(&header, 0, sizeof(perfect_hash_kb_header));
+  header.magic = PERFECT_HASH_KB_MAGIC;
+  header.version = PERFECT_HASH_KB_VERSION;
+  header.fingerprintBits = fingerprintBits;
+  header.count = count;
+  header.numLevels = levels.size();
+  header.levelsOffset = sizeof(perfect_hash_kb_header);
+  header.numBlocks = numBlocks;
+  // (blocks are aligned to cache lines, so that each is one cache miss)
+  const uint64_t levelsEnd =
+    header.levelsOffset + levels.size() * sizeof(perfect_hash_level);
+  header.blocksOffset =
+    ((levelsEnd + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE;
+  header.fallbackCount = remaining.size();
+  header.fallbackOffset = header.blocksOffset + blocks.size() * sizeof(uint64_t);
+  header.fingerprintOffset =
+    header.fallbackOffset + remaining.size() * sizeof(uint64_t);
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open KB file for writing: %s!\n", path.c_str());
+    exit(1);
+  }
+  const vector<char> padding(header.blocksOffset - levelsEnd, 0);
+  if (fwrite(&header, sizeof(perfect_hash_kb_header), 1, file) != 1 ||
+      fwrite(levels.data(), sizeof(perfect_hash_level), levels.size(), file)
+        != levels.size() ||
+      fwrite(padding.data(), 1, padding.size(), file) != padding.size() ||
+      fwrite(blocks.data(), sizeof(uint64_t), blocks.size(), file)
+        != blocks.size() ||
+      fwrite(remaining.data(), sizeof(uint64_t), remaining.size(), file)
+        != remaining.size() ||
+      fwrite(fingerprints.data(), 1, fingerprints.size(), file)
+        != fingerprints.size() ||
+      fclose(file) != 0) {
+    fprintf(stderr, "Could not write to KB file: %s!\n", path.c_str());
+    unlink(path.c_str());
     exit(1);
   }
+}
+
+//
+// Write a sorted KB from memory
+//
+uint64_t writeKB(const string& path, uint64_t* facts, const uint64_t& count,
+                 const kb_format& format, const uint32_t& fingerprintBits) {
+  parallelSort(facts, count, max(1u, thread::hardware_concurrency()));
+  const uint64_t uniqueCount = unique(facts, facts + count) - facts;
+  if (format == KB_FORMAT_PERFECT_HASH) {
+    writePerfectHashKB(path, facts, uniqueCount, fingerprintBits);
+    return uniqueCount;
+  } else if (format == KB_FORMAT_EYTZINGER) {
+    writeEytzingerKB(path, facts, uniqueCount);
+    return uniqueCount;
+  } else if (format == KB_FORMAT_ELIAS_FANO) {
+    EliasFanoKBWriter writer(path, uniqueCount);
+    for (uint64_t i = 0; i < uniqueCount; ++i) {
+      writer.append(facts[i]);
+    }
+    writer.close();
+    return writer.size();
+  } else {
+    SortedKBWriter writer(path);
+    for (uint64_t i = 0; i < uniqueCount; ++i) {
+      writer.append(facts[i]);
+    }
+    writer.close();
+    return writer.size();
+  }
+}
+
+//
+// ExternalFactSorter::ExternalFactSorter()
+//
+ExternalFactSorter::ExternalFactSorter(const string& runPrefix,
+                                       const uint64_t& runSize,
+                                       const uint32_t& numThreads)
+    : runPrefix(runPrefix), runSize(max(1ul, runSize)),
+      numThreads(numThreads), bufferSize(0),
+      bufferCapacity(min(this->runSize, EXTERNAL_SORT_INITIAL_BUFFER_SIZE)),
+      totalCount(0) {
+  buffer = (uint64_t*) malloc(bufferCapacity * sizeof(uint64_t));
+  if (buffer == NULL) {
+    fprintf(stderr, "Out of memory allocating sort buffer (%lu facts)!\n",
+            bufferCapacity);
+    exit(1);
+  }
+}
 
-  // Read chunks
-  uint64_t* buffer = (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t));
-  uint64_t numRead;
-  uint64_t nextPrint = 10 * 1000 * 1000;
+//
+// ExternalFactSorter::~ExternalFactSorter()
+//
+ExternalFactSorter::~ExternalFactSorter() {
+  for (auto iter = runPaths.begin(); iter != runPaths.end(); ++iter) {
+    unlink(iter->c_str());
+  }
+  free(buffer);
+}
+
+//
+// ExternalFactSorter::grow()
+//
+void ExternalFactSorter::grow() {
+  const uint64_t capacity = min(runSize, 2 * bufferCapacity);
+  uint64_t* larger = (uint64_t*) realloc(buffer, capacity * sizeof(uint64_t));
+  if (larger == NULL) {
+    fprintf(stderr, "Out of memory growing sort buffer (%lu facts)!\n",
+            capacity);
+    exit(1);
+  }
+  buffer = larger;
+  bufferCapacity = capacity;
+}
+
+//
+// ExternalFactSorter::spill()
+//
+void ExternalFactSorter::spill() {
+  const string path = runPrefix + ".run." + to_string(runPaths.size());
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open sort run for writing: %s!\n", path.c_str());
+    exit(1);
+  }
+  runPaths.push_back(path);
+  parallelSort(buffer, bufferSize, numThreads);
+  // (write (fact, count) pairs, collapsing duplicates)
+  uint64_t pair[2];
+  uint64_t i = 0;
+  while (i < bufferSize) {
+    uint64_t j = i + 1;
+    while (j < bufferSize && buffer[j] == buffer[i]) {
+      j += 1;
+    }
+    pair[0] = buffer[i];
+    pair[1] = j - i;
+    if (fwrite(pair, sizeof(uint64_t), 2, file) != 2) {
+      fprintf(stderr, "Could not write sort run: %s!\n", path.c_str());
+      exit(1);
+    }
+    i = j;
+  }
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Could not write sort run: %s!\n", path.c_str());
+    exit(1);
+  }
   printTime("[%c] ");
-  fprintf(stderr, "Reading the knowledge base...");
-  while ( 
-      (numRead = fread(buffer, sizeof(uint64_t), CHUNK_SIZE, file)) 
-        == CHUNK_SIZE ) {
-    appendToKB(buffer, numRead, kb);
-    if (kb->size() > nextPrint) {
-      nextPrint += (10 * 1000 * 1000);
-      fprintf(stderr, ".");
+  fprintf(stderr, "Spilled sort run %s (%lu facts)\n", path.c_str(),
+          bufferSize);
+  bufferSize = 0;
+}
+
+/**
+ * A buffered reader over the (fact, count) pairs of a sort run.
+ */
+struct sort_run_reader {
+  FILE* file;
+  uint64_t* pairs;
+  uint64_t capacity;
+  uint64_t size;
+  uint64_t index;
+
+  /** Refill the buffer; returns false at the end of the run. */
+  bool refill() {
+    size = fread(pairs, 2 * sizeof(uint64_t), capacity, file);
+    index = 0;
+    return size > 0;
+  }
+};
+
+//
+// ExternalFactSorter::merge()
+//
+void ExternalFactSorter::merge(
+    function<void(const uint64_t& fact, const uint64_t& count)> callback) {
+  // Case: everything fit in memory
+  if (runPaths.empty()) {
+    parallelSort(buffer, bufferSize, numThreads);
+    uint64_t i = 0;
+    while (i < bufferSize) {
+      uint64_t j = i + 1;
+      while (j < bufferSize && buffer[j] == buffer[i]) {
+        j += 1;
+      }
+      callback(buffer[i], j - i);
+      i = j;
+    }
+    bufferSize = 0;
+    return;
+  }
+
+  // Case: merge the runs
+  if (bufferSize > 0) {
+    spill();
+  }
+  // (split the sort buffer between the runs' read buffers)
+  const uint64_t numRuns = runPaths.size();
+  const uint64_t pairsPerRun = max(4096ul, runSize / (2 * numRuns));
+  free(buffer);
+  buffer = NULL;
+  vector<sort_run_reader> readers(numRuns);
+  // (a min-heap of (fact, run))
+  priority_queue<pair<uint64_t, uint64_t>, vector<pair<uint64_t, uint64_t>>,
+                 greater<pair<uint64_t, uint64_t>>> heap;
+  for (uint64_t r = 0; r < numRuns; ++r) {
+    readers[r].file = fopen(runPaths[r].c_str(), "rb");
+    if (readers[r].file == NULL) {
+      fprintf(stderr, "Can't open sort run: %s!\n", runPaths[r].c_str());
+      exit(1);
+    }
+    readers[r].pairs = (uint64_t*) malloc(pairsPerRun * 2 * sizeof(uint64_t));
+    readers[r].capacity = pairsPerRun;
+    if (readers[r].refill()) {
+      heap.push(make_pair(readers[r].pairs[0], r));
+    }
+  }
+  bool any = false;
+  uint64_t fact = 0;
+  uint64_t count = 0;
+  while (!heap.empty()) {
+    const uint64_t r = heap.top().second;
+    heap.pop();
+    sort_run_reader& reader = readers[r];
+    const uint64_t nextFact = reader.pairs[2 * reader.index];
+    const uint64_t nextCount = reader.pairs[2 * reader.index + 1];
+    if (any && nextFact == fact) {
+      count += nextCount;
+    } else {
+      if (any) {
+        callback(fact, count);
+      }
+      any = true;
+      fact = nextFact;
+      count = nextCount;
+    }
+    reader.index += 1;
+    if (reader.index < reader.size || reader.refill()) {
+      heap.push(make_pair(reader.pairs[2 * reader.index], r));
+    }
+  }
+  if (any) {
+    callback(fact, count);
+  }
+  for (auto iter = readers.begin(); iter != readers.end(); ++iter) {
+    fclose(iter->file);
+    free(iter->pairs);
+  }
+}
+
+/**
+ * Write a KB from an external sorter to the given path, in place.
+ */
+uint64_t writeKBInPlace(const string& path, ExternalFactSorter* sorter,
+                        const uint64_t& minCount, const kb_format& format,
+                        const uint32_t& fingerprintBits) {
+  // Sorted KBs are written straight from the merge
+  if (format == KB_FORMAT_SORTED) {
+    SortedKBWriter writer(path);
+    sorter->merge([&writer, &minCount](const uint64_t& fact,
+                                       const uint64_t& count) -> void {
+      if (count >= minCount) {
+        writer.append(fact);
+      }
+    });
+    writer.close();
+    return writer.size();
+  }
+
+  // Otherwise, stage the facts which survive the minimum count
+  const string stagingPath = path + ".staging";
+  uint64_t numFacts;
+  {
+    FILE* staging = fopen(stagingPath.c_str(), "wb");
+    if (staging == NULL) {
+      fprintf(stderr, "Can't open file for writing: %s!\n",
+              stagingPath.c_str());
+      exit(1);
+    }
+    numFacts = 0;
+    sorter->merge([staging, &stagingPath, &minCount, &numFacts](
+        const uint64_t& fact, const uint64_t& count) -> void {
+      if (count >= minCount) {
+        if (fwrite(&fact, sizeof(uint64_t), 1, staging) != 1) {
+          fprintf(stderr, "Could not write file: %s!\n", stagingPath.c_str());
+          fclose(staging);
+          unlink(stagingPath.c_str());
+          exit(1);
+        }
+        numFacts += 1;
+      }
+    });
+    if (fclose(staging) != 0) {
+      fprintf(stderr, "Could not write file: %s!\n", stagingPath.c_str());
+      unlink(stagingPath.c_str());
+      exit(1);
+    }
+  }
+  FILE* staging = fopen(stagingPath.c_str(), "rb");
+  if (staging == NULL) {
+    fprintf(stderr, "Can't open file: %s!\n", stagingPath.c_str());
+    exit(1);
+  }
+  uint64_t written;
+  if (format == KB_FORMAT_ELIAS_FANO) {
+    // (Elias-Fano only needs the exact count up front)
+    EliasFanoKBWriter writer(path, numFacts);
+    uint64_t fact;
+    while (fread(&fact, sizeof(uint64_t), 1, staging) == 1) {
+      writer.append(fact);
+    }
+    writer.close();
+    written = writer.size();
+  } else {
+    uint64_t* facts = (uint64_t*) malloc(max(1ul, numFacts) * sizeof(uint64_t));
+    if (facts == NULL ||
+        fread(facts, sizeof(uint64_t), numFacts, staging) != numFacts) {
+      fprintf(stderr, "Could not read back %lu facts from %s!\n",
+              numFacts, stagingPath.c_str());
+      unlink(stagingPath.c_str());
+      exit(1);
+    }
+    written = writeKB(path, facts, numFacts, format, fingerprintBits);
+    free(facts);
+  }
+  fclose(staging);
+  unlink(stagingPath.c_str());
+  return written;
+}
+
+//
+// Write a KB from an external sorter
+//
+uint64_t writeKB(const string& path, ExternalFactSorter* sorter,
+                 const uint64_t& minCount, const kb_format& format,
+                 const uint32_t& fingerprintBits) {
+  // (a server may have the old KB mapped; never write over it in place)
+  const string writingPath = path + ".writing";
+  const uint64_t written = writeKBInPlace(writingPath, sorter, minCount,
+                                          format, fingerprintBits);
+  if (rename(writingPath.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "Could not move KB into place: %s!\n", path.c_str());
+    unlink(writingPath.c_str());
+    exit(1);
+  }
+  return written;
+}
+
+//
+// Merge sorted KBs
+//
+uint64_t mergeKBs(const vector<string>& inputs, const string& path,
+                  const kb_merge_op& op, const kb_format& format,
+                  const uint32_t& fingerprintBits) {
+  // Merge the inputs into a sorted KB
+  const string mergingPath = path + ".merging";
+  uint64_t written;
+  {
+    vector<SortedKBReader*> readers;
+    // (a min-heap of (fact, input))
+    priority_queue<pair<uint64_t, uint64_t>, vector<pair<uint64_t, uint64_t>>,
+                   greater<pair<uint64_t, uint64_t>>> heap;
+    for (uint64_t i = 0; i < inputs.size(); ++i) {
+      readers.push_back(new SortedKBReader(inputs[i]));
+      if (readers[i]->hasNext()) {
+        heap.push(make_pair(readers[i]->next(), i));
+      }
+    }
+    SortedKBWriter writer(mergingPath);
+    while (!heap.empty()) {
+      // (pop the fact from every input that has it; each input has it
+      //  at most once)
+      const uint64_t fact = heap.top().first;
+      uint64_t numInputs = 0;
+      bool inFirst = false;
+      while (!heap.empty() && heap.top().first == fact) {
+        const uint64_t i = heap.top().second;
+        heap.pop();
+        numInputs += 1;
+        inFirst = inFirst || i == 0;
+        if (readers[i]->hasNext()) {
+          heap.push(make_pair(readers[i]->next(), i));
+        }
+      }
+      switch (op) {
+        case KB_MERGE_UNION:
+          writer.append(fact);
+          break;
+        case KB_MERGE_INTERSECTION:
+          if (numInputs == inputs.size()) { writer.append(fact); }
+          break;
+        case KB_MERGE_DIFFERENCE:
+          if (inFirst && numInputs == 1) { writer.append(fact); }
+          break;
+      }
+    }
+    writer.close();
+    written = writer.size();
+    for (auto iter = readers.begin(); iter != readers.end(); ++iter) {
+      delete *iter;
+    }
+  }
+
+  // Convert the merged KB to the requested format
+  string finishedPath = mergingPath;
+  if (format != KB_FORMAT_SORTED) {
+    finishedPath = path + ".converting";
+    SortedKBReader reader(mergingPath);
+    // (the reader keeps the file open; so, an error below cannot leave it
+    //  behind)
+    unlink(mergingPath.c_str());
+    if (format == KB_FORMAT_ELIAS_FANO) {
+      EliasFanoKBWriter writer(finishedPath, reader.size());
+      while (reader.hasNext()) {
+        writer.append(reader.next());
+      }
+      writer.close();
+    } else {
+      uint64_t* facts =
+        (uint64_t*) malloc(max(1ul, reader.size()) * sizeof(uint64_t));
+      if (facts == NULL) {
+        fprintf(stderr, "Out of memory merging KBs (%lu facts)!\n",
+                reader.size());
+        exit(1);
+      }
+      for (uint64_t i = 0; i < reader.size(); ++i) {
+        facts[i] = reader.next();
+      }
+      writeKB(finishedPath, facts, reader.size(), format, fingerprintBits);
+      free(facts);
     }
   }
-  appendToKB(buffer, numRead, kb);
+  if (rename(finishedPath.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "Could not move merged KB into place: %s!\n",
+            path.c_str());
+    unlink(finishedPath.c_str());
+    exit(1);
+  }
+  return written;
+}
+
+/**
+ * Memory map a KB file read-only, in its entirety.
+ */
+void* mmapKBFile(const string& path, uint64_t* fileSize) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open KB file %s!\n", path.c_str());
+    exit(1);
+  }
+  struct stat stats;
+  fstat(fd, &stats);
+  *fileSize = stats.st_size;
+  void* mapping = mmap(NULL, *fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping keeps the file open
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Could not mmap KB file %s!\n", path.c_str());
+    exit(1);
+  }
+  // (lookups are random access)
+  madvise(mapping, *fileSize, MADV_RANDOM);
+  return mapping;
+}
+
+/**
+ * Returns true if a sorted KB file of the given size has a valid header;
+ * otherwise, says why on stderr.
+ */
+bool validSortedKBHeader(const sorted_kb_header* header,
+                         const uint64_t& fileSize, const string& path) {
+  if (fileSize < sizeof(sorted_kb_header)) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  if (header->version != SORTED_KB_VERSION) {
+    fprintf(stderr, "Unknown KB version in %s: %u (expected %u)\n",
+            path.c_str(), header->version, SORTED_KB_VERSION);
+    return false;
+  }
+  if (header->fenceStride == 0 ||
+      header->fenceCount !=
+        (header->count + header->fenceStride - 1) / header->fenceStride ||
+      header->factsOffset + header->count * sizeof(uint64_t) > fileSize ||
+      header->fenceOffset + header->fenceCount * sizeof(uint64_t) > fileSize) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Memory map a sorted KB file, validating its header.
+ */
+const FactDB* mmapSortedKB(const string& path) {
+  uint64_t fileSize;
+  void* mapping = mmapKBFile(path, &fileSize);
+  const sorted_kb_header* header = (const sorted_kb_header*) mapping;
+  if (!validSortedKBHeader(header, fileSize, path)) {
+    exit(1);
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Mapped sorted KB (size=%lu)\n", header->count);
+  return new SortedFactDB(mapping, fileSize, header);
+}
+
+/**
+ * Returns true if an Elias-Fano encoded KB file of the given size has a
+ * valid header; otherwise, says why on stderr.
+ */
+bool validEliasFanoKBHeader(const elias_fano_kb_header* header,
+                            const uint64_t& fileSize, const string& path) {
+  if (fileSize < sizeof(elias_fano_kb_header)) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  if (header->version != ELIAS_FANO_KB_VERSION) {
+    fprintf(stderr, "Unknown KB version in %s: %u (expected %u)\n",
+            path.c_str(), header->version, ELIAS_FANO_KB_VERSION);
+    return false;
+  }
+  const uint64_t lowWords = (header->count * header->lowBits + 63) / 64 + 1;
+  const uint64_t upperWords = (header->count + header->numBuckets) / 64 + 1;
+  const uint64_t sampleCount =
+    (header->numBuckets + header->sampleStride - 1) / header->sampleStride;
+  if (header->lowBits == 0 || header->lowBits > 63 ||
+      header->numBuckets != (0x1ul << (64 - header->lowBits)) ||
+      header->sampleStride == 0 ||
+      header->lowOffset + lowWords * sizeof(uint64_t) > header->upperOffset ||
+      header->upperOffset + upperWords * sizeof(uint64_t) > header->sampleOffset ||
+      header->sampleOffset + sampleCount * sizeof(uint64_t) > fileSize) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Memory map an Elias-Fano encoded KB file, validating its header.
+ */
+const FactDB* mmapEliasFanoKB(const string& path) {
+  uint64_t fileSize;
+  void* mapping = mmapKBFile(path, &fileSize);
+  const elias_fano_kb_header* header = (const elias_fano_kb_header*) mapping;
+  if (!validEliasFanoKBHeader(header, fileSize, path)) {
+    exit(1);
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Mapped Elias-Fano KB (size=%lu; %.2f bytes/fact)\n",
+          header->count, ((double) fileSize) / max(1.0, (double) header->count));
+  return new EliasFanoFactDB(mapping, fileSize, header);
+}
+
+/**
+ * Returns true if an Eytzinger layout KB file of the given size has a
+ * valid header; otherwise, says why on stderr.
+ */
+bool validEytzingerKBHeader(const eytzinger_kb_header* header,
+                            const uint64_t& fileSize, const string& path) {
+  if (fileSize < sizeof(eytzinger_kb_header)) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  if (header->version != EYTZINGER_KB_VERSION) {
+    fprintf(stderr, "Unknown KB version in %s: %u (expected %u)\n",
+            path.c_str(), header->version, EYTZINGER_KB_VERSION);
+    return false;
+  }
+  if (header->factsOffset % CACHE_LINE_SIZE != 0 ||
+      header->factsOffset + (header->count + 1) * sizeof(uint64_t) > fileSize) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Memory map an Eytzinger layout KB file, validating its header.
+ */
+const FactDB* mmapEytzingerKB(const string& path) {
+  uint64_t fileSize;
+  void* mapping = mmapKBFile(path, &fileSize);
+  const eytzinger_kb_header* header = (const eytzinger_kb_header*) mapping;
+  if (!validEytzingerKBHeader(header, fileSize, path)) {
+    exit(1);
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Mapped Eytzinger KB (size=%lu)\n", header->count);
+  return new EytzingerFactDB(mapping, fileSize, header);
+}
+
+/**
+ * Returns true if a perfect hash KB file of the given size has a valid
+ * header; otherwise, says why on stderr.
+ */
+bool validPerfectHashKBHeader(const perfect_hash_kb_header* header,
+                              const uint64_t& fileSize, const string& path) {
+  if (fileSize < sizeof(perfect_hash_kb_header)) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  if (header->version != PERFECT_HASH_KB_VERSION) {
+    fprintf(stderr, "Unknown KB version in %s: %u (expected %u)\n",
+            path.c_str(), header->version, PERFECT_HASH_KB_VERSION);
+    return false;
+  }
+  if ((header->fingerprintBits != 8 && header->fingerprintBits != 16 &&
+       header->fingerprintBits != 32) ||
+      header->fallbackCount > header->count ||
+      header->levelsOffset + header->numLevels * sizeof(perfect_hash_level) >
+        header->blocksOffset ||
+      header->blocksOffset +
+        header->numBlocks * PERFECT_HASH_WORDS_PER_BLOCK * sizeof(uint64_t) >
+        header->fallbackOffset ||
+      header->fallbackOffset + header->fallbackCount * sizeof(uint64_t) >
+        header->fingerprintOffset ||
+      header->fingerprintOffset +
+        header->count * (header->fingerprintBits / 8) > fileSize) {
+    fprintf(stderr, "Corrupt KB file %s!\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Memory map a perfect hash KB file, validating its header.
+ */
+const FactDB* mmapPerfectHashKB(const string& path) {
+  uint64_t fileSize;
+  void* mapping = mmapKBFile(path, &fileSize);
+  const perfect_hash_kb_header* header = (const perfect_hash_kb_header*) mapping;
+  if (!validPerfectHashKBHeader(header, fileSize, path)) {
+    exit(1);
+  }
+  const double falsePositiveRate = pow(2.0, -(double) header->fingerprintBits);
+  printTime("[%c] ");
+  fprintf(stderr, "Mapped perfect hash KB (size=%lu; %.2f bytes/fact; "
+          "false positive rate %g)\n", header->count,
+          ((double) fileSize) / max(1.0, (double) header->count),
+          falsePositiveRate);
+  return new PerfectHashFactDB(mapping, fileSize, header);
+}
+
+/**
+ * Read a legacy KB file -- a flat sequence of hashes -- into a btree.
+ */
+const FactDB* readLegacyKB(const string& path) {
+  // Read the facts, in parallel
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open KB file %s!\n", path.c_str());
+    exit(1);
+  }
+  struct stat stats;
+  if (fstat(fd, &stats) != 0) {
+    fprintf(stderr, "Error reading KB file %s!\n", path.c_str());
+    exit(1);
+  }
+  const uint64_t count = stats.st_size / sizeof(uint64_t);
+  uint64_t* facts = (uint64_t*) malloc(max(count, 1ul) * sizeof(uint64_t));
+  if (facts == NULL) {
+    fprintf(stderr, "Out of memory reading KB (%lu facts)!\n", count);
+    exit(1);
+  }
+  const uint32_t numThreads = max(1u, thread::hardware_concurrency());
+  printTime("[%c] ");
+  fprintf(stderr, "Reading the knowledge base (%lu facts; %u threads)...",
+          count, numThreads);
+  vector<thread> threads;
+  for (uint32_t i = 0; i < numThreads; ++i) {
+    threads.push_back(thread([fd, facts, count, numThreads, i, &path]() -> void {
+      const uint64_t begin = (count * i) / numThreads;
+      const uint64_t end = (count * (i + 1)) / numThreads;
+      uint64_t offset = begin;
+      while (offset < end) {
+        const uint64_t toRead = min(end - offset, (uint64_t) CHUNK_SIZE);
+        const ssize_t numRead = pread(fd, facts + offset,
+                                      toRead * sizeof(uint64_t),
+                                      offset * sizeof(uint64_t));
+        if (numRead <= 0) {
+          fprintf(stderr, "Error reading KB file %s!\n", path.c_str());
+          exit(1);
+        }
+        offset += numRead / sizeof(uint64_t);
+      }
+    }));
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  close(fd);
+  fprintf(stderr, "done.\n");
+
+  // Build the btree
+  printTime("[%c] ");
+  fprintf(stderr, "Bulk loading the knowledge base...");
+  btree_set<uint64_t>* kb = bulkLoadKB(facts, count, numThreads);
+  free(facts);
   fprintf(stderr, "done.\n");
   printTime("[%c] ");
-  fprintf(stderr, "KB size=%lu\n", kb->size());
+  fprintf(stderr, "KB size=%lu (%lu bytes)\n", kb->size(), kb->bytes_used());
 
   // Return
-  free(buffer);
+  return new BTreeFactDB(kb, true);
+}
+
+/**
+ * Guard a knowledge base with a Bloom filter, reading the filter saved next
+ * to the KB file if it is up to date, and building (and saving) it otherwise.
+ */
+const FactDB* addBloomFilter(const FactDB* kb, const string& path,
+                             const uint32_t& bitsPerFact) {
+  struct stat stats;
+  stat(path.c_str(), &stats);
+  const uint64_t kbModifiedTime = stats.st_mtime;
+  const string filterPath = path + BLOOM_FILTER_SUFFIX;
+  BloomFilter* filter =
+    BloomFilter::read(filterPath, kb->size(), kbModifiedTime, bitsPerFact);
+  if (filter != NULL) {
+    printTime("[%c] ");
+    fprintf(stderr, "Read Bloom filter from %s\n", filterPath.c_str());
+  } else {
+    printTime("[%c] ");
+    fprintf(stderr, "Building Bloom filter (%u bits/fact)...", bitsPerFact);
+    filter = new BloomFilter(kb->size(), bitsPerFact);
+    kb->forEach([filter](const uint64_t& fact) -> void { filter->add(fact); });
+    fprintf(stderr, "done.\n");
+    if (!filter->write(filterPath, kbModifiedTime)) {
+      fprintf(stderr, "WARNING: could not save Bloom filter to %s\n",
+              filterPath.c_str());
+    }
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Bloom filter expected false positive rate: %f\n",
+          filter->expectedFalsePositiveRate());
+  return new BloomFilteredFactDB(kb, filter);
+}
+
+//
+// Check that readKB() can read a file
+//
+bool isReadableKB(const string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open KB file %s!\n", path.c_str());
+    return false;
+  }
+  struct stat stats;
+  union {
+    sorted_kb_header sorted;
+    elias_fano_kb_header eliasFano;
+    eytzinger_kb_header eytzinger;
+    perfect_hash_kb_header perfectHash;
+  } header;
+  memset(&header, 0, sizeof(header));
+  const bool readable = fstat(fd, &stats) == 0 &&
+    pread(fd, &header, sizeof(header), 0) >= 0;
+  close(fd);
+  if (!readable) {
+    fprintf(stderr, "Error reading KB file %s!\n", path.c_str());
+    return false;
+  }
+  // (any other file is read as a legacy KB)
+  const uint64_t fileSize = stats.st_size;
+  switch (header.sorted.magic) {
+    case SORTED_KB_MAGIC:
+      return validSortedKBHeader(&header.sorted, fileSize, path);
+    case ELIAS_FANO_KB_MAGIC:
+      return validEliasFanoKBHeader(&header.eliasFano, fileSize, path);
+    case EYTZINGER_KB_MAGIC:
+      return validEytzingerKBHeader(&header.eytzinger, fileSize, path);
+    case PERFECT_HASH_KB_MAGIC:
+      return validPerfectHashKBHeader(&header.perfectHash, fileSize, path);
+    default:
+      return true;
+  }
+}
+
+//
+// Read a KB from a file
+//
+const FactDB* readKB(string path) {
+  // Open the KB file
+  FILE* file;
+  file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open KB file %s!\n", path.c_str());
+    exit(1);
+  }
+
+  // Check for a sorted, Elias-Fano, Eytzinger or perfect hash KB
+  uint64_t magic = 0;
+  if (fread(&magic, sizeof(uint64_t), 1, file) != 1) {
+    magic = 0;
+  }
   fclose(file);
+  const FactDB* kb;
+  if (magic == SORTED_KB_MAGIC) {
+    kb = mmapSortedKB(path);
+  } else if (magic == ELIAS_FANO_KB_MAGIC) {
+    kb = mmapEliasFanoKB(path);
+  } else if (magic == EYTZINGER_KB_MAGIC) {
+    kb = mmapEytzingerKB(path);
+  } else if (magic == PERFECT_HASH_KB_MAGIC) {
+    kb = mmapPerfectHashKB(path);
+  } else {
+    kb = readLegacyKB(path);
+  }
+
+  // Spread it over the NUMA nodes
+#if KB_NUMA_SHARD_BITS > 0
+  if (kb->enumerable()) {
+    kb = new NumaShardedFactDB(kb, KB_NUMA_SHARD_BITS, KB_NUMA_HOT_SHARDS,
+                               readNumaTopology());
+  }
+#elif KB_HOT_SET_SIZE > 0
+  // Or, keep only the most looked up facts in RAM
+  kb = new TieredFactDB(kb, KB_HOT_SET_SIZE);
+#endif
+
+  // Guard it with a Bloom filter
+#if KB_BLOOM_BITS_PER_FACT > 0
+  if (kb->enumerable()) {
+    kb = addBloomFilter(kb, path, KB_BLOOM_BITS_PER_FACT);
+  }
+#endif
   return kb;
 }
 
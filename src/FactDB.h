@@ -1,9 +1,781 @@
 #ifndef FACT_DB_H
 #define FACT_DB_H
 
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
 #include "config.h"
 #include "btree_set.h"
 
+/**
+ * The magic number at the start of a sorted KB file ("NLIKBSRT" in
+ * little-endian order). Files without this header are read as a legacy
+ * raw stream of hashes.
+ */
+#define SORTED_KB_MAGIC 0x545253424b494c4eul
+/** The version of the sorted KB format written by SortedKBWriter */
+#define SORTED_KB_VERSION 1
+/**
+ * The number of facts between two entries in the fence index of a sorted KB.
+ * 512 facts is exactly one 4K page, so a lookup touches a single page of
+ * the fact array once the fence index is resident.
+ */
+#define SORTED_KB_FENCE_STRIDE 512
+
+/**
+ * The on-disk header of a sorted knowledge base. The file consists of
+ * this header, followed by |count| unique, strictly increasing uint64_t
+ * fact hashes, followed by |fenceCount| fence entries. Fence entry i is the
+ * fact at index (i * fenceStride).
+ * If the KB was compacted from a live KB (see LiveFactDB), deltaLogOffset
+ * is the length of the KB's delta log already merged into these facts.
+ */
+struct sorted_kb_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t fenceStride;
+  uint64_t count;
+  uint64_t fenceCount;
+  uint64_t factsOffset;
+  uint64_t fenceOffset;
+  uint64_t deltaLogOffset;
+  uint64_t reserved[1];
+};
+
+/**
+ * The magic number at the start of an Elias-Fano encoded KB file
+ * ("NLIKBELF" in little-endian order).
+ */
+#define ELIAS_FANO_KB_MAGIC 0x464c45424b494c4eul
+/** The version of the Elias-Fano KB format written by EliasFanoKBWriter */
+#define ELIAS_FANO_KB_VERSION 1
+/**
+ * The number of high-bits buckets between two entries in the sampled
+ * index of an Elias-Fano KB. There are about as many buckets as facts, so
+ * this costs 64/256 = 0.25 bits per fact, and a lookup scans ~2*256 bits
+ * (8 words) of the upper bits from the nearest sample.
+ */
+#define ELIAS_FANO_KB_SAMPLE_STRIDE 256
+
+/**
+ * The on-disk header of an Elias-Fano encoded knowledge base.
+ *
+ * Each fact is split into its low |lowBits| bits, and its high bits (the
+ * "bucket" of the fact). The low bits of every fact are stored packed, in
+ * sorted order, starting at lowOffset. The high bits are stored in unary
+ * starting at upperOffset: the i'th fact sets bit (bucket + i), so that each
+ * bucket is a run of ones (one per fact) terminated by a zero.
+ * The sampled index at sampleOffset records, for every sampleStride'th
+ * bucket, the bit position at which that bucket starts.
+ *
+ * With lowBits = log2(2^64 / count), this takes (lowBits + 2) bits per fact.
+ */
+struct elias_fano_kb_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t lowBits;
+  uint64_t count;
+  uint64_t numBuckets;
+  uint64_t sampleStride;
+  uint64_t lowOffset;
+  uint64_t upperOffset;
+  uint64_t sampleOffset;
+};
+
+/**
+ * The magic number at the start of an Eytzinger layout KB file
+ * ("NLIKBEYT" in little-endian order).
+ */
+#define EYTZINGER_KB_MAGIC 0x545945424b494c4eul
+/** The version of the Eytzinger KB format written by writeKB() */
+#define EYTZINGER_KB_VERSION 1
+
+/**
+ * The on-disk header of an Eytzinger layout knowledge base. The file
+ * consists of this header, followed by |count| + 1 uint64_t slots: slot 0 is
+ * unused, and slots 1..count hold the unique facts laid out as an implicit
+ * binary search tree in breadth-first order -- the children of slot k are
+ * slots 2k and 2k+1. Since the header is one cache line, the 8 descendants
+ * three levels below a slot share a single cache line.
+ */
+struct eytzinger_kb_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved0;
+  uint64_t count;
+  uint64_t factsOffset;
+  uint64_t reserved[4];
+};
+
+/**
+ * The magic number at the start of a perfect hash KB file
+ * ("NLIKBMPH" in little-endian order).
+ */
+#define PERFECT_HASH_KB_MAGIC 0x48504d424b494c4eul
+/** The version of the perfect hash KB format written by writeKB() */
+#define PERFECT_HASH_KB_VERSION 1
+/**
+ * The default width of the fingerprint stored for each fact in a perfect
+ * hash KB. A fact not in the KB is falsely reported as present with
+ * probability 2^-bits; valid widths are 8, 16 and 32.
+ */
+#define PERFECT_HASH_KB_FINGERPRINT_BITS 16
+/**
+ * The maximum number of levels in a perfect hash KB; the (very few) facts
+ * which still collide after this many levels are stored explicitly.
+ */
+#define PERFECT_HASH_KB_MAX_LEVELS 24
+
+/**
+ * The on-disk header of a minimal perfect hash knowledge base.
+ *
+ * The facts themselves are not stored. Instead, a BBHash-style minimal
+ * perfect hash maps each fact to a unique slot in [0, count), and the slot
+ * stores a short fingerprint of the fact. Each level of the hash is a bit
+ * array; a fact's slot is the rank of the first bit it lands on which is
+ * set, over all levels. The bit arrays are stored in cache-line blocks of
+ * a cumulative rank word followed by 448 bits, so finding a slot costs one
+ * cache miss per level tried (one, for ~2/3 of facts), and verifying the
+ * fingerprint one more.
+ *
+ * The file consists of this header, followed by |numLevels| level
+ * descriptors (the first block of the level, and its number of bits), the
+ * blocks at blocksOffset, |fallbackCount| sorted facts which collided in
+ * every level at fallbackOffset, and |count| fingerprints of
+ * |fingerprintBits| bits at fingerprintOffset.
+ */
+struct perfect_hash_kb_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t fingerprintBits;
+  uint64_t count;
+  uint32_t numLevels;
+  uint32_t reserved0;
+  uint64_t levelsOffset;
+  uint64_t numBlocks;
+  uint64_t blocksOffset;
+  uint64_t fallbackCount;
+  uint64_t fallbackOffset;
+  uint64_t fingerprintOffset;
+  uint64_t reserved[5];
+};
+
+/** The on-disk formats that writeKB() can produce. */
+enum kb_format {
+  KB_FORMAT_SORTED,
+  KB_FORMAT_ELIAS_FANO,
+  KB_FORMAT_EYTZINGER,
+  KB_FORMAT_PERFECT_HASH
+};
+
+/**
+ * A read-only set of hashed facts, queried during search to check whether
+ * a search node is a known fact. The actual storage depends on how the
+ * knowledge base was loaded; e.g., an in-memory btree, or a memory mapped
+ * sorted file.
+ */
+class FactDB {
+ public:
+  virtual ~FactDB() { }
+
+  /** Returns true if the given fact hash is in the knowledge base. */
+  virtual bool contains(const uint64_t& fact) const = 0;
+  /** The number of facts in the knowledge base. */
+  virtual uint64_t size() const = 0;
+  /**
+   * Calls the given function on every fact in the knowledge base, in
+   * increasing order. This is only valid if enumerable() is true.
+   */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const = 0;
+  /**
+   * Whether the facts can be listed with forEach(). This is false for
+   * knowledge bases which store only fingerprints of their facts.
+   */
+  virtual bool enumerable() const { return true; }
+
+  /**
+   * A cheap pre-check for contains(). If this returns false, the fact is
+   * definitely not in the knowledge base; if it returns true, contains()
+   * must be called to be sure. By default, this is always true.
+   */
+  virtual bool mayContain(const uint64_t& /*fact*/) const { return true; }
+
+  /**
+   * Looks up a fact as contains() does, also noting whether mayContain()
+   * alone ruled it out. Callers which count filter rejects use this rather
+   * than calling both, which would probe the filter twice on every hit.
+   *
+   * @param fact The fact to look up.
+   * @param rejected Set to true if the fact failed the cheap pre-check.
+   *
+   * @return True if the fact is in the knowledge base.
+   */
+  virtual bool filteredContains(const uint64_t& fact, bool* rejected) const {
+    *rejected = !mayContain(fact);
+    return !*rejected && contains(fact);
+  }
+};
+
+/**
+ * The magic number at the start of a persisted Bloom filter
+ * ("NLIBLOOM" in little-endian order).
+ */
+#define BLOOM_FILTER_MAGIC 0x4d4f4f4c42494c4eul
+/** The suffix appended to a KB path to get its persisted Bloom filter */
+#define BLOOM_FILTER_SUFFIX ".bloom"
+
+/**
+ * The on-disk header of a persisted Bloom filter. The file consists of
+ * this header, followed by |numBlocks| cache lines of filter bits.
+ */
+struct bloom_filter_header {
+  uint64_t magic;
+  uint32_t bitsPerFact;
+  uint32_t numHashes;
+  uint64_t numBlocks;
+  uint64_t kbSize;
+  uint64_t kbModifiedTime;
+  uint64_t reserved[3];
+};
+
+/**
+ * A cache-line blocked Bloom filter over fact hashes.
+ * Each fact maps to a single cache line (a block), and all of its probe
+ * bits are set within that line; a membership test therefore touches
+ * exactly one cache line, at the cost of a slightly higher false positive
+ * rate than an unblocked filter of the same size.
+ */
+class BloomFilter {
+ public:
+  /**
+   * Create an empty filter, sized for the given number of facts.
+   *
+   * @param count The number of facts that will be added to the filter.
+   * @param bitsPerFact The size of the filter, in bits per fact.
+   */
+  BloomFilter(const uint64_t& count, const uint32_t& bitsPerFact);
+  ~BloomFilter();
+
+  /** Add a fact to the filter. */
+  inline void add(const uint64_t& fact) {
+    uint64_t* block = blocks + BLOOM_WORDS_PER_BLOCK * blockFor(fact);
+    uint64_t bits = remix(fact);
+    for (uint32_t i = 0; i < header.numHashes; ++i) {
+      if (i > 0 && i % 7 == 0) { bits = remix(bits); }
+      const uint32_t bit = bits & (BLOOM_BITS_PER_BLOCK - 1);
+      block[bit >> 6] |= (0x1ul << (bit & 63));
+      bits >>= 9;
+    }
+  }
+
+  /** Returns false if the fact is definitely not in the filter. */
+  inline bool mayContain(const uint64_t& fact) const {
+    const uint64_t* block = blocks + BLOOM_WORDS_PER_BLOCK * blockFor(fact);
+    uint64_t bits = remix(fact);
+    for (uint32_t i = 0; i < header.numHashes; ++i) {
+      if (i > 0 && i % 7 == 0) { bits = remix(bits); }
+      const uint32_t bit = bits & (BLOOM_BITS_PER_BLOCK - 1);
+      if ((block[bit >> 6] & (0x1ul << (bit & 63))) == 0) {
+        return false;
+      }
+      bits >>= 9;
+    }
+    return true;
+  }
+
+  /** The false positive rate we would expect from this filter. */
+  double expectedFalsePositiveRate() const;
+
+  /**
+   * Write this filter to a file, so that it can be read with
+   * read(). Returns false if the file could not be written.
+   *
+   * @param path The file to write to.
+   * @param kbModifiedTime The modification time of the knowledge base file
+   *                       this filter was built from.
+   */
+  bool write(const std::string& path, const uint64_t& kbModifiedTime);
+
+  /**
+   * Read a filter written by write(). Returns NULL if the file does not
+   * exist, or was not built for a KB of the given size, modification
+   * time, and bits per fact.
+   */
+  static BloomFilter* read(const std::string& path,
+                           const uint64_t& kbSize,
+                           const uint64_t& kbModifiedTime,
+                           const uint32_t& bitsPerFact);
+
+ private:
+  /** The number of bits in a block; this is the size of a cache line. */
+  static const uint32_t BLOOM_BITS_PER_BLOCK = 512;
+  static const uint32_t BLOOM_WORDS_PER_BLOCK = BLOOM_BITS_PER_BLOCK / 64;
+
+  bloom_filter_header header;
+  uint64_t* blocks;
+  /** If non-NULL, the blocks are memory mapped from a file of this size */
+  void* mapping;
+  uint64_t mappingSize;
+
+  BloomFilter() { }
+
+  inline uint64_t blockFor(const uint64_t& fact) const {
+    return (uint64_t) (((__uint128_t) fact * header.numBlocks) >> 64);
+  }
+
+  static inline uint64_t remix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdul;
+    h ^= h >> 33;
+    return h;
+  }
+};
+
+/**
+ * A knowledge base guarded by a Bloom filter, so that definite misses are
+ * answered by touching a single cache line, without consulting the
+ * underlying knowledge base.
+ */
+class BloomFilteredFactDB : public FactDB {
+ public:
+  /** Takes ownership of both the knowledge base and the filter. */
+  BloomFilteredFactDB(const FactDB* impl, BloomFilter* filter)
+    : impl(impl), filter(filter) { }
+
+  ~BloomFilteredFactDB() {
+    delete impl;
+    delete filter;
+  }
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    return filter->mayContain(fact) && impl->contains(fact);
+  }
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return impl->size(); }
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const {
+    impl->forEach(callback);
+  }
+  /** {@inheritDoc} */
+  virtual bool enumerable() const { return impl->enumerable(); }
+  /** {@inheritDoc} */
+  virtual bool mayContain(const uint64_t& fact) const {
+    return filter->mayContain(fact);
+  }
+  /** {@inheritDoc} */
+  virtual bool filteredContains(const uint64_t& fact, bool* rejected) const {
+    *rejected = !filter->mayContain(fact);
+    return !*rejected && impl->contains(fact);
+  }
+
+ private:
+  const FactDB* impl;
+  BloomFilter* filter;
+};
+
+/**
+ * A FactDB backed by an in-memory btree.
+ * This is the representation used for legacy (unsorted) KB files, and
+ * for small knowledge bases constructed programatically.
+ */
+class BTreeFactDB : public FactDB {
+ public:
+  /** Create an empty knowledge base */
+  BTreeFactDB()
+    : facts(new btree::btree_set<uint64_t>()), owned(true) { }
+  /**
+   * Wrap an existing set of facts.
+   *
+   * @param facts The facts in the knowledge base.
+   * @param owned If true, the facts are deleted along with this object.
+   */
+  BTreeFactDB(const btree::btree_set<uint64_t>* facts, const bool& owned)
+    : facts(facts), owned(owned) { }
+
+  ~BTreeFactDB() {
+    if (owned) { delete facts; }
+  }
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    return facts->find(fact) != facts->end();
+  }
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return facts->size(); }
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const {
+    for (auto iter = facts->begin(); iter != facts->end(); ++iter) {
+      callback(*iter);
+    }
+  }
+
+ private:
+  const btree::btree_set<uint64_t>* facts;
+  const bool owned;
+};
+
+/**
+ * The number of facts a PremiseKB holds without allocating; queries
+ * typically come with 1-50 premises.
+ */
+#define PREMISE_KB_INLINE_CAPACITY 64
+/**
+ * The size at or below which a PremiseKB is scanned linearly, rather than
+ * binary searched.
+ */
+#define PREMISE_KB_SCAN_SIZE 16
+
+/**
+ * The small set of premise facts given along with a single query, which is
+ * checked on every node visited by the search (see SynSearch()).
+ * The facts are kept in a sorted array, stored inline for up to
+ * PREMISE_KB_INLINE_CAPACITY facts, so that building one on the stack does
+ * not allocate, and a lookup touches a few cache lines at most.
+ */
+class PremiseKB {
+ public:
+  /** Create an empty set of premises */
+  PremiseKB()
+    : facts(inlineFacts), count(0), capacity(PREMISE_KB_INLINE_CAPACITY) { }
+  ~PremiseKB() {
+    if (facts != inlineFacts) { free(facts); }
+  }
+  PremiseKB(const PremiseKB& other) = delete;
+  PremiseKB& operator=(const PremiseKB& other) = delete;
+
+  /** Add a premise fact; duplicates are ignored. */
+  void add(const uint64_t& fact);
+
+  /** Returns true if the given fact hash is one of the premises. */
+  inline bool contains(const uint64_t& fact) const {
+    if (count <= PREMISE_KB_SCAN_SIZE) {
+      // (no early exit, so this compiles to straight-line compares)
+      bool found = false;
+      for (uint64_t i = 0; i < count; ++i) {
+        found |= (facts[i] == fact);
+      }
+      return found;
+    }
+    return std::binary_search(facts, facts + count, fact);
+  }
+
+  /** The number of premise facts. */
+  inline uint64_t size() const { return count; }
+
+ private:
+  uint64_t inlineFacts[PREMISE_KB_INLINE_CAPACITY];
+  uint64_t* facts;
+  uint64_t count;
+  uint64_t capacity;
+};
+
+/**
+ * Writes a sorted knowledge base, in the format read by readKB(std::string).
+ * Facts are streamed to disk as they are appended, so only the fence index
+ * is held in memory.
+ */
+class SortedKBWriter {
+ public:
+  /**
+   * Open a new sorted KB for writing. Exits the program if the file
+   * cannot be created, or if any write to it fails; the partial file is
+   * then removed, so that it is never renamed over a good KB.
+   *
+   * @param path The file to write to. Any existing file is overwritten.
+   * @param fenceStride The number of facts per fence index entry.
+   */
+  SortedKBWriter(const std::string& path,
+                 const uint32_t& fenceStride = SORTED_KB_FENCE_STRIDE);
+  ~SortedKBWriter();
+
+  /**
+   * Append a fact to the knowledge base. Facts must be appended in
+   * non-decreasing order; duplicates of the last fact are dropped.
+   */
+  void append(const uint64_t& fact);
+
+  /**
+   * Write the fence index and the header, and close the file.
+   * This is called automatically by the destructor, if it was not
+   * called explicitly.
+   */
+  void close();
+
+  /** The number of unique facts written so far. */
+  inline uint64_t size() const { return count; }
+
+  /**
+   * Record that the facts in this KB include the first |offset| bytes of
+   * the KB's delta log. See LiveFactDB.
+   */
+  inline void setDeltaLogOffset(const uint64_t& offset) {
+    deltaLogOffset = offset;
+  }
+
+ private:
+  std::string path;
+  FILE* file;
+  const uint32_t fenceStride;
+  uint64_t deltaLogOffset;
+  uint64_t count;
+  uint64_t last;
+  std::vector<uint64_t> fences;
+  uint64_t* buffer;
+  uint64_t bufferSize;
+
+  void flushBuffer();
+  /** Remove the partial file, and exit. */
+  void failWrite();
+};
+
+/**
+ * Streams the facts of a sorted knowledge base (see SortedKBWriter) from
+ * disk, in increasing order, buffering only a chunk at a time. Unlike
+ * readKB(), this does not map the file, and so can read any number of
+ * large KBs side by side.
+ */
+class SortedKBReader {
+ public:
+  /**
+   * Open a sorted KB for reading. Exits the program if the file cannot be
+   * read, or is not a sorted KB.
+   */
+  SortedKBReader(const std::string& path);
+  ~SortedKBReader();
+
+  /** Returns true if there are facts left to read. */
+  inline bool hasNext() const { return index < header.count; }
+
+  /** Returns the next fact. Only valid if hasNext() is true. */
+  inline uint64_t next() {
+    if (bufferPos == bufferSize) {
+      fillBuffer();
+    }
+    index += 1;
+    bufferPos += 1;
+    return buffer[bufferPos - 1];
+  }
+
+  /** The number of facts in the KB. */
+  inline uint64_t size() const { return header.count; }
+
+ private:
+  std::string path;
+  FILE* file;
+  sorted_kb_header header;
+  uint64_t index;
+  uint64_t* buffer;
+  uint64_t bufferSize;
+  uint64_t bufferPos;
+
+  void fillBuffer();
+};
+
+/**
+ * Writes an Elias-Fano encoded knowledge base (see elias_fano_kb_header)
+ * incrementally, from a sorted stream of facts. The packed low bits are
+ * streamed to disk; the upper bits (~2 bits per fact) and the sampled index
+ * are kept in memory, and written on close().
+ */
+class EliasFanoKBWriter {
+ public:
+  /**
+   * Open a new Elias-Fano KB for writing. Exits the program if the file
+   * cannot be created, or if any write to it fails; the partial file is
+   * then removed, so that it is never renamed over a good KB.
+   *
+   * @param path The file to write to. Any existing file is overwritten.
+   * @param maxCount An upper bound on the number of unique facts that will
+   *                 be appended. The encoding is most compact when this
+   *                 is exact.
+   * @param sampleStride The number of buckets per sampled index entry.
+   */
+  EliasFanoKBWriter(const std::string& path, const uint64_t& maxCount,
+                    const uint32_t& sampleStride = ELIAS_FANO_KB_SAMPLE_STRIDE);
+  ~EliasFanoKBWriter();
+
+  /**
+   * Append a fact to the knowledge base. Facts must be appended in
+   * non-decreasing order; duplicates of the last fact are dropped.
+   * At most maxCount unique facts may be appended.
+   */
+  void append(const uint64_t& fact);
+
+  /**
+   * Write the upper bits, the sampled index and the header, and close the
+   * file. This is called automatically by the destructor, if it was not
+   * called explicitly.
+   */
+  void close();
+
+  /** The number of unique facts written so far. */
+  inline uint64_t size() const { return count; }
+
+ private:
+  std::string path;
+  FILE* file;
+  const uint64_t maxCount;
+  const uint32_t sampleStride;
+  uint32_t lowBits;
+  uint64_t numBuckets;
+  uint64_t count;
+  uint64_t last;
+  std::vector<uint64_t> upper;
+  std::vector<uint64_t> samples;
+  uint64_t nextSampledBucket;
+  /** The low bits which do not yet fill a complete word */
+  uint64_t lowWord;
+  uint32_t lowWordBits;
+  uint64_t* buffer;
+  uint64_t bufferSize;
+  uint64_t lowWordsWritten;
+
+  void appendLowWord(const uint64_t& word);
+  void flushBuffer();
+  /** Remove the partial file, and exit. */
+  void failWrite();
+};
+
+/**
+ * The default number of facts an ExternalFactSorter holds in memory (512MB)
+ * before it sorts them and spills them to disk as a run.
+ */
+#define EXTERNAL_SORT_RUN_SIZE (64ul * 1024 * 1024)
+/**
+ * The number of facts an ExternalFactSorter's buffer starts out with (512KB);
+ * it doubles as facts are added, up to the run size.
+ */
+#define EXTERNAL_SORT_INITIAL_BUFFER_SIZE (64ul * 1024)
+
+/**
+ * Sorts and counts a stream of facts which may not fit in memory.
+ * Facts are buffered until the buffer is full (it grows as needed, up to
+ * the run size, so small inputs stay small); the buffer is then sorted,
+ * collapsed into (fact, count) pairs, and spilled to a run file. merge()
+ * k-way merges the runs, summing the counts of each fact across runs.
+ * If everything fit in the buffer, nothing is written to disk.
+ */
+class ExternalFactSorter {
+ public:
+  /**
+   * Create a new sorter.
+   *
+   * @param runPrefix The prefix of the temporary run files; the runs are
+   *                  written to runPrefix + ".run.<i>".
+   * @param runSize The number of facts to buffer in memory per run.
+   * @param numThreads The number of threads to sort each run with.
+   */
+  ExternalFactSorter(const std::string& runPrefix,
+                     const uint64_t& runSize = EXTERNAL_SORT_RUN_SIZE,
+                     const uint32_t& numThreads = 1);
+  /** Deletes any run files. */
+  ~ExternalFactSorter();
+
+  /** Add a fact to be sorted. */
+  inline void add(const uint64_t& fact) {
+    buffer[bufferSize] = fact;
+    bufferSize += 1;
+    totalCount += 1;
+    if (bufferSize == bufferCapacity) {
+      if (bufferCapacity == runSize) {
+        spill();
+      } else {
+        grow();
+      }
+    }
+  }
+
+  /**
+   * Call the given function on every distinct fact added, in increasing
+   * order, along with the number of times it was added.
+   * This must be called at most once, after every fact has been added.
+   */
+  void merge(std::function<void(const uint64_t& fact,
+                                const uint64_t& count)> callback);
+
+  /** The number of facts added, counting duplicates. */
+  inline uint64_t size() const { return totalCount; }
+  /** The number of runs spilled to disk so far. */
+  inline uint32_t numRuns() const { return runPaths.size(); }
+
+ private:
+  const std::string runPrefix;
+  const uint64_t runSize;
+  const uint32_t numThreads;
+  uint64_t* buffer;
+  uint64_t bufferSize;
+  uint64_t bufferCapacity;
+  uint64_t totalCount;
+  std::vector<std::string> runPaths;
+
+  /** Sort the buffer, and write it as a run. */
+  void spill();
+  /** Double the capacity of the buffer, up to runSize. */
+  void grow();
+};
+
+/**
+ * Writes a knowledge base from the facts in an external sorter, dropping
+ * any fact added fewer than minCount times. Sorted and Elias-Fano KBs
+ * are streamed to disk from the merged runs; the other formats need
+ * every fact in memory at once.
+ * The KB is written to a temporary file, and renamed into place once
+ * complete; so, servers with the old KB mapped keep reading the old file.
+ *
+ * @param path The file to write to.
+ * @param sorter The facts to write.
+ * @param minCount The minimum number of times a fact must have been seen.
+ * @param format The on-disk format to write.
+ * @param fingerprintBits For KB_FORMAT_PERFECT_HASH, the number of bits of
+ *                        fingerprint to store for each fact.
+ *
+ * @return The number of unique facts written.
+ */
+uint64_t writeKB(const std::string& path, ExternalFactSorter* sorter,
+                 const uint64_t& minCount,
+                 const kb_format& format = KB_FORMAT_SORTED,
+                 const uint32_t& fingerprintBits =
+                   PERFECT_HASH_KB_FINGERPRINT_BITS);
+
+/** The ways in which mergeKBs() can combine its input KBs. */
+enum kb_merge_op {
+  /** Every fact in any of the inputs */
+  KB_MERGE_UNION,
+  /** Every fact in all of the inputs */
+  KB_MERGE_INTERSECTION,
+  /** Every fact in the first input, and in none of the others */
+  KB_MERGE_DIFFERENCE
+};
+
+/**
+ * K-way merges sorted knowledge bases (see SortedKBWriter) into a new
+ * knowledge base. The inputs are streamed from disk with SortedKBReader, so
+ * memory use is bounded by a chunk per input, plus whatever the output
+ * format needs (see writeKB(std::string, ExternalFactSorter*, ...)).
+ * The output is written to a temporary file, and renamed into place once
+ * complete; so, it may safely be one of the inputs.
+ * Exits the program if an input is not a sorted KB.
+ *
+ * @param inputs The paths of the sorted KBs to merge.
+ * @param path The file to write to.
+ * @param op How to combine the inputs.
+ * @param format The on-disk format to write.
+ * @param fingerprintBits For KB_FORMAT_PERFECT_HASH, the number of bits of
+ *                        fingerprint to store for each fact.
+ *
+ * @return The number of unique facts written.
+ */
+uint64_t mergeKBs(const std::vector<std::string>& inputs,
+                  const std::string& path,
+                  const kb_merge_op& op = KB_MERGE_UNION,
+                  const kb_format& format = KB_FORMAT_SORTED,
+                  const uint32_t& fingerprintBits =
+                    PERFECT_HASH_KB_FINGERPRINT_BITS);
+
 /**
  * Appends the given facts to the fact stream.
  *
@@ -17,6 +789,22 @@ void appendToKB(const uint64_t* factStream,
 
 
 
+/**
+ * Bulk loads a knowledge base from an array of facts. The facts are sorted
+ * and deduplicated in parallel, and then inserted in order, so that the
+ * btree is built left to right with fully packed nodes; this is far faster
+ * than appendToKB(), and the resulting tree is smaller.
+ *
+ * @param facts The facts to load. This array is sorted as a side effect.
+ * @param count The number of facts in the array.
+ * @param numThreads The number of threads to sort with.
+ *
+ * @return A set representing the facts in the knowledge base.
+ */
+btree::btree_set<uint64_t>* bulkLoadKB(uint64_t* facts,
+                                       const uint64_t& count,
+                                       const uint32_t& numThreads);
+
 /**
  * Creates a knowledge base from a fixed stream of hashes.
  *
@@ -33,14 +821,75 @@ inline const btree::btree_set<uint64_t>* readKB(
 }
 
 /**
- * Reads a knowledge base from a given serialized file. This file should be
- * a simple sequence of hashed values; each 8 bytes represents a fact, followed
- * immediately by the next fact.
+ * Writes a sorted knowledge base from an in-memory array of facts.
+ * The facts are sorted and deduplicated in place.
+ *
+ * @param path The file to write to.
+ * @param facts The facts to write; this array is sorted as a side effect.
+ * @param count The number of facts in the array.
+ * @param format The on-disk format to write; either a plain sorted array
+ *               (SortedKBWriter), Elias-Fano encoded (EliasFanoKBWriter),
+ *               in Eytzinger layout (eytzinger_kb_header), or as a
+ *               perfect hash of fingerprints (perfect_hash_kb_header).
+ * @param fingerprintBits For KB_FORMAT_PERFECT_HASH, the number of bits of
+ *                        fingerprint to store for each fact.
+ *
+ * @return The number of unique facts written.
+ */
+uint64_t writeKB(const std::string& path, uint64_t* facts,
+                 const uint64_t& count,
+                 const kb_format& format = KB_FORMAT_SORTED,
+                 const uint32_t& fingerprintBits =
+                   PERFECT_HASH_KB_FINGERPRINT_BITS);
+
+/**
+ * Reads a knowledge base from a given serialized file.
+ *
+ * If the file starts with a sorted KB header (see SortedKBWriter), it is
+ * memory mapped and queried in place; startup is constant time, and the
+ * page cache is shared between processes serving the same file.
+ *
+ * Likewise, an Elias-Fano encoded KB (see EliasFanoKBWriter) is memory
+ * mapped and queried in place, at around half the memory; and an
+ * Eytzinger layout KB (see eytzinger_kb_header) is memory mapped and
+ * queried in place, with a branch-free search that prefetches ahead.
+ * A perfect hash KB (see perfect_hash_kb_header) is memory mapped too; it
+ * answers in about two cache misses, but with a small false positive rate.
+ *
+ * Otherwise, the file is treated as a legacy sequence of hashed values;
+ * each 8 bytes represents a fact, followed immediately by the next fact.
+ * These are read in parallel and bulk loaded into an in-memory btree
+ * (see bulkLoadKB()).
+ *
+ * If KB_NUMA_SHARD_BITS is nonzero, the facts are then copied into a
+ * NumaShardedFactDB, partitioned by hash prefix across the NUMA nodes of
+ * the machine, replicating the KB_NUMA_HOT_SHARDS hottest shards on every
+ * node.
+ * Otherwise, if KB_HOT_SET_SIZE is nonzero, the KB is served as the cold
+ * tier of a TieredFactDB, which answers the KB_HOT_SET_SIZE most looked up
+ * facts from RAM.
+ *
+ * If KB_BLOOM_BITS_PER_FACT is nonzero, the knowledge base is guarded by a
+ * BloomFilter, unless it is a perfect hash KB; that cannot enumerate its
+ * facts to build a filter, and answers about as quickly without one. The
+ * filter is read from path + BLOOM_FILTER_SUFFIX if a filter matching this
+ * KB exists there; otherwise, it is built and saved to that path.
+ *
+ * @param path The path to the file.
+ *
+ * @return The facts in the knowledge base.
+ */
+const FactDB* readKB(std::string path);
+
+/**
+ * Checks that readKB() can read the given file, without exiting if it
+ * cannot: the file must open, and a sorted, Elias-Fano, Eytzinger or
+ * perfect hash KB must have a valid header. Says why not on stderr.
  *
  * @param path The path to the file.
- * 
- * @return A set representing the facts in the knowledge base.
+ *
+ * @return True if readKB() can read the file.
  */
-const btree::btree_set<uint64_t>* readKB(std::string path);
+bool isReadableKB(const std::string& path);
 
 #endif
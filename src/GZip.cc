@@ -1,185 +1,154 @@
 #include "GZip.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <assert.h>
-#include <sstream>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
   
 using namespace std;
 
 //
-// zfatal()
+// splitLine()
 //
-void zfatal(int ret) {
-  fputs("GZip.cc: ", stderr);
-  switch (ret) {
-    case Z_ERRNO:
-      if (ferror(stdin))
-        fputs("error reading stdin\n", stderr);
-      if (ferror(stdout))
-        fputs("error writing stdout\n", stderr);
-      std::exit(1);
-      break;
-    case Z_STREAM_ERROR:
-      fputs("invalid compression level\n", stderr);
-      std::exit(1);
-      break;
-    case Z_DATA_ERROR:
-      fputs("invalid or incomplete deflate data\n", stderr);
-      std::exit(1);
-      break;
-    case Z_MEM_ERROR:
-      fputs("out of memory\n", stderr);
-      std::exit(1);
-      break;
-    case Z_VERSION_ERROR:
-      fputs("zlib version mismatch!\n", stderr);
-      std::exit(1);
+uint32_t splitLine(char* line, const char** fields, const uint32_t& maxFields) {
+  uint32_t numFields = 0;
+  fields[numFields++] = line;
+  for (char* c = line; *c != '\0'; ++c) {
+    if (*c == '\t') {
+      *c = '\0';
+      if (numFields == maxFields) {
+        return maxFields + 1;
+      }
+      fields[numFields++] = c + 1;
+    }
   }
+  return numFields;
 }
-  
-//
-// GZIterator::GZIterator
-//
-GZIterator::GZIterator() : bufferSize(0), source(NULL), lastLine(NULL) { }
 
 //
-// GZIterator::GZIterator
+// GZLineReader::GZLineReader
 //
-GZIterator::GZIterator(const char* filename, const uint64_t& bufferSize)
-    : source(fopen(filename, "r")), bufferSize(bufferSize), lastLine(NULL) {
-  // Error check
+GZLineReader::GZLineReader(const char* filename, const uint64_t& bufferSize)
+    : source(gzopen(filename, "rb")), bufferSize(max(bufferSize, (uint64_t) 1)),
+      start(0), end(0), atEOF(false), length(0), numFields(0) {
   if (source == NULL) {
     fprintf(stderr, "Could not find file: %s\n", filename);
     exit(1);
   }
-  // Initialize the buffers
-  this->in = (uint8_t*) malloc(bufferSize * sizeof(uint8_t));
-  this->out = (uint8_t*) malloc(bufferSize * sizeof(uint8_t));
-  // Initialize the stream
-  this->strm.zalloc = Z_NULL;
-  this->strm.zfree = Z_NULL;
-  this->strm.opaque = Z_NULL;
-  this->strm.avail_in = 0;
-  this->strm.next_in = Z_NULL;
-  this->strm.avail_out = 0;
-  this->strm.next_out = Z_NULL;
-  this->status = inflateInit2(&(this->strm), 16+MAX_WBITS);
-  this->outConsumed = 0;
-  this->outHave = 0;
-  // Make sure we're ok
-  if (this->status != Z_OK) {
-    zfatal(this->status);
-  }
-  // Prime the iterator
-  fillOut();
+  gzbuffer(source, 1024 * 1024);
+  // (+ 1 for the null after a last line with no newline)
+  buffer = (char*) malloc(this->bufferSize + 1);
 }
 
 //
-// GZIterator::~GZIterator
+// GZLineReader::GZLineReader
 //
-GZIterator::~GZIterator() {
+GZLineReader::GZLineReader(const string& text)
+    : source(NULL), bufferSize(text.length()),
+      start(0), end(text.length()), atEOF(true), length(0), numFields(0) {
+  buffer = (char*) malloc(bufferSize + 1);
+  memcpy(buffer, text.c_str(), text.length());
+}
+
+//
+// GZLineReader::~GZLineReader
+//
+GZLineReader::~GZLineReader() {
   if (source != NULL) {
-    fclose(source);
-    free(this->in);
-    free(this->out);
+    gzclose(source);
   }
+  free(buffer);
 }
 
 //
-// GZIterator::fillIn
+// GZLineReader::fill
 //
-bool GZIterator::fillIn() {
-  strm.avail_in = fread(in, sizeof(uint8_t), bufferSize, source);
-  if (ferror(source)) {
-    (void)inflateEnd(&strm);
-    zfatal(Z_ERRNO);
+bool GZLineReader::fill() {
+  if (atEOF) {
+    return false;
+  }
+  // (move the partial line to the front, growing the buffer if it is full)
+  if (start > 0) {
+    memmove(buffer, buffer + start, end - start);
+    end -= start;
+    start = 0;
+  }
+  if (end == bufferSize) {
+    bufferSize *= 2;
+    buffer = (char*) realloc(buffer, bufferSize + 1);
   }
-  if (strm.avail_in == 0) {
+  const int32_t read = gzread(source, buffer + end, bufferSize - end);
+  if (read < 0) {
+    int32_t status;
+    fprintf(stderr, "Could not read file: %s\n", gzerror(source, &status));
+    exit(1);
+  }
+  if (read == 0) {
+    atEOF = true;
     return false;
   }
-  strm.next_in = in;
+  end += read;
   return true;
 }
 
 //
-// GZIterator::fillOut
-//
-bool GZIterator::fillOut() {
-  // Read from the input
-  strm.avail_out = bufferSize;
-  strm.next_out = out;
-  status = inflate(&strm, Z_NO_FLUSH);
-  assert(status != Z_STREAM_ERROR);  /* state not clobbered */
-  switch (status) {
-    case Z_NEED_DICT:
-        status = Z_DATA_ERROR;     /* and fall through */
-    case Z_DATA_ERROR:
-    case Z_MEM_ERROR:
-    case Z_STREAM_ERROR:
-        (void) inflateEnd(&strm);
-        zfatal(status);
-  }
-  this->outHave = bufferSize - strm.avail_out;
-  this->outConsumed = 0;
-  // Return
-  if (this->outHave != 0) {
-    // Case: something was read.
-    return true;
-  } else {
-    // Case: have to read more input
-    if (!fillIn()) {
-      return false;
+// GZLineReader::next
+//
+bool GZLineReader::next() {
+  uint64_t scanned = start;
+  char* newline;
+  while ((newline = (char*) memchr(buffer + scanned, '\n', end - scanned))
+         == NULL) {
+    scanned = end - start;
+    if (!fill()) {
+      if (start == end) {
+        return false;
+      }
+      // (the last line has no newline)
+      newline = buffer + end;
+      break;
     }
-    return fillOut();
   }
+  *newline = '\0';
+  char* line = buffer + start;
+  length = newline - line;
+  start = min((uint64_t) (newline - buffer) + 1, end);
+  numFields = splitLine(line, fields, GZ_MAX_FIELDS);
+  return true;
+}
+
+//
+// GZIterator::GZIterator
+//
+GZIterator::GZIterator() : reader(NULL), primed(false) { }
+
+//
+// GZIterator::GZIterator
+//
+GZIterator::GZIterator(const char* filename, const uint64_t& bufferSize)
+    : reader(new GZLineReader(filename, bufferSize)), primed(false) { }
+
+//
+// GZIterator::~GZIterator
+//
+GZIterator::~GZIterator() {
+  delete reader;
 }
 
 //
 // GZIterator::hasNext
 //
 bool GZIterator::hasNext() {
-  // Shortcuts
-  if (source == NULL) {
+  if (reader == NULL) {
     std::exit(1);
   }
-  if (this->lastLine != NULL) {
-    return true;
-  }
-  if (this->status == Z_STREAM_END &&
-      this->outConsumed >= this->outHave) {
-    return false;
-  }
-
-  // Create line
-  this->lastLine = (char*) malloc(bufferSize * sizeof(char));
-  uint32_t lineIndex = 0;
-  while (out[this->outConsumed] != '\n') {  // assumption: we always start with output
-    // Set character
-    this->lastLine[lineIndex] = out[this->outConsumed];
-    // Update indices
-    lineIndex += 1;
-    this->outConsumed += 1;
-    // Check if we have more output
-    if (this->outConsumed >= this->outHave) {
-      bool canFillOut = fillOut();
-      if (!canFillOut) {
-        // Base case: no more input to read
-        this->lastLine[lineIndex] = '\0';
-        return true;
-      }
-      this->outConsumed = 0;
-    }
-  }
-  this->lastLine[lineIndex] = '\0';
-
-  // Skip newline
-  this->outConsumed += 1;
-  if (this->outConsumed >= this->outHave) {
-    fillOut();
+  if (!primed) {
+    primed = reader->next();
   }
-
-  // Return success
-  return true;
+  return primed;
 }
   
 //
@@ -217,15 +186,147 @@ GZRow GZIterator::next() {
     fprintf(stderr, "Called next() on GZIterator with no elements remaining!\n");
     exit(1);
   }
-  // Split the string
-  istringstream iss(this->lastLine);
-  string s;
-  vector<string> elems;
-  while ( getline( iss, s, '\t' ) ) {
-    elems.push_back(s);
-  }
-  // Return
-  free(this->lastLine);
-  this->lastLine = NULL;
-  return GZRow(elems);
+  primed = false;
+  // Copy the fields
+  // (an empty line has no fields, and a trailing tab ends the last field)
+  uint32_t size = min(reader->size(), (uint32_t) GZ_MAX_FIELDS);
+  if (reader->lineLength() == 0) {
+    size = 0;
+  } else if (size > 1 && (*reader)[size - 1][0] == '\0' &&
+             size == reader->size()) {
+    size -= 1;
+  }
+  return GZRow(reader->row(), size);
+}
+
+/** A block of whole lines, handed from the inflater to a parser */
+struct gz_line_block {
+  char* data;
+  uint64_t length;
+};
+
+//
+// parallelForEachLine()
+//
+void parallelForEachLine(const char* filename, const uint32_t& numThreads,
+                         function<void(const uint32_t&, char*)> callback) {
+  gzFile source = gzopen(filename, "rb");
+  if (source == NULL) {
+    fprintf(stderr, "Could not find file: %s\n", filename);
+    exit(1);
+  }
+  gzbuffer(source, 1024 * 1024);
+
+  // Start the parsers
+  deque<gz_line_block> pending;
+  bool done = false;
+  mutex lock;
+  condition_variable blockReady;
+  condition_variable blockTaken;
+  vector<thread> parsers;
+  for (uint32_t t = 0; t < numThreads; ++t) {
+    parsers.push_back(thread([&, t]() -> void {
+      while (true) {
+        gz_line_block block;
+        {
+          unique_lock<mutex> guard(lock);
+          blockReady.wait(guard, [&]() -> bool {
+            return done || !pending.empty();
+          });
+          if (pending.empty()) {
+            return;
+          }
+          block = pending.front();
+          pending.pop_front();
+        }
+        blockTaken.notify_one();
+        char* line = block.data;
+        char* end = block.data + block.length;
+        while (line < end) {
+          char* newline = (char*) memchr(line, '\n', end - line);
+          if (newline == NULL) {
+            newline = end;
+          }
+          *newline = '\0';
+          if (newline > line) {
+            callback(t, line);
+          }
+          line = newline + 1;
+        }
+        free(block.data);
+      }
+    }));
+  }
+
+  // Inflate the file, cutting it into blocks at line boundaries
+  // (each block carries the partial line left over by the last one)
+  char* carry = NULL;
+  uint64_t carryLength = 0;
+  while (true) {
+    char* data = (char*) malloc(carryLength + GZ_LINE_BLOCK_SIZE + 1);
+    if (carry != NULL) {
+      memcpy(data, carry, carryLength);
+      free(carry);
+      carry = NULL;
+    }
+    const int32_t read = gzread(source, data + carryLength, GZ_LINE_BLOCK_SIZE);
+    if (read < 0) {
+      int32_t status;
+      fprintf(stderr, "Could not read %s: %s\n", filename,
+              gzerror(source, &status));
+      exit(1);
+    }
+    uint64_t length = carryLength + read;
+    carryLength = 0;
+    if (read == 0) {
+      if (length == 0) {
+        free(data);
+        break;
+      }
+    } else {
+      // (hold back the trailing partial line)
+      uint64_t cut = length;
+      while (cut > 0 && data[cut - 1] != '\n') {
+        cut -= 1;
+      }
+      if (cut == 0) {
+        // (a line longer than a block; keep reading)
+        carry = data;
+        carryLength = length;
+        continue;
+      }
+      carryLength = length - cut;
+      if (carryLength > 0) {
+        carry = (char*) malloc(carryLength);
+        memcpy(carry, data + cut, carryLength);
+      }
+      length = cut;
+    }
+    gz_line_block block;
+    block.data = data;
+    block.length = length;
+    {
+      // (bound the inflated data waiting to be parsed)
+      unique_lock<mutex> guard(lock);
+      blockTaken.wait(guard, [&]() -> bool {
+        return pending.size() < 2 * numThreads;
+      });
+      pending.push_back(block);
+    }
+    blockReady.notify_one();
+    if (read == 0) {
+      break;
+    }
+  }
+  gzclose(source);
+
+  // Wait for the parsers
+  {
+    lock_guard<mutex> guard(lock);
+    done = true;
+  }
+  blockReady.notify_all();
+  for (auto iter = parsers.begin(); iter != parsers.end(); ++iter) {
+    iter->join();
+  }
 }
@@ -2,6 +2,7 @@
 #define GZIP_H
 
 #include <cstdio>
+#include <functional>
 #include <string>
 #include <vector>
 #include <zlib.h>
@@ -15,6 +16,96 @@
 
 #include <config.h>
 
+/** The size of the blocks of lines parallelForEachLine() hands out */
+#define GZ_LINE_BLOCK_SIZE (4 * 1024 * 1024)
+/** The default size of the inflate buffer of a GZLineReader */
+#define GZ_READ_BUFFER_SIZE (1024 * 1024)
+/** The most fields a GZLineReader splits a line into */
+#define GZ_MAX_FIELDS 32
+
+/**
+ * Split a line on tabs, in place: each tab is replaced with a null, so
+ * each field is a null terminated string within the line.
+ *
+ * @param line The line to split; null terminated, without its newline.
+ * @param fields [output] The start of each field; maxFields long.
+ * @param maxFields The most fields to split the line into.
+ *
+ * @return The number of fields; or, maxFields + 1 if there are more than
+ *         maxFields (in which case only the first maxFields are set).
+ */
+uint32_t splitLine(char* line, const char** fields, const uint32_t& maxFields);
+
+/**
+ * Reads a tab separated file one line at a time, without copying: the file
+ * is inflated into a large buffer, each line is split in place, and its
+ * fields are exposed as pointers into the buffer. Parse them with
+ * fast_atoi() and fast_atof(), rather than copying them out.
+ * A field is only valid until the next call to next().
+ */
+class GZLineReader {
+ public:
+  /**
+   * Read a gzipped (or plain) file.
+   * Exits the program if the file cannot be opened.
+   *
+   * @param filename The file to read.
+   * @param bufferSize The initial size of the buffer; it grows to fit the
+   *                   longest line.
+   */
+  GZLineReader(const char* filename,
+               const uint64_t& bufferSize = GZ_READ_BUFFER_SIZE);
+
+  /**
+   * Read lines from memory, rather than a file; e.g., for test fixtures.
+   *
+   * @param text The lines, each terminated by a newline.
+   */
+  GZLineReader(const std::string& text);
+
+  ~GZLineReader();
+
+  /**
+   * Advance to the next line.
+   *
+   * @return False if there are no more lines.
+   */
+  bool next();
+
+  /**
+   * The number of tab separated fields in the current line; an empty line
+   * has a single empty field. A line with more than GZ_MAX_FIELDS fields
+   * has size GZ_MAX_FIELDS + 1, and only the first GZ_MAX_FIELDS are set.
+   */
+  inline uint32_t size() const { return numFields; }
+
+  /** The given field of the current line, null terminated. */
+  inline const char* operator[](const uint32_t& index) const {
+    return fields[index];
+  }
+
+  /** The fields of the current line. */
+  inline const char** row() { return fields; }
+
+  /** The length of the current line, without its newline. */
+  inline uint64_t lineLength() const { return length; }
+
+ private:
+  gzFile source;
+  char* buffer;
+  uint64_t bufferSize;
+  /** The inflated, unread data is buffer[start] .. buffer[end] */
+  uint64_t start;
+  uint64_t end;
+  bool atEOF;
+  uint64_t length;
+  uint32_t numFields;
+  const char* fields[GZ_MAX_FIELDS];
+
+  /** Read more of the file into the buffer; false at the end of the file */
+  bool fill();
+};
+
 /**
  * Represents a single row of a database query result.
  */
@@ -36,10 +127,13 @@ class GZRow {
  * An iterator for a particular query. 
  * Automatically manages the cursor, and creating + cleaning up
  * the connection and memory when constructed and deconstructed.
+ * Each row is copied out of the file; loaders should prefer a
+ * GZLineReader.
  */
 class GZIterator {
  public:
-  GZIterator(const char* filename, const uint64_t& bufferSize = (0x1l << 10));
+  GZIterator(const char* filename,
+             const uint64_t& bufferSize = GZ_READ_BUFFER_SIZE);
 
   virtual ~GZIterator();
 
@@ -54,23 +148,24 @@ class GZIterator {
   GZIterator();
  
  private:
-  FILE* source;
-  const uint64_t bufferSize;
-  char* lastLine;
-  
-  // (internal variables for reading the stream)
-  uint64_t have;
-  z_stream strm;
-  int32_t status;
-  uint8_t* out;
-  uint8_t* in;
-
-  // (helper functions)
-  bool fillIn();
-  bool fillOut();
-
-  uint32_t outConsumed;
-  uint32_t outHave;
+  GZLineReader* reader;
+  /** True if the reader is at a line which next() has not returned */
+  bool primed;
 };
 
+/**
+ * Reads every line of a gzipped file, in parallel. The calling thread
+ * inflates the file, and cuts it into blocks of whole lines, which are
+ * parsed by numThreads worker threads. Lines are handed to the callback
+ * in no particular order.
+ *
+ * @param filename The gzipped file to read.
+ * @param numThreads The number of threads to call the callback from.
+ * @param callback Called with the index of the calling thread (in
+ *                 [0, numThreads)), and a (mutable) line, null terminated
+ *                 and without its newline. Empty lines are skipped.
+ */
+void parallelForEachLine(const char* filename, const uint32_t& numThreads,
+                         std::function<void(const uint32_t&, char*)> callback);
+
 #endif
@@ -1,6 +1,17 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 #include "Utils.h"
 #include "Graph.h"
@@ -10,91 +21,297 @@
 
 using namespace std;
 
-class MockGZIterator : public GZIterator {
+/**
+ * A hash index from the gloss of each word to its index, over an arena of
+ * glosses laid out as in the graph image: word w's gloss starts at
+ * glossOffsets[w], and a word with no gloss has an empty range. The index
+ * is an open addressing table storing only the word (plus one, so 0 marks
+ * an empty slot); the glosses themselves are compared in place.
+ * If two words share a gloss, the lower index is found.
+ */
+class GlossIndex {
  public:
-  MockGZIterator(const uint32_t size, const GZRow* rows) :
-    GZIterator(),
-    size(size), rows(rows), index(0) { }
+  GlossIndex(const char* glosses, const uint64_t* glossOffsets,
+             const uint64_t& numWords)
+      : glosses(glosses), glossOffsets(glossOffsets) {
+    uint64_t capacity = 2;
+    while (capacity < 2 * numWords) { capacity <<= 1; }
+    mask = capacity - 1;
+    slots = (uint32_t*) malloc(capacity * sizeof(uint32_t));
+    memset(slots, 0, capacity * sizeof(uint32_t));
+    for (uint64_t w = 0; w < numWords; ++w) {
+      if (glossOffsets[w] == glossOffsets[w + 1]) { continue; }
+      uint64_t slot;
+      if (!probe(glosses + glossOffsets[w], &slot)) {
+        slots[slot] = w + 1;
+      }
+    }
+  }
 
-  virtual bool hasNext()  {
-    return index < size;
+  ~GlossIndex() {
+    free(slots);
   }
 
-  virtual GZRow next() {
-    index += 1;
-    return rows[index - 1];
+  /** Find the word with the given gloss; returns false if there is none. */
+  inline bool find(const char* gloss, word* out) const {
+    uint64_t slot;
+    if (probe(gloss, &slot)) {
+      *out = slots[slot] - 1;
+      return true;
+    }
+    return false;
   }
 
  private:
-  const uint32_t size;
-  const GZRow* rows;
-  uint32_t index;
+  const char* glosses;
+  const uint64_t* glossOffsets;
+  uint32_t* slots;
+  uint64_t mask;
+
+  /**
+   * Find the slot of the given gloss, returning true; or, the empty slot
+   * it would go in, returning false.
+   */
+  inline bool probe(const char* gloss, uint64_t* slot) const {
+    uint64_t i = fnv_64a_str((char*) gloss, FNV1_64_INIT) & mask;
+    while (slots[i] != 0) {
+      if (strcmp(glosses + glossOffsets[slots[i] - 1], gloss) == 0) {
+        *slot = i;
+        return true;
+      }
+      i = (i + 1) & mask;
+    }
+    *slot = i;
+    return false;
+  }
 };
 
+static_assert((0x1 << SENSE_ENTROPY) <= RUN_ANY_SENSE,
+              "RUN_ANY_SENSE must not be a valid sense");
+static_assert(NUM_MUTATION_TYPES <= 8 * sizeof(edge_type_mask),
+              "edge_type_mask is too narrow for every edge type");
+
+/** The source sense of a run of edges which may be taken from any sense */
+static const uint8_t ANY_SENSE_SOURCE_SENSE = 0;
+
 /**
  * A simple in-memory stored Graph, with the word indexer and the edge
- * matrix.
+ * matrix. The edges are stored in compressed sparse row form, as a
+ * structure of arrays: the edges are grouped by sink, and each field
+ * (bar the sink, which is implied by the group) is in its own packed
+ * array. This takes 11 bytes per edge rather than sizeof(edge), and lets
+ * the search loop order and check edges by their type, cost and senses
+ * alone, reading the source only of the edges it takes.
+ *
+ * Each sink's edges are further partitioned by sense and type (see
+ * edgeOrder()): the edges into any sense come first, then the edges into
+ * each sink sense; each of these is split into a run per edge type. The
+ * runs of each sink are indexed by a small table of (sense, type, start)
+ * entries, of 10 bytes per run, and the types of each sink's edges are
+ * summarized in a bitmask; so, the search only visits edges valid for the
+ * sense it is at, of the types it allows.
+ *
+ * A compact graph (costBits of 8 or 16) goes further, and stores only what
+ * the run index does not already give: a packed source word per edge (the
+ * source, and whichever sense its run does not fix), and a cost quantized
+ * to costBits bits against a per-type scale table. This takes 5 or 6 bytes
+ * per edge, on top of the run index. Costs are dequantized as the search
+ * reads them; each is within (max - min) / (2 * (2^costBits - 1)) of the
+ * original, where max and min are the largest and smallest costs of that
+ * edge type. Since rounding is monotone, the edges of a run stay in cost
+ * order. incomingEdgesFast() spans runs, so a compact graph serves it from
+ * a copy of the edges in the float layout, unpacked on its first call;
+ * the search never calls it, and callers visiting every edge use
+ * forEachIncomingRun(), which reads the compact layout in place.
+ *
+ * The glosses are stored in one arena, laid out as in the graph image (see
+ * buildGlossArena()).
  */
 class InMemoryGraph : public Graph {
  private:
-  char** index2gloss;
-  edge** edgesBySink;
-  uint32_t* edgesSizes;
+  char* glosses;
+  uint64_t* glossOffsets;
+  /** Built on the first call to findWord() */
+  mutable GlossIndex* glossIndex;
+  mutable std::once_flag glossIndexBuilt;
+  uint64_t* edgeOffsets;
+  /** The float layout; for a compact graph, unpacked on first use */
+  mutable word* sources;
+  mutable uint8_t* sourceSenses;
+  mutable uint8_t* sinkSenses;
+  mutable edge_type* types;
+  mutable float* costs;
+  mutable std::once_flag unpacked;
+  /** The compact layout; NULL unless costBits is set */
+  uint32_t* packedSources;
+  void* costCodes;
+  const uint8_t costBits;
+  /** Dequantize the costs of each edge type; see edge_list */
+  float costOffsets[8 * sizeof(edge_type_mask)];
+  float costScales[8 * sizeof(edge_type_mask)];
+  /** The runs of sink word w are runOffsets[w] .. runOffsets[w+1] */
+  uint64_t* runOffsets;
+  /** The sink sense of each run, or RUN_ANY_SENSE */
+  std::vector<uint8_t> runSenses;
+  std::vector<edge_type> runTypes;
+  std::vector<uint64_t> runStarts;
+  /** The types of the edges into each word */
+  edge_type_mask* edgeTypeMasks;
   uint32_t size;
-  btree::btree_set<tagged_word> invalidDeletions;
+  btree::btree_set<tagged_word> invalidDeletionSet;
   btree::btree_set<word> invalidDeletionWords;
   
  public:
-  InMemoryGraph(char** index2gloss,
-                edge** edgesBySink,
-                uint32_t* edgesSizes,
+  /**
+   * Create a graph. The edges into each sink must already be sorted; see
+   * buildAdjacency(); and, the glosses laid out by buildGlossArena().
+   * The edges are freed once they are packed.
+   *
+   * @param costBits The bits to quantize each cost to (8 or 16), or 0 to
+   *                 store the edges in the float layout.
+   */
+  InMemoryGraph(char* glosses,
+                uint64_t* glossOffsets,
+                edge* edges,
+                uint64_t* edgeOffsets,
                 uint32_t size,
-                btree::btree_set<tagged_word> invalidDeletions)
-        : index2gloss(index2gloss), edgesBySink(edgesBySink), 
-          edgesSizes(edgesSizes), size(size),
-          invalidDeletions(invalidDeletions) {
+                btree::btree_set<tagged_word> invalidDeletions,
+                const uint8_t& costBits)
+        : glosses(glosses), glossOffsets(glossOffsets), glossIndex(NULL),
+          edgeOffsets(edgeOffsets), sources(NULL), sourceSenses(NULL),
+          sinkSenses(NULL), types(NULL), costs(NULL), packedSources(NULL),
+          costCodes(NULL), costBits(costBits), size(size),
+          invalidDeletionSet(invalidDeletions) {
     for (auto iter = invalidDeletions.begin();
               iter != invalidDeletions.end(); ++iter) {
       invalidDeletionWords.insert(iter->word);
     }
-//    fprintf(stderr,"  sorting the graph edges..");
-    for (uint32_t i = 0; i < size; ++i) {
-//      if (i % 100000 == 0) { fprintf(stderr, "."); fflush(stderr); }
-      std::sort(edgesBySink[i], edgesBySink[i] + edgesSizes[i]);
+    if (costBits != 0 && costBits != 8 && costBits != 16) {
+      fprintf(stderr, "Edge costs can only be quantized to 8 or 16 bits; got %u\n",
+              costBits);
+      exit(1);
+    }
+    if (costBits != 0 && size > PACKED_SOURCE_MASK + 1) {
+      fprintf(stderr, "Too many words (%u) for a compact graph\n", size);
+      exit(1);
+    }
+    // Index the sense + type runs
+    runOffsets = (uint64_t*) malloc((size + 1) * sizeof(uint64_t));
+    edgeTypeMasks = (edge_type_mask*) malloc(max(size, (uint32_t) 1) *
+                                             sizeof(edge_type_mask));
+    for (uint64_t w = 0; w < size; ++w) {
+      runOffsets[w] = runStarts.size();
+      edgeTypeMasks[w] = 0x0;
+      for (uint64_t i = edgeOffsets[w]; i < edgeOffsets[w + 1]; ++i) {
+        const uint8_t sense =
+          edges[i].source_sense == 0 ? RUN_ANY_SENSE : edges[i].sink_sense;
+        if (runStarts.size() == runOffsets[w] ||
+            runSenses.back() != sense || runTypes.back() != edges[i].type) {
+          runSenses.push_back(sense);
+          runTypes.push_back(edges[i].type);
+          runStarts.push_back(i);
+        }
+        edgeTypeMasks[w] |= edgeTypeBit(edges[i].type);
+      }
+    }
+    runOffsets[size] = runStarts.size();
+    // Pack the edges
+    if (costBits == 0) {
+      unpack(edges);
+    } else {
+      pack(edges);
     }
-//    fprintf(stderr,"done.\n");
+    free(edges);
   }
 
   ~InMemoryGraph() {
-    for (int i = 0; i < size; ++i) { 
-      if (index2gloss[i] != NULL) {
-        free(index2gloss[i]);
-      }
-      if (edgesBySink[i] != NULL) {
-        free(edgesBySink[i]);
+    delete glossIndex;
+    free(glosses);
+    free(glossOffsets);
+    free(edgeOffsets);
+    free(sources);
+    free(sourceSenses);
+    free(sinkSenses);
+    free(types);
+    free(costs);
+    free(packedSources);
+    free(costCodes);
+    free(runOffsets);
+    free(edgeTypeMasks);
+  }
+
+  virtual edge_list incomingEdgesFast(const word& sink) const {
+    assert (sink < this->size);
+    if (costBits != 0) {
+      call_once(unpacked, [this]() -> void { unpack(NULL); });
+    }
+    return edgeRange(sink, edgeOffsets[sink], edgeOffsets[sink + 1]);
+  }
+
+  /** {@inheritDoc} */
+  virtual uint32_t incomingEdgesFor(const word& sink, const uint8_t& sense,
+                                    const edge_type_mask& edgeTypes,
+                                    edge_list* runs) const {
+    assert (sink < this->size);
+    if ((edgeTypeMasks[sink] & edgeTypes) == 0) {
+      return 0;
+    }
+    const uint64_t lastRun = runOffsets[sink + 1];
+    uint32_t numRuns = 0;
+    for (uint64_t run = runOffsets[sink]; run < lastRun; ++run) {
+      if ((runSenses[run] == RUN_ANY_SENSE || runSenses[run] == sense) &&
+          (edgeTypes & edgeTypeBit(runTypes[run])) != 0) {
+        const uint64_t end =
+          run + 1 < lastRun ? runStarts[run + 1] : edgeOffsets[sink + 1];
+        runs[numRuns] = costBits == 0
+          ? edgeRange(sink, runStarts[run], end)
+          : compactRun(sink, run, end);
+        numRuns += 1;
       }
     }
-    free(index2gloss);
-    free(edgesBySink);
-    free(edgesSizes);
+    return numRuns;
   }
 
-  virtual const edge* incomingEdgesFast(const word& sink, uint32_t* size) const {
+  /** {@inheritDoc} */
+  virtual edge_type_mask incomingEdgeTypes(const word& sink) const {
     assert (sink < this->size);
-    *size = edgesSizes[sink];
-    return edgesBySink[sink];
+    return edgeTypeMasks[sink];
+  }
+
+  /** {@inheritDoc} */
+  virtual void forEachIncomingRun(const word& sink,
+      function<void(const edge_list&)> visit) const {
+    assert (sink < this->size);
+    if (costBits == 0) {
+      visit(edgeRange(sink, edgeOffsets[sink], edgeOffsets[sink + 1]));
+      return;
+    }
+    const uint64_t lastRun = runOffsets[sink + 1];
+    for (uint64_t run = runOffsets[sink]; run < lastRun; ++run) {
+      const uint64_t end =
+        run + 1 < lastRun ? runStarts[run + 1] : edgeOffsets[sink + 1];
+      visit(compactRun(sink, run, end));
+    }
   }
 
   virtual const char* gloss(const tagged_word& word) const {
     const uint32_t w = word.word;
     if (w >= size) {
       return "<INVALID_WORD>";
-    } else if (index2gloss[w] == NULL) {
+    } else if (glossOffsets[w] == glossOffsets[w + 1]) {
       return "<UNK>";
     } else {
-      return index2gloss[word.word];
+      return glosses + glossOffsets[w];
     }
   }
+
+  /** {@inheritDoc} */
+  virtual bool findWord(const char* gloss, word* out) const {
+    call_once(glossIndexBuilt, [this]() -> void {
+      glossIndex = new GlossIndex(glosses, glossOffsets, size);
+    });
+    return glossIndex->find(gloss, out);
+  }
   
   virtual const vector<word> keys() const {
     vector<word> keys(size);
@@ -107,7 +324,7 @@ class InMemoryGraph : public Graph {
   virtual const bool containsDeletion(const edge& deletion) const {
     if (invalidDeletionWords.find( deletion.source ) != invalidDeletionWords.end()) {
       tagged_word w = getTaggedWord(deletion.source,  deletion.source_sense, MONOTONE_DEFAULT);
-      return invalidDeletions.find( w ) == invalidDeletions.end();
+      return invalidDeletionSet.find( w ) == invalidDeletionSet.end();
     } else {
       return true;
     }
@@ -117,216 +334,1301 @@ class InMemoryGraph : public Graph {
   virtual const uint64_t vocabSize() const {
     return size;
   }
+
+  /** {@inheritDoc} */
+  virtual const vector<tagged_word> invalidDeletions() const {
+    return vector<tagged_word>(invalidDeletionSet.begin(), invalidDeletionSet.end());
+  }
+
+ private:
+  /** The edges into the given sink, from index start to end. */
+  inline edge_list edgeRange(const word& sink, const uint64_t& start,
+                             const uint64_t& end) const {
+    return edge_list(sink, end - start,
+                     sources + start, sourceSenses + start,
+                     sinkSenses + start, types + start, costs + start);
+  }
+
+  /** The compact edges of the given run, which ends at index end. */
+  inline edge_list compactRun(const word& sink, const uint64_t& run,
+                              const uint64_t& end) const {
+    const uint64_t start = runStarts[run];
+    const edge_type& type = runTypes[run];
+    const bool anySense = (runSenses[run] == RUN_ANY_SENSE);
+    return edge_list(sink, end - start, packedSources + start, anySense,
+                     anySense ? &ANY_SENSE_SOURCE_SENSE : &runSenses[run],
+                     &type, ((const char*) costCodes) + start * (costBits / 8),
+                     costBits, costOffsets[type], costScales[type]);
+  }
+
+  /**
+   * Store the edges in the compact layout, quantizing their costs against
+   * the smallest and largest cost of each edge type.
+   */
+  void pack(const edge* edges) {
+    const uint64_t numEdges = edgeOffsets[size];
+    const uint32_t numTypes = 8 * sizeof(edge_type_mask);
+    const uint32_t maxCode = (0x1u << costBits) - 1;
+    float minCosts[numTypes];
+    float maxCosts[numTypes];
+    for (uint32_t t = 0; t < numTypes; ++t) {
+      minCosts[t] = 0.0f;
+      maxCosts[t] = 0.0f;
+    }
+    bool seen[numTypes];
+    memset(seen, 0, sizeof(seen));
+    for (uint64_t i = 0; i < numEdges; ++i) {
+      const edge_type& type = edges[i].type;
+      if (!seen[type] || edges[i].cost < minCosts[type]) {
+        minCosts[type] = edges[i].cost;
+      }
+      if (!seen[type] || edges[i].cost > maxCosts[type]) {
+        maxCosts[type] = edges[i].cost;
+      }
+      seen[type] = true;
+    }
+    for (uint32_t t = 0; t < numTypes; ++t) {
+      costOffsets[t] = minCosts[t];
+      costScales[t] = (maxCosts[t] - minCosts[t]) / maxCode;
+    }
+
+    packedSources = (uint32_t*) malloc(max(numEdges, (uint64_t) 1) *
+                                       sizeof(uint32_t));
+    costCodes = malloc(max(numEdges, (uint64_t) 1) * (costBits / 8));
+    for (uint64_t i = 0; i < numEdges; ++i) {
+      const edge& e = edges[i];
+      // (the sense not fixed by the edge's run)
+      const uint8_t sense = e.source_sense == 0 ? e.sink_sense : e.source_sense;
+      packedSources[i] = (((uint32_t) sense) << PACKED_SOURCE_BITS) | e.source;
+      const uint32_t code = costScales[e.type] == 0.0f ? 0 :
+        min(maxCode, (uint32_t) lround(
+          (e.cost - costOffsets[e.type]) / costScales[e.type]));
+      if (costBits == 8) {
+        ((uint8_t*) costCodes)[i] = code;
+      } else {
+        ((uint16_t*) costCodes)[i] = code;
+      }
+    }
+  }
+
+  /**
+   * Store the edges in the float layout: from the given edges, or, if
+   * NULL, by unpacking the compact layout.
+   */
+  void unpack(const edge* edges) const {
+    const uint64_t numEdges = max(edgeOffsets[size], (uint64_t) 1);
+    sources = (word*) malloc(numEdges * sizeof(word));
+    sourceSenses = (uint8_t*) malloc(numEdges * sizeof(uint8_t));
+    sinkSenses = (uint8_t*) malloc(numEdges * sizeof(uint8_t));
+    types = (edge_type*) malloc(numEdges * sizeof(edge_type));
+    costs = (float*) malloc(numEdges * sizeof(float));
+    if (edges != NULL) {
+      for (uint64_t i = 0; i < edgeOffsets[size]; ++i) {
+        sources[i] = edges[i].source;
+        sourceSenses[i] = edges[i].source_sense;
+        sinkSenses[i] = edges[i].sink_sense;
+        types[i] = edges[i].type;
+        costs[i] = edges[i].cost;
+      }
+      return;
+    }
+    for (uint64_t w = 0; w < size; ++w) {
+      for (uint64_t run = runOffsets[w]; run < runOffsets[w + 1]; ++run) {
+        const uint64_t end =
+          run + 1 < runOffsets[w + 1] ? runStarts[run + 1] : edgeOffsets[w + 1];
+        const edge_list edges = compactRun(w, run, end);
+        for (uint32_t k = 0; k < edges.size(); ++k) {
+          const uint64_t i = runStarts[run] + k;
+          sources[i] = edges.source(k);
+          sourceSenses[i] = edges.sourceSense(k);
+          sinkSenses[i] = edges.sinkSense(k);
+          types[i] = edges.type(k);
+          costs[i] = edges.cost(k);
+        }
+      }
+    }
+  }
 };
-  
+
+/**
+ * A Graph served straight from a memory mapped graph image; see
+ * writeGraphImage() for the format. Nothing is parsed or copied at
+ * startup, and the pages of the image are shared by every process
+ * mapping it.
+ */
+class MMapGraph : public Graph {
+ public:
+  MMapGraph(void* mapping, const uint64_t& mappingSize,
+            const graph_image_header* header)
+      : mapping(mapping), mappingSize(mappingSize),
+        size(header->numWords),
+        numInvalidDeletions(header->numInvalidDeletions) {
+    const char* base = (const char*) mapping;
+    edgeOffsets = (const uint64_t*) (base + header->edgeOffsetsOffset);
+    edges = (const edge*) (base + header->edgesOffset);
+    glossOffsets = (const uint64_t*) (base + header->glossOffsetsOffset);
+    glosses = base + header->glossOffset;
+    invalidTaggedWords =
+      (const tagged_word*) (base + header->invalidDeletionsOffset);
+    runOffsets = (const uint64_t*) (base + header->runOffsetsOffset);
+    runs = (const graph_image_run*) (base + header->runsOffset);
+    glossIndex = NULL;
+  }
+
+  ~MMapGraph() {
+    delete glossIndex;
+    munmap(mapping, mappingSize);
+  }
+
+  /** {@inheritDoc} */
+  virtual edge_list incomingEdgesFast(const word& sink) const {
+    assert (sink < this->size);
+    return edge_list(sink, edges + edgeOffsets[sink],
+                     edgeOffsets[sink + 1] - edgeOffsets[sink]);
+  }
+
+  /** {@inheritDoc} */
+  virtual uint32_t incomingEdgesFor(const word& sink, const uint8_t& sense,
+                                    const edge_type_mask& edgeTypes,
+                                    edge_list* out) const {
+    assert (sink < this->size);
+    const uint64_t lastRun = runOffsets[sink + 1];
+    uint32_t numRuns = 0;
+    for (uint64_t run = runOffsets[sink]; run < lastRun; ++run) {
+      if ((runs[run].sense == RUN_ANY_SENSE || runs[run].sense == sense) &&
+          (edgeTypes & edgeTypeBit(runs[run].type)) != 0) {
+        const uint64_t end =
+          run + 1 < lastRun ? runs[run + 1].start : edgeOffsets[sink + 1];
+        out[numRuns] = edge_list(sink, edges + runs[run].start,
+                                 end - runs[run].start);
+        numRuns += 1;
+      }
+    }
+    return numRuns;
+  }
+
+  /** {@inheritDoc} */
+  virtual edge_type_mask incomingEdgeTypes(const word& sink) const {
+    assert (sink < this->size);
+    edge_type_mask types = 0x0;
+    for (uint64_t run = runOffsets[sink]; run < runOffsets[sink + 1]; ++run) {
+      types |= edgeTypeBit(runs[run].type);
+    }
+    return types;
+  }
+
+  /** {@inheritDoc} */
+  virtual const char* gloss(const tagged_word& word) const {
+    const uint32_t w = word.word;
+    if (w >= size) {
+      return "<INVALID_WORD>";
+    } else if (glossOffsets[w] == glossOffsets[w + 1]) {
+      return "<UNK>";
+    } else {
+      return glosses + glossOffsets[w];
+    }
+  }
+
+  /** {@inheritDoc} */
+  virtual bool findWord(const char* gloss, word* out) const {
+    // (built lazily, so mapping the image stays cheap)
+    call_once(glossIndexBuilt, [this]() -> void {
+      glossIndex = new GlossIndex(glosses, glossOffsets, size);
+    });
+    return glossIndex->find(gloss, out);
+  }
+
+  /** {@inheritDoc} */
+  virtual const vector<word> keys() const {
+    vector<word> keys(size);
+    for (uint64_t i = 0; i < size; ++i) {
+      keys[i] = i;
+    }
+    return keys;
+  }
+
+  /** {@inheritDoc} */
+  virtual const bool containsDeletion(const edge& deletion) const {
+    const tagged_word w = getTaggedWord(deletion.source, deletion.source_sense,
+                                        MONOTONE_DEFAULT);
+    return !std::binary_search(invalidTaggedWords,
+                               invalidTaggedWords + numInvalidDeletions, w);
+  }
+
+  /** {@inheritDoc} */
+  virtual const uint64_t vocabSize() const {
+    return size;
+  }
+
+  /** {@inheritDoc} */
+  virtual const vector<tagged_word> invalidDeletions() const {
+    return vector<tagged_word>(invalidTaggedWords,
+                               invalidTaggedWords + numInvalidDeletions);
+  }
+
+ private:
+  void* mapping;
+  const uint64_t mappingSize;
+  const uint64_t size;
+  const uint64_t numInvalidDeletions;
+  const uint64_t* edgeOffsets;
+  const edge* edges;
+  const uint64_t* glossOffsets;
+  const char* glosses;
+  const tagged_word* invalidTaggedWords;
+  /** The sense + type runs of sink word w are runOffsets[w] .. [w+1] */
+  const uint64_t* runOffsets;
+  const graph_image_run* runs;
+  /** Built on the first call to findWord() */
+  mutable GlossIndex* glossIndex;
+  mutable std::once_flag glossIndexBuilt;
+};
+
+
+/**
+ * Run a task on each of numThreads threads, passing each its index; or,
+ * with one thread, on this thread. Returns once every task has finished.
+ */
+void inParallel(const uint32_t& numThreads,
+                function<void(const uint32_t&)> task) {
+  if (numThreads <= 1) {
+    task(0);
+    return;
+  }
+  vector<thread> threads;
+  for (uint32_t t = 0; t < numThreads; ++t) {
+    threads.push_back(thread(task, t));
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+}
 
 //
 // BidirectionalGraph()
 //
-BidirectionalGraph::BidirectionalGraph(const Graph* impl) 
+BidirectionalGraph::BidirectionalGraph(const Graph* impl,
+                                       const uint32_t& numThreads)
     : impl(impl),
       size(impl->vocabSize()) {
-  outgoingEdgeData.resize(size);
-  uint32_t length;
-  for (uint32_t sink = 0; sink < size; ++sink) {
-    const edge* incomingFromSink = incomingEdgesFast(sink, &length);
-    for (uint32_t source = 0; source < length; ++source) {
-      outgoingEdgeData[source].push_back(incomingFromSink[source]);
+  // Count the edges out of each source
+  atomic<uint64_t>* cursors = new atomic<uint64_t>[size + 1];
+  for (uint64_t w = 0; w <= size; ++w) {
+    cursors[w].store(0, memory_order_relaxed);
+  }
+  // (sinks are handed out in small chunks, as a few words have most edges)
+  const uint64_t chunkSize = 1024;
+  auto forEachSink = [&](function<void(const edge_list&)> visit) -> void {
+    inParallel(numThreads, [&](const uint32_t& t) -> void {
+      for (uint64_t start = t * chunkSize; start < size;
+           start += numThreads * chunkSize) {
+        const uint64_t end = min(start + chunkSize, size);
+        for (uint64_t sink = start; sink < end; ++sink) {
+          impl->forEachIncomingRun(sink, visit);
+        }
+      }
+    });
+  };
+  forEachSink([&](const edge_list& incoming) -> void {
+    for (uint32_t i = 0; i < incoming.size(); ++i) {
+      cursors[incoming.source(i)].fetch_add(1, memory_order_relaxed);
     }
+  });
+
+  // Lay out the sources
+  outgoingOffsets = (uint64_t*) malloc((size + 1) * sizeof(uint64_t));
+  uint64_t numEdges = 0;
+  for (uint64_t w = 0; w <= size; ++w) {
+    outgoingOffsets[w] = numEdges;
+    numEdges += cursors[w].load(memory_order_relaxed);
+    cursors[w].store(outgoingOffsets[w], memory_order_relaxed);
   }
+  outgoingEdgeData = (edge*) malloc(max(numEdges, (uint64_t) 1) * sizeof(edge));
+
+  // Scatter the edges into place
+  forEachSink([&](const edge_list& incoming) -> void {
+    for (uint32_t i = 0; i < incoming.size(); ++i) {
+      outgoingEdgeData[cursors[incoming.source(i)].fetch_add(
+          1, memory_order_relaxed)] = incoming[i];
+    }
+  });
+  delete[] cursors;
+
+  // Sort each source's edges
+  // (the scatter order depends on the threads; this makes it deterministic)
+  inParallel(numThreads, [&](const uint32_t& t) -> void {
+    for (uint64_t start = t * chunkSize; start < size;
+         start += numThreads * chunkSize) {
+      const uint64_t end = min(start + chunkSize, size);
+      for (uint64_t w = start; w < end; ++w) {
+        std::sort(outgoingEdgeData + outgoingOffsets[w],
+                  outgoingEdgeData + outgoingOffsets[w + 1],
+                  [](const edge& a, const edge& b) -> bool {
+          if (a.sink != b.sink) { return a.sink < b.sink; }
+          return edgeCostOrder(a, b);
+        });
+      }
+    }
+  });
+}
+
+//
+// BidirectionalGraph::~BidirectionalGraph()
+//
+BidirectionalGraph::~BidirectionalGraph() {
+  free(outgoingOffsets);
+  free(outgoingEdgeData);
+  delete impl;
+}
+
+/**
+ * The order of the edges into a sink, partitioned by sense and type: the
+ * edges which may be taken from any sense of the sink (source_sense == 0)
+ * come first, then the rest, grouped by sink sense; each group is split
+ * by edge type, and each of those is in edgeCostOrder().
+ */
+inline bool edgeOrder(const edge& a, const edge& b) {
+  const bool aAgnostic = (a.source_sense == 0);
+  const bool bAgnostic = (b.source_sense == 0);
+  if (aAgnostic != bAgnostic) { return aAgnostic; }
+  if (!aAgnostic && a.sink_sense != b.sink_sense) {
+    return a.sink_sense < b.sink_sense;
+  }
+  if (a.type != b.type) { return a.type < b.type; }
+  return edgeCostOrder(a, b);
+}
+
+/**
+ * Parse the fields of a row of the graph file into an edge, exiting on
+ * an invalid row.
+ *
+ * @return False if the edge is an identity edge, and should be skipped.
+ */
+bool parseEdge(const char** fields, const uint32_t& numFields,
+               const uint32_t& numWords, edge* out) {
+  if (numFields != 6) {
+    fprintf(stderr, "Invalid row in edge iterator (size=%u)!", numFields);
+    exit(1);
+  }
+  edge e;
+  e.source       = fast_atoi(fields[0]);
+  if (e.source >= numWords) {
+    fprintf(stderr, "Invalid source word=%u (numWords=%u)\n", e.source, numWords);
+    exit(1);
+  }
+  e.source_sense = fast_atoi(fields[1]);
+  if (e.source_sense >= (0x1 << SENSE_ENTROPY)) {
+    fprintf(stderr, "Invalid source sense=%u (SENSE_ENTROPY=%u; edgeType=%s)\n", e.source_sense, SENSE_ENTROPY, fields[4]);
+    exit(1);
+  }
+  e.sink         = fast_atoi(fields[2]);
+  if (e.sink >= numWords) {
+    fprintf(stderr, "Invalid sink word=%u (numWords=%u)\n", e.sink, numWords);
+    exit(1);
+  }
+  e.sink_sense   = fast_atoi(fields[3]);
+  if (e.sink_sense >= (0x1 << SENSE_ENTROPY)) {
+    fprintf(stderr, "Invalid sink sense=%u (SENSE_ENTROPY=%u; edgeType=%s)\n", e.sink_sense, SENSE_ENTROPY, fields[4]);
+    exit(1);
+  }
+  e.type         = fast_atoi(fields[4]);
+  if (e.type >= NUM_MUTATION_TYPES) {
+    fprintf(stderr, "Invalid mutation type=%u (NUM_MUTATION_TYPES=%u)\n", e.type, NUM_MUTATION_TYPES);
+    exit(1);
+  }
+  if (e.sink == e.source && e.sink_sense == e.source_sense) {
+    return false;  // Ignore any identity edges
+  }
+  e.cost         = fast_atof(fields[5]);
+  if (isinf(e.cost)) { fprintf(stderr, "Infinite cost edge: %f (parsed from %s)\n", e.cost, fields[5]); exit(1); }
+  if (e.cost != e.cost) { fprintf(stderr, "NaN cost edge: %f (parsed from %s)\n", e.cost, fields[5]); exit(1); }
+  if (e.cost < 0.0) { fprintf(stderr, "Negative cost edge: %f (parsed from %s)\n", e.cost, fields[5]); exit(1); }
+  *out = e;
+  return true;
+}
+
+/**
+ * The glosses read from (part of) a vocabulary file: each word's gloss,
+ * null terminated, in one buffer.
+ */
+struct gloss_buffer {
+  /** Each word, with the offset of its gloss in chars */
+  vector<pair<uint32_t, uint64_t>> words;
+  vector<char> chars;
+
+  /**
+   * Add a word's gloss, stripping out Unicode.
+   * Really, this is lossy, but who cares it's all indexed anyways...
+   */
+  void add(const uint32_t& w, const char* raw) {
+    words.push_back(make_pair(w, chars.size()));
+    for (const char* c = raw; *c != '\0'; ++c) {
+      if (32 <= *c && *c < 127) {
+        chars.push_back(*c);
+      }
+    }
+    chars.push_back('\0');
+  }
+};
+
+/**
+ * Lay out the glosses of a graph in one arena. If a word is given more
+ * than one gloss, the last one (in buffer order) is kept.
+ *
+ * @param buffers The glosses, in any number of buffers.
+ * @param numWords The number of words in the graph.
+ * @param glossesOut [output] The null terminated glosses, in word order.
+ *                   Must be freed with free().
+ * @param offsetsOut [output] The numWords + 1 offsets into glossesOut of
+ *                   each word's gloss; a word with no gloss has an empty
+ *                   range. Must be freed with free().
+ */
+void buildGlossArena(const vector<gloss_buffer>& buffers,
+                     const uint32_t& numWords,
+                     char** glossesOut, uint64_t** offsetsOut) {
+  const char** index2gloss = (const char**) malloc(
+      max(numWords, (uint32_t) 1) * sizeof(const char*));
+  memset(index2gloss, 0, numWords * sizeof(const char*));
+  for (auto iter = buffers.begin(); iter != buffers.end(); ++iter) {
+    for (auto wordIter = iter->words.begin(); wordIter != iter->words.end();
+         ++wordIter) {
+      if (wordIter->first < numWords) {
+        index2gloss[wordIter->first] = iter->chars.data() + wordIter->second;
+      }
+    }
+  }
+  uint64_t* offsets = (uint64_t*) malloc((numWords + 1) * sizeof(uint64_t));
+  uint64_t numChars = 0;
+  for (uint64_t w = 0; w < numWords; ++w) {
+    offsets[w] = numChars;
+    if (index2gloss[w] != NULL) {
+      numChars += strlen(index2gloss[w]) + 1;
+    }
+  }
+  offsets[numWords] = numChars;
+  char* glosses = (char*) malloc(max(numChars, (uint64_t) 1));
+  for (uint64_t w = 0; w < numWords; ++w) {
+    if (index2gloss[w] != NULL) {
+      memcpy(glosses + offsets[w], index2gloss[w], offsets[w + 1] - offsets[w]);
+    }
+  }
+  free(index2gloss);
+  *glossesOut = glosses;
+  *offsetsOut = offsets;
+}
+
+/**
+ * Build the compressed sparse row adjacency of a graph from buffers of
+ * edges in any order, with a parallel counting sort by sink. The buffers
+ * are emptied along the way.
+ *
+ * Edges may be pruned along the way: those costing more than maxEdgeCost
+ * are dropped, and then only the maxEdgesPerWord first edges into each
+ * sink in edgeCostOrder() are kept; i.e., those the search would visit
+ * first from any sense of the sink.
+ *
+ * @param buffers The edges, in any number of buffers.
+ * @param numWords The number of words in the graph.
+ * @param numThreads The number of threads to sort with.
+ * @param maxEdgesPerWord The most edges to keep into each sink, or 0 to
+ *                        keep every edge.
+ * @param maxEdgeCost The largest cost of an edge to keep, or 0 to keep
+ *                    edges of any cost.
+ * @param edgesOut [output] The edges, grouped by sink and sorted within
+ *                 each sink by edgeOrder(). Must be freed with free().
+ * @param offsetsOut [output] The numWords + 1 offsets into edgesOut of
+ *                   each sink's edges. Must be freed with free().
+ */
+void buildAdjacency(vector<vector<edge>>* buffers, const uint32_t& numWords,
+                    const uint32_t& numThreads,
+                    const uint32_t& maxEdgesPerWord, const float& maxEdgeCost,
+                    edge** edgesOut, uint64_t** offsetsOut) {
+  // Count the edges into each sink
+  atomic<uint64_t>* cursors = new atomic<uint64_t>[numWords + 1];
+  for (uint64_t w = 0; w <= numWords; ++w) {
+    cursors[w].store(0, memory_order_relaxed);
+  }
+  inParallel(numThreads, [&](const uint32_t& t) -> void {
+    for (uint64_t b = t; b < buffers->size(); b += numThreads) {
+      const vector<edge>& buffer = (*buffers)[b];
+      for (auto iter = buffer.begin(); iter != buffer.end(); ++iter) {
+        if (maxEdgeCost == 0.0f || iter->cost <= maxEdgeCost) {
+          cursors[iter->sink].fetch_add(1, memory_order_relaxed);
+        }
+      }
+    }
+  });
+
+  // Lay out the sinks
+  uint64_t* offsets = (uint64_t*) malloc((numWords + 1) * sizeof(uint64_t));
+  uint64_t numEdges = 0;
+  for (uint64_t w = 0; w <= numWords; ++w) {
+    offsets[w] = numEdges;
+    numEdges += cursors[w].load(memory_order_relaxed);
+    cursors[w].store(offsets[w], memory_order_relaxed);
+  }
+  edge* edges = (edge*) malloc(max(numEdges, (uint64_t) 1) * sizeof(edge));
+
+  // Scatter the edges into place
+  inParallel(numThreads, [&](const uint32_t& t) -> void {
+    for (uint64_t b = t; b < buffers->size(); b += numThreads) {
+      vector<edge>& buffer = (*buffers)[b];
+      for (auto iter = buffer.begin(); iter != buffer.end(); ++iter) {
+        if (maxEdgeCost == 0.0f || iter->cost <= maxEdgeCost) {
+          edges[cursors[iter->sink].fetch_add(1, memory_order_relaxed)] = *iter;
+        }
+      }
+      vector<edge>().swap(buffer);
+    }
+  });
+  delete[] cursors;
+
+  // Sort each sink's edges, keeping only the cheapest maxEdgesPerWord
+  // (sinks are handed out in small chunks, as a few words have most edges)
+  uint64_t* kept = (uint64_t*) malloc((numWords + 1) * sizeof(uint64_t));
+  const uint64_t chunkSize = 1024;
+  inParallel(numThreads, [&](const uint32_t& t) -> void {
+    for (uint64_t start = t * chunkSize; start < numWords;
+         start += numThreads * chunkSize) {
+      const uint64_t end = min(start + chunkSize, (uint64_t) numWords);
+      for (uint64_t w = start; w < end; ++w) {
+        edge* first = edges + offsets[w];
+        kept[w] = offsets[w + 1] - offsets[w];
+        if (maxEdgesPerWord > 0 && kept[w] > maxEdgesPerWord) {
+          std::nth_element(first, first + maxEdgesPerWord, first + kept[w],
+                           edgeCostOrder);
+          kept[w] = maxEdgesPerWord;
+        }
+        std::sort(first, first + kept[w], edgeOrder);
+      }
+    }
+  });
+
+  // Close the gaps left by pruning
+  if (maxEdgesPerWord > 0) {
+    uint64_t numKept = 0;
+    for (uint64_t w = 0; w < numWords; ++w) {
+      memmove(edges + numKept, edges + offsets[w], kept[w] * sizeof(edge));
+      offsets[w] = numKept;
+      numKept += kept[w];
+    }
+    offsets[numWords] = numKept;
+    if (numKept < numEdges) {
+      edges = (edge*) realloc(edges, max(numKept, (uint64_t) 1) * sizeof(edge));
+    }
+  }
+  free(kept);
+
+  *edgesOut = edges;
+  *offsetsOut = offsets;
+}
+
+/**
+ * Read the invalid deletions from their reader.
+ */
+btree::btree_set<tagged_word> readInvalidDeletions(GZLineReader* reader) {
+  btree::btree_set<tagged_word> invalidDeletions;
+  while (reader->next()) {
+    invalidDeletions.insert(getTaggedWord(
+        fast_atoi((*reader)[0]), fast_atoi((*reader)[1]), MONOTONE_DEFAULT));
+  }
+  return invalidDeletions;
 }
 
 //
 // Read Any Graph
 //
 Graph* readGraph(const uint32_t numWords, 
-                 GZIterator* wordIter,
-                 GZIterator* edgeIter,
-                 GZIterator* invalidDeletionIter,
-                 const bool& mock) {
+                 GZLineReader* words,
+                 GZLineReader* edgeRows,
+                 GZLineReader* invalidDeletionRows,
+                 const bool& mock,
+                 const uint8_t& costBits,
+                 const uint32_t& maxEdgesPerWord,
+                 const float& maxEdgeCost) {
   // Read words
-  char** index2gloss = (char**) malloc( numWords * sizeof(char*) );
-  memset(index2gloss, 0, numWords * sizeof(char*));
+  vector<gloss_buffer> glossBuffers(1);
   uint64_t wordI = 0;
-  while (wordIter->hasNext()) {
-    // Get word
-    GZRow row = wordIter->next();
-    size_t len = strlen(row[1]);
-    char* gloss = (char*) malloc( len * sizeof(char) + 1 );
-    // Strip out Unicode
-    // Really, this is lossy, but who cares it's all indexed anyways...
-    uint32_t target = 0;
-    for (uint32_t i = 0; i < len; ++i) {
-      const char& c = row[1][i];
-      if (32 <= c && c < 127) {
-        gloss[target] = c;
-        target += 1;
-      }
+  while (words->next()) {
+    if (words->size() < 2) {
+      fprintf(stderr, "Invalid row in vocab file: '%s'\n", (*words)[0]);
+      exit(1);
     }
-    gloss[target] = '\0';
-    // Set gloss
-    index2gloss[atoi(row[0])] = gloss;
+    glossBuffers[0].add(fast_atoi((*words)[0]), (*words)[1]);
     wordI += 1;
     if (wordI % 1000000 == 0) {
       fprintf(stderr, "loaded %luM words\n", wordI / 1000000);
     }
   }
+  char* glosses;
+  uint64_t* glossOffsets;
+  buildGlossArena(glossBuffers, numWords, &glosses, &glossOffsets);
   
   // Read edges
-  // (initialize variables)
-  struct edge** edges = (struct edge**) malloc((numWords+1) * sizeof(struct edge*));
-  memset(edges, 0, (numWords+1) * sizeof(struct edge*));
-  uint32_t* edgesSizes = (uint32_t*) malloc((numWords+1) * sizeof(uint32_t));
-  memset(edgesSizes, 0, (numWords+1) * sizeof(uint32_t));
-  uint32_t* edgeCapacities = (uint32_t*) malloc((numWords+1) * sizeof(uint32_t));
-  for (uint32_t i = 0; i < numWords; ++i) {
-    edges[i] = (struct edge*) malloc(4 * sizeof(struct edge));
-    edgeCapacities[i] = 4;
-  }
+  vector<vector<edge>> buffers(1);
   uint64_t edgeI = 0;
   // (iterate over rows in DB)
-  while (edgeIter->hasNext()) {
-    GZRow row = edgeIter->next();
-    if (row.size() != 6) {
-      fprintf(stderr, "Invalid row in edge iterator (size=%u)!", row.size());
-      exit(1);
-    }
+  while (edgeRows->next()) {
     edge e;
-    e.source       = fast_atoi(row[0]);
-    if (e.source >= numWords) {
-      fprintf(stderr, "Invalid source word=%u (numWords=%u)\n", e.source, numWords);
-      exit(1);
+    if (!parseEdge(edgeRows->row(), edgeRows->size(), numWords, &e)) {
+      continue;
     }
-    e.source_sense = fast_atoi(row[1]);
-    if (e.source_sense >= (0x1 << SENSE_ENTROPY)) {
-      fprintf(stderr, "Invalid source sense=%u (SENSE_ENTROPY=%u; edgeType=%s)\n", e.source_sense, SENSE_ENTROPY, row[4]);
-      exit(1);
-    }
-    e.sink         = fast_atoi(row[2]);
-    if (e.sink >= numWords) {
-      fprintf(stderr, "Invalid sink word=%u (numWords=%u)\n", e.sink, numWords);
-      exit(1);
-    }
-    e.sink_sense   = fast_atoi(row[3]);
-    if (e.sink_sense >= (0x1 << SENSE_ENTROPY)) {
-      fprintf(stderr, "Invalid sink sense=%u (SENSE_ENTROPY=%u; edgeType=%s)\n", e.sink_sense, SENSE_ENTROPY, row[4]);
-      exit(1);
-    }
-    e.type         = fast_atoi(row[4]);
-    if (e.type >= NUM_MUTATION_TYPES) {
-      fprintf(stderr, "Invalid mutation type=%u (NUM_MUTATION_TYPES=%u)\n", e.type, NUM_MUTATION_TYPES);
-      exit(1);
-    }
-    if (e.sink == e.source && e.sink_sense == e.source_sense) {
-      continue;  // Ignore any identity edges
-    }
-    e.cost         = atof(row[5]);
-    if (isinf(e.cost)) { fprintf(stderr, "Infinite cost edge: %f (parsed from %s)\n", e.cost, row[5]); exit(1); }
-    if (e.cost != e.cost) { fprintf(stderr, "NaN cost edge: %f (parsed from %s)\n", e.cost, row[5]); exit(1); }
-    if (e.cost != e.cost) { fprintf(stderr, "NaN cost edge: %f (parsed from %s)\n", e.cost, row[5]); exit(1); }
-    if (e.cost < 0.0) { fprintf(stderr, "Negative cost edge: %f (parsed from %s)\n", e.cost, row[5]); exit(1); }
-    const word& sink = e.sink;
-    if (edgesSizes[sink] >= edgeCapacities[sink] - 1) {
-      struct edge* newEdges = (struct edge*) malloc(edgeCapacities[sink] * 2 * sizeof(struct edge));
-      memcpy(newEdges, edges[sink], edgeCapacities[sink] * sizeof(struct edge));
-      edgeCapacities[sink] = 2 * edgeCapacities[sink];
-      free(edges[sink]);
-      edges[sink] = newEdges;
-    }
-    edges[sink][edgesSizes[sink]] = e;
-    edgesSizes[sink] += 1;
+    buffers[0].push_back(e);
     edgeI += 1;
     if (!mock && edgeI % 1000000 == 0) {
       fprintf(stderr, "  loaded %luM edges\n", edgeI / 1000000);
     }
   }
-  free(edgeCapacities);
   if (!mock) { fprintf(stderr, "  %lu edges loaded.\n", edgeI); }
+  edge* edges;
+  uint64_t* edgeOffsets;
+  buildAdjacency(&buffers, numWords, 1, maxEdgesPerWord, maxEdgeCost,
+                 &edges, &edgeOffsets);
   
   // Read invalid deletions
-  btree::btree_set<tagged_word> invalidDeletions;
-  while (invalidDeletionIter->hasNext()) {
-    GZRow row = invalidDeletionIter->next();
-    invalidDeletions.insert(getTaggedWord(atoi(row[0]), atoi(row[1]), MONOTONE_DEFAULT));
-  }
+  btree::btree_set<tagged_word> invalidDeletions =
+    readInvalidDeletions(invalidDeletionRows);
   if (!mock) { fprintf(stderr, "  %lu invalid deletions.\n", invalidDeletions.size()); }
   
   // Finish
   if (!mock) { fprintf(stderr, "%s\n", "  done reading the graph."); }
-  return new InMemoryGraph(index2gloss, edges, edgesSizes, numWords, invalidDeletions);
+  return new InMemoryGraph(glosses, glossOffsets, edges, edgeOffsets,
+                           numWords, invalidDeletions, costBits);
 }
 
 
+/**
+ * Returns true if the graph or vocabulary text file was changed after the
+ * image at the given path was compiled.
+ */
+bool graphImageIsStale(const string& imagePath) {
+  struct stat imageStats;
+  if (stat(imagePath.c_str(), &imageStats) != 0) {
+    return false;
+  }
+  const char* textFiles[] = { GRAPH_FILE, VOCAB_FILE };
+  for (uint32_t i = 0; i < 2; ++i) {
+    struct stat textStats;
+    if (stat(textFiles[i], &textStats) == 0 &&
+        textStats.st_mtime > imageStats.st_mtime) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//
+// Read Real Graph
+//
+Graph* ReadGraph(const string& imagePath, const bool& shareImage) {
+  if (!imagePath.empty() && shareImage) {
+    // (build the image once, for this and every later process to map)
+    Graph* graph = readSharedGraphImage(imagePath,
+        []() -> Graph* { return ReadTextGraph(); });
+    if (graph != NULL) {
+      return graph;
+    }
+  }
+  struct stat imageStats;
+  if (!imagePath.empty() && stat(imagePath.c_str(), &imageStats) == 0) {
+    if (!graphImageMatches(imagePath)) {
+      fprintf(stderr, "WARNING: %s was compiled by another version or with "
+                      "other GRAPH_* settings; rerun compile_graph\n",
+              imagePath.c_str());
+      return ReadTextGraph();
+    }
+    if (graphImageIsStale(imagePath)) {
+      fprintf(stderr, "WARNING: %s is older than %s or %s; "
+                      "rerun compile_graph\n",
+              imagePath.c_str(), GRAPH_FILE, VOCAB_FILE);
+    }
+    Graph* image = tryReadGraphImage(imagePath);
+    if (image != NULL) {
+      return image;
+    }
+    fprintf(stderr, "WARNING: could not read %s; rerun compile_graph\n",
+            imagePath.c_str());
+    return ReadTextGraph();
+  }
+  return ReadTextGraph();
+}
+
 //
 // Read Real Graph
 //
 Graph* ReadGraph() {
-  fprintf(stderr, "Reading graph...\n");
-  // Words
-  fprintf(stderr, "  creating word iterator...\n");
-  GZIterator wordCountIter = GZIterator(VOCAB_FILE);
+  return ReadGraph(string(GRAPH_IMAGE), GRAPH_IMAGE_SHARED);
+}
+
+//
+// Read Text Graph
+//
+Graph* ReadTextGraph() {
+  return ReadTextGraph(max(1u, thread::hardware_concurrency()));
+}
+
+//
+// Read Text Graph
+//
+Graph* ReadTextGraph(const uint32_t& numThreads, const uint8_t& costBits,
+                     const uint32_t& maxEdgesPerWord,
+                     const float& maxEdgeCost) {
+  fprintf(stderr, "Reading graph (%u threads)...\n", numThreads);
+  const time_t start = time(NULL);
+
+  // Read words
+  vector<gloss_buffer> glossBuffers(numThreads);
+  parallelForEachLine(VOCAB_FILE, numThreads,
+      [&glossBuffers](const uint32_t& t, char* line) -> void {
+    const char* fields[2];
+    if (splitLine(line, fields, 2) < 2) {
+      fprintf(stderr, "Invalid row in vocab file: '%s'\n", line);
+      exit(1);
+    }
+    glossBuffers[t].add(fast_atoi(fields[0]), fields[1]);
+  });
   uint32_t numWords = 0;
-  while (wordCountIter.hasNext()) {
-    uint32_t wordIndex = fast_atoi(wordCountIter.next()[0]);
-    numWords = (wordIndex >= numWords ? (wordIndex + 1) : numWords);
+  uint64_t wordI = 0;
+  for (auto iter = glossBuffers.begin(); iter != glossBuffers.end(); ++iter) {
+    for (auto wordIter = iter->words.begin(); wordIter != iter->words.end();
+         ++wordIter) {
+      numWords = max(numWords, wordIter->first + 1);
+    }
+    wordI += iter->words.size();
   }
-  GZIterator wordIter = GZIterator(VOCAB_FILE);
-  
-  // Edges
-  fprintf(stderr, "  creating edge iterator...\n");
-  GZIterator edgeIter = GZIterator(GRAPH_FILE);
+  char* glosses;
+  uint64_t* glossOffsets;
+  buildGlossArena(glossBuffers, numWords, &glosses, &glossOffsets);
+  vector<gloss_buffer>().swap(glossBuffers);
+  fprintf(stderr, "  %lu words loaded.\n", wordI);
+
+  // Read edges
+  vector<vector<edge>> buffers(numThreads);
+  parallelForEachLine(GRAPH_FILE, numThreads,
+      [&buffers, &numWords](const uint32_t& t, char* line) -> void {
+    const char* fields[6];
+    const uint32_t numFields = splitLine(line, fields, 6);
+    edge e;
+    if (parseEdge(fields, numFields, numWords, &e)) {
+      buffers[t].push_back(e);
+    }
+  });
+  uint64_t edgeI = 0;
+  for (auto iter = buffers.begin(); iter != buffers.end(); ++iter) {
+    edgeI += iter->size();
+  }
+  fprintf(stderr, "  %lu edges loaded.\n", edgeI);
+  edge* edges;
+  uint64_t* edgeOffsets;
+  buildAdjacency(&buffers, numWords, numThreads, maxEdgesPerWord, maxEdgeCost,
+                 &edges, &edgeOffsets);
+  if (edgeOffsets[numWords] < edgeI) {
+    fprintf(stderr, "  %lu edges kept (at most %u per word, of cost <= %f).\n",
+            edgeOffsets[numWords], maxEdgesPerWord, maxEdgeCost);
+  }
+
+  // Read invalid deletions
+  GZLineReader invalidDeletionRows(PRIVATIVE_FILE);
+  btree::btree_set<tagged_word> invalidDeletions =
+    readInvalidDeletions(&invalidDeletionRows);
+  fprintf(stderr, "  %lu invalid deletions.\n", invalidDeletions.size());
+
+  // Finish
+  fprintf(stderr, "  done reading the graph (%lu seconds).\n",
+          (uint64_t) (time(NULL) - start));
+  return new InMemoryGraph(glosses, glossOffsets, edges, edgeOffsets,
+                           numWords, invalidDeletions, costBits);
+}
+
+/**
+ * Write count items of the given size to a graph image being written to
+ * tmpPath. If the write fails (e.g., the disk is full), removes the
+ * partial image and exits the program.
+ */
+void writeGraphImageData(FILE* file, const string& tmpPath, const void* data,
+                         const size_t& size, const size_t& count) {
+  if (fwrite(data, size, count, file) != count) {
+    fprintf(stderr, "Could not write graph image %s: %s\n",
+            tmpPath.c_str(), strerror(errno));
+    fclose(file);
+    unlink(tmpPath.c_str());
+    exit(1);
+  }
+}
+
+/**
+ * Write padding to the next 8 byte boundary; returns the new offset.
+ */
+uint64_t padGraphImage(FILE* file, const string& tmpPath, uint64_t offset) {
+  const char zeros[8] = { 0 };
+  const uint64_t padding = (8 - (offset % 8)) % 8;
+  writeGraphImageData(file, tmpPath, zeros, 1, padding);
+  return offset + padding;
+}
+
+//
+// writeGraphImage()
+//
+void writeGraphImage(const Graph& graph, const string& path,
+                     const uint8_t& costBits, const uint32_t& maxEdgesPerWord,
+                     const float& maxEdgeCost) {
+  // Write to a temporary file, so a running server never sees half an image
+  const string tmpPath = path + ".compiling";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open graph image for writing: %s\n",
+            tmpPath.c_str());
+    exit(1);
+  }
+  graph_image_header header;
+  memset(&header, 0, sizeof(graph_image_header));
+  header.magic = GRAPH_IMAGE_MAGIC;
+  header.version = GRAPH_IMAGE_VERSION;
+  header.edgeSize = sizeof(edge);
+  header.numWords = graph.vocabSize();
+  header.costBits = costBits;
+  header.maxEdgesPerWord = maxEdgesPerWord;
+  header.maxEdgeCost = maxEdgeCost;
+  writeGraphImageData(file, tmpPath, &header, sizeof(graph_image_header), 1);
+  uint64_t offset = sizeof(graph_image_header);
 
-  // Invalid deletions
-  fprintf(stderr, "  creating valid deletion iterator...\n");
-  GZIterator invalidDeletionIter = GZIterator(PRIVATIVE_FILE);
+  // Write the edge offsets
+  header.edgeOffsetsOffset = offset;
+  uint64_t edgeOffset = 0;
+  for (uint64_t w = 0; w < header.numWords; ++w) {
+    writeGraphImageData(file, tmpPath, &edgeOffset, sizeof(uint64_t), 1);
+    graph.forEachIncomingRun(w, [&edgeOffset](const edge_list& edges) -> void {
+      edgeOffset += edges.size();
+    });
+  }
+  writeGraphImageData(file, tmpPath, &edgeOffset, sizeof(uint64_t), 1);
+  header.numEdges = edgeOffset;
+  offset += (header.numWords + 1) * sizeof(uint64_t);
+
+  // Write the edges, in edgeOrder(), indexing their sense + type runs
+  // (copied field by field, so the padding in the image is zeroed)
+  header.edgesOffset = offset;
+  vector<uint64_t> runOffsets;
+  vector<graph_image_run> runs;
+  vector<edge> sinkEdges;
+  edgeOffset = 0;
+  for (uint64_t w = 0; w < header.numWords; ++w) {
+    sinkEdges.clear();
+    graph.forEachIncomingRun(w, [&sinkEdges](const edge_list& edges) -> void {
+      for (uint32_t i = 0; i < edges.size(); ++i) {
+        edge e;
+        memset(&e, 0, sizeof(edge));
+        e.source = edges.source(i);
+        e.source_sense = edges.sourceSense(i);
+        e.sink = edges.sink();
+        e.sink_sense = edges.sinkSense(i);
+        e.type = edges.type(i);
+        e.cost = edges.cost(i);
+        sinkEdges.push_back(e);
+      }
+    });
+    std::sort(sinkEdges.begin(), sinkEdges.end(), edgeOrder);
+    runOffsets.push_back(runs.size());
+    for (uint32_t i = 0; i < sinkEdges.size(); ++i) {
+      const uint8_t sense = sinkEdges[i].source_sense == 0
+        ? RUN_ANY_SENSE : sinkEdges[i].sink_sense;
+      if (runs.size() == runOffsets.back() || runs.back().sense != sense ||
+          runs.back().type != sinkEdges[i].type) {
+        graph_image_run run;
+        memset(&run, 0, sizeof(graph_image_run));
+        run.start = edgeOffset + i;
+        run.sense = sense;
+        run.type = sinkEdges[i].type;
+        runs.push_back(run);
+      }
+    }
+    writeGraphImageData(file, tmpPath, sinkEdges.data(), sizeof(edge),
+                        sinkEdges.size());
+    edgeOffset += sinkEdges.size();
+  }
+  runOffsets.push_back(runs.size());
+  offset = padGraphImage(file, tmpPath,
+                         offset + header.numEdges * sizeof(edge));
+
+  // Write the gloss offsets, then the glosses
+  header.glossOffsetsOffset = offset;
+  uint64_t glossOffset = 0;
+  for (uint64_t w = 0; w < header.numWords; ++w) {
+    writeGraphImageData(file, tmpPath, &glossOffset, sizeof(uint64_t), 1);
+    const char* gloss = graph.gloss((word) w);
+    if (strcmp(gloss, "<UNK>") != 0) {
+      glossOffset += strlen(gloss) + 1;
+    }
+  }
+  writeGraphImageData(file, tmpPath, &glossOffset, sizeof(uint64_t), 1);
+  header.glossBytes = glossOffset;
+  offset += (header.numWords + 1) * sizeof(uint64_t);
+  header.glossOffset = offset;
+  for (uint64_t w = 0; w < header.numWords; ++w) {
+    const char* gloss = graph.gloss((word) w);
+    if (strcmp(gloss, "<UNK>") != 0) {
+      writeGraphImageData(file, tmpPath, gloss, 1, strlen(gloss) + 1);
+    }
+  }
+  offset = padGraphImage(file, tmpPath, offset + header.glossBytes);
+
+  // Write the invalid deletions
+  header.invalidDeletionsOffset = offset;
+  const vector<tagged_word> invalidDeletions = graph.invalidDeletions();
+  header.numInvalidDeletions = invalidDeletions.size();
+  writeGraphImageData(file, tmpPath, invalidDeletions.data(),
+                      sizeof(tagged_word), invalidDeletions.size());
+  offset = padGraphImage(file, tmpPath,
+      offset + invalidDeletions.size() * sizeof(tagged_word));
 
-  // Invalid deletions
-  fprintf(stderr, "  reading the graph...\n");
-  return readGraph(numWords, &wordIter, &edgeIter, &invalidDeletionIter, false);
+  // Write the run index
+  header.runOffsetsOffset = offset;
+  writeGraphImageData(file, tmpPath, runOffsets.data(), sizeof(uint64_t),
+                      runOffsets.size());
+  offset += runOffsets.size() * sizeof(uint64_t);
+  header.runsOffset = offset;
+  header.numRuns = runs.size();
+  writeGraphImageData(file, tmpPath, runs.data(), sizeof(graph_image_run),
+                      runs.size());
+
+  // Write the header, and swap the image in
+  if (fseek(file, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "Could not write graph image %s: %s\n",
+            tmpPath.c_str(), strerror(errno));
+    fclose(file);
+    unlink(tmpPath.c_str());
+    exit(1);
+  }
+  writeGraphImageData(file, tmpPath, &header, sizeof(graph_image_header), 1);
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Could not finish writing graph image: %s\n",
+            tmpPath.c_str());
+    unlink(tmpPath.c_str());
+    exit(1);
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "Could not move graph image into place: %s\n",
+            path.c_str());
+    unlink(tmpPath.c_str());
+    exit(1);
+  }
+}
+
+/**
+ * Whether a section of count T's at the given offset of a graph image lies
+ * within the file (without overflowing), suitably aligned.
+ */
+template<typename T>
+bool graphImageSectionFits(const uint64_t& offset, const uint64_t& count,
+                           const uint64_t& fileSize) {
+  return offset % alignof(T) == 0 && offset <= fileSize &&
+         count <= (fileSize - offset) / sizeof(T);
+}
+
+/**
+ * Whether the (size + 1) offsets of a graph image index a section of the
+ * given length: starting at 0, never decreasing, and ending at length.
+ */
+bool graphImageOffsetsValid(const uint64_t* offsets, const uint64_t& size,
+                            const uint64_t& length) {
+  if (offsets[0] != 0 || offsets[size] != length) {
+    return false;
+  }
+  for (uint64_t w = 0; w < size; ++w) {
+    if (offsets[w] > offsets[w + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Whether the runs of each word of a graph image start at its first edge,
+ * strictly increase, and end within its edges; and have a valid type.
+ */
+bool graphImageRunsValid(const uint64_t* edgeOffsets,
+                         const uint64_t* runOffsets,
+                         const graph_image_run* runs,
+                         const uint64_t& size) {
+  for (uint64_t w = 0; w < size; ++w) {
+    for (uint64_t run = runOffsets[w]; run < runOffsets[w + 1]; ++run) {
+      const uint64_t start =
+        run == runOffsets[w] ? edgeOffsets[w] : runs[run - 1].start + 1;
+      if (runs[run].start < start || runs[run].start >= edgeOffsets[w + 1] ||
+          runs[run].type >= 8 * sizeof(edge_type_mask)) {
+        return false;
+      }
+    }
+    if (runOffsets[w] == runOffsets[w + 1] &&
+        edgeOffsets[w] != edgeOffsets[w + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Whether every edge of a graph image leads from a word in the vocabulary
+ * into the word it is stored under, and has a valid type.
+ */
+bool graphImageEdgesValid(const uint64_t* edgeOffsets, const edge* edges,
+                          const uint64_t& size) {
+  for (uint64_t w = 0; w < size; ++w) {
+    for (uint64_t i = edgeOffsets[w]; i < edgeOffsets[w + 1]; ++i) {
+      if (edges[i].source >= size || edges[i].sink != w ||
+          edges[i].type >= 8 * sizeof(edge_type_mask)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Whether the invalid deletions of a graph image are sorted, as
+ * containsDeletion() searches them.
+ */
+bool graphImageDeletionsSorted(const tagged_word* deletions,
+                               const uint64_t& count) {
+  for (uint64_t i = 1; i < count; ++i) {
+    if (deletions[i] < deletions[i - 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// tryReadGraphImage()
+//
+Graph* tryReadGraphImage(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open graph image %s!\n", path.c_str());
+    return NULL;
+  }
+  struct stat stats;
+  if (fstat(fd, &stats) != 0) {
+    fprintf(stderr, "Can't stat graph image %s!\n", path.c_str());
+    close(fd);
+    return NULL;
+  }
+  const uint64_t fileSize = stats.st_size;
+  if (fileSize < sizeof(graph_image_header)) {
+    fprintf(stderr, "Not a graph image: %s!\n", path.c_str());
+    close(fd);
+    return NULL;
+  }
+  void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping keeps the file open
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Could not mmap graph image %s!\n", path.c_str());
+    return NULL;
+  }
+  // (the whole graph is hot; start reading it in now)
+  madvise(mapping, fileSize, MADV_WILLNEED);
+
+  // Validate the header
+  const graph_image_header* header = (const graph_image_header*) mapping;
+  if (header->magic != GRAPH_IMAGE_MAGIC) {
+    fprintf(stderr, "Not a graph image: %s!\n", path.c_str());
+    munmap(mapping, fileSize);
+    return NULL;
+  }
+  if (header->version != GRAPH_IMAGE_VERSION ||
+      header->edgeSize != sizeof(edge)) {
+    fprintf(stderr, "Graph image %s was compiled by another version "
+                    "(version=%u, edgeSize=%u); rerun compile_graph\n",
+            path.c_str(), header->version, header->edgeSize);
+    munmap(mapping, fileSize);
+    return NULL;
+  }
+  // (every section is in the file, and every offset within its section)
+  const char* base = (const char*) mapping;
+  const uint64_t numWords = header->numWords;
+  if (numWords >= fileSize ||
+      !graphImageSectionFits<uint64_t>(header->edgeOffsetsOffset, numWords + 1, fileSize) ||
+      !graphImageSectionFits<edge>(header->edgesOffset, header->numEdges, fileSize) ||
+      !graphImageSectionFits<uint64_t>(header->glossOffsetsOffset, numWords + 1, fileSize) ||
+      !graphImageSectionFits<char>(header->glossOffset, header->glossBytes, fileSize) ||
+      !graphImageSectionFits<tagged_word>(header->invalidDeletionsOffset,
+                                          header->numInvalidDeletions, fileSize) ||
+      !graphImageSectionFits<uint64_t>(header->runOffsetsOffset, numWords + 1, fileSize) ||
+      !graphImageSectionFits<graph_image_run>(header->runsOffset, header->numRuns, fileSize) ||
+      !graphImageOffsetsValid((const uint64_t*) (base + header->edgeOffsetsOffset),
+                              numWords, header->numEdges) ||
+      !graphImageOffsetsValid((const uint64_t*) (base + header->glossOffsetsOffset),
+                              numWords, header->glossBytes) ||
+      !graphImageOffsetsValid((const uint64_t*) (base + header->runOffsetsOffset),
+                              numWords, header->numRuns) ||
+      !graphImageRunsValid((const uint64_t*) (base + header->edgeOffsetsOffset),
+                           (const uint64_t*) (base + header->runOffsetsOffset),
+                           (const graph_image_run*) (base + header->runsOffset),
+                           numWords) ||
+      !graphImageEdgesValid((const uint64_t*) (base + header->edgeOffsetsOffset),
+                            (const edge*) (base + header->edgesOffset),
+                            numWords) ||
+      !graphImageDeletionsSorted(
+        (const tagged_word*) (base + header->invalidDeletionsOffset),
+        header->numInvalidDeletions) ||
+      (header->glossBytes > 0 &&
+       base[header->glossOffset + header->glossBytes - 1] != '\0')) {
+    fprintf(stderr, "Corrupt graph image %s!\n", path.c_str());
+    munmap(mapping, fileSize);
+    return NULL;
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Mapped graph image (words=%lu edges=%lu)\n",
+          header->numWords, header->numEdges);
+  return new MMapGraph(mapping, fileSize, header);
+}
+
+//
+// readGraphImage()
+//
+Graph* readGraphImage(const string& path) {
+  Graph* graph = tryReadGraphImage(path);
+  if (graph == NULL) {
+    exit(1);
+  }
+  return graph;
+}
+
+//
+// graphImageMatches()
+//
+bool graphImageMatches(const string& path, const uint8_t& costBits,
+                       const uint32_t& maxEdgesPerWord,
+                       const float& maxEdgeCost) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  graph_image_header header;
+  const bool read = fread(&header, sizeof(graph_image_header), 1, file) == 1;
+  fclose(file);
+  return read &&
+         header.magic == GRAPH_IMAGE_MAGIC &&
+         header.version == GRAPH_IMAGE_VERSION &&
+         header.edgeSize == sizeof(edge) &&
+         header.costBits == costBits &&
+         header.maxEdgesPerWord == maxEdgesPerWord &&
+         header.maxEdgeCost == maxEdgeCost;
+}
+
+//
+// readSharedGraphImage()
+//
+Graph* readSharedGraphImage(const string& path,
+                            function<Graph*()> readTextGraph,
+                            const uint8_t& costBits,
+                            const uint32_t& maxEdgesPerWord,
+                            const float& maxEdgeCost) {
+  // (the lock is held while the image is built, so only one process does)
+  const string lockPath = path + ".lock";
+  const int lock = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+  if (lock < 0) {
+    fprintf(stderr, "WARNING: could not create %s; not sharing the graph\n",
+            lockPath.c_str());
+    return NULL;
+  }
+  if (flock(lock, LOCK_EX) != 0) {
+    fprintf(stderr, "WARNING: could not lock %s; not sharing the graph\n",
+            lockPath.c_str());
+    close(lock);
+    return NULL;
+  }
+  // (an image compiled with other settings, or before the text files were
+  // last changed, or which is corrupt, is rebuilt; processes which mapped
+  // it keep the old file until they unmap it)
+  Graph* image = NULL;
+  if (graphImageMatches(path, costBits, maxEdgesPerWord, maxEdgeCost) &&
+      !graphImageIsStale(path)) {
+    image = tryReadGraphImage(path);
+  }
+  if (image == NULL) {
+    printTime("[%c] ");
+    fprintf(stderr, "Building shared graph image %s...\n", path.c_str());
+    Graph* graph = readTextGraph();
+    writeGraphImage(*graph, path, costBits, maxEdgesPerWord, maxEdgeCost);
+    delete graph;
+    image = readGraphImage(path);
+  }
+  flock(lock, LOCK_UN);
+  close(lock);
+  return image;
+}
+
+/**
+ * The vocabulary of the mock graphs, as the rows of a vocab file.
+ */
+string mockVocab() {
+  return string(LEMUR_STR)  + "\tlemur\n"  +
+         string(ANIMAL_STR) + "\tanimal\n" +
+         string(POTTO_STR)  + "\tpotto\n"  +
+         string(CAT_STR)    + "\tcat\n"    +
+         string(HAVE_STR)   + "\thave\n"   +
+         string(TAIL_STR)   + "\ttail\n"   +
+         string(ALL_STR)    + "\tall\n"    +
+         string(FURRY_STR)  + "\tfurry\n";
+}
+
+/**
+ * A mock edge, as a row of the graph file.
+ */
+string mockEdge(const char* source, const char* sink,
+                const edge_type& type, const char* cost) {
+  char row[128];
+  snprintf(row, sizeof(row), "%s\t0\t%s\t0\t%u\t%s\n",
+           source, sink, (uint32_t) type, cost);
+  return string(row);
 }
 
 //
 // Read Dummy Graph
 //
-Graph* ReadMockGraph(const bool& allowCycles) {
-  const char* lemur[]  {LEMUR_STR,  "lemur" };  GZRow lemurRow(lemur, 2);
-  const char* animal[] {ANIMAL_STR, "animal" }; GZRow animalRow(animal, 2);
-  const char* potto[]  {POTTO_STR,  "potto" };  GZRow pottoRow(potto, 2);
-  const char* cat[]    {CAT_STR,    "cat" };    GZRow catRow(cat, 2);
-  const char* have[]   {HAVE_STR,   "have" };   GZRow haveRow(have, 2);
-  const char* tail[]   {TAIL_STR,   "tail" };   GZRow tailRow(tail, 2);
-  const char* all[]    {ALL_STR,    "all" };    GZRow allRow(all, 2);
-  const char* furry[]  {FURRY_STR,  "furry" };  GZRow furryRow(furry, 2);
-  GZRow words[]   { lemurRow, animalRow, pottoRow, catRow, haveRow, tailRow, allRow, furryRow };
-  MockGZIterator wordIter(8, words);
+Graph* ReadMockGraph(const bool& allowCycles, const uint8_t& costBits) {
+  GZLineReader words(mockVocab());
   
-  char hypo[8];
-  sprintf(hypo, "%d", HYPONYM);
-  char hyper[8];
-  sprintf(hyper, "%d", HYPERNYM);
-
-  const char* lemur2potto[]{LEMUR_STR,   "0", POTTO_STR,  "0", hypo, "0.01"  }; GZRow lemur2pottoRow(lemur2potto, 6);
-  const char* potto2lemur[]{POTTO_STR,   "0", LEMUR_STR,  "0", hyper, "0.01"  }; GZRow potto2lemurRow(potto2lemur, 6);
-  const char* lemur2animal[]{LEMUR_STR,  "0", ANIMAL_STR, "0", hyper, "0.42"  }; GZRow lemur2animalRow(lemur2animal, 6);
-  const char* animal2lemur[]{ANIMAL_STR, "0", LEMUR_STR,  "0", hypo, "0.42"  }; GZRow animal2lemurRow(animal2lemur, 6);
-  const char* animal2cat[]{  ANIMAL_STR, "0", CAT_STR,    "0", hypo, "42.00" }; GZRow animal2catRow(animal2cat, 6);
-  const char* cat2animal[]{  CAT_STR,    "0", ANIMAL_STR, "0", hyper, "42.00" }; GZRow cat2animalRow(cat2animal, 6);
-  GZRow edges[] = {cat2animalRow, cat2animalRow, cat2animalRow, cat2animalRow, cat2animalRow, cat2animalRow };
-  edges[0] = potto2lemurRow;
-  edges[1] = animal2lemurRow;
-  edges[2] = cat2animalRow;
+  string edgeText =
+    mockEdge(POTTO_STR,  LEMUR_STR,  HYPERNYM, "0.01") +
+    mockEdge(ANIMAL_STR, LEMUR_STR,  HYPONYM,  "0.42") +
+    mockEdge(CAT_STR,    ANIMAL_STR, HYPERNYM, "42.00");
   if (allowCycles) {
-    edges[3] = lemur2pottoRow;
-    edges[4] = lemur2animalRow;
-    edges[5] = animal2catRow;
+    edgeText +=
+      mockEdge(LEMUR_STR,  POTTO_STR,  HYPONYM,  "0.01") +
+      mockEdge(LEMUR_STR,  ANIMAL_STR, HYPERNYM, "0.42") +
+      mockEdge(ANIMAL_STR, CAT_STR,    HYPONYM,  "42.00");
   }
-  MockGZIterator edgeIter(allowCycles ? 6 : 3, edges);
+  GZLineReader edges(edgeText);
   
-  const char* invalidDeletions[]{HAVE_STR, "3"};
-  GZRow invalidDeletionsRow(invalidDeletions, 2); 
-  GZRow dels[]{ invalidDeletionsRow };
-  MockGZIterator invalidDeletionIter(1, dels);
+  GZLineReader invalidDeletions(string(HAVE_STR) + "\t3\n");
   
-  return readGraph(HIGHEST_MOCK_WORD_INDEX + 1, &wordIter, &edgeIter, 
-  & invalidDeletionIter, true);
+  return readGraph(HIGHEST_MOCK_WORD_INDEX + 1, &words, &edges, 
+                   &invalidDeletions, true, costBits, 0, 0.0f);
+}
+
+//
+// Read Dummy Graph (with the given edges)
+//
+Graph* ReadMockGraph(const vector<edge>& edges, const uint8_t& costBits,
+                     const uint32_t& maxEdgesPerWord,
+                     const float& maxEdgeCost) {
+  GZLineReader words(mockVocab());
+
+  string edgeText;
+  for (auto iter = edges.begin(); iter != edges.end(); ++iter) {
+    char row[128];
+    snprintf(row, sizeof(row), "%u\t%u\t%u\t%u\t%u\t%.9g\n",
+             iter->source, (uint32_t) iter->source_sense,
+             iter->sink, (uint32_t) iter->sink_sense,
+             (uint32_t) iter->type, iter->cost);
+    edgeText += row;
+  }
+  GZLineReader edgeRows(edgeText);
+  GZLineReader invalidDeletions(string(""));
+
+  return readGraph(HIGHEST_MOCK_WORD_INDEX + 1, &words, &edgeRows,
+                   &invalidDeletions, true, costBits, maxEdgesPerWord,
+                   maxEdgeCost);
 }
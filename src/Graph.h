@@ -3,8 +3,268 @@
 
 #include <config.h>
 #include "Types.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
 #include <vector>
 
+/**
+ * The magic number at the start of a compiled graph image ("NLIGRAPH" in
+ * little-endian order); see compile_graph.
+ */
+#define GRAPH_IMAGE_MAGIC 0x4850415247494c4eul
+/** The version of the graph image format written by writeGraphImage() */
+#define GRAPH_IMAGE_VERSION 3
+
+/** The sense of a run of edges which may be taken from any sense */
+#define RUN_ANY_SENSE 0xFF
+
+/**
+ * A run of the edges into a sink in a graph image: the edges of one type,
+ * into one sink sense (or into any sense); see edgeOrder().
+ */
+struct graph_image_run {
+  /** The index of the first edge of the run */
+  uint64_t start;
+  /** The sink sense of the run, or RUN_ANY_SENSE */
+  uint8_t sense;
+  edge_type type;
+  uint8_t padding[6];
+};
+
+/**
+ * The on-disk header of a compiled graph image. The file consists of this
+ * header, followed by these sections, each starting on an 8 byte boundary:
+ *
+ * <ul>
+ *   <li> (numWords + 1) uint64_t offsets into the edge array, such that
+ *        the edges into word w are edges[offsets[w]] .. edges[offsets[w+1]].
+ *   </li>
+ *   <li> numEdges edges, in the in-memory layout of struct edge (which must
+ *        be edgeSize bytes), sorted within each sink by edgeOrder(). </li>
+ *   <li> (numWords + 1) uint64_t offsets into the gloss blob; a word with
+ *        no gloss has an empty range. </li>
+ *   <li> The gloss blob: glossBytes of null terminated glosses. </li>
+ *   <li> numInvalidDeletions sorted tagged_words (with monotonicity
+ *        MONOTONE_DEFAULT) which may not be deleted. </li>
+ *   <li> (numWords + 1) uint64_t offsets into the run array, such that the
+ *        runs of word w are runs[runOffsets[w]] .. runs[runOffsets[w+1]].
+ *   </li>
+ *   <li> numRuns graph_image_runs, indexing the sense and type runs of
+ *        each sink's edges; a run ends where the next run of its sink (or
+ *        the sink's edges) begins. </li>
+ * </ul>
+ *
+ * The header also records the settings the graph was read with (see
+ * ReadTextGraph()), so that an image compiled with other settings is not
+ * served in place of the graph they configure. The costs of a graph read
+ * with costBits set are stored as their quantized values, so the image
+ * searches exactly as that graph does (though as full edges).
+ */
+struct graph_image_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t edgeSize;
+  uint64_t numWords;
+  uint64_t numEdges;
+  uint64_t glossBytes;
+  uint64_t numInvalidDeletions;
+  uint64_t edgeOffsetsOffset;
+  uint64_t edgesOffset;
+  uint64_t glossOffsetsOffset;
+  uint64_t glossOffset;
+  uint64_t invalidDeletionsOffset;
+  uint64_t numRuns;
+  uint64_t runOffsetsOffset;
+  uint64_t runsOffset;
+  uint32_t costBits;
+  uint32_t maxEdgesPerWord;
+  float maxEdgeCost;
+  uint32_t padding;
+};
+
+/**
+ * The number of low bits of a packed source word (see edge_list) holding
+ * the source word; the high byte holds a sense.
+ */
+#define PACKED_SOURCE_BITS 24
+/** The mask of the source word in a packed source word */
+#define PACKED_SOURCE_MASK ((0x1u << PACKED_SOURCE_BITS) - 1)
+
+/**
+ * A read-only view of the edges into a single sink. The fields of the
+ * edges are read through accessors, from arrays with a fixed stride per
+ * field; so, the same view serves packed parallel arrays (a structure of
+ * arrays, where the search loop only pulls the fields it checks into
+ * cache), plain arrays of struct edge, and runs of compact edges, where
+ * the fields shared by the whole run are stored once (with a stride of 0).
+ * The sink is the same for every edge in the list, and stored once.
+ */
+class edge_list {
+ public:
+  /** An empty list. */
+  edge_list()
+      : sinkWord(0), length(0), sources(NULL), sourceSenses(NULL),
+        sinkSenses(NULL), types(NULL), costs(NULL),
+        sourceMask(0xFFFFFFFF), costOffset(0.0f), costScale(0.0f),
+        sourceStride(0), sourceSenseStride(0), sinkSenseStride(0),
+        typeStride(0), costStride(0), costBits(0) { }
+
+  /**
+   * A view of packed parallel arrays of length elements each.
+   */
+  edge_list(const word& sink, const uint32_t& length,
+            const word* sources, const uint8_t* sourceSenses,
+            const uint8_t* sinkSenses, const edge_type* types,
+            const float* costs)
+      : sinkWord(sink), length(length),
+        sources((const char*) sources),
+        sourceSenses((const char*) sourceSenses),
+        sinkSenses((const char*) sinkSenses),
+        types((const char*) types), costs((const char*) costs),
+        sourceMask(0xFFFFFFFF), costOffset(0.0f), costScale(0.0f),
+        sourceStride(sizeof(word)), sourceSenseStride(sizeof(uint8_t)),
+        sinkSenseStride(sizeof(uint8_t)), typeStride(sizeof(edge_type)),
+        costStride(sizeof(float)), costBits(0) { }
+
+  /**
+   * A view of an array of edges, all into the given sink.
+   */
+  edge_list(const word& sink, const edge* edges, const uint32_t& length)
+      : sinkWord(sink), length(length),
+        sources((const char*) &edges->source),
+        sourceSenses((const char*) &edges->source_sense),
+        sinkSenses((const char*) &edges->sink_sense),
+        types((const char*) &edges->type), costs((const char*) &edges->cost),
+        sourceMask(0xFFFFFFFF), costOffset(0.0f), costScale(0.0f),
+        sourceStride(sizeof(edge)), sourceSenseStride(sizeof(edge)),
+        sinkSenseStride(sizeof(edge)), typeStride(sizeof(edge)),
+        costStride(sizeof(edge)), costBits(0) { }
+
+  /**
+   * A view of a run of compact edges, which share their type and one of
+   * their senses. Each edge is a packed source word, with the source in
+   * its low PACKED_SOURCE_BITS and the other sense in its high byte; and a
+   * cost quantized to costBits bits, read back as
+   * costOffset + code * costScale.
+   *
+   * @param anySense If true, the edges go into any sense of the sink: the
+   *                 run's sense is the source sense (i.e., 0), and the
+   *                 packed sense is the sink sense. Otherwise, the run's
+   *                 sense is the sink sense, and the packed sense is the
+   *                 source sense.
+   * @param sense The sense shared by the run.
+   * @param type The type shared by the run.
+   * @param codes The quantized costs; uint8_t or uint16_t, by costBits.
+   */
+  edge_list(const word& sink, const uint32_t& length,
+            const uint32_t* packedSources, const bool& anySense,
+            const uint8_t* sense, const edge_type* type,
+            const void* codes, const uint8_t& costBits,
+            const float& costOffset, const float& costScale)
+      : sinkWord(sink), length(length),
+        sources((const char*) packedSources),
+        // (the high byte of a little-endian packed word)
+        sourceSenses(anySense ? (const char*) sense
+                              : ((const char*) packedSources) + 3),
+        sinkSenses(anySense ? ((const char*) packedSources) + 3
+                            : (const char*) sense),
+        types((const char*) type), costs((const char*) codes),
+        sourceMask(PACKED_SOURCE_MASK),
+        costOffset(costOffset), costScale(costScale),
+        sourceStride(sizeof(uint32_t)),
+        sourceSenseStride(anySense ? 0 : sizeof(uint32_t)),
+        sinkSenseStride(anySense ? sizeof(uint32_t) : 0),
+        typeStride(0), costStride(costBits / 8), costBits(costBits) { }
+
+  /** The number of edges in the list. */
+  inline uint32_t size() const { return length; }
+  /** The word every edge in the list leads into. */
+  inline word sink() const { return sinkWord; }
+
+  inline word source(const uint32_t& i) const {
+    return *((const word*) (sources + i * sourceStride)) & sourceMask;
+  }
+  inline uint8_t sourceSense(const uint32_t& i) const {
+    return *((const uint8_t*) (sourceSenses + i * sourceSenseStride));
+  }
+  inline uint8_t sinkSense(const uint32_t& i) const {
+    return *((const uint8_t*) (sinkSenses + i * sinkSenseStride));
+  }
+  inline edge_type type(const uint32_t& i) const {
+    return *((const edge_type*) (types + i * typeStride));
+  }
+  /** The cost of the i'th edge, dequantized if need be. */
+  inline float cost(const uint32_t& i) const {
+    switch (costBits) {
+      case 8:
+        return costOffset + costScale * *((const uint8_t*) (costs + i));
+      case 16:
+        return costOffset + costScale * *((const uint16_t*) (costs + 2 * i));
+      default:
+        return *((const float*) (costs + i * costStride));
+    }
+  }
+
+  /** Reassemble the i'th edge in the list. */
+  inline edge operator[](const uint32_t& i) const {
+    edge e;
+    e.source = source(i);
+    e.source_sense = sourceSense(i);
+    e.sink = sinkWord;
+    e.sink_sense = sinkSense(i);
+    e.type = type(i);
+    e.cost = cost(i);
+    return e;
+  }
+
+ private:
+  word sinkWord;
+  uint32_t length;
+  const char* sources;
+  const char* sourceSenses;
+  const char* sinkSenses;
+  const char* types;
+  const char* costs;
+  /** The bits of the source field holding the source word */
+  uint32_t sourceMask;
+  /** Dequantizes the costs, if costBits is not 0 */
+  float costOffset;
+  float costScale;
+  /** The strides of each field; 0 for a field shared by every edge */
+  uint8_t sourceStride;
+  uint8_t sourceSenseStride;
+  uint8_t sinkSenseStride;
+  uint8_t typeStride;
+  uint8_t costStride;
+  /** The bits of a quantized cost (8 or 16), or 0 for float costs */
+  uint8_t costBits;
+};
+
+/**
+ * The most lists of edges returned by Graph::incomingEdgesFor(): a list of
+ * the edges into any sense, and of the edges into one sense, for each of
+ * the (at most 32) edge types.
+ */
+#define MAX_EDGE_RUNS 64
+
+/**
+ * The order in which the edges into a sink are searched: the order of
+ * edge::operator<, with ties broken on every other field, so that the order
+ * does not depend on the order the edges were read in.
+ */
+inline bool edgeCostOrder(const edge& a, const edge& b) {
+  if (a < b) { return true; }
+  if (b < a) { return false; }
+  if (a.source != b.source) { return a.source < b.source; }
+  if (a.source_sense != b.source_sense) { return a.source_sense < b.source_sense; }
+  if (a.sink_sense != b.sink_sense) { return a.sink_sense < b.sink_sense; }
+  if (a.type != b.type) { return a.type < b.type; }
+  return a.cost < b.cost;
+}
+
 /**
  * Represents the mutation graph, along with the word indexer.
  * That is, for any given query word, it returns the set of valid edges
@@ -21,27 +281,93 @@ class Graph {
    * TODO(gabor) this should not take a tagged word
    * 
    */
-  virtual const edge* incomingEdgesFast(const word& sink, uint32_t* outputLength) const = 0;
+  virtual edge_list incomingEdgesFast(const word& sink) const = 0;
+  /**
+   * Get the incoming edges into the given word which may be taken from
+   * the given sense of it (i.e., the edges where source_sense is 0, or
+   * sink_sense is the given sense), and which are of one of the given
+   * types. These are returned as at most MAX_EDGE_RUNS lists, each in
+   * edgeCostOrder(); a search visits them cheapest first by merging the
+   * lists.
+   *
+   * A graph which partitions its edges by sense and type returns exactly
+   * these edges, and never touches the others. This default implementation
+   * returns every edge into the sink as one list; so, callers must still
+   * check the sense and type of each edge.
+   *
+   * @param runs [output] The lists of edges; at least MAX_EDGE_RUNS long.
+   *
+   * @return The number of lists written to runs.
+   */
+  virtual uint32_t incomingEdgesFor(const word& sink, const uint8_t& /*sense*/,
+                                    const edge_type_mask& /*edgeTypes*/,
+                                    edge_list* runs) const {
+    runs[0] = incomingEdgesFast(sink);
+    return runs[0].size() > 0 ? 1 : 0;
+  }
+  /**
+   * The types of the edges into the given word; or, a superset of them
+   * (by default, every type). A search restricted to some edge types need
+   * not look at the edges of a word which has none of them.
+   */
+  virtual edge_type_mask incomingEdgeTypes(const word& /*sink*/) const {
+    return ALL_EDGE_TYPES;
+  }
+  /**
+   * Visit every edge into the given word, as one or more lists, in the
+   * layout the graph stores them in; e.g., to copy or invert the whole
+   * graph. Unlike incomingEdgesFast(), this never makes a copy of the
+   * edges. By default, visits incomingEdgesFast().
+   */
+  virtual void forEachIncomingRun(const word& sink,
+      std::function<void(const edge_list&)> visit) const {
+    visit(incomingEdgesFast(sink));
+  }
   /** For debugging, get the string form of the given word */
   virtual const char* gloss(const tagged_word&) const = 0;
   /** @see gloss(const tagged_word&) */
   inline const char* gloss(const word& w) const {
     return gloss(getTaggedWord(w, 0, 0));
   }
+  /**
+   * Find the word with the given gloss; e.g., to index text without the
+   * JavaBridge. If several words share the gloss, the lowest is found.
+   * This default implementation scans the vocabulary; the graphs read by
+   * ReadGraph() keep a hash index.
+   *
+   * @param gloss The gloss of the word, as returned by gloss().
+   * @param out [output] The word, if it was found.
+   *
+   * @return False if no word has this gloss.
+   */
+  virtual bool findWord(const char* gloss, word* out) const {
+    for (uint64_t w = 0; w < vocabSize(); ++w) {
+      const char* candidate = this->gloss((word) w);
+      if (strcmp(candidate, gloss) == 0 && strcmp(candidate, "<UNK>") != 0) {
+        *out = w;
+        return true;
+      }
+    }
+    return false;
+  }
   /** The set of all words in the graph, created as a vector */
   virtual const std::vector<word> keys() const = 0;
   /** Returns whether this edge is a valid deletion */
   virtual const bool containsDeletion(const edge& deletion) const = 0;
   /** Returns the vocabulary size */
   virtual const uint64_t vocabSize() const = 0;
+  /**
+   * The words which may not be deleted (i.e., the words for which
+   * containsDeletion() is false), in sorted order.
+   */
+  virtual const std::vector<tagged_word> invalidDeletions() const = 0;
 
   /** A helper to get the outgoing edges in a more reasonable form */
   virtual const std::vector<edge> incomingEdges(const tagged_word& sink) {
     std::vector<edge> rtn;
-    uint32_t length = 0;
-    const edge* edges = incomingEdgesFast(sink.word, &length);
-    for (int i = 0; i < length; ++i) {
-      if (edges[i].sink_sense == sink.sense) {
+    const edge_list edges = incomingEdgesFast(sink.word);
+    for (uint32_t i = 0; i < edges.size(); ++i) {
+      if (edges.sinkSense(i) == sink.sense) {
         rtn.push_back(edges[i]);
       }
     }
@@ -51,42 +377,93 @@ class Graph {
 
 /**
  * A Graph that also allows for looking up outgoing edges.
- * This class is far less optimized than its single directional 
- * counterpart
+ * The outgoing edges are the transpose of the incoming edges of the wrapped
+ * graph, built at construction into compressed sparse row arrays (with a
+ * parallel counting sort by source); so, a lookup either way is a slice of
+ * an array.
  */
 class BidirectionalGraph : public Graph {
  public:
-  BidirectionalGraph(const Graph* impl);
-  ~BidirectionalGraph() { 
-    delete impl;
+  /**
+   * Index the outgoing edges of a graph.
+   *
+   * @param impl The graph to wrap. This is now owned by the
+   *             BidirectionalGraph.
+   * @param numThreads The number of threads to build the index with; by
+   *                   default, one per core.
+   */
+  BidirectionalGraph(const Graph* impl,
+                     const uint32_t& numThreads =
+                       std::max(1u, std::thread::hardware_concurrency()));
+  ~BidirectionalGraph();
+
+  /**
+   * Get all outgoing edges from the given word.
+   * This function ignores the word sense of the source word; that must be
+   * checked by the caller of the function.
+   * The edges are sorted by sink, and then in edgeCostOrder().
+   *
+   * @param length [output] The number of outgoing edges.
+   *
+   * @return The first of the outgoing edges.
+   */
+  inline const edge* outgoingEdgesFast(const word& source,
+                                       uint64_t* length) const {
+    *length = outgoingOffsets[source + 1] - outgoingOffsets[source];
+    return outgoingEdgeData + outgoingOffsets[source];
   }
 
   /** Get all outgoing edges from a source. */
   const std::vector<edge> outgoingEdges(const tagged_word& source) const {
     std::vector<edge> rtn;
-    for (auto iter = outgoingEdgeData[source.word].begin(); iter != outgoingEdgeData[source.word].end(); ++iter) {
-      if (iter->source_sense == source.sense) {
-        rtn.push_back(*iter);
+    uint64_t length;
+    const edge* edges = outgoingEdgesFast(source.word, &length);
+    for (uint64_t i = 0; i < length; ++i) {
+      if (edges[i].source_sense == source.sense) {
+        rtn.push_back(edges[i]);
       }
     }
     return rtn;
   }
   
   /** {@inheritDoc} */
-  virtual const edge* incomingEdgesFast(const word& sink, uint32_t* outputLength) const {
-    return impl->incomingEdgesFast(sink, outputLength);
+  virtual edge_list incomingEdgesFast(const word& sink) const {
+    return impl->incomingEdgesFast(sink);
+  }
+  /** {@inheritDoc} */
+  virtual uint32_t incomingEdgesFor(const word& sink, const uint8_t& sense,
+                                    const edge_type_mask& edgeTypes,
+                                    edge_list* runs) const {
+    return impl->incomingEdgesFor(sink, sense, edgeTypes, runs);
+  }
+  /** {@inheritDoc} */
+  virtual edge_type_mask incomingEdgeTypes(const word& sink) const {
+    return impl->incomingEdgeTypes(sink);
+  }
+  /** {@inheritDoc} */
+  virtual void forEachIncomingRun(const word& sink,
+      std::function<void(const edge_list&)> visit) const {
+    impl->forEachIncomingRun(sink, visit);
   }
   /** {@inheritDoc} */
   virtual const char* gloss(const tagged_word& token) const {
     return impl->gloss(token);
   }
   /** {@inheritDoc} */
+  virtual bool findWord(const char* gloss, word* out) const {
+    return impl->findWord(gloss, out);
+  }
+  /** {@inheritDoc} */
   virtual const std::vector<word> keys() const { return impl->keys(); }
   /** {@inheritDoc} */
   virtual const bool containsDeletion(const edge& deletion) const {
     return impl->containsDeletion(deletion);
   }
   /** {@inheritDoc} */
+  virtual const std::vector<tagged_word> invalidDeletions() const {
+    return impl->invalidDeletions();
+  }
+  /** {@inheritDoc} */
   virtual const uint64_t vocabSize() const {
     return size;
   }
@@ -96,25 +473,161 @@ class BidirectionalGraph : public Graph {
 
  private:
   const uint64_t size;
-  std::vector<std::vector<edge>> outgoingEdgeData;
+  /** The outgoing edges of word w are at outgoingOffsets[w] .. [w+1] */
+  uint64_t* outgoingOffsets;
+  edge* outgoingEdgeData;
 };
 
 /**
  * Read the mutation graph. The actual Graph object returns depends on
  * various flags, optionally storing it in memory, RamCloud, etc.
+ * If shareImage is set, the first process to read the graph builds the
+ * image at imagePath for every process to share, and every process maps
+ * it (see readSharedGraphImage()). Otherwise, the image is memory mapped
+ * if it exists and was compiled with the configured GRAPH_* settings (see
+ * readGraphImage()); else, the graph is parsed from its text files.
+ *
+ * @param imagePath The path of the compiled graph image; or empty to
+ *                  always read the text files.
+ * @param shareImage If true, build the image if it is missing or stale.
+ */
+Graph* ReadGraph(const std::string& imagePath, const bool& shareImage);
+
+/**
+ * @see ReadGraph(std::string, bool), with the configured GRAPH_IMAGE and
+ * GRAPH_IMAGE_SHARED.
  */
 Graph* ReadGraph();
 
+/**
+ * Read the mutation graph from its text files (VOCAB_FILE, GRAPH_FILE and
+ * PRIVATIVE_FILE), into memory. Each file is inflated on one thread while
+ * numThreads threads parse it (see parallelForEachLine()), and the edges
+ * are then grouped by sink with a parallel counting sort.
+ *
+ * @param numThreads The number of threads to parse and sort with.
+ * @param costBits The bits to quantize each edge cost to (8 or 16), for a
+ *                 compact graph of 5 or 6 bytes per edge (plus about 10
+ *                 bytes per sense + type run of a word, as for the float
+ *                 layout); or 0 to keep the costs as floats. A quantized cost is within
+ *                 (max - min) / (2 * (2^costBits - 1)) of the original,
+ *                 where max and min are the largest and smallest costs of
+ *                 its edge type.
+ * @param maxEdgesPerWord The most edges to keep into each word, or 0 to
+ *                        keep every edge. The edges kept are those the
+ *                        search would visit first (see edgeCostOrder()).
+ * @param maxEdgeCost The largest cost of an edge to keep, or 0 to keep
+ *                    edges of any cost.
+ */
+Graph* ReadTextGraph(const uint32_t& numThreads,
+                     const uint8_t& costBits = GRAPH_COST_BITS,
+                     const uint32_t& maxEdgesPerWord = GRAPH_MAX_EDGES_PER_WORD,
+                     const float& maxEdgeCost = GRAPH_MAX_EDGE_COST);
+
+/**
+ * @see ReadTextGraph(uint32_t, uint8_t, uint32_t, float), with a thread per
+ * core, and the configured GRAPH_* options.
+ */
+Graph* ReadTextGraph();
+
+/**
+ * Write a graph as a compiled graph image, which can be read back by
+ * readGraphImage(). Exits the program if the file cannot be written.
+ *
+ * @param graph The graph to write.
+ * @param path The path of the image.
+ * @param costBits As given to ReadTextGraph() to read the graph.
+ * @param maxEdgesPerWord As given to ReadTextGraph() to read the graph.
+ * @param maxEdgeCost As given to ReadTextGraph() to read the graph.
+ */
+void writeGraphImage(const Graph& graph, const std::string& path,
+                     const uint8_t& costBits = GRAPH_COST_BITS,
+                     const uint32_t& maxEdgesPerWord = GRAPH_MAX_EDGES_PER_WORD,
+                     const float& maxEdgeCost = GRAPH_MAX_EDGE_COST);
+
+/**
+ * Check whether the file at the given path is a graph image of this
+ * version, compiled from a graph read with the given settings (see
+ * ReadTextGraph()).
+ *
+ * @return False if the image is missing, of another version, or was
+ *         compiled with other settings.
+ */
+bool graphImageMatches(const std::string& path,
+                       const uint8_t& costBits = GRAPH_COST_BITS,
+                       const uint32_t& maxEdgesPerWord = GRAPH_MAX_EDGES_PER_WORD,
+                       const float& maxEdgeCost = GRAPH_MAX_EDGE_COST);
+
+/**
+ * Memory map a compiled graph image, as written by writeGraphImage(). No
+ * part of the graph is parsed or copied; edges are served straight from
+ * the mapping. Exits the program if the file is not a valid image.
+ *
+ * @param path The path of the image.
+ */
+Graph* readGraphImage(const std::string& path);
+
+/**
+ * As readGraphImage(), but says why on stderr and returns NULL if the file
+ * is not a valid image, rather than exiting; e.g., to rebuild it.
+ *
+ * @param path The path of the image.
+ */
+Graph* tryReadGraphImage(const std::string& path);
+
+/**
+ * Memory map the graph image at the given path, building it first if it
+ * does not exist, was compiled with other settings (see
+ * graphImageMatches()), is older than GRAPH_FILE or VOCAB_FILE, or is not
+ * a valid image (see tryReadGraphImage()). A lock file beside the image
+ * (path + ".lock") makes sure only one process builds it: any others
+ * starting meanwhile wait, and then map the image it built. Since the mapping is read-only and shared, every
+ * process reads the same pages of the page cache; so, later processes start
+ * in about the time it takes to map the file, and the graph is held in RAM
+ * once however many processes map it. Put the image on a tmpfs (e.g.,
+ * /dev/shm) to hold it in shared memory rather than on disk.
+ *
+ * @param path The path of the image.
+ * @param readTextGraph Reads the graph to build the image from, with the
+ *                      given settings; e.g., ReadTextGraph().
+ * @param costBits As given to readTextGraph.
+ * @param maxEdgesPerWord As given to readTextGraph.
+ * @param maxEdgeCost As given to readTextGraph.
+ *
+ * @return The mapped graph, or NULL if the lock file could not be created
+ *         (e.g., the directory is read-only).
+ */
+Graph* readSharedGraphImage(const std::string& path,
+                            std::function<Graph*()> readTextGraph,
+                            const uint8_t& costBits = GRAPH_COST_BITS,
+                            const uint32_t& maxEdgesPerWord = GRAPH_MAX_EDGES_PER_WORD,
+                            const float& maxEdgeCost = GRAPH_MAX_EDGE_COST);
+
 
 /**
  * Create a simple, fake graph to use for debugging and testing.
  * At the time of writing this comment, it handled the facts
  * "lemur have tail", "animal have tail", and "cat have tail",
  * with appropriate edges defined
+ *
+ * @param costBits As in ReadTextGraph(); 0 to keep the costs as floats.
  */
-Graph* ReadMockGraph(const bool& allowCycles);
+Graph* ReadMockGraph(const bool& allowCycles, const uint8_t& costBits = 0);
 
 /** @see ReadMockGraph(false) */
 inline Graph* ReadMockGraph() { return ReadMockGraph(false); }
 
+/**
+ * Create a fake graph over the vocabulary of ReadMockGraph(), but with
+ * the given edges; e.g., to test edges between word senses.
+ *
+ * @param costBits As in ReadTextGraph(); 0 to keep the costs as floats.
+ * @param maxEdgesPerWord As in ReadTextGraph(); 0 to keep every edge.
+ * @param maxEdgeCost As in ReadTextGraph(); 0 to keep every edge.
+ */
+Graph* ReadMockGraph(const std::vector<edge>& edges,
+                     const uint8_t& costBits = 0,
+                     const uint32_t& maxEdgesPerWord = 0,
+                     const float& maxEdgeCost = 0.0f);
+
 #endif
@@ -5,7 +5,13 @@
 #include <signal.h>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <unistd.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include "NaturalLIIO.h"
 #include "SynSearch.h"
@@ -13,12 +19,212 @@
 
 using namespace std;
 
+/** The number of bytes of input to read at once in parallel mode */
+#define HASH_TREE_BLOCK_SIZE (4 * 1024 * 1024)
+
+/**
+ * Hash a single tree, as read by readTree(), appending the output line for
+ * it to the given buffer.
+ */
+void hashTree(Tree* sentence, string* output) {
+  char buffer[32];
+  if (sentence != NULL) {
+    if (sentence->length > 0) {
+      snprintf(buffer, sizeof(buffer), "%lu\n", sentence->hash());
+      output->append(buffer);
+    } else {
+      fprintf(stderr, "No sentence input!\n");
+      output->append("-1\n");
+    }
+    delete sentence;
+  } else {
+    fprintf(stderr, "Input is too long! skipping.\n");
+    output->append("-1\n");
+  }
+}
+
+/**
+ * Hash every tree in a block of input, appending the output line for each
+ * to the given buffer. A tree with a line too long for readTree() is
+ * reported and hashed as -1, and the rest of the block is read as usual.
+ */
+void hashBlock(const string& input, SynSearchCosts** costs,
+               vector<AlignmentSimilarity>* alignments,
+               syn_search_options* opts, string* output) {
+  istringstream stream(input);
+  while (stream.peek() != EOF && !stream.fail()) {
+    Tree* sentence = readTree(stream, costs, alignments, opts);
+    if (stream.fail() && !stream.eof()) {
+      // (readTree() stopped partway through a line; skip the rest of it,
+      //  and of its tree)
+      delete sentence;
+      stream.clear();
+      string line;
+      getline(stream, line);
+      while (getline(stream, line) && !line.empty()) { }
+      fprintf(stderr, "Input line is too long! skipping.\n");
+      output->append("-1\n");
+    } else {
+      hashTree(sentence, output);
+    }
+  }
+}
+
+/**
+ * A block of whole trees from the input, and the hashes of those trees
+ * once a worker has processed it.
+ */
+struct tree_block {
+  uint64_t sequence;
+  string input;
+  string output;
+};
+
+/**
+ * Hash trees in parallel. The main thread reads the input in large blocks,
+ * split on the blank lines between trees; a pool of workers parses and
+ * hashes each block; and a writer thread prints the hashes, either in
+ * input order, or in whatever order the blocks finish.
+ */
+void hashTreesInParallel(const uint32_t& numThreads, const bool& ordered) {
+  deque<tree_block*> pending;
+  map<uint64_t, tree_block*> finished;
+  uint64_t outstanding = 0;  // blocks read but not yet written
+  bool finishedReading = false;
+  mutex lock;
+  condition_variable changed;
+  const uint64_t maxOutstanding = 4 * numThreads;
+
+  // Workers
+  vector<thread> workers;
+  for (uint32_t t = 0; t < numThreads; ++t) {
+    workers.push_back(thread([&]() -> void {
+      SynSearchCosts* costs = intermediateNaturalLogicCosts();
+      vector<AlignmentSimilarity> alignments;
+      syn_search_options opts;
+      while (true) {
+        tree_block* block;
+        {
+          unique_lock<mutex> guard(lock);
+          changed.wait(guard, [&]() -> bool {
+            return finishedReading || !pending.empty();
+          });
+          if (pending.empty()) { break; }
+          block = pending.front();
+          pending.pop_front();
+        }
+        hashBlock(block->input, &costs, &alignments, &opts, &block->output);
+        {
+          lock_guard<mutex> guard(lock);
+          finished[block->sequence] = block;
+        }
+        changed.notify_all();
+      }
+      delete costs;
+    }));
+  }
+
+  // Writer
+  thread writer([&]() -> void {
+    uint64_t nextToWrite = 0;
+    while (true) {
+      tree_block* block;
+      {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&]() -> bool {
+          return (finishedReading && outstanding == 0) ||
+            (ordered ? finished.count(nextToWrite) > 0 : !finished.empty());
+        });
+        if (finished.empty()) { break; }
+        auto iter = ordered ? finished.find(nextToWrite) : finished.begin();
+        block = iter->second;
+        finished.erase(iter);
+      }
+      fwrite(block->output.data(), 1, block->output.size(), stdout);
+      delete block;
+      nextToWrite += 1;
+      {
+        lock_guard<mutex> guard(lock);
+        outstanding -= 1;
+      }
+      changed.notify_all();
+    }
+  });
+
+  // Reader
+  char* buffer = (char*) malloc(HASH_TREE_BLOCK_SIZE);
+  string carry = "";
+  uint64_t sequence = 0;
+  while (true) {
+    const size_t numRead = fread(buffer, 1, HASH_TREE_BLOCK_SIZE, stdin);
+    carry.append(buffer, numRead);
+    tree_block* block = new tree_block();
+    if (numRead == 0) {
+      if (carry.empty()) { delete block; break; }
+      block->input.swap(carry);  // (the last, possibly unterminated, tree)
+    } else {
+      // (cut after the last blank line, so the block holds whole trees)
+      const size_t blankLine = carry.rfind("\n\n");
+      if (blankLine == string::npos) {
+        delete block;
+        continue;  // (a very long tree; keep reading)
+      }
+      block->input = carry.substr(0, blankLine + 2);
+      carry.erase(0, blankLine + 2);
+    }
+    block->sequence = sequence;
+    sequence += 1;
+    {
+      unique_lock<mutex> guard(lock);
+      changed.wait(guard, [&]() -> bool {
+        return outstanding < maxOutstanding;
+      });
+      pending.push_back(block);
+      outstanding += 1;
+    }
+    changed.notify_all();
+  }
+  free(buffer);
+  {
+    lock_guard<mutex> guard(lock);
+    finishedReading = true;
+  }
+  changed.notify_all();
+  for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+    iter->join();
+  }
+  writer.join();
+  fflush(stdout);
+}
 
 /**
  * The Entry point for streaming dependency trees into candidate
  * facts.
+ *
+ * With --threads=n (n > 1), the input is read in large blocks, which are
+ * parsed and hashed by a pool of n worker threads. The hashes are written
+ * in input order, unless --unordered is given, in which case each block's
+ * hashes are written as soon as the block is done.
  */
 int32_t main( int32_t argc, char *argv[] ) {
+  uint32_t numThreads = 1;
+  bool ordered = true;
+  for (int32_t i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--threads=", 10) == 0) {
+      numThreads = max(1, atoi(argv[i] + 10));
+    } else if (strcmp(argv[i], "--unordered") == 0) {
+      ordered = false;
+    } else {
+      fprintf(stderr, "usage: hash_tree [--threads=n] [--unordered]\n");
+      exit(1);
+    }
+  }
+
+  if (numThreads > 1) {
+    hashTreesInParallel(numThreads, ordered);
+    return 0;
+  }
+
   while (!cin.fail()) {
     Tree* sentence = readTreeFromStdin();
     if (sentence != NULL) {
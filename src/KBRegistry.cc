@@ -0,0 +1,202 @@
+#include "KBRegistry.h"
+
+#include "LiveFactDB.h"
+#include "Utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * The suffixes of the files written beside a KB: its delta log and Bloom
+ * filter, and the temporary files of writeKB() and of the Graph image.
+ * These are never KBs themselves.
+ */
+static const char* SIDECAR_SUFFIXES[] = {
+  KB_DELTA_LOG_SUFFIX, BLOOM_FILTER_SUFFIX, ".lock", ".staging", ".writing",
+  ".merging", ".converting"
+};
+
+//
+// KBRegistry::KBRegistry()
+//
+KBRegistry::KBRegistry(const FactDB* defaultKB, const string& directory,
+                       function<const FactDB*(const string&)> loader)
+    : directory(directory), loader(loader) {
+  if (!this->loader) {
+    this->loader = [](const string& path) -> const FactDB* {
+      return readLiveKB(path);
+    };
+  }
+  entry* defaultEntry = new entry();
+  defaultEntry->kb = defaultKB;
+  // (mark it as loaded)
+  call_once(defaultEntry->loaded, []() -> void { });
+  entries[""] = defaultEntry;
+}
+
+//
+// KBRegistry::~KBRegistry()
+//
+KBRegistry::~KBRegistry() {
+  for (auto iter = entries.begin(); iter != entries.end(); ++iter) {
+    delete iter->second->kb.load();
+    delete iter->second;
+  }
+}
+
+//
+// KBRegistry::isValidName()
+//
+bool KBRegistry::isValidName(const string& name) {
+  if (name.empty() || name[0] == '.') {
+    return false;
+  }
+  for (auto iter = name.begin(); iter != name.end(); ++iter) {
+    const char c = *iter;
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.')) {
+      return false;
+    }
+  }
+  // (nor may it name a file beside a KB; e.g., a compaction's new base, or
+  // a spill file of the external sorter)
+  if (name.find(".compacting.") != string::npos ||
+      name.find(".run.") != string::npos) {
+    return false;
+  }
+  const uint32_t numSuffixes =
+    sizeof(SIDECAR_SUFFIXES) / sizeof(SIDECAR_SUFFIXES[0]);
+  for (uint32_t i = 0; i < numSuffixes; ++i) {
+    const uint64_t length = strlen(SIDECAR_SUFFIXES[i]);
+    if (name.length() >= length &&
+        name.compare(name.length() - length, length,
+                     SIDECAR_SUFFIXES[i]) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// KBRegistry::add()
+//
+void KBRegistry::add(const string& name, const string& path) {
+  if (!isValidName(name)) {
+    fprintf(stderr, "Invalid KB name: '%s'\n", name.c_str());
+    exit(1);
+  }
+  lock_guard<mutex> guard(lock);
+  if (entries.find(name) != entries.end()) {
+    fprintf(stderr, "KB registered twice: '%s'\n", name.c_str());
+    exit(1);
+  }
+  entry* added = new entry();
+  added->path = path;
+  added->kb = NULL;
+  entries[name] = added;
+}
+
+//
+// KBRegistry::addAll()
+//
+void KBRegistry::addAll(const string& namedFiles) {
+  uint64_t start = 0;
+  while (start < namedFiles.length()) {
+    uint64_t end = namedFiles.find(',', start);
+    if (end == string::npos) {
+      end = namedFiles.length();
+    }
+    const string namedFile = namedFiles.substr(start, end - start);
+    const uint64_t equals = namedFile.find('=');
+    if (equals == string::npos || equals + 1 == namedFile.length()) {
+      fprintf(stderr, "Expected name=path for a named KB; got '%s'\n",
+              namedFile.c_str());
+      exit(1);
+    }
+    const string name = namedFile.substr(0, equals);
+    add(name, namedFile.substr(equals + 1));
+    if (get(name) == NULL) {
+      fprintf(stderr, "Could not load the KB named '%s'\n", name.c_str());
+      exit(1);
+    }
+    start = end + 1;
+  }
+}
+
+//
+// KBRegistry::find()
+//
+KBRegistry::entry* KBRegistry::find(const string& name) {
+  lock_guard<mutex> guard(lock);
+  auto iter = entries.find(name);
+  if (iter != entries.end()) {
+    return iter->second;
+  }
+  // (load it on demand from the directory, if it's there)
+  if (directory.empty() || !isValidName(name)) {
+    return NULL;
+  }
+  const string path = directory + "/" + name;
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+    return NULL;
+  }
+  entry* found = new entry();
+  found->path = path;
+  found->kb = NULL;
+  entries[name] = found;
+  return found;
+}
+
+//
+// KBRegistry::get()
+//
+const FactDB* KBRegistry::get(const string& name) {
+  entry* found = find(name);
+  if (found == NULL) {
+    return NULL;
+  }
+  // (load outside of the lock, so other KBs are served in the meantime)
+  call_once(found->loaded, [this, &name, found]() -> void {
+    printTime("[%c] ");
+    fprintf(stderr, "Loading KB '%s' from %s\n", name.c_str(),
+            found->path.c_str());
+    // (a bad KB fails only the queries asking for it)
+    if (!isReadableKB(found->path)) {
+      fprintf(stderr, "WARNING: could not load KB '%s'\n", name.c_str());
+      return;
+    }
+    found->kb = loader(found->path);
+  });
+  return found->kb;
+}
+
+//
+// KBRegistry::isLoaded()
+//
+bool KBRegistry::isLoaded(const string& name) {
+  lock_guard<mutex> guard(lock);
+  auto iter = entries.find(name);
+  return iter != entries.end() && iter->second->kb != NULL;
+}
+
+//
+// KBRegistry::size()
+//
+uint64_t KBRegistry::size() {
+  lock_guard<mutex> guard(lock);
+  return entries.size();
+}
+
+//
+// readKBRegistry()
+//
+KBRegistry* readKBRegistry(const FactDB* defaultKB) {
+  KBRegistry* registry = new KBRegistry(defaultKB, string(KB_DIRECTORY));
+  registry->addAll(string(KB_NAMED_FILES));
+  return registry;
+}
@@ -0,0 +1,108 @@
+#ifndef KB_REGISTRY_H
+#define KB_REGISTRY_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "config.h"
+#include "FactDB.h"
+
+/**
+ * The knowledge bases served by one process, keyed by name. A query picks
+ * one with the "%kb = name" directive; queries which do not are run against
+ * the default KB, registered under the empty name. Every KB is searched
+ * against the same Graph, so a new KB costs only its own facts.
+ *
+ * KBs are either registered at startup, or loaded on demand the first time
+ * they are asked for, from the file of the same name in the registry's
+ * directory. A KB is loaded at most once, and then served until the
+ * registry is deleted. A KB which cannot be read is not loaded, and is not
+ * retried; queries asking for it are answered with an error.
+ */
+class KBRegistry {
+ public:
+  /**
+   * Create a registry.
+   *
+   * @param defaultKB The KB to serve to queries which do not name one.
+   *                  This is now owned by the registry.
+   * @param directory The directory to load unregistered KBs from on demand,
+   *                  or empty to only serve registered KBs.
+   * @param loader Reads the KB at the given path; readLiveKB() by default.
+   */
+  KBRegistry(const FactDB* defaultKB, const std::string& directory = "",
+             std::function<const FactDB*(const std::string&)> loader =
+                 NULL);
+  ~KBRegistry();
+
+  /**
+   * Register a KB under the given name, to be loaded from the given path
+   * when it is first asked for.
+   * Exits the program if the name is not a valid KB name, or is taken.
+   */
+  void add(const std::string& name, const std::string& path);
+
+  /**
+   * Register every KB in a comma separated list of name=path pairs (e.g.,
+   * KB_NAMED_FILES), and load them now.
+   * Exits the program if the list is malformed, or a KB cannot be read.
+   */
+  void addAll(const std::string& namedFiles);
+
+  /**
+   * Get the KB of the given name, loading it if need be; the empty name
+   * gets the default KB. Safe to call from many threads; only the threads
+   * asking for a KB which is being loaded wait for it.
+   *
+   * @return The KB, or NULL if there is no KB of that name, or it cannot
+   *         be read.
+   */
+  const FactDB* get(const std::string& name);
+
+  /** Returns true if the KB of the given name is registered and loaded. */
+  bool isLoaded(const std::string& name);
+
+  /** The number of registered KBs, including the default. */
+  uint64_t size();
+
+  /**
+   * Returns true if the given string may name a KB; i.e., it is not empty,
+   * is made only of letters, digits, '_', '-' and (not leading) '.', and
+   * does not name a file kept beside a KB (e.g., a delta log, a Bloom
+   * filter or a sort spill file). This keeps names from reaching outside
+   * the registry's directory, or at files which are not KBs.
+   */
+  static bool isValidName(const std::string& name);
+
+ private:
+  struct entry {
+    std::string path;
+    std::once_flag loaded;
+    /** Set once the KB is loaded */
+    std::atomic<const FactDB*> kb;
+  };
+
+  const std::string directory;
+  std::function<const FactDB*(const std::string&)> loader;
+  /** Guards the map itself; entries are never removed */
+  std::mutex lock;
+  std::map<std::string, entry*> entries;
+
+  /** Find or register the entry for a name; NULL if there is none. */
+  entry* find(const std::string& name);
+};
+
+/**
+ * Create the registry configured for this build: the given default KB,
+ * the KBs in KB_NAMED_FILES (loaded now), and, if KB_DIRECTORY is set,
+ * every KB in that directory on demand.
+ *
+ * @param defaultKB The KB to serve to queries which do not name one.
+ *                  This is now owned by the registry.
+ */
+KBRegistry* readKBRegistry(const FactDB* defaultKB);
+
+#endif
@@ -0,0 +1,546 @@
+#include "LiveFactDB.h"
+
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define CHUNK_SIZE 1048576
+
+/** The smallest power of two >= the given capacity (and at least 64). */
+uint64_t deltaCapacity(const uint64_t& requested) {
+  uint64_t capacity = 64;
+  while (capacity < requested) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+//
+// DeltaFactSet::DeltaFactSet()
+//
+DeltaFactSet::DeltaFactSet(const uint64_t& capacity)
+    : mask(deltaCapacity(capacity) - 1), count(0), hasZero(false) {
+  slots = new atomic<uint64_t>[mask + 1];
+  for (uint64_t i = 0; i <= mask; ++i) {
+    slots[i].store(0, memory_order_relaxed);
+  }
+}
+
+//
+// DeltaFactSet::~DeltaFactSet()
+//
+DeltaFactSet::~DeltaFactSet() {
+  delete[] slots;
+}
+
+//
+// DeltaFactSet::insert()
+//
+bool DeltaFactSet::insert(const uint64_t& fact) {
+  if (fact == 0) {
+    if (!hasZero.exchange(true, memory_order_acq_rel)) {
+      count.fetch_add(1, memory_order_acq_rel);
+    }
+    return true;
+  }
+  // (keep the table at most 3/4 full, so that probes stay short)
+  if (count.load(memory_order_acquire) >= ((mask + 1) / 4) * 3) {
+    return contains(fact);
+  }
+  uint64_t slot = hashSlot(fact);
+  while (true) {
+    uint64_t value = slots[slot].load(memory_order_acquire);
+    if (value == fact) {
+      return true;
+    }
+    if (value == 0) {
+      if (slots[slot].compare_exchange_strong(value, fact,
+                                              memory_order_acq_rel)) {
+        count.fetch_add(1, memory_order_acq_rel);
+        return true;
+      }
+      if (value == fact) {
+        return true;  // (someone else inserted it first)
+      }
+    }
+    slot = (slot + 1) & mask;
+  }
+}
+
+//
+// DeltaFactSet::sortedFacts()
+//
+void DeltaFactSet::sortedFacts(vector<uint64_t>* output) const {
+  const uint64_t begin = output->size();
+  if (hasZero.load(memory_order_acquire)) {
+    output->push_back(0);
+  }
+  for (uint64_t i = 0; i <= mask; ++i) {
+    const uint64_t value = slots[i].load(memory_order_acquire);
+    if (value != 0) {
+      output->push_back(value);
+    }
+  }
+  sort(output->begin() + begin, output->end());
+}
+
+//
+// LiveFactDB::LiveFactDB()
+//
+LiveFactDB::LiveFactDB(const string& path, const FactDB* base,
+                       const uint64_t& deltaLogOffset,
+                       const uint64_t& compactSize,
+                       const uint32_t& pollMillis)
+    : path(path), logPath(path + KB_DELTA_LOG_SUFFIX),
+      compactSize(compactSize), pollMillis(pollMillis),
+      logOffset(deltaLogOffset), logFd(-1), compacting(false),
+      stopping(false) {
+  snapshot* initial = new snapshot();
+  initial->base = base;
+  initial->frozen = NULL;
+  initial->active = new DeltaFactSet(KB_DELTA_INITIAL_CAPACITY);
+  current.store(initial, memory_order_release);
+  // (catch up on the log before serving)
+  poll();
+  if (pollMillis > 0) {
+    poller = thread([this]() -> void { pollLoop(); });
+  }
+}
+
+//
+// LiveFactDB::~LiveFactDB()
+//
+LiveFactDB::~LiveFactDB() {
+  {
+    lock_guard<mutex> guard(stopLock);
+    stopping = true;
+  }
+  stopSignal.notify_all();
+  if (poller.joinable()) {
+    poller.join();
+  }
+  if (compactor.joinable()) {
+    compactor.join();
+  }
+  lock_guard<mutex> guard(writeLock);
+  if (logFd >= 0) {
+    close(logFd);
+  }
+  reclaim(true);
+  snapshot* last = current.load(memory_order_acquire);
+  delete last->base;
+  delete last->frozen;
+  delete last->active;
+  delete last;
+}
+
+//
+// LiveFactDB::forEach()
+//
+void LiveFactDB::forEach(function<void(const uint64_t&)> callback) const {
+  const snapshot* s = current.load(memory_order_acquire);
+  vector<uint64_t> delta;
+  s->active->sortedFacts(&delta);
+  if (s->frozen != NULL) {
+    s->frozen->sortedFacts(&delta);
+    sort(delta.begin(), delta.end());
+  }
+  // (merge the delta into the base, dropping duplicates)
+  auto iter = delta.begin();
+  bool any = false;
+  uint64_t last = 0;
+  auto emit = [&callback, &any, &last](const uint64_t& fact) -> void {
+    if (!any || fact != last) {
+      callback(fact);
+      any = true;
+      last = fact;
+    }
+  };
+  s->base->forEach([&iter, &delta, &emit](const uint64_t& fact) -> void {
+    while (iter != delta.end() && *iter < fact) {
+      emit(*iter);
+      ++iter;
+    }
+    emit(fact);
+  });
+  while (iter != delta.end()) {
+    emit(*iter);
+    ++iter;
+  }
+}
+
+//
+// LiveFactDB::insert()
+//
+void LiveFactDB::insert(const uint64_t& fact) {
+  appendToDeltaLog(path, &fact, 1);
+  // If this races with a resize or compaction, the fact may land in a
+  // retired delta; it is then picked up again from the log on the next poll.
+  current.load(memory_order_acquire)->active->insert(fact);
+}
+
+//
+// LiveFactDB::poll()
+//
+void LiveFactDB::poll() {
+  lock_guard<mutex> guard(writeLock);
+  // (the log is kept open, so that a new log cannot reuse its inode)
+  struct stat pathStats;
+  struct stat stats;
+  if (stat(logPath.c_str(), &pathStats) == 0 &&
+      (logFd < 0 || fstat(logFd, &stats) != 0 ||
+       stats.st_ino != pathStats.st_ino || stats.st_dev != pathStats.st_dev)) {
+    if (logFd >= 0) {
+      // (the log was replaced; start over)
+      close(logFd);
+      logOffset = 0;
+    }
+    logFd = open(logPath.c_str(), O_RDONLY);
+  }
+  const int fd = logFd;
+  if (fd >= 0) {
+    fstat(fd, &stats);
+    const uint64_t logSize = stats.st_size;
+    if (logSize < logOffset) {
+      // (the log was truncated; start over)
+      logOffset = 0;
+    }
+    // (only read whole facts; a writer may be mid-append)
+    const uint64_t end = logSize - (logSize % sizeof(uint64_t));
+    uint64_t* buffer = (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t));
+    uint64_t numAdded = 0;
+    while (logOffset < end) {
+      const uint64_t toRead =
+        min(end - logOffset, (uint64_t) CHUNK_SIZE * sizeof(uint64_t));
+      const ssize_t numRead = pread(fd, buffer, toRead, logOffset);
+      if (numRead <= 0) {
+        break;
+      }
+      const uint64_t numFacts = numRead / sizeof(uint64_t);
+      for (uint64_t i = 0; i < numFacts; ++i) {
+        snapshot* s = current.load(memory_order_acquire);
+        if (!s->active->insert(buffer[i])) {
+          // (the delta is full; copy it into one twice the size)
+          DeltaFactSet* larger = new DeltaFactSet(2 * s->active->capacity());
+          vector<uint64_t> facts;
+          s->active->sortedFacts(&facts);
+          for (auto iter = facts.begin(); iter != facts.end(); ++iter) {
+            larger->insert(*iter);
+          }
+          larger->insert(buffer[i]);
+          snapshot* next = new snapshot();
+          next->base = s->base;
+          next->frozen = s->frozen;
+          next->active = larger;
+          publish(next, NULL, s->active);
+        }
+      }
+      logOffset += numFacts * sizeof(uint64_t);
+      numAdded += numFacts;
+    }
+    free(buffer);
+    if (numAdded > 0) {
+      printTime("[%c] ");
+      fprintf(stderr, "Read %lu new facts from %s\n",
+              numAdded, logPath.c_str());
+    }
+  }
+  reclaim(false);
+}
+
+/**
+ * Copy the delta log from the given offset to its end into a new log file.
+ * Returns false if the copy could not be written.
+ */
+bool copyLogTail(const int& log, const uint64_t& offset, const uint64_t& end,
+                 const string& path) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    return false;
+  }
+  uint64_t* buffer = (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t));
+  uint64_t position = offset;
+  bool ok = true;
+  while (ok && position < end) {
+    const uint64_t toRead =
+      min(end - position, (uint64_t) CHUNK_SIZE * sizeof(uint64_t));
+    const ssize_t numRead = pread(log, buffer, toRead, position);
+    ok = numRead > 0 &&
+         fwrite(buffer, 1, numRead, file) == (size_t) numRead;
+    position += max(numRead, (ssize_t) 0);
+  }
+  free(buffer);
+  return fclose(file) == 0 && ok;
+}
+
+//
+// LiveFactDB::compact()
+//
+bool LiveFactDB::compact() {
+  // Freeze the active delta; new facts go to a fresh delta from here on
+  uint64_t frozenOffset;
+  struct stat frozenLog;
+  bool frozenLogOpen;
+  const FactDB* base;
+  const DeltaFactSet* frozen;
+  {
+    lock_guard<mutex> guard(writeLock);
+    snapshot* s = current.load(memory_order_acquire);
+    if (s->frozen != NULL || !s->base->enumerable()) {
+      return false;
+    }
+    snapshot* next = new snapshot();
+    next->base = s->base;
+    next->frozen = s->active;
+    next->active = new DeltaFactSet(KB_DELTA_INITIAL_CAPACITY);
+    publish(next, NULL, NULL);
+    base = next->base;
+    frozen = next->frozen;
+    frozenOffset = logOffset;
+    frozenLogOpen = logFd >= 0 && fstat(logFd, &frozenLog) == 0;
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Compacting %lu new facts into %s...\n",
+          frozen->size(), path.c_str());
+
+  // Merge the base and the frozen delta into a new sorted KB
+  vector<uint64_t> delta;
+  frozen->sortedFacts(&delta);
+  const string tmpPath = path + ".compacting." + to_string(getpid());
+  SortedKBWriter writer(tmpPath);
+  auto iter = delta.begin();
+  base->forEach([&iter, &delta, &writer](const uint64_t& fact) -> void {
+    while (iter != delta.end() && *iter < fact) {
+      writer.append(*iter);
+      ++iter;
+    }
+    writer.append(fact);
+  });
+  while (iter != delta.end()) {
+    writer.append(*iter);
+    ++iter;
+  }
+  // (the log is rotated below, so the new base has read none of it)
+  writer.setDeltaLogOffset(0);
+  writer.close();
+
+  // Load the new base. We load it before renaming, so that it is certainly
+  // the file we wrote.
+  const FactDB* newBase = readKB(tmpPath);
+
+  // Move the new base into place, and rotate the facts it now holds out of
+  // the delta log. Appenders wait on the log's lock meanwhile; see
+  // appendToDeltaLog().
+  {
+    lock_guard<mutex> guard(writeLock);
+    const int lock = open(logPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+      fprintf(stderr, "WARNING: could not lock delta log %s\n",
+              logPath.c_str());
+    }
+    // (the log must still be the one frozenOffset is into)
+    struct stat lockStats;
+    const bool sameLog = lock >= 0 && fstat(lock, &lockStats) == 0 &&
+      (frozenLogOpen ? lockStats.st_ino == frozenLog.st_ino &&
+                       lockStats.st_dev == frozenLog.st_dev
+                     : frozenOffset == 0);
+    if (!sameLog) {
+      // (e.g., another process compacted the KB, and rotated the log, since
+      //  we froze the delta; its base has facts ours does not)
+      fprintf(stderr, "WARNING: the delta log of %s was replaced; "
+                      "not replacing the KB file\n", path.c_str());
+      unlink(tmpPath.c_str());
+      unlink((tmpPath + BLOOM_FILTER_SUFFIX).c_str());
+    } else {
+      const string rotatedPath = tmpPath + KB_DELTA_LOG_SUFFIX;
+      const bool rotated =
+        copyLogTail(lock, frozenOffset, lockStats.st_size, rotatedPath);
+      if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "WARNING: could not replace KB file %s\n",
+                path.c_str());
+        unlink(rotatedPath.c_str());
+      } else if (!rotated || rename(rotatedPath.c_str(), logPath.c_str()) != 0) {
+        // (a restart replays the whole log; that is only slower)
+        fprintf(stderr, "WARNING: could not rotate delta log %s\n",
+                logPath.c_str());
+        unlink(rotatedPath.c_str());
+      } else {
+        // (we now read the rotated log, from where we were in the old one)
+        if (logFd >= 0) {
+          close(logFd);
+        }
+        logFd = open(logPath.c_str(), O_RDONLY);
+        logOffset = logOffset >= frozenOffset ? logOffset - frozenOffset : 0;
+      }
+      rename((tmpPath + BLOOM_FILTER_SUFFIX).c_str(),
+             (path + BLOOM_FILTER_SUFFIX).c_str());
+    }
+    if (lock >= 0) {
+      flock(lock, LOCK_UN);
+      close(lock);
+    }
+
+    // Publish the new base
+    snapshot* s = current.load(memory_order_acquire);
+    snapshot* next = new snapshot();
+    next->base = newBase;
+    next->frozen = NULL;
+    next->active = s->active;
+    publish(next, s->base, s->frozen);
+  }
+  printTime("[%c] ");
+  fprintf(stderr, "Compacted %s (size=%lu)\n", path.c_str(), newBase->size());
+  return true;
+}
+
+//
+// LiveFactDB::publish()
+//
+void LiveFactDB::publish(snapshot* next, const FactDB* retiredBase,
+                         const DeltaFactSet* retiredDelta) {
+  snapshot* previous = current.exchange(next, memory_order_acq_rel);
+  retired_entry entry;
+  entry.retiredAt = time(NULL);
+  entry.view = previous;
+  entry.base = retiredBase;
+  entry.delta = retiredDelta;
+  retired.push_back(entry);
+}
+
+//
+// LiveFactDB::reclaim()
+//
+void LiveFactDB::reclaim(const bool& all) {
+  const time_t now = time(NULL);
+  auto iter = retired.begin();
+  while (iter != retired.end()) {
+    if (all || now - iter->retiredAt >= KB_RETIRE_DELAY_SECONDS) {
+      delete iter->view;
+      delete iter->base;
+      delete iter->delta;
+      iter = retired.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+//
+// LiveFactDB::pollLoop()
+//
+void LiveFactDB::pollLoop() {
+  unique_lock<mutex> lock(stopLock);
+  while (!stopping) {
+    stopSignal.wait_for(lock, chrono::milliseconds(pollMillis));
+    if (stopping) {
+      break;
+    }
+    lock.unlock();
+    poll();
+    // (start a compaction, if the delta is large enough)
+    if (compactSize > 0 && !compacting.load() &&
+        current.load(memory_order_acquire)->active->size() >= compactSize &&
+        enumerable()) {
+      if (compactor.joinable()) {
+        compactor.join();
+      }
+      compacting.store(true);
+      compactor = thread([this]() -> void {
+        compact();
+        compacting.store(false);
+      });
+    }
+    lock.lock();
+  }
+}
+
+//
+// Append to the delta log
+//
+void appendToDeltaLog(const string& path, const uint64_t* facts,
+                      const uint64_t& count) {
+  const string logPath = path + KB_DELTA_LOG_SUFFIX;
+  // (appenders share the log's lock; a compaction rotating the log, or a
+  //  new KB removing it, takes it exclusively. If the log was replaced
+  //  while we waited for the lock, append to the new log instead.)
+  int fd;
+  while (true) {
+    fd = open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0 || flock(fd, LOCK_SH) != 0) {
+      fprintf(stderr, "Can't open delta log %s!\n", logPath.c_str());
+      exit(1);
+    }
+    struct stat openStats;
+    struct stat pathStats;
+    if (fstat(fd, &openStats) == 0 && stat(logPath.c_str(), &pathStats) == 0 &&
+        openStats.st_ino == pathStats.st_ino &&
+        openStats.st_dev == pathStats.st_dev) {
+      break;
+    }
+    close(fd);
+  }
+  // (write whole chunks, so concurrent writers do not interleave facts)
+  uint64_t offset = 0;
+  while (offset < count) {
+    const uint64_t toWrite = min(count - offset, (uint64_t) CHUNK_SIZE);
+    const ssize_t written =
+      write(fd, facts + offset, toWrite * sizeof(uint64_t));
+    if (written != (ssize_t) (toWrite * sizeof(uint64_t))) {
+      fprintf(stderr, "Could not write to delta log %s!\n", logPath.c_str());
+      exit(1);
+    }
+    offset += toWrite;
+  }
+  close(fd);
+}
+
+//
+// Remove the delta log
+//
+void removeDeltaLog(const string& path) {
+  const string logPath = path + KB_DELTA_LOG_SUFFIX;
+  const int lock = open(logPath.c_str(), O_RDONLY);
+  if (lock < 0) {
+    return;  // (no log)
+  }
+  flock(lock, LOCK_EX);
+  unlink(logPath.c_str());
+  close(lock);
+}
+
+/**
+ * The number of bytes of the delta log already merged into a KB file.
+ */
+uint64_t readDeltaLogOffset(const string& path) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    return 0;
+  }
+  sorted_kb_header header;
+  uint64_t offset = 0;
+  if (fread(&header, sizeof(sorted_kb_header), 1, file) == 1 &&
+      header.magic == SORTED_KB_MAGIC) {
+    offset = header.deltaLogOffset;
+  }
+  fclose(file);
+  return offset;
+}
+
+//
+// Read a live KB from a file
+//
+LiveFactDB* readLiveKB(const string& path) {
+  const uint64_t deltaLogOffset = readDeltaLogOffset(path);
+  const FactDB* base = readKB(path);
+  return new LiveFactDB(path, base, deltaLogOffset, KB_DELTA_COMPACT_SIZE);
+}
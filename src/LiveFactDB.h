@@ -0,0 +1,267 @@
+#ifndef LIVE_FACT_DB_H
+#define LIVE_FACT_DB_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "FactDB.h"
+
+/**
+ * The suffix appended to a KB's path to get the path of its delta log.
+ * The delta log is a flat sequence of uint64_t fact hashes, appended to
+ * by writers (e.g., write_kb --append), and tailed by every LiveFactDB
+ * serving that KB.
+ */
+#define KB_DELTA_LOG_SUFFIX ".delta"
+/** The interval at which a LiveFactDB polls its delta log for new facts */
+#define KB_DELTA_POLL_MILLIS 1000
+/** The initial number of slots in a DeltaFactSet */
+#define KB_DELTA_INITIAL_CAPACITY 65536
+/**
+ * The number of seconds a LiveFactDB waits after a base KB or delta is
+ * replaced before freeing it. Readers never lock anything, so this must be
+ * (much) longer than any single lookup.
+ */
+#define KB_RETIRE_DELAY_SECONDS 60
+
+/**
+ * A fixed capacity, insert-only hash set of facts, which can be read and
+ * inserted into concurrently without locks. Facts are stored in an open
+ * addressing table of atomic words; a slot is claimed with a single
+ * compare-and-swap.
+ */
+class DeltaFactSet {
+ public:
+  /** Create an empty set; the capacity is rounded up to a power of two. */
+  DeltaFactSet(const uint64_t& capacity);
+  ~DeltaFactSet();
+
+  /**
+   * Insert a fact into the set. Returns false if the set is too full to
+   * take the fact, in which case it should be copied into a larger set.
+   */
+  bool insert(const uint64_t& fact);
+
+  /** Returns true if the fact is in the set. */
+  inline bool contains(const uint64_t& fact) const {
+    if (fact == 0) {
+      return hasZero.load(std::memory_order_acquire);
+    }
+    uint64_t slot = hashSlot(fact);
+    while (true) {
+      const uint64_t value = slots[slot].load(std::memory_order_acquire);
+      if (value == fact) { return true; }
+      if (value == 0) { return false; }
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  /** The number of facts in the set. */
+  inline uint64_t size() const {
+    return count.load(std::memory_order_acquire);
+  }
+  /** The number of slots in the set. */
+  inline uint64_t capacity() const { return mask + 1; }
+
+  /** Appends the facts in the set, in increasing order, to the given vector. */
+  void sortedFacts(std::vector<uint64_t>* output) const;
+
+ private:
+  std::atomic<uint64_t>* slots;
+  const uint64_t mask;
+  std::atomic<uint64_t> count;
+  /** 0 marks an empty slot, so the fact 0 is stored separately */
+  std::atomic<bool> hasZero;
+
+  inline uint64_t hashSlot(uint64_t h) const {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdul;
+    h ^= h >> 33;
+    return h & mask;
+  }
+};
+
+/**
+ * A knowledge base which can take new facts while it is serving lookups.
+ *
+ * A LiveFactDB is an immutable base KB (as read by readKB()), plus an
+ * in-memory DeltaFactSet of the facts appended to the KB's delta log
+ * (path + KB_DELTA_LOG_SUFFIX) since the base was written. A background
+ * thread tails the log. Once the delta grows past a threshold, it is frozen
+ * and merged with the base into a new sorted KB file on a second thread,
+ * which then replaces both the base file on disk and the base in memory.
+ * The facts merged into the new base are then rotated out of the log, so
+ * that it only holds the facts since; other processes tailing the log see
+ * it replaced, and read the rotated log from its start.
+ *
+ * The base and the deltas are published together as a single immutable
+ * snapshot, swapped atomically; readers take no locks and never wait on
+ * writers. Replaced snapshots are freed KB_RETIRE_DELAY_SECONDS later.
+ */
+class LiveFactDB : public FactDB {
+ public:
+  /**
+   * Start serving a live knowledge base.
+   *
+   * @param path The path of the base KB; the delta log is next to it.
+   * @param base The base KB, read from path. This is now owned by the
+   *             LiveFactDB.
+   * @param deltaLogOffset The number of bytes of the delta log already
+   *                       included in the base.
+   * @param compactSize The number of facts in the delta at which to
+   *                    compact it into a new base, or 0 to never compact.
+   * @param pollMillis The interval at which to poll the delta log, or 0 to
+   *                   only read it on calls to poll().
+   */
+  LiveFactDB(const std::string& path, const FactDB* base,
+             const uint64_t& deltaLogOffset, const uint64_t& compactSize,
+             const uint32_t& pollMillis = KB_DELTA_POLL_MILLIS);
+  ~LiveFactDB();
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    const snapshot* s = current.load(std::memory_order_acquire);
+    return s->active->contains(fact) ||
+           (s->frozen != NULL && s->frozen->contains(fact)) ||
+           s->base->contains(fact);
+  }
+  /** {@inheritDoc} */
+  virtual bool mayContain(const uint64_t& fact) const {
+    const snapshot* s = current.load(std::memory_order_acquire);
+    return s->active->contains(fact) ||
+           (s->frozen != NULL && s->frozen->contains(fact)) ||
+           s->base->mayContain(fact);
+  }
+  /** {@inheritDoc} */
+  virtual bool filteredContains(const uint64_t& fact, bool* rejected) const {
+    const snapshot* s = current.load(std::memory_order_acquire);
+    if (s->active->contains(fact) ||
+        (s->frozen != NULL && s->frozen->contains(fact))) {
+      *rejected = false;
+      return true;
+    }
+    return s->base->filteredContains(fact, rejected);
+  }
+  /**
+   * {@inheritDoc}
+   * This is approximate, as a fact may be counted in both the base and
+   * the delta.
+   */
+  virtual uint64_t size() const {
+    const snapshot* s = current.load(std::memory_order_acquire);
+    return s->base->size() + s->active->size() +
+      (s->frozen != NULL ? s->frozen->size() : 0);
+  }
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const;
+  /** {@inheritDoc} */
+  virtual bool enumerable() const {
+    return current.load(std::memory_order_acquire)->base->enumerable();
+  }
+
+  /**
+   * Add a fact to the knowledge base: append it to the delta log, and make
+   * it visible to lookups in this process immediately.
+   */
+  void insert(const uint64_t& fact);
+
+  /**
+   * Read any new facts in the delta log into the delta. This is called
+   * periodically by the background thread.
+   */
+  void poll();
+
+  /**
+   * Merge the current delta into a new base KB, replacing the base file.
+   * This is called on a background thread when the delta grows past the
+   * compaction threshold. Once the new base is in place, the merged facts
+   * are rotated out of the delta log. Returns false if the base cannot be
+   * compacted.
+   */
+  bool compact();
+
+ private:
+  /** An immutable view of the KB; readers see exactly one of these. */
+  struct snapshot {
+    const FactDB* base;
+    const DeltaFactSet* frozen;
+    DeltaFactSet* active;
+  };
+  /** A replaced snapshot, or part of one, awaiting deletion */
+  struct retired_entry {
+    time_t retiredAt;
+    snapshot* view;
+    const FactDB* base;
+    const DeltaFactSet* delta;
+  };
+
+  const std::string path;
+  const std::string logPath;
+  const uint64_t compactSize;
+  const uint32_t pollMillis;
+  std::atomic<snapshot*> current;
+  /** The number of bytes of the delta log read into the current snapshot */
+  uint64_t logOffset;
+  /**
+   * The open delta log which logOffset is into, or -1 until it exists. A
+   * log replaced by another file, even one grown past logOffset, is read
+   * again from the start.
+   */
+  int logFd;
+  /** Serializes writers: log polling, compaction and retirement */
+  std::mutex writeLock;
+  std::vector<retired_entry> retired;
+  std::thread poller;
+  std::thread compactor;
+  std::atomic<bool> compacting;
+  bool stopping;
+  std::mutex stopLock;
+  std::condition_variable stopSignal;
+
+  /** Publish a new snapshot. Must hold writeLock. */
+  void publish(snapshot* next, const FactDB* retiredBase,
+               const DeltaFactSet* retiredDelta);
+  /** Free retired snapshots past their delay. Must hold writeLock. */
+  void reclaim(const bool& all);
+  /** The background thread's loop. */
+  void pollLoop();
+};
+
+/**
+ * Appends facts to the delta log of the given KB, from where they are
+ * picked up by every LiveFactDB serving it.
+ * Exits the program if the log cannot be written.
+ *
+ * @param path The path of the KB (not of its delta log).
+ * @param facts The facts to append.
+ * @param count The number of facts to append.
+ */
+void appendToDeltaLog(const std::string& path, const uint64_t* facts,
+                      const uint64_t& count);
+
+/**
+ * Removes the delta log of the given KB; e.g., once a new KB has replaced
+ * it. Appenders waiting on the log start a new one.
+ *
+ * @param path The path of the KB (not of its delta log).
+ */
+void removeDeltaLog(const std::string& path);
+
+/**
+ * Reads a knowledge base with readKB(), and serves it as a LiveFactDB
+ * which follows the KB's delta log, compacting it into the base file
+ * every KB_DELTA_COMPACT_SIZE facts.
+ *
+ * @param path The path to the file.
+ *
+ * @return The facts in the knowledge base, including new facts as they
+ *         are added.
+ */
+LiveFactDB* readLiveKB(const std::string& path);
+
+#endif
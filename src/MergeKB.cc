@@ -0,0 +1,70 @@
+#include "FactDB.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+/** Print the usage of merge_kb, and exit */
+void usage() {
+  fprintf(stderr,
+    "usage: merge_kb [options] output input [input...]\n"
+    "  --union                Keep facts in any input (default)\n"
+    "  --intersect            Keep facts in every input\n"
+    "  --subtract             Keep facts in the first input, and no other\n"
+    "  --elias-fano           Write an Elias-Fano encoded KB\n"
+    "  --eytzinger            Write an Eytzinger layout KB\n"
+    "  --perfect-hash[=bits]  Write a perfect hash KB (8, 16 or 32 bits)\n");
+  exit(1);
+}
+
+/*
+ * Merges sorted KB files, as written by write_kb, into a single KB which
+ * can be read by readKB(string). The inputs are streamed from disk, so any
+ * number of KBs of any size can be merged; this lets KBs be built and
+ * maintained per source, and combined cheaply.
+ *
+ * By default, the output is the union of the inputs; with --intersect, it
+ * is their intersection, and with --subtract, it is the facts of the first
+ * input less those in any other input.
+ */
+int32_t main( int32_t argc, char *argv[] ) {
+  kb_merge_op op = KB_MERGE_UNION;
+  kb_format format = KB_FORMAT_SORTED;
+  uint32_t fingerprintBits = PERFECT_HASH_KB_FINGERPRINT_BITS;
+  int32_t i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+    if (strcmp(argv[i], "--union") == 0) {
+      op = KB_MERGE_UNION;
+    } else if (strcmp(argv[i], "--intersect") == 0) {
+      op = KB_MERGE_INTERSECTION;
+    } else if (strcmp(argv[i], "--subtract") == 0) {
+      op = KB_MERGE_DIFFERENCE;
+    } else if (strcmp(argv[i], "--elias-fano") == 0) {
+      format = KB_FORMAT_ELIAS_FANO;
+    } else if (strcmp(argv[i], "--eytzinger") == 0) {
+      format = KB_FORMAT_EYTZINGER;
+    } else if (strcmp(argv[i], "--perfect-hash") == 0) {
+      format = KB_FORMAT_PERFECT_HASH;
+    } else if (strncmp(argv[i], "--perfect-hash=", 15) == 0) {
+      format = KB_FORMAT_PERFECT_HASH;
+      fingerprintBits = atoi(argv[i] + 15);
+    } else {
+      usage();
+    }
+  }
+  if (argc - i < 2) {
+    usage();
+  }
+  const string filename = string(argv[i]);
+  vector<string> inputs;
+  for (i += 1; i < argc; ++i) {
+    inputs.push_back(string(argv[i]));
+  }
+
+  const uint64_t written =
+    mergeKBs(inputs, filename, op, format, fingerprintBits);
+  fprintf(stderr, "Wrote %lu unique facts (from %lu KBs) to %s\n",
+          written, inputs.size(), filename.c_str());
+}
@@ -282,6 +282,23 @@ bool parseMetadata(const char *rawLine, SynSearchCosts **costs,
     } else if (toSet == "skipNegationSearch") {
       opts->skipNegationSearch = to_bool(value);
       fprintf(stderr, "set skipNegationSearch to %u\n", to_bool(value));
+    } else if (toSet == "kb") {
+      opts->kbName = value;
+      fprintf(stderr, "set kb to '%s'\n", value.c_str());
+    } else if (toSet == "edgeTypes") {
+      // (the list may have spaces after its commas; take the rest of the line)
+      value = "";
+      for (uint64_t i = pmatch[2].rm_so; i < line.length(); ++i) {
+        if (line[i] != ' ') {
+          value.push_back(line[i]);
+        }
+      }
+      if (parseEdgeTypes(value, &opts->edgeTypes)) {
+        opts->invalidEdgeTypes = "";
+        fprintf(stderr, "set edgeTypes to '%s'\n", value.c_str());
+      } else {
+        opts->invalidEdgeTypes = value;
+      }
     } else if (toSet == "alignment") {
       if (alignments->size() < MAX_FUZZY_MATCHES) {
         alignments->push_back(parseAlignment(value));
@@ -324,6 +341,22 @@ bool parseMetadata(const char *rawLine, SynSearchCosts **costs,
 }
 
 
+//
+// unknownKBResponse()
+//
+string unknownKBResponse(const string& kbName) {
+  fprintf(stderr, "No such KB: '%s'\n", kbName.c_str());
+  return "{\"success\": false, \"reason\": \"no such KB\"}";
+}
+
+//
+// invalidEdgeTypesResponse()
+//
+string invalidEdgeTypesResponse(const string& edgeTypes) {
+  fprintf(stderr, "Invalid edge types: '%s'\n", edgeTypes.c_str());
+  return "{\"success\": false, \"reason\": \"invalid edge types\"}";
+}
+
 //
 // Sigmoid utility function
 //
@@ -354,7 +387,7 @@ bool existsSoftFalseJudgment(const float* ifTrue, const float* ifFalse, const fl
 //
 // executeQuery()
 //
-string executeQuery(const vector<Tree*> premises, const btree_set<uint64_t> *kb,
+string executeQuery(const vector<Tree*> premises, const FactDB *kb,
                     const Tree* query,
                     const Graph *graph, const SynSearchCosts *costs,
                     vector<AlignmentSimilarity> alignments,
@@ -362,7 +395,7 @@ string executeQuery(const vector<Tree*> premises, const btree_set<uint64_t> *kb,
                     double *truth) {
   // Create KB
   bool doAlignments = (alignments.size() == 0);
-  btree_set<uint64_t> auxKB;
+  PremiseKB auxKB;
   uint32_t factsInserted = 0;
   for (auto treeIter = premises.begin(); treeIter != premises.end();
        ++treeIter) {
@@ -373,7 +406,7 @@ string executeQuery(const vector<Tree*> premises, const btree_set<uint64_t> *kb,
 //    fprintf(stderr, "|KB| adding premise '%s'with hash: %lu\n", 
 //        toString(*premise, *graph).c_str(),
 //        hash);
-    auxKB.insert(hash);
+    auxKB.add(hash);
     factsInserted += 1;
     // align the tree
     if (doAlignments && alignments.size() < MAX_FUZZY_MATCHES) {
@@ -503,6 +536,15 @@ string executeQuery(const vector<Tree*> premises, const btree_set<uint64_t> *kb,
     *truth = 1.0;
   }
 
+  // Compute KB lookup statistics
+  const uint64_t kbLookups = resultIfTrue.kbLookups + resultIfFalse.kbLookups;
+  const uint64_t kbHits = resultIfTrue.kbHits + resultIfFalse.kbHits;
+  const uint64_t kbFilterRejects =
+    resultIfTrue.kbFilterRejects + resultIfFalse.kbFilterRejects;
+  const uint64_t kbMisses = kbLookups - kbHits;
+  const double kbFilterFalsePositiveRate = kbMisses == 0 ? 0.0
+    : ((double) (kbMisses - kbFilterRejects)) / ((double) kbMisses);
+
   // Generate JSON
   stringstream rtn;
   rtn << fixed
@@ -510,6 +552,11 @@ string executeQuery(const vector<Tree*> premises, const btree_set<uint64_t> *kb,
       << ", "
       << "\"totalTicks\": "
       << (resultIfTrue.totalTicks + resultIfFalse.totalTicks) << ", "
+      << "\"kbStats\": {"
+      << "\"lookups\": " << kbLookups << ", "
+      << "\"hits\": " << kbHits << ", "
+      << "\"filterRejects\": " << kbFilterRejects << ", "
+      << "\"filterFalsePositiveRate\": " << kbFilterFalsePositiveRate << "}, "
       << "\"truth\": " << (*truth) << ", "
       << "\"hardGuess\": \"" << (hardGuess) << "\", "
       << "\"softGuess\": \"" << (softGuess) << "\", "
@@ -630,17 +677,17 @@ string passOrFail(const double &truth, const bool &haveExpectedTruth,
 }
 
 //
-// readTreeFromStdin()
+// readTree()
 //
-Tree* readTreeFromStdin(SynSearchCosts** costs,
-                        vector<AlignmentSimilarity>* alignments,
-                        syn_search_options* opts) {
+Tree* readTree(istream& input, SynSearchCosts** costs,
+               vector<AlignmentSimilarity>* alignments,
+               syn_search_options* opts) {
   string conll = "";
   char line[256];
   char newline = '\n';
   uint32_t numLines = 0;
-  while (!cin.fail()) {
-    cin.getline(line, 255);
+  while (!input.fail()) {
+    input.getline(line, 255);
     if (line[0] == '#') {
       continue;
     }
@@ -660,6 +707,15 @@ Tree* readTreeFromStdin(SynSearchCosts** costs,
   }
 }
 
+//
+// readTreeFromStdin()
+//
+Tree* readTreeFromStdin(SynSearchCosts** costs,
+                        vector<AlignmentSimilarity>* alignments,
+                        syn_search_options* opts) {
+  return readTree(cin, costs, alignments, opts);
+}
+
 //
 // readTreeFromStdin()
 //
@@ -676,7 +732,7 @@ Tree* readTreeFromStdin() {
 // repl()
 //
 uint32_t repl(const Graph *graph, JavaBridge *proc,
-              const btree_set<uint64_t> *kb) {
+              KBRegistry *kbs) {
   uint32_t failedExamples = 0;
   SynSearchCosts* costs = intermediateNaturalLogicCosts();
   syn_search_options opts;
@@ -711,8 +767,10 @@ uint32_t repl(const Graph *graph, JavaBridge *proc,
       query = grokExpectedTruth(query, &haveExpectedTruth, &expectUnknown,
                                 &expectedTruth);
       // Run query
-      double truth;
-      string response =
+      double truth = 0.0;
+      const FactDB* kb = kbs->get(opts.kbName);
+      string response = kb == NULL ? unknownKBResponse(opts.kbName) :
+          !opts.invalidEdgeTypes.empty() ? invalidEdgeTypesResponse(opts.invalidEdgeTypes) :
           executeQuery(proc, kb, lines, query, graph, costs, alignments, opts, &truth);
       // Print
       fprintf(stderr, "\n");
@@ -735,7 +793,7 @@ uint32_t repl(const Graph *graph, JavaBridge *proc,
 //
 // repl (with trees)
 //
-uint32_t repl(const Graph *graph, const btree_set<uint64_t> *kb) {
+uint32_t repl(const Graph *graph, KBRegistry *kbs) {
   uint32_t failedExamples = 0;
   SynSearchCosts* costs = intermediateNaturalLogicCosts();
   syn_search_options opts;
@@ -763,8 +821,10 @@ uint32_t repl(const Graph *graph, const btree_set<uint64_t> *kb) {
       trees.pop_back();
       fprintf(stderr, "%lu premise trees read\n", trees.size());
       // Run query
-      double truth;
-      string response =
+      double truth = 0.0;
+      const FactDB* kb = kbs->get(opts.kbName);
+      string response = kb == NULL ? unknownKBResponse(opts.kbName) :
+          !opts.invalidEdgeTypes.empty() ? invalidEdgeTypesResponse(opts.invalidEdgeTypes) :
           executeQuery(trees, kb, query, graph, costs, alignments, opts, &truth);
       // Print
       fprintf(stderr, "\n");
@@ -831,7 +891,7 @@ void closeConnection(const uint32_t socket, sockaddr_in *client) {
 //
 // executeQuery() w/JavaBridge
 //
-string executeQuery(const JavaBridge *proc, const btree_set<uint64_t> *kb,
+string executeQuery(const JavaBridge *proc, const FactDB *kb,
                     const vector<string> &knownFacts, const string &query,
                     const Graph *graph, const SynSearchCosts *costs,
                     const vector<AlignmentSimilarity>& alignments,
@@ -918,7 +978,7 @@ ssize_t readLine(uint32_t fd, char *buf, size_t n) {
  */
 void handleConnection(const uint32_t &socket, sockaddr_in *client,
                       const JavaBridge *proc, const Graph *graph,
-                      const btree_set<uint64_t> *kb) {
+                      KBRegistry *kbs) {
 
   // Initialize options
   SynSearchCosts* costs = intermediateNaturalLogicCosts();
@@ -961,7 +1021,9 @@ void handleConnection(const uint32_t &socket, sockaddr_in *client,
                               &expectedTruth);
     knownFacts.pop_back();
     double truth = 0.0;
-    string json =
+    const FactDB* kb = kbs->get(opts.kbName);
+    string json = kb == NULL ? unknownKBResponse(opts.kbName) :
+        !opts.invalidEdgeTypes.empty() ? invalidEdgeTypesResponse(opts.invalidEdgeTypes) :
         executeQuery(proc, kb, knownFacts, query, graph, costs, alignments, opts, &truth);
     uint32_t failedExamples = 0;
     string passFail =
@@ -980,7 +1042,7 @@ void handleConnection(const uint32_t &socket, sockaddr_in *client,
 // startServer
 //
 bool startServer(const uint32_t &port, const JavaBridge *proc,
-                 const Graph *graph, const btree_set<uint64_t> *kb) {
+                 const Graph *graph, KBRegistry *kbs) {
   // Get hostname, for debugging
   char hostname[256];
   gethostname(hostname, 256);
@@ -1100,7 +1162,7 @@ bool startServer(const uint32_t &port, const JavaBridge *proc,
             inet_ntoa(clientAddress->sin_addr), ntohs(clientAddress->sin_port));
 
     std::thread t(handleConnection, requestSocket, clientAddress, proc, graph,
-                  kb);
+                  kbs);
     t.detach();
   }
 
@@ -1,9 +1,12 @@
 #ifndef NaturalLI_H
 #define NaturalLI_H
 
+#include <istream>
+
 #include "config.h"
 #include "SynSearch.h"
 #include "JavaBridge.h"
+#include "KBRegistry.h"
 
 #define MEM_ENV_VAR "MAXMEM_GB"
 
@@ -23,7 +26,11 @@ void init();
 
 /**
  * Parse a metadata line, returning false if the line didn't match any
- * known directives.
+ * known directives. For example, "%kb = name" runs the query against the
+ * KB of that name, rather than the default KB; and "%edgeTypes = -nn,-similar"
+ * keeps the search from mutating along NN or SIMILAR edges (see
+ * parseEdgeTypes()). An invalid list of edge types is still a directive;
+ * it is recorded in opts->invalidEdgeTypes, and the query is rejected.
  */
 bool parseMetadata(const char *rawLine, SynSearchCosts *costs,
                    std::vector<AlignmentSimilarity>* alignments,
@@ -47,7 +54,7 @@ bool parseMetadata(const char *rawLine, SynSearchCosts *costs,
  *
  * @return A JSON formatted response with the result of the search.
  */
-std::string executeQuery(const std::vector<Tree*> premises, const btree::btree_set<uint64_t> *kb,
+std::string executeQuery(const std::vector<Tree*> premises, const FactDB *kb,
                          const std::vector<std::string> &knownFacts, const std::string &query,
                          const Graph *graph, const SynSearchCosts *costs,
                          const std::vector<AlignmentSimilarity>& alignments,
@@ -57,19 +64,41 @@ std::string executeQuery(const std::vector<Tree*> premises, const btree::btree_s
 /**
  * Execute a query using the java bridge to annotate the trees.
  */
-std::string executeQuery(const JavaBridge *proc, const btree::btree_set<uint64_t> *kb,
+std::string executeQuery(const JavaBridge *proc, const FactDB *kb,
                          const std::vector<std::string> &knownFacts, const std::string &query,
                          const Graph *graph, const SynSearchCosts *costs,
                          const std::vector<AlignmentSimilarity>& alignments,
                          const syn_search_options &options,
                          double *truth);
 
+/**
+ * The JSON response to a query which selected a KB (with "%kb = name")
+ * which is not being served.
+ */
+std::string unknownKBResponse(const std::string& kbName);
+
+/**
+ * The JSON response to a query which set an invalid list of edge types
+ * (with "%edgeTypes = ...").
+ */
+std::string invalidEdgeTypesResponse(const std::string& edgeTypes);
+
 /**
  * Reads a tree from standard input, where the standard input is
  * already a CoNLL representation of the tree.
  */
 Tree* readTreeFromStdin();
 
+/**
+ * Reads a tree from the given stream, where the stream is already a CoNLL
+ * representation of the tree, terminated by a blank line.
+ * This method additionally parses optional metadata passed in along with
+ * the tree. Returns NULL if the tree is too long.
+ */
+Tree* readTree(std::istream& input, SynSearchCosts** costs,
+               std::vector<AlignmentSimilarity>* alignments,
+               syn_search_options* opts);
+
 /**
  * Reads a tree from standard input, where the standard input is
  * already a CoNLL representation of the tree.
@@ -89,22 +118,24 @@ Tree* readTreeFromStdin(SynSearchCosts* costs,
  *
  * @param graph The graph containing the edge instances we can traverse.
  * @param proc The preprocessor to use during the search.
- * @param kb The main [i.e., large] knowledge base to use, possibly empty.
+ * @param kbs The main [i.e., large] knowledge bases to use, by name; each
+ *            query runs against the default KB unless it selects another.
  *
  * @return The number of failed examples, if any were annotated. 0 by default.
  */
 uint32_t repl(const Graph *graph, JavaBridge *proc,
-              const btree::btree_set<uint64_t> *kb);
+              KBRegistry *kbs);
 
 /**
- * @see repl(Graph* JavaBridge* btree::btree_set<uint64_t>)
+ * @see repl(Graph* JavaBridge* KBRegistry*)
  */
-uint32_t repl(const Graph *graph, const btree::btree_set<uint64_t> *kb);
+uint32_t repl(const Graph *graph, KBRegistry *kbs);
 
 /**
- * Set up listening on a server port.
+ * Set up listening on a server port. Every connection shares the one graph,
+ * and the KBs in the registry.
  */
 bool startServer(const uint32_t &port, const JavaBridge *proc,
-                 const Graph *graph, const btree::btree_set<uint64_t> *kb);
+                 const Graph *graph, KBRegistry *kbs);
 
 #endif
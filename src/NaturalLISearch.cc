@@ -3,6 +3,8 @@
 #include <thread>
 
 #include "FactDB.h"
+#include "KBRegistry.h"
+#include "LiveFactDB.h"
 
 using namespace std;
 using namespace btree;
@@ -14,27 +16,29 @@ using namespace btree;
 int32_t main(int32_t argc, char *argv[]) {
   init();
 
-  // Read the knowledge base
-  const btree_set<uint64_t> *kb;
+  // Read the knowledge base, and follow its delta log for new facts
+  const FactDB *kb;
   if (KB_FILE[0] != '\0') {
-    kb = readKB(string(KB_FILE));
+    kb = readLiveKB(string(KB_FILE));
   } else {
-    kb = new btree_set<uint64_t>;
+    kb = new BTreeFactDB();
     fprintf(stderr,
             "No knowledge base given (configure with KB_FILE=/path/to/kb)\n");
   }
+  // (and any named KBs, which queries select with '%kb = name')
+  KBRegistry *kbs = readKBRegistry(kb);
 
   // Load graph
   Graph *graph = ReadGraph();
 
 //  // Start server
-//  std::thread t(startServer, SERVER_PORT, proc, graph, kb);
+//  std::thread t(startServer, SERVER_PORT, proc, graph, kbs);
 //  t.detach();
 
   // Start REPL
-  uint32_t retVal = repl(graph, kb);
-//  delete graph;  // TODO(gabor) this causes a seg fault? Harmless, but maybe points to some memory bug.
-  delete kb;
+  uint32_t retVal = repl(graph, kbs);
+  delete graph;
+  delete kbs;
   return retVal;
 }
  
@@ -0,0 +1,375 @@
+#include "NumaFactDB.h"
+
+#include "Utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sched.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+thread_local numa_thread_state numaThreadState = { 0, 0, 0 };
+
+//
+// Parse a sysfs CPU list
+//
+vector<uint32_t> parseCpuList(const string& list) {
+  vector<uint32_t> cpus;
+  const char* cursor = list.c_str();
+  while (*cursor != '\0' && *cursor != '\n') {
+    char* end;
+    const uint32_t first = strtoul(cursor, &end, 10);
+    uint32_t last = first;
+    if (end == cursor) {
+      break;  // (not a number)
+    }
+    if (*end == '-') {
+      cursor = end + 1;
+      last = strtoul(cursor, &end, 10);
+    }
+    for (uint32_t cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    cursor = (*end == ',') ? end + 1 : end;
+  }
+  return cpus;
+}
+
+//
+// Read the NUMA topology
+//
+numa_topology readNumaTopology(const string& root) {
+  numa_topology topology;
+  for (uint32_t node = 0; ; ++node) {
+    ifstream file(root + "/node" + to_string(node) + "/cpulist");
+    if (!file.is_open()) {
+      break;
+    }
+    string list;
+    getline(file, list);
+    topology.nodeCpus.push_back(parseCpuList(list));
+  }
+  if (topology.nodeCpus.empty()) {
+    // (not NUMA; one node with every CPU)
+    vector<uint32_t> cpus;
+    for (uint32_t cpu = 0; cpu < max(1u, thread::hardware_concurrency());
+         ++cpu) {
+      cpus.push_back(cpu);
+    }
+    topology.nodeCpus.push_back(cpus);
+  }
+  for (uint32_t node = 0; node < topology.nodeCpus.size(); ++node) {
+    const vector<uint32_t>& cpus = topology.nodeCpus[node];
+    for (auto iter = cpus.begin(); iter != cpus.end(); ++iter) {
+      if (*iter >= topology.cpuNode.size()) {
+        topology.cpuNode.resize(*iter + 1, 0);
+      }
+      topology.cpuNode[*iter] = node;
+    }
+  }
+  return topology;
+}
+
+//
+// NumaShardedFactDB::NumaShardedFactDB()
+//
+NumaShardedFactDB::NumaShardedFactDB(const FactDB* kb,
+                                     const uint32_t& shardBits,
+                                     const uint32_t& hotShards,
+                                     const numa_topology& topology,
+                                     const uint32_t& rebalanceSeconds)
+    : topology(topology), numNodes(topology.nodeCpus.size()),
+      shardShift(64 - min(16u, max(1u, shardBits))),
+      numShards(0x1ul << (64 - shardShift)),
+      hotShards(numNodes > 1 ? hotShards : 0),
+      rebalanceSeconds(rebalanceSeconds), count(0),
+      home(numShards, NULL), replicated(numShards, false), stopping(false) {
+  // Read the facts
+  if (!kb->enumerable()) {
+    fprintf(stderr, "Cannot shard a KB which cannot list its facts!\n");
+    exit(1);
+  }
+  uint64_t* facts = (uint64_t*) malloc(max(1ul, kb->size()) * sizeof(uint64_t));
+  kb->forEach([facts, this](const uint64_t& fact) -> void {
+    facts[count] = fact;
+    count += 1;
+  });
+  delete kb;
+  // (the facts are sorted, so each shard is a contiguous range)
+  vector<uint64_t> begin(numShards + 1, count);
+  for (uint64_t i = count; i > 0; --i) {
+    begin[facts[i - 1] >> shardShift] = i - 1;
+  }
+  for (uint64_t shard = numShards; shard > 0; --shard) {
+    begin[shard - 1] = min(begin[shard - 1], begin[shard]);
+  }
+
+  // Place the shards; each node takes a contiguous range of shards
+  vector<thread> loaders;
+  for (uint32_t node = 0; node < numNodes; ++node) {
+    loaders.push_back(onNode(node, [this, node, facts, &begin]() -> void {
+      for (uint64_t shard = node * numShards / numNodes;
+           shard < (node + 1) * numShards / numNodes; ++shard) {
+        home[shard] = placeShard(facts + begin[shard],
+                                 begin[shard + 1] - begin[shard], node);
+      }
+    }));
+  }
+  for (auto iter = loaders.begin(); iter != loaders.end(); ++iter) {
+    iter->join();
+  }
+  free(facts);
+
+  // Route every node to the home copies
+  routes = new atomic<const fact_shard*>[numNodes * numShards];
+  heat = new atomic<uint64_t>[numNodes * numShards];
+  for (uint32_t node = 0; node < numNodes; ++node) {
+    for (uint64_t shard = 0; shard < numShards; ++shard) {
+      routes[node * numShards + shard].store(home[shard],
+                                             memory_order_relaxed);
+      heat[node * numShards + shard].store(0, memory_order_relaxed);
+    }
+  }
+  atomic_thread_fence(memory_order_release);
+  printTime("[%c] ");
+  fprintf(stderr, "Sharded KB (size=%lu) into %lu shards over %u NUMA nodes\n",
+          count, numShards, numNodes);
+
+  if (this->hotShards > 0 && rebalanceSeconds > 0) {
+    rebalancer = thread([this]() -> void { rebalanceLoop(); });
+  }
+}
+
+//
+// NumaShardedFactDB::~NumaShardedFactDB()
+//
+NumaShardedFactDB::~NumaShardedFactDB() {
+  {
+    lock_guard<mutex> guard(stopLock);
+    stopping = true;
+  }
+  stopSignal.notify_all();
+  if (rebalancer.joinable()) {
+    rebalancer.join();
+  }
+  lock_guard<mutex> guard(writeLock);
+  reclaim(true);
+  for (uint32_t node = 0; node < numNodes; ++node) {
+    for (uint64_t shard = 0; shard < numShards; ++shard) {
+      const fact_shard* copy = routes[node * numShards + shard].load();
+      if (copy != home[shard]) {
+        freeShard((fact_shard*) copy);
+      }
+    }
+  }
+  for (auto iter = home.begin(); iter != home.end(); ++iter) {
+    freeShard(*iter);
+  }
+  delete[] routes;
+  delete[] heat;
+}
+
+//
+// NumaShardedFactDB::forEach()
+//
+void NumaShardedFactDB::forEach(
+    function<void(const uint64_t&)> callback) const {
+  for (auto iter = home.begin(); iter != home.end(); ++iter) {
+    for (uint64_t i = 0; i < (*iter)->count; ++i) {
+      callback((*iter)->facts[i]);
+    }
+  }
+}
+
+//
+// NumaShardedFactDB::isReplicated()
+//
+bool NumaShardedFactDB::isReplicated(const uint64_t& shard) const {
+  for (uint32_t node = 0; node < numNodes; ++node) {
+    const fact_shard* copy =
+      routes[node * numShards + shard].load(memory_order_acquire);
+    if (copy->node != node) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// NumaShardedFactDB::rebalance()
+//
+void NumaShardedFactDB::rebalance() {
+  lock_guard<mutex> guard(writeLock);
+  reclaim(false);
+  if (hotShards == 0) {
+    return;
+  }
+
+  // Find the shards read most from remote nodes
+  // (halving the counts, so that old lookups fade out)
+  vector<pair<uint64_t, uint64_t>> remoteHeat;
+  for (uint64_t shard = 0; shard < numShards; ++shard) {
+    uint64_t remote = 0;
+    for (uint32_t node = 0; node < numNodes; ++node) {
+      atomic<uint64_t>& counter = heat[node * numShards + shard];
+      const uint64_t sampled = counter.load(memory_order_relaxed);
+      counter.fetch_sub(sampled - sampled / 2, memory_order_relaxed);
+      if (node != home[shard]->node) {
+        remote += sampled;
+      }
+    }
+    if (remote > 0) {
+      remoteHeat.push_back(make_pair(remote, shard));
+    }
+  }
+  const uint64_t numHot = min((uint64_t) hotShards, remoteHeat.size());
+  partial_sort(remoteHeat.begin(), remoteHeat.begin() + numHot,
+               remoteHeat.end(), greater<pair<uint64_t, uint64_t>>());
+  vector<bool> hot(numShards, false);
+  for (uint64_t i = 0; i < numHot; ++i) {
+    hot[remoteHeat[i].second] = true;
+  }
+
+  // Drop the replicas of shards which have cooled off
+  const time_t now = time(NULL);
+  for (uint64_t shard = 0; shard < numShards; ++shard) {
+    if (!replicated[shard] || hot[shard]) {
+      continue;
+    }
+    for (uint32_t node = 0; node < numNodes; ++node) {
+      const fact_shard* copy =
+        routes[node * numShards + shard].exchange(home[shard],
+                                                  memory_order_acq_rel);
+      if (copy != home[shard]) {
+        retired_shard entry;
+        entry.retiredAt = now;
+        entry.copy = (fact_shard*) copy;
+        retired.push_back(entry);
+      }
+    }
+    replicated[shard] = false;
+  }
+
+  // Replicate newly hot shards onto every node
+  vector<thread> copiers;
+  for (uint32_t node = 0; node < numNodes; ++node) {
+    copiers.push_back(onNode(node, [this, node, &hot]() -> void {
+      for (uint64_t shard = 0; shard < numShards; ++shard) {
+        if (hot[shard] && !replicated[shard] && home[shard]->node != node) {
+          routes[node * numShards + shard].store(
+            placeShard(home[shard]->facts, home[shard]->count, node),
+            memory_order_release);
+        }
+      }
+    }));
+  }
+  for (auto iter = copiers.begin(); iter != copiers.end(); ++iter) {
+    iter->join();
+  }
+  for (uint64_t shard = 0; shard < numShards; ++shard) {
+    if (hot[shard]) {
+      replicated[shard] = true;
+    }
+  }
+}
+
+//
+// NumaShardedFactDB::refreshCpu()
+//
+void NumaShardedFactDB::refreshCpu(numa_thread_state* state) {
+  const int cpu = sched_getcpu();
+  state->cpu = cpu < 0 ? 0 : cpu;
+  state->untilRefresh = KB_NUMA_CPU_REFRESH_INTERVAL;
+}
+
+//
+// NumaShardedFactDB::placeShard()
+//
+NumaShardedFactDB::fact_shard* NumaShardedFactDB::placeShard(
+    const uint64_t* facts, const uint64_t& count, const uint32_t& node) {
+  fact_shard* shard = new fact_shard();
+  shard->count = count;
+  shard->node = node;
+  shard->mapping = NULL;
+  shard->mappingSize = count * sizeof(uint64_t);
+  shard->facts = NULL;
+  if (count > 0) {
+    // (fresh anonymous pages are placed on the node that first writes them)
+    shard->mapping = mmap(NULL, shard->mappingSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (shard->mapping == MAP_FAILED) {
+      fprintf(stderr, "Could not allocate a KB shard of %lu facts!\n", count);
+      exit(1);
+    }
+    memcpy(shard->mapping, facts, shard->mappingSize);
+    shard->facts = (const uint64_t*) shard->mapping;
+  }
+  return shard;
+}
+
+//
+// NumaShardedFactDB::freeShard()
+//
+void NumaShardedFactDB::freeShard(fact_shard* shard) {
+  if (shard->mapping != NULL) {
+    munmap(shard->mapping, shard->mappingSize);
+  }
+  delete shard;
+}
+
+//
+// NumaShardedFactDB::onNode()
+//
+thread NumaShardedFactDB::onNode(const uint32_t& node,
+                                 function<void()> fn) const {
+  const vector<uint32_t> cpus = topology.nodeCpus[node];
+  return thread([cpus, fn]() -> void {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (auto iter = cpus.begin(); iter != cpus.end(); ++iter) {
+      if (*iter < CPU_SETSIZE) {
+        CPU_SET(*iter, &mask);
+      }
+    }
+    if (!cpus.empty() && sched_setaffinity(0, sizeof(cpu_set_t), &mask) != 0) {
+      fprintf(stderr, "WARNING: could not pin a thread to its NUMA node\n");
+    }
+    fn();
+  });
+}
+
+//
+// NumaShardedFactDB::reclaim()
+//
+void NumaShardedFactDB::reclaim(const bool& all) {
+  const time_t now = time(NULL);
+  auto iter = retired.begin();
+  while (iter != retired.end()) {
+    if (all || now - iter->retiredAt >= KB_NUMA_RETIRE_DELAY_SECONDS) {
+      freeShard(iter->copy);
+      iter = retired.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+//
+// NumaShardedFactDB::rebalanceLoop()
+//
+void NumaShardedFactDB::rebalanceLoop() {
+  unique_lock<mutex> lock(stopLock);
+  while (!stopping) {
+    stopSignal.wait_for(lock, chrono::seconds(rebalanceSeconds));
+    if (stopping) {
+      break;
+    }
+    lock.unlock();
+    rebalance();
+    lock.lock();
+  }
+}
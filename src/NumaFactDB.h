@@ -0,0 +1,209 @@
+#ifndef NUMA_FACT_DB_H
+#define NUMA_FACT_DB_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "FactDB.h"
+
+/** The interval at which a NumaShardedFactDB re-picks its hot shards */
+#define KB_NUMA_REBALANCE_SECONDS 60
+/**
+ * Each thread counts one in every this many of its lookups towards the
+ * heat of the shard it looked up; the counters are shared, so counting
+ * every lookup would bounce their cache lines between cores.
+ */
+#define KB_NUMA_SAMPLE_INTERVAL 64
+/** Each thread re-checks which CPU it is running on every this many lookups */
+#define KB_NUMA_CPU_REFRESH_INTERVAL 4096
+/**
+ * The number of seconds a NumaShardedFactDB waits after dropping a replica
+ * before freeing it; see KB_RETIRE_DELAY_SECONDS.
+ */
+#define KB_NUMA_RETIRE_DELAY_SECONDS 60
+
+/** The NUMA nodes of the machine, and the CPUs on each. */
+struct numa_topology {
+  /** For each node, the CPUs on that node */
+  std::vector<std::vector<uint32_t>> nodeCpus;
+  /** For each CPU, the node that it is on */
+  std::vector<uint32_t> cpuNode;
+};
+
+/**
+ * Parses a CPU list as found in sysfs; e.g., "0-3,8,10-11".
+ */
+std::vector<uint32_t> parseCpuList(const std::string& list);
+
+/**
+ * Reads the NUMA topology of the machine from sysfs. If the machine is not
+ * NUMA (or sysfs is not available), this is a single node with every CPU.
+ *
+ * @param root The sysfs directory with the node<i>/cpulist files.
+ */
+numa_topology readNumaTopology(
+    const std::string& root = "/sys/devices/system/node");
+
+/** A thread's cached view of where it is running; see NumaShardedFactDB. */
+struct numa_thread_state {
+  uint32_t cpu;
+  uint32_t untilRefresh;
+  uint32_t untilSample;
+};
+extern thread_local numa_thread_state numaThreadState;
+
+/**
+ * A knowledge base partitioned by the high bits of the fact hash into
+ * shards, which are spread across the NUMA nodes of the machine. Each
+ * shard is a sorted array, written by a thread pinned to its node so that
+ * its pages are placed in that node's memory on first touch.
+ *
+ * Every node has a routing table from shard to the copy of the shard that
+ * threads on that node should read. Initially, this is the shard's home
+ * copy. If hotShards is nonzero, lookups are sampled, and every
+ * rebalanceSeconds the hotShards shards most read from remote nodes are
+ * replicated onto every node, so that lookups into them are local. Shards
+ * which have cooled off are routed back to their home copy.
+ *
+ * Lookups take no locks: a thread finds its node from its (cached) CPU,
+ * and reads the routing table entry for the shard atomically.
+ */
+class NumaShardedFactDB : public FactDB {
+ public:
+  /**
+   * Partition a knowledge base into shards.
+   *
+   * @param kb The knowledge base to partition; it must be enumerable. It is
+   *           deleted once it has been copied into the shards.
+   * @param shardBits The number of high bits of the fact hash to shard on;
+   *                  there are 2^shardBits shards. Between 1 and 16.
+   * @param hotShards The number of hot shards to replicate on every node,
+   *                  or 0 to never replicate.
+   * @param topology The NUMA nodes to place the shards on.
+   * @param rebalanceSeconds The interval at which to re-pick the hot
+   *                         shards, or 0 to only do so on rebalance().
+   */
+  NumaShardedFactDB(const FactDB* kb, const uint32_t& shardBits,
+                    const uint32_t& hotShards, const numa_topology& topology,
+                    const uint32_t& rebalanceSeconds =
+                      KB_NUMA_REBALANCE_SECONDS);
+  ~NumaShardedFactDB();
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const {
+    const uint64_t shard = fact >> shardShift;
+    const uint64_t route = localNode() * numShards + shard;
+    if (hotShards > 0) {
+      numa_thread_state& state = numaThreadState;
+      if (state.untilSample == 0) {
+        state.untilSample = KB_NUMA_SAMPLE_INTERVAL;
+        heat[route].fetch_add(1, std::memory_order_relaxed);
+      }
+      state.untilSample -= 1;
+    }
+    const fact_shard* copy = routes[route].load(std::memory_order_acquire);
+    return std::binary_search(copy->facts, copy->facts + copy->count, fact);
+  }
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return count; }
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const;
+
+  /**
+   * Re-pick the hot shards from the lookups sampled since the last call:
+   * replicate newly hot shards onto every node, and drop the replicas of
+   * shards which are no longer hot. This is called periodically by the
+   * background thread.
+   */
+  void rebalance();
+
+  /** The number of shards. */
+  inline uint64_t shards() const { return numShards; }
+  /** The shard a fact is stored in. */
+  inline uint64_t shardOf(const uint64_t& fact) const {
+    return fact >> shardShift;
+  }
+  /** The node holding the home copy of the given shard. */
+  inline uint32_t homeNode(const uint64_t& shard) const {
+    return home[shard]->node;
+  }
+  /** Whether the given shard is currently replicated on every node. */
+  bool isReplicated(const uint64_t& shard) const;
+
+ private:
+  /** A copy of a shard, placed in the memory of one node. */
+  struct fact_shard {
+    const uint64_t* facts;
+    uint64_t count;
+    uint32_t node;
+    void* mapping;
+    uint64_t mappingSize;
+  };
+  /** A dropped replica, awaiting deletion */
+  struct retired_shard {
+    time_t retiredAt;
+    fact_shard* copy;
+  };
+
+  const numa_topology topology;
+  const uint32_t numNodes;
+  const uint32_t shardShift;
+  const uint64_t numShards;
+  const uint32_t hotShards;
+  const uint32_t rebalanceSeconds;
+  uint64_t count;
+  /** The home copy of each shard */
+  std::vector<fact_shard*> home;
+  /** For each node, for each shard, the copy that node reads */
+  std::atomic<const fact_shard*>* routes;
+  /** For each node, for each shard, the sampled lookups from that node */
+  mutable std::atomic<uint64_t>* heat;
+  /** Serializes rebalancing */
+  std::mutex writeLock;
+  std::vector<bool> replicated;
+  std::vector<retired_shard> retired;
+  std::thread rebalancer;
+  bool stopping;
+  std::mutex stopLock;
+  std::condition_variable stopSignal;
+
+  /** The node of the CPU the calling thread is (probably) running on. */
+  inline uint32_t localNode() const {
+    numa_thread_state& state = numaThreadState;
+    if (state.untilRefresh == 0) {
+      refreshCpu(&state);
+    }
+    state.untilRefresh -= 1;
+    return state.cpu < topology.cpuNode.size() ?
+      topology.cpuNode[state.cpu] : 0;
+  }
+  /** Look up which CPU the calling thread is running on. */
+  static void refreshCpu(numa_thread_state* state);
+
+  /**
+   * Copy facts into a new shard in the memory of the given node.
+   * This must be called from a thread pinned to that node.
+   */
+  static fact_shard* placeShard(const uint64_t* facts, const uint64_t& count,
+                                const uint32_t& node);
+  /** Free a shard created with placeShard(). */
+  static void freeShard(fact_shard* shard);
+
+  /** Run a function on a thread pinned to the CPUs of the given node. */
+  std::thread onNode(const uint32_t& node, std::function<void()> fn) const;
+
+  /** Free retired replicas past their delay. Must hold writeLock. */
+  void reclaim(const bool& all);
+  /** The background thread's loop. */
+  void rebalanceLoop();
+};
+
+#endif
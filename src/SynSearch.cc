@@ -1540,3 +1540,36 @@ SynSearchCosts* createStrictCosts(const float& smallConstantCost,
   costs->transitionCostFromFalse[FUNCTION_INDEPENDENCE] = badCost;
   return costs;
 }
+
+//
+// parseEdgeTypes()
+//
+bool parseEdgeTypes(const string& spec, edge_type_mask* edgeTypes) {
+  edge_type_mask allowed = 0x0;
+  edge_type_mask excluded = 0x0;
+  uint64_t start = 0;
+  while (start <= spec.length()) {
+    uint64_t end = spec.find(',', start);
+    if (end == string::npos) {
+      end = spec.length();
+    }
+    string name = spec.substr(start, end - start);
+    const bool exclude = !name.empty() && name[0] == '-';
+    if (exclude) {
+      name = name.substr(1);
+    }
+    const uint8_t type = indexEdgeType(name);
+    if (type >= NUM_MUTATION_TYPES) {
+      fprintf(stderr, "Unknown edge type: '%s'\n", name.c_str());
+      return false;
+    }
+    if (exclude) {
+      excluded |= edgeTypeBit(type);
+    } else {
+      allowed |= edgeTypeBit(type);
+    }
+    start = end + 1;
+  }
+  *edgeTypes = (allowed == 0x0 ? ALL_EDGE_TYPES : allowed) & ~excluded;
+  return true;
+}
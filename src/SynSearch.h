@@ -3,12 +3,14 @@
 
 #include <limits>
 #include <bitset>
+#include <string>
 
 #include "config.h"
 #include "Types.h"
 #include "Graph.h"
 #include "knheap/knheap.h"
 #include "btree_set.h"
+#include "FactDB.h"
 #include "Models.h"
 
 // Ensure definitions
@@ -1259,6 +1261,15 @@ struct syn_search_options {
   // 
   /** If true, only run entailment from the true state. */
   bool skipNegationSearch;
+  /** The name of the KB to search against; empty for the default KB. */
+  std::string kbName;
+  /** The edge types the search may mutate along; by default, all of them. */
+  edge_type_mask edgeTypes;
+  /**
+   * The value of the last "%edgeTypes" directive, if it was invalid; the
+   * query is then rejected, rather than searched along the wrong edges.
+   */
+  std::string invalidEdgeTypes;
 
   /**
    * Create the input options for a Search.
@@ -1286,6 +1297,9 @@ struct syn_search_options {
     this->checkFringe = checkFringe;
     this->silent = silent;
     this->skipNegationSearch = false;
+    this->kbName = "";
+    this->edgeTypes = ALL_EDGE_TYPES;
+    this->invalidEdgeTypes = "";
   }
 
   syn_search_options() {
@@ -1295,9 +1309,25 @@ struct syn_search_options {
     this->checkFringe =         true;
     this->silent =              false;
     this->skipNegationSearch =  false;
+    this->kbName =              "";
+    this->edgeTypes =           ALL_EDGE_TYPES;
+    this->invalidEdgeTypes =    "";
   }
 };
 
+/**
+ * Parse a set of edge types, as given to the "%edgeTypes = ..." directive.
+ * This is a comma separated list of edge type names: either the types to
+ * allow (e.g., "hypernym,hyponym,synonym"), or, each prefixed with a '-',
+ * the types to exclude from every type (e.g., "-nn,-similar").
+ *
+ * @param spec The list of edge types.
+ * @param edgeTypes [output] The set of edge types allowed.
+ *
+ * @return False if the list names an unknown edge type.
+ */
+bool parseEdgeTypes(const std::string& spec, edge_type_mask* edgeTypes);
+
 /**
  * A single search path.
  */
@@ -1326,6 +1356,12 @@ struct syn_search_response {
   float closestSoftAlignmentScore = -std::numeric_limits<float>::infinity();
   float closestSoftAlignmentSearchCosts[MAX_FUZZY_MATCHES];
   uint64_t totalTicks;
+  /** The number of facts looked up in the main knowledge base. */
+  uint64_t kbLookups = 0;
+  /** The number of those lookups which found the fact. */
+  uint64_t kbHits = 0;
+  /** The number of those lookups rejected early by the KB's Bloom filter. */
+  uint64_t kbFilterRejects = 0;
     
   /**
    * Initialize some values while creating a new syn_search_response
@@ -1354,8 +1390,8 @@ struct syn_search_response {
  */
 syn_search_response SynSearch(
     const Graph* mutationGraph,
-    const btree::btree_set<uint64_t>* mainKB,
-    const btree::btree_set<uint64_t>& auxKB,
+    const FactDB* mainKB,
+    const PremiseKB& auxKB,
     const Tree* input,
     const SynSearchCosts* costs,
     const bool& assumedInitialTruth,
@@ -1366,8 +1402,8 @@ syn_search_response SynSearch(
 /** @see SynSearch(), but with no soft alignments*/
 inline syn_search_response SynSearch(
     const Graph* mutationGraph,
-    const btree::btree_set<uint64_t>* mainKB,
-    const btree::btree_set<uint64_t>& auxKB,
+    const FactDB* mainKB,
+    const PremiseKB& auxKB,
     const Tree* input,
     const SynSearchCosts* costs,
     const bool& assumedInitialTruth,
@@ -1380,28 +1416,58 @@ inline syn_search_response SynSearch(
 /** @see SynSearch(), but with only one knowledge base */
 inline syn_search_response SynSearch(
     const Graph* mutationGraph,
-    const btree::btree_set<uint64_t>* mainKB,
+    const FactDB* mainKB,
     const Tree* input,
     const SynSearchCosts* costs,
     const bool& assumedInitialTruth,
     const syn_search_options& opts,
     const std::vector<AlignmentSimilarity>& softAlignments
     ) {
-  return SynSearch(mutationGraph, mainKB, btree::btree_set<uint64_t>(), 
+  return SynSearch(mutationGraph, mainKB, PremiseKB(), 
       input, costs, assumedInitialTruth, opts, softAlignments);
 }
 
 /** @see SynSearch(), but with only one knowledge base and no soft alignments */
 inline syn_search_response SynSearch(
     const Graph* mutationGraph,
-    const btree::btree_set<uint64_t>* mainKB,
+    const FactDB* mainKB,
     const Tree* input,
     const SynSearchCosts* costs,
     const bool& assumedInitialTruth,
     const syn_search_options& opts) {
   std::vector<AlignmentSimilarity> alignments;
-  return SynSearch(mutationGraph, mainKB, btree::btree_set<uint64_t>(), 
+  return SynSearch(mutationGraph, mainKB, PremiseKB(), 
       input, costs, assumedInitialTruth, opts, alignments);
 }
 
+/** @see SynSearch(), but with a single in-memory btree knowledge base */
+inline syn_search_response SynSearch(
+    const Graph* mutationGraph,
+    const btree::btree_set<uint64_t>* mainKB,
+    const Tree* input,
+    const SynSearchCosts* costs,
+    const bool& assumedInitialTruth,
+    const syn_search_options& opts,
+    const std::vector<AlignmentSimilarity>& softAlignments
+    ) {
+  const BTreeFactDB kb(mainKB, false);
+  return SynSearch(mutationGraph, &kb, input, costs, assumedInitialTruth, opts,
+                   softAlignments);
+}
+
+/**
+ * @see SynSearch(), but with a single in-memory btree knowledge base and no
+ *      soft alignments
+ */
+inline syn_search_response SynSearch(
+    const Graph* mutationGraph,
+    const btree::btree_set<uint64_t>* mainKB,
+    const Tree* input,
+    const SynSearchCosts* costs,
+    const bool& assumedInitialTruth,
+    const syn_search_options& opts) {
+  const BTreeFactDB kb(mainKB, false);
+  return SynSearch(mutationGraph, &kb, input, costs, assumedInitialTruth, opts);
+}
+
 #endif
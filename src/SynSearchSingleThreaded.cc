@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <sstream>
 #include <thread>
@@ -71,6 +72,30 @@ inline uint64_t searchLoop(
   uint8_t topologicalOrder[tree.length + 1];
   tree.topologicalSort(topologicalOrder);
 
+  // The edges into the word being mutated, as lists to merge. A heap keeps
+  // the list whose next edge comes first in edgeCostOrder() on top, keyed
+  // on that edge's type priority + cost; whole edges are only compared to
+  // break ties.
+  edge_list edgeRuns[MAX_EDGE_RUNS];
+  uint32_t edgeRunIndices[MAX_EDGE_RUNS];
+  float edgeRunKeys[MAX_EDGE_RUNS];
+  uint32_t edgeRunHeap[MAX_EDGE_RUNS];
+  float typePriorities[32];
+  for (uint32_t type = 0; type < 32; ++type) {
+    typePriorities[type] = edgeTypePriority(type);
+  }
+  auto runAfter = [&edgeRuns, &edgeRunIndices, &edgeRunKeys](
+      const uint32_t& a, const uint32_t& b) -> bool {
+    if (edgeRunKeys[a] != edgeRunKeys[b]) {
+      return edgeRunKeys[a] > edgeRunKeys[b];
+    }
+    return edgeCostOrder(edgeRuns[b][edgeRunIndices[b]],
+                         edgeRuns[a][edgeRunIndices[a]]);
+  };
+  const edge_type_mask quantifierEdgeTypes =
+    edgeTypeBit(QUANTREWORD) | edgeTypeBit(QUANTNEGATE) |
+    edgeTypeBit(QUANTUP) | edgeTypeBit(QUANTDOWN);
+
   // Main Loop
   while (ticks < opts.maxTicks && dequeue(scoredNode)) {
     // ---
@@ -163,28 +188,69 @@ inline uint64_t searchLoop(
     // ---
 
     // PUSH 1: Mutations
-    uint32_t numEdges;
     const tagged_word nodeToken = node.wordAndSense();
     assert(nodeToken.word < graph->vocabSize());
-    const edge* edges = graph->incomingEdgesFast(nodeToken.word, &numEdges);
+    // (the edge types which may be taken from this node)
+    edge_type_mask edgeTypes = opts.edgeTypes;
+    if (!tree.isLocation(tokenIndex)) {
+      // (ignore meronym edges if not a location)
+      edgeTypes &= ~(edgeTypeBit(MERONYM) | edgeTypeBit(HOLONYM));
+    }
+    if (quantifierIndex < 0) {
+      // (can only quantifier mutate quantifiers)
+      edgeTypes &= ~quantifierEdgeTypes;
+    } else {
+      // (disallow quantifiers changing their sense)
+      edgeTypes &= quantifierEdgeTypes;
+    }
+    uint32_t numEdgeRuns = 0;
+    if ((graph->incomingEdgeTypes(nodeToken.word) & edgeTypes) != 0) {
+      numEdgeRuns = graph->incomingEdgesFor(nodeToken.word, nodeToken.sense,
+                                            edgeTypes, edgeRuns);
+    }
+    uint32_t heapSize = 0;
+    for (uint32_t run = 0; run < numEdgeRuns; ++run) {
+      if (edgeRuns[run].size() > 0) {
+        edgeRunIndices[run] = 0;
+        edgeRunKeys[run] =
+          typePriorities[edgeRuns[run].type(0)] + edgeRuns[run].cost(0);
+        edgeRunHeap[heapSize] = run;
+        heapSize += 1;
+      }
+    }
+    make_heap(edgeRunHeap, edgeRunHeap + heapSize, runAfter);
     uint32_t numEdgesTaken = 0;
-    for (uint32_t edgeI = 0; edgeI < numEdges; ++edgeI) {
-      const edge& edge = edges[edgeI];
-//      fprintf(stderr, "    %u / %u: edge %u[%u]  -->  %u[%u]\n", 
-//          edgeI, numEdges,
-//          edge.source, edge.source_sense, edge.sink, edge.sink_sense);
-      assert(edge.source < graph->vocabSize());
-      assert(nodeToken.word < graph->vocabSize());
-      assert(edge.sink == nodeToken.word);
+    while (heapSize > 0) {
+      // (merge the runs, so edges are visited cheapest first)
+      pop_heap(edgeRunHeap, edgeRunHeap + heapSize, runAfter);
+      const uint32_t nextRun = edgeRunHeap[heapSize - 1];
+      const edge_list& run = edgeRuns[nextRun];
+      const uint32_t edgeIndex = edgeRunIndices[nextRun];
+      edgeRunIndices[nextRun] += 1;
+      if (edgeRunIndices[nextRun] < run.size()) {
+        const uint32_t next = edgeRunIndices[nextRun];
+        edgeRunKeys[nextRun] = typePriorities[run.type(next)] + run.cost(next);
+        push_heap(edgeRunHeap, edgeRunHeap + heapSize, runAfter);
+      } else {
+        heapSize -= 1;
+      }
+      // (check the edge from its columns; it is only read in whole once
+      //  it may be taken)
       // (ignore when sense doesn't match)
-      if (edge.source_sense != 0 && edge.sink_sense != nodeToken.sense) { 
-        continue; 
+      if (run.sourceSense(edgeIndex) != 0 &&
+          run.sinkSense(edgeIndex) != nodeToken.sense) {
+        continue;
       }
-      // (ignore meronym edges if not a location)
-      if ( (edge.type == MERONYM || edge.type == HOLONYM) &&
-           !tree.isLocation(tokenIndex) ) {
+      // (ignore edge types which may not be taken here)
+      if ((edgeTypes & edgeTypeBit(run.type(edgeIndex))) == 0) {
         continue;
       }
+      const edge edge = run[edgeIndex];
+//      fprintf(stderr, "    edge %u[%u]  -->  %u[%u]\n", 
+//          edge.source, edge.source_sense, edge.sink, edge.sink_sense);
+      assert(edge.source < graph->vocabSize());
+      assert(nodeToken.word < graph->vocabSize());
+      assert(edge.sink == nodeToken.word);
       // (ignore multiple quantifier mutations)
       if (edge.type == QUANTREWORD || edge.type == QUANTNEGATE ||
           edge.type == QUANTUP || edge.type == QUANTDOWN) {
@@ -433,8 +499,8 @@ inline uint64_t searchLoop(
 //
 syn_search_response SynSearch(
     const Graph* mutationGraph, 
-    const btree::btree_set<uint64_t>* kb,
-    const btree::btree_set<uint64_t>& auxKB,
+    const FactDB* kb,
+    const PremiseKB& auxKB,
     const Tree* input, const SynSearchCosts* costs,
     const bool& assumedInitialTruth, const syn_search_options& opts,
     const vector<AlignmentSimilarity>& softAlignments) {
@@ -474,8 +540,21 @@ syn_search_response SynSearch(
   vector<syn_search_path>& matches = response.paths;
   vector<feature_vector>& featurizedPaths = response.featurizedPaths;
   // (the lookup function)
-  std::function<bool(uint64_t)> lookupFn = [&kb,&auxKB](const uint64_t& value) -> bool {
-    return kb->find(value) != kb->end() || auxKB.find(value) != auxKB.end();
+  // (the premises are a few cache lines at most, so check them first)
+  std::function<bool(uint64_t)> lookupFn = [&kb,&auxKB,&response](const uint64_t& value) -> bool {
+    if (auxKB.contains(value)) {
+      return true;
+    }
+    response.kbLookups += 1;
+    bool rejected;
+    if (kb->filteredContains(value, &rejected)) {
+      response.kbHits += 1;
+      return true;
+    }
+    if (rejected) {
+      response.kbFilterRejects += 1;
+    }
+    return false;
   };
   // (register a node as visited)
   auto registerVisited = [&matches,&lookupFn,&history,&mutationGraph,&input,
@@ -0,0 +1,241 @@
+#include "TieredFactDB.h"
+
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+using namespace std;
+
+/** The state of each thread's sampling; see TieredFactDB::sample() */
+thread_local uint64_t tieredSampleRandom = 0;
+
+/** The smallest power of two >= the given size (and at least 1024). */
+uint64_t samplePoolSize(const uint64_t& requested) {
+  uint64_t size = 1024;
+  while (size < requested) {
+    size *= 2;
+  }
+  return size;
+}
+
+//
+// HotFactSet::HotFactSet()
+//
+HotFactSet::HotFactSet(const uint64_t& capacity)
+    : count(0), hasZero(false), zeroPresent(false) {
+  // (at most half full)
+  uint64_t slots = 64;
+  while (slots < 2 * capacity) {
+    slots *= 2;
+  }
+  mask = slots - 1;
+  keys = (uint64_t*) calloc(slots, sizeof(uint64_t));
+  answers = (uint64_t*) calloc(slots / 64, sizeof(uint64_t));
+}
+
+//
+// HotFactSet::~HotFactSet()
+//
+HotFactSet::~HotFactSet() {
+  free(keys);
+  free(answers);
+}
+
+//
+// HotFactSet::insert()
+//
+void HotFactSet::insert(const uint64_t& fact, const bool& present) {
+  if (fact == 0) {
+    count += hasZero ? 0 : 1;
+    hasZero = true;
+    zeroPresent = present;
+    return;
+  }
+  uint64_t slot = hashSlot(fact);
+  while (keys[slot] != 0 && keys[slot] != fact) {
+    slot = (slot + 1) & mask;
+  }
+  if (keys[slot] == 0) {
+    keys[slot] = fact;
+    count += 1;
+  }
+  if (present) {
+    answers[slot >> 6] |= (0x1ul << (slot & 63));
+  } else {
+    answers[slot >> 6] &= ~(0x1ul << (slot & 63));
+  }
+}
+
+//
+// TieredFactDB::TieredFactDB()
+//
+TieredFactDB::TieredFactDB(const FactDB* cold, const uint64_t& hotSize,
+                           const uint32_t& rebuildSeconds)
+    : cold(cold), hotSize(hotSize), rebuildSeconds(rebuildSeconds),
+      sampleMask(samplePoolSize(hotSize * KB_HOT_SAMPLES_PER_FACT) - 1),
+      stopping(false) {
+  hot.store(new HotFactSet(0), memory_order_release);
+  samples = new atomic<uint64_t>[sampleMask + 1];
+  for (uint64_t i = 0; i <= sampleMask; ++i) {
+    samples[i].store(0, memory_order_relaxed);
+  }
+  if (rebuildSeconds > 0) {
+    rebuilder = thread([this]() -> void { rebuildLoop(); });
+  }
+}
+
+//
+// TieredFactDB::~TieredFactDB()
+//
+TieredFactDB::~TieredFactDB() {
+  {
+    lock_guard<mutex> guard(stopLock);
+    stopping = true;
+  }
+  stopSignal.notify_all();
+  if (rebuilder.joinable()) {
+    rebuilder.join();
+  }
+  lock_guard<mutex> guard(writeLock);
+  reclaim(true);
+  delete hot.load(memory_order_acquire);
+  delete[] samples;
+  delete cold;
+}
+
+//
+// TieredFactDB::contains()
+//
+bool TieredFactDB::contains(const uint64_t& fact) const {
+  sample(fact);
+  bool present;
+  if (hot.load(memory_order_acquire)->lookup(fact, &present)) {
+    return present;
+  }
+  return cold->contains(fact);
+}
+
+//
+// TieredFactDB::mayContain()
+//
+bool TieredFactDB::mayContain(const uint64_t& fact) const {
+  bool present;
+  if (hot.load(memory_order_acquire)->lookup(fact, &present)) {
+    return present;
+  }
+  return cold->mayContain(fact);
+}
+
+//
+// TieredFactDB::filteredContains()
+//
+bool TieredFactDB::filteredContains(const uint64_t& fact,
+                                    bool* rejected) const {
+  sample(fact);
+  bool present;
+  if (hot.load(memory_order_acquire)->lookup(fact, &present)) {
+    *rejected = !present;
+    return present;
+  }
+  return cold->filteredContains(fact, rejected);
+}
+
+//
+// TieredFactDB::sample()
+//
+void TieredFactDB::sample(const uint64_t& fact) const {
+  // (a thread-local xorshift picks both whether to sample, and where to;
+  //  so, threads share no counters)
+  uint64_t x = tieredSampleRandom;
+  if (x == 0) {
+    x = ((uint64_t) &tieredSampleRandom) | 0x1;
+  }
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  tieredSampleRandom = x;
+  if ((x & (KB_HOT_SAMPLE_INTERVAL - 1)) == 0) {
+    samples[(x >> 32) & sampleMask].store(fact, memory_order_relaxed);
+  }
+}
+
+//
+// TieredFactDB::rebuildHotSet()
+//
+void TieredFactDB::rebuildHotSet() {
+  lock_guard<mutex> guard(writeLock);
+  reclaim(false);
+
+  // Count the samples
+  unordered_map<uint64_t, uint64_t> counts;
+  for (uint64_t i = 0; i <= sampleMask; ++i) {
+    const uint64_t fact = samples[i].load(memory_order_relaxed);
+    if (fact != 0) {
+      counts[fact] += 1;
+    }
+  }
+  vector<pair<uint64_t, uint64_t>> candidates;
+  for (auto iter = counts.begin(); iter != counts.end(); ++iter) {
+    if (iter->second >= KB_HOT_MIN_SAMPLES) {
+      candidates.push_back(make_pair(iter->second, iter->first));
+    }
+  }
+  const uint64_t numHot = min(hotSize, (uint64_t) candidates.size());
+  nth_element(candidates.begin(), candidates.begin() + numHot,
+              candidates.end(), greater<pair<uint64_t, uint64_t>>());
+
+  // Look up the hot facts in the cold tier
+  HotFactSet* next = new HotFactSet(numHot);
+  uint64_t numPresent = 0;
+  for (uint64_t i = 0; i < numHot; ++i) {
+    const bool present = cold->contains(candidates[i].second);
+    next->insert(candidates[i].second, present);
+    numPresent += present ? 1 : 0;
+  }
+
+  // Swap it in
+  retired_hot_set entry;
+  entry.retiredAt = time(NULL);
+  entry.set = hot.exchange(next, memory_order_acq_rel);
+  retired.push_back(entry);
+  printTime("[%c] ");
+  fprintf(stderr, "Rebuilt hot KB tier: %lu facts (%lu hits, %lu misses)\n",
+          numHot, numPresent, numHot - numPresent);
+}
+
+//
+// TieredFactDB::reclaim()
+//
+void TieredFactDB::reclaim(const bool& all) {
+  const time_t now = time(NULL);
+  auto iter = retired.begin();
+  while (iter != retired.end()) {
+    if (all || now - iter->retiredAt >= KB_HOT_RETIRE_DELAY_SECONDS) {
+      delete iter->set;
+      iter = retired.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+//
+// TieredFactDB::rebuildLoop()
+//
+void TieredFactDB::rebuildLoop() {
+  unique_lock<mutex> lock(stopLock);
+  while (!stopping) {
+    stopSignal.wait_for(lock, chrono::seconds(rebuildSeconds));
+    if (stopping) {
+      break;
+    }
+    lock.unlock();
+    rebuildHotSet();
+    lock.lock();
+  }
+}
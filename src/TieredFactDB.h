@@ -0,0 +1,175 @@
+#ifndef TIERED_FACT_DB_H
+#define TIERED_FACT_DB_H
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "FactDB.h"
+
+/** The interval at which a TieredFactDB rebuilds its hot set */
+#define KB_HOT_REBUILD_SECONDS 60
+/**
+ * Each thread records one in (about) this many of its lookups as a sample
+ * for choosing the hot set. Must be a power of two.
+ */
+#define KB_HOT_SAMPLE_INTERVAL 16
+/** The number of sampled lookups a TieredFactDB keeps, per hot fact */
+#define KB_HOT_SAMPLES_PER_FACT 4
+/** The minimum number of times a fact must be sampled to become hot */
+#define KB_HOT_MIN_SAMPLES 2
+/**
+ * The number of seconds a TieredFactDB waits after replacing its hot set
+ * before freeing the old one; see KB_RETIRE_DELAY_SECONDS.
+ */
+#define KB_HOT_RETIRE_DELAY_SECONDS 60
+
+/**
+ * An immutable set of facts along with whether each is in a knowledge
+ * base; i.e., the cached answers to a set of lookups. This is an open
+ * addressing table of fact hashes, with a bit per slot for the answer.
+ */
+class HotFactSet {
+ public:
+  /** Create an empty set with room for the given number of facts. */
+  HotFactSet(const uint64_t& capacity);
+  ~HotFactSet();
+
+  /** Add a fact, and whether it is in the knowledge base. */
+  void insert(const uint64_t& fact, const bool& present);
+
+  /**
+   * Look up a fact. Returns false if the fact is not in the set; otherwise,
+   * returns true and sets present to the cached answer.
+   */
+  inline bool lookup(const uint64_t& fact, bool* present) const {
+    if (fact == 0) {
+      *present = zeroPresent;
+      return hasZero;
+    }
+    uint64_t slot = hashSlot(fact);
+    while (true) {
+      const uint64_t key = keys[slot];
+      if (key == fact) {
+        *present = (answers[slot >> 6] >> (slot & 63)) & 0x1;
+        return true;
+      }
+      if (key == 0) { return false; }
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  /** The number of facts in the set. */
+  inline uint64_t size() const { return count; }
+
+ private:
+  /** 0 marks an empty slot; the fact 0 is stored separately */
+  uint64_t* keys;
+  uint64_t* answers;
+  uint64_t mask;
+  uint64_t count;
+  bool hasZero;
+  bool zeroPresent;
+
+  inline uint64_t hashSlot(uint64_t h) const {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdul;
+    h ^= h >> 33;
+    return h & mask;
+  }
+};
+
+/**
+ * A knowledge base in two tiers: a small hot set of cached lookups held in
+ * RAM, in front of the full (cold) knowledge base; typically a memory
+ * mapped file larger than RAM, from which only the pages touched by cold
+ * lookups are read.
+ *
+ * Lookups are sampled (without locks) into a fixed-size pool, where newer
+ * samples overwrite older ones at random. Every rebuildSeconds, the hotSize
+ * facts sampled most often, whether or not they are in the KB, are looked
+ * up in the cold tier and published as a new hot set; so, both frequent
+ * hits and frequent misses are answered from RAM.
+ */
+class TieredFactDB : public FactDB {
+ public:
+  /**
+   * Put a hot tier in front of a knowledge base.
+   *
+   * @param cold The full knowledge base. This is now owned by the
+   *             TieredFactDB.
+   * @param hotSize The maximum number of facts in the hot set.
+   * @param rebuildSeconds The interval at which to rebuild the hot set, or
+   *                       0 to only do so on rebuildHotSet().
+   */
+  TieredFactDB(const FactDB* cold, const uint64_t& hotSize,
+               const uint32_t& rebuildSeconds = KB_HOT_REBUILD_SECONDS);
+  ~TieredFactDB();
+
+  /** {@inheritDoc} */
+  virtual bool contains(const uint64_t& fact) const;
+  /** {@inheritDoc} */
+  virtual bool mayContain(const uint64_t& fact) const;
+  /** {@inheritDoc} */
+  virtual bool filteredContains(const uint64_t& fact, bool* rejected) const;
+  /** {@inheritDoc} */
+  virtual uint64_t size() const { return cold->size(); }
+  /** {@inheritDoc} */
+  virtual void forEach(std::function<void(const uint64_t&)> callback) const {
+    cold->forEach(callback);
+  }
+  /** {@inheritDoc} */
+  virtual bool enumerable() const { return cold->enumerable(); }
+
+  /**
+   * Rebuild the hot set from the lookups sampled so far, and swap it in.
+   * This is called periodically by the background thread.
+   */
+  void rebuildHotSet();
+
+  /** The number of facts currently in the hot set. */
+  inline uint64_t hotSetSize() const {
+    return hot.load(std::memory_order_acquire)->size();
+  }
+  /** Returns true if the given fact is currently answered from RAM. */
+  inline bool isHot(const uint64_t& fact) const {
+    bool present;
+    return hot.load(std::memory_order_acquire)->lookup(fact, &present);
+  }
+
+ private:
+  /** A replaced hot set, awaiting deletion */
+  struct retired_hot_set {
+    time_t retiredAt;
+    const HotFactSet* set;
+  };
+
+  const FactDB* cold;
+  const uint64_t hotSize;
+  const uint32_t rebuildSeconds;
+  std::atomic<const HotFactSet*> hot;
+  /** The sampled lookups; 0 marks an empty sample */
+  std::atomic<uint64_t>* samples;
+  const uint64_t sampleMask;
+  /** Serializes rebuilds */
+  std::mutex writeLock;
+  std::vector<retired_hot_set> retired;
+  std::thread rebuilder;
+  bool stopping;
+  std::mutex stopLock;
+  std::condition_variable stopSignal;
+
+  /** Maybe record a lookup in the sample pool. */
+  void sample(const uint64_t& fact) const;
+  /** Free retired hot sets past their delay. Must hold writeLock. */
+  void reclaim(const bool& all);
+  /** The background thread's loop. */
+  void rebuildLoop();
+};
+
+#endif
@@ -27,6 +27,16 @@ void initPriority() {
 }
 
 
+//
+// edgeTypePriority()
+//
+float edgeTypePriority(const edge_type& type) {
+  if (!priorityInititalized) {
+    initPriority();
+  }
+  return type < NUM_MUTATION_TYPES ? priority[type] : 0.0f;
+}
+
 //
 // edge::<
 //
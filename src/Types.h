@@ -112,6 +112,17 @@ typedef uint32_t word;
 /** An edge type -- for example, WORDNET_UP */
 typedef uint8_t edge_type;
 
+/** A set of edge types, as a bitmask with bit i set for edge type i */
+typedef uint32_t edge_type_mask;
+
+/** The set of every edge type */
+#define ALL_EDGE_TYPES 0xFFFFFFFF
+
+/** The set of just the given edge type */
+inline edge_type_mask edgeTypeBit(const edge_type& type) {
+  return ((edge_type_mask) 0x1) << type;
+}
+
 
 /** An inference function (e.g., forward entailment) */
 typedef uint8_t inference_function;
@@ -131,6 +142,13 @@ struct edge {
   bool operator<(const edge& other) const;
 };
 
+/**
+ * The priority of an edge type in edge::operator<: edges sort by the
+ * priority of their type plus their cost. A search comparing many edges
+ * can look these up once, rather than comparing whole edges.
+ */
+float edgeTypePriority(const edge_type& type);
+
 //
 // Some Utilities
 //
@@ -1,36 +1,96 @@
 #include "FactDB.h"
+#include "LiveFactDB.h"
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
 
 #define CHUNK_SIZE 1048576
 
+/** Print the usage of write_kb, and exit */
+void usage() {
+  fprintf(stderr,
+    "usage: write_kb [options] filename\n"
+    "  --append               Append to the KB's delta log\n"
+    "  --elias-fano           Write an Elias-Fano encoded KB\n"
+    "  --eytzinger            Write an Eytzinger layout KB\n"
+    "  --perfect-hash[=bits]  Write a perfect hash KB (8, 16 or 32 bits)\n"
+    "  --min-count=n          Drop facts seen fewer than n times "
+    "(default: %u)\n"
+    "  --memory=mb            Memory for sorting, before spilling to disk "
+    "(default: %lu)\n",
+    (uint32_t) MIN_FACT_COUNT, EXTERNAL_SORT_RUN_SIZE * sizeof(uint64_t) / (1024 * 1024));
+  exit(1);
+}
+
 /*
  * Reads a sequence of text lines representing hashed facts
- * (uint64_t values), and writes the corresponding values to a text file
- * in a way that can be read by readKB(string)
+ * (uint64_t values), and writes the corresponding values to a sorted,
+ * deduplicated KB file in a way that can be read by readKB(string).
+ * Facts seen fewer than MIN_FACT_COUNT times are dropped.
+ *
+ * The input may be larger than memory: facts are sorted in runs of
+ * bounded size, spilled next to the output file, and merged.
+ *
+ * With --elias-fano, the KB is written Elias-Fano encoded; with
+ * --eytzinger, it is written in Eytzinger layout; with
+ * --perfect-hash[=bits], it is written as a minimal perfect hash of
+ * fingerprints of the given width (8, 16 or 32 bits).
+ *
+ * With --append, the facts are instead appended to the KB's delta log,
+ * from where running servers pick them up without a restart (see
+ * LiveFactDB). Writing a new KB discards its old delta log, once the new
+ * KB is in place.
  */
 int32_t main( int32_t argc, char *argv[] ) {
+  kb_format format = KB_FORMAT_SORTED;
+  uint32_t fingerprintBits = PERFECT_HASH_KB_FINGERPRINT_BITS;
+  uint64_t minCount = MIN_FACT_COUNT;
+  uint64_t runSize = EXTERNAL_SORT_RUN_SIZE;
+  bool append = false;
   if (argc < 2) {
-    fprintf(stderr, "usage: write_kb filename\n");
-    exit(1);
+    usage();
   }
-
-  // Create output file
-  char* filename = argv[1];
-  FILE* file;
-  file = fopen(filename, "wb");
-  if (file == NULL) {
-    fprintf(stderr, "Can't open KB file for writing: %s!\n", filename);
-    exit(1);
+  for (int32_t i = 1; i < argc - 1; ++i) {
+    if (strcmp(argv[i], "--append") == 0) {
+      append = true;
+    } else if (strcmp(argv[i], "--elias-fano") == 0) {
+      format = KB_FORMAT_ELIAS_FANO;
+    } else if (strcmp(argv[i], "--eytzinger") == 0) {
+      format = KB_FORMAT_EYTZINGER;
+    } else if (strcmp(argv[i], "--perfect-hash") == 0) {
+      format = KB_FORMAT_PERFECT_HASH;
+    } else if (strncmp(argv[i], "--perfect-hash=", 15) == 0) {
+      format = KB_FORMAT_PERFECT_HASH;
+      fingerprintBits = atoi(argv[i] + 15);
+    } else if (strncmp(argv[i], "--min-count=", 12) == 0) {
+      minCount = strtoul(argv[i] + 12, NULL, 10);
+    } else if (strncmp(argv[i], "--memory=", 9) == 0) {
+      runSize =
+        strtoul(argv[i] + 9, NULL, 10) * 1024 * 1024 / sizeof(uint64_t);
+    } else {
+      usage();
+    }
+  }
+  const string filename = string(argv[argc - 1]);
+  if (filename[0] == '-') {
+    usage();
   }
 
-  // Read from stdin, write to buffer
-  char line[256];
-  uint64_t* buffer = (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t));
+  // Read from stdin
+  ExternalFactSorter* sorter = append ? NULL :
+    new ExternalFactSorter(filename, runSize,
+                           max(1u, thread::hardware_concurrency()));
+  uint64_t* buffer = append ? (uint64_t*) malloc(CHUNK_SIZE * sizeof(uint64_t))
+                            : NULL;
+  uint64_t bufferSize = 0;
   uint64_t index = 0;
+  char line[256];
   memset(line, 0, sizeof(line));
   while (!cin.fail()) {
     // Parse the line
@@ -38,27 +98,33 @@ int32_t main( int32_t argc, char *argv[] ) {
     if (line[0] == '\0') { continue; }
     // Convert the line to an integer
     const uint64_t hash = strtoul(line, NULL, 10);
-    buffer[index] = hash;
     index += 1;
-    // Optionally write the chunk
-    if (index == CHUNK_SIZE) {
-      fwrite(buffer, CHUNK_SIZE * sizeof(uint64_t), 1, file);
-      index = 0;
+    if (append) {
+      buffer[bufferSize] = hash;
+      bufferSize += 1;
+      if (bufferSize == CHUNK_SIZE) {
+        appendToDeltaLog(filename, buffer, bufferSize);
+        bufferSize = 0;
+      }
+    } else {
+      sorter->add(hash);
     }
   }
 
-  // Write the last few facts
-  fwrite(buffer, sizeof(uint64_t), index, file);
-  fclose(file);
-
-  // Re-read the knowledge base, printing out the values
-//  fprintf(stderr, "Re-reading file\n");
-//  const btree::btree_set<uint64_t> kb = readKB(filename);
-//  for ( auto iter = kb.begin(); iter != kb.end(); ++iter ) {
-//    fprintf(stderr, "contains: %lu\n", *iter);
-//  }
-//  fprintf(stderr, "DONE\n");
+  // Append the facts to the delta log
+  if (append) {
+    appendToDeltaLog(filename, buffer, bufferSize);
+    fprintf(stderr, "Appended %lu facts to the delta log of %s\n",
+            index, filename.c_str());
+    free(buffer);
+    return 0;
+  }
 
+  // Sort, deduplicate, filter, and write the facts
+  const uint64_t written =
+    writeKB(filename, sorter, minCount, format, fingerprintBits);
+  removeDeltaLog(filename);
+  fprintf(stderr, "Wrote %lu unique facts (of %lu read; min count %lu) to %s\n",
+          written, index, minCount, filename.c_str());
+  delete sorter;
 }
-
-
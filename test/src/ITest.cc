@@ -1,9 +1,14 @@
 #include <limits.h>
+#include <ctime>
+#include <limits>
+#include <thread>
 #include <vector>
 #include <stdint.h>
+#include <unistd.h>
 
 #include <config.h>
 #include "gtest/gtest.h"
+#include "FactDB.h"
 #include "Graph.h"
 #include "Utils.h"
 
@@ -25,14 +30,22 @@ using namespace std;
 /**
  * Iterate over the entire graph, to make sure that we are
  * not going to either segfault or return an invalid edge.
+ * (the graph is read through a shared image in a scratch directory, so
+ * that the test leaves no image behind)
  */
 TEST(GraphITest, AllEdgesValid) {
-  Graph* graph = ReadGraph();
+  char buffer[] = "/tmp/naturalli_itest_graph_XXXXXX";
+  ASSERT_TRUE(mkdtemp(buffer) != NULL);
+  const string imagePath = string(buffer) + "/graph.img";
+  Graph* graph = ReadGraph(imagePath, true);
+  EXPECT_TRUE(graphImageMatches(imagePath));
+  unlink(imagePath.c_str());
+  unlink((imagePath + ".lock").c_str());
+  rmdir(buffer);
   vector<word> keys = graph->keys();
   for (int w = 0; w < keys.size(); ++w) {
-    uint32_t numEdges = 0;
-    const edge* edges = graph->incomingEdgesFast(w, &numEdges);
-    for (uint32_t i = 0; i < numEdges; ++i) {
+    const edge_list edges = graph->incomingEdgesFast(w);
+    for (uint32_t i = 0; i < edges.size(); ++i) {
       ASSERT_LT(edges[i].sink, keys.size());
       ASSERT_LT(edges[i].source, keys.size());
       ASSERT_GE(edges[i].cost, 0.0);
@@ -40,3 +53,190 @@ TEST(GraphITest, AllEdgesValid) {
   }
   delete graph;
 }
+
+/**
+ * Load the graph text files sequentially and with the parallel pipeline,
+ * and make sure both give the same graph; the load times are printed.
+ */
+TEST(GraphITest, ParallelLoadMatchesSequential) {
+  const uint32_t numThreads = max(2u, thread::hardware_concurrency());
+  time_t start = time(NULL);
+  Graph* sequential = ReadTextGraph(1);
+  const time_t sequentialSeconds = time(NULL) - start;
+  start = time(NULL);
+  Graph* parallel = ReadTextGraph(numThreads);
+  const time_t parallelSeconds = time(NULL) - start;
+  fprintf(stderr, "Graph load: %lus sequential; %lus with %u threads\n",
+          (uint64_t) sequentialSeconds, (uint64_t) parallelSeconds,
+          numThreads);
+
+  ASSERT_EQ(sequential->vocabSize(), parallel->vocabSize());
+  for (word w = 0; w < sequential->vocabSize(); ++w) {
+    ASSERT_EQ(string(sequential->gloss(w)), string(parallel->gloss(w)));
+    const edge_list sequentialEdges = sequential->incomingEdgesFast(w);
+    const edge_list parallelEdges = parallel->incomingEdgesFast(w);
+    ASSERT_EQ(sequentialEdges.size(), parallelEdges.size());
+    for (uint32_t i = 0; i < sequentialEdges.size(); ++i) {
+      ASSERT_EQ(sequentialEdges[i].source, parallelEdges[i].source);
+      ASSERT_EQ(sequentialEdges[i].source_sense, parallelEdges[i].source_sense);
+      ASSERT_EQ(sequentialEdges[i].sink_sense, parallelEdges[i].sink_sense);
+      ASSERT_EQ(sequentialEdges[i].type, parallelEdges[i].type);
+      ASSERT_EQ(sequentialEdges[i].cost, parallelEdges[i].cost);
+    }
+  }
+  delete sequential;
+  delete parallel;
+}
+
+/**
+ * Load the graph text files keeping only MAX_BRANCHOUT edges into each
+ * word, and make sure no word has more; the edges kept are printed.
+ */
+TEST(GraphITest, PrunedLoad) {
+  Graph* graph = ReadTextGraph(max(1u, thread::hardware_concurrency()),
+                               0, MAX_BRANCHOUT);
+  uint64_t numEdges = 0;
+  for (word w = 0; w < graph->vocabSize(); ++w) {
+    const edge_list edges = graph->incomingEdgesFast(w);
+    ASSERT_LE(edges.size(), MAX_BRANCHOUT);
+    numEdges += edges.size();
+  }
+  fprintf(stderr, "Kept %lu edges at %u per word\n", numEdges, MAX_BRANCHOUT);
+  delete graph;
+}
+
+/**
+ * Load the graph text files as a compact graph, and make sure it has the
+ * same edges as the float graph, with each cost within the tolerance
+ * documented on ReadTextGraph(); the load times are printed.
+ */
+TEST(GraphITest, CompactMatchesFloat) {
+  time_t start = time(NULL);
+  Graph* floats = ReadTextGraph(max(1u, thread::hardware_concurrency()), 0);
+  const time_t floatSeconds = time(NULL) - start;
+  start = time(NULL);
+  Graph* compact = ReadTextGraph(max(1u, thread::hardware_concurrency()), 16);
+  const time_t compactSeconds = time(NULL) - start;
+  fprintf(stderr, "Graph load: %lus with float costs; %lus with 16 bit costs\n",
+          (uint64_t) floatSeconds, (uint64_t) compactSeconds);
+
+  // (the range of costs of each type)
+  float minCosts[8 * sizeof(edge_type_mask)];
+  float maxCosts[8 * sizeof(edge_type_mask)];
+  for (uint32_t t = 0; t < 8 * sizeof(edge_type_mask); ++t) {
+    minCosts[t] = numeric_limits<float>::infinity();
+    maxCosts[t] = 0.0f;
+  }
+  for (word w = 0; w < floats->vocabSize(); ++w) {
+    const edge_list edges = floats->incomingEdgesFast(w);
+    for (uint32_t i = 0; i < edges.size(); ++i) {
+      minCosts[edges.type(i)] = min(minCosts[edges.type(i)], edges.cost(i));
+      maxCosts[edges.type(i)] = max(maxCosts[edges.type(i)], edges.cost(i));
+    }
+  }
+
+  ASSERT_EQ(floats->vocabSize(), compact->vocabSize());
+  edge_list floatRuns[MAX_EDGE_RUNS];
+  edge_list compactRuns[MAX_EDGE_RUNS];
+  for (word w = 0; w < floats->vocabSize(); ++w) {
+    const uint32_t numRuns =
+      floats->incomingEdgesFor(w, 1, ALL_EDGE_TYPES, floatRuns);
+    ASSERT_EQ(numRuns,
+              compact->incomingEdgesFor(w, 1, ALL_EDGE_TYPES, compactRuns));
+    for (uint32_t run = 0; run < numRuns; ++run) {
+      ASSERT_EQ(floatRuns[run].size(), compactRuns[run].size());
+      for (uint32_t i = 0; i < floatRuns[run].size(); ++i) {
+        const edge expected = floatRuns[run][i];
+        const edge actual = compactRuns[run][i];
+        ASSERT_EQ(expected.source, actual.source);
+        ASSERT_EQ(expected.source_sense, actual.source_sense);
+        ASSERT_EQ(expected.sink_sense, actual.sink_sense);
+        ASSERT_EQ(expected.type, actual.type);
+        const float tolerance =
+          (maxCosts[expected.type] - minCosts[expected.type]) / (2 * 65535);
+        ASSERT_NEAR(expected.cost, actual.cost, tolerance * 1.001);
+      }
+    }
+  }
+  delete floats;
+  delete compact;
+}
+
+/**
+ * Compare the lookup latency of the static KB layouts against the
+ * btree, on a KB of random hashes too large for the cache.
+ * Half of the queries are hits; the reported figures are cycles per lookup.
+ */
+TEST(FactDBITest, LookupBenchmark) {
+  const uint64_t count = 16 * 1024 * 1024;
+  const uint64_t numQueries = 1000000;
+  uint64_t* facts = (uint64_t*) malloc(count * sizeof(uint64_t));
+  uint64_t* queries = (uint64_t*) malloc(numQueries * sizeof(uint64_t));
+  uint64_t state = 42;
+  for (uint64_t i = 0; i < count; ++i) {
+    state = state * 6364136223846793005ul + 1442695040888963407ul;
+    facts[i] = state;
+  }
+  for (uint64_t i = 0; i < numQueries; ++i) {
+    state = state * 6364136223846793005ul + 1442695040888963407ul;
+    queries[i] = (i % 2 == 0) ? facts[state % count] : state;
+  }
+
+  // The btree
+  btree::btree_set<uint64_t>* btree = bulkLoadKB(facts, count, 1);
+  uint64_t btreeHits = 0;
+  uint64_t start = rdtsc();
+  for (uint64_t i = 0; i < numQueries; ++i) {
+    if (btree->find(queries[i]) != btree->end()) { btreeHits += 1; }
+  }
+  const uint64_t btreeCycles = rdtsc() - start;
+  fprintf(stderr, "btree_set::find:        %lu cycles/lookup\n",
+          btreeCycles / numQueries);
+  uint64_t btreeSum = 0;
+  for (auto iter = btree->begin(); iter != btree->end(); ++iter) {
+    btreeSum += *iter;
+  }
+  delete btree;
+
+  // The static layouts
+  const kb_format formats[] = { KB_FORMAT_SORTED, KB_FORMAT_EYTZINGER,
+                                KB_FORMAT_ELIAS_FANO, KB_FORMAT_PERFECT_HASH };
+  const char* names[] = { "sorted", "Eytzinger", "Elias-Fano", "perfect hash" };
+  char path[] = "/tmp/naturalli_itest_kb_XXXXXX";
+  close(mkstemp(path));
+  for (uint32_t f = 0; f < 4; ++f) {
+    writeKB(path, facts, count, formats[f]);
+    const FactDB* kb = readKB(string(path));
+    // (page it in, as the btree is; the sum keeps the reads from being
+    //  optimized away)
+    if (kb->enumerable()) {
+      uint64_t sum = 0;
+      kb->forEach([&sum](const uint64_t& fact) -> void { sum += fact; });
+      EXPECT_EQ(btreeSum, sum);
+    } else {
+      uint64_t warmHits = 0;
+      for (uint64_t i = 0; i < numQueries; ++i) {
+        if (kb->contains(queries[i])) { warmHits += 1; }
+      }
+      EXPECT_GE(warmHits, btreeHits);
+    }
+    uint64_t hits = 0;
+    start = rdtsc();
+    for (uint64_t i = 0; i < numQueries; ++i) {
+      if (kb->contains(queries[i])) { hits += 1; }
+    }
+    const uint64_t cycles = rdtsc() - start;
+    fprintf(stderr, "%-12s contains(): %lu cycles/lookup\n",
+            names[f], cycles / numQueries);
+    if (kb->enumerable()) {
+      EXPECT_EQ(btreeHits, hits);
+    } else {
+      EXPECT_GE(hits, btreeHits);  // (fingerprints allow false positives)
+    }
+    delete kb;
+  }
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+  free(facts);
+  free(queries);
+}
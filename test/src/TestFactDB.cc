@@ -1,5 +1,8 @@
 #include <limits.h>
 #include <bitset>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
 
@@ -22,3 +25,604 @@ TEST(FactDBTest, ReadFromIntStream) {
   EXPECT_FALSE(kb->find(45l) != kb->end());
   delete kb;
 }
+
+//
+// Write + read a sorted KB
+//
+TEST(FactDBTest, ReadSortedKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  uint64_t stream[] = { 44l, 42l, 43l, 42l };
+  EXPECT_EQ(3, writeKB(path, stream, 4));
+  const FactDB* kb = readKB(string(path));
+  EXPECT_EQ(3, kb->size());
+  EXPECT_FALSE(kb->contains(41l));
+  EXPECT_TRUE(kb->contains(42l));
+  EXPECT_TRUE(kb->contains(43l));
+  EXPECT_TRUE(kb->contains(44l));
+  EXPECT_FALSE(kb->contains(45l));
+  delete kb;
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Lookups across many fence blocks of a sorted KB
+//
+TEST(FactDBTest, ReadSortedKBMultipleBlocks) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  SortedKBWriter writer(path, 4);
+  for (uint64_t i = 1; i <= 101; ++i) {
+    writer.append(i * 2);
+  }
+  writer.close();
+  const FactDB* kb = readKB(string(path));
+  EXPECT_EQ(101, kb->size());
+  for (uint64_t i = 0; i <= 204; ++i) {
+    EXPECT_EQ(i % 2 == 0 && i >= 2 && i <= 202, kb->contains(i));
+  }
+  delete kb;
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// A sorted KB which cannot be written in full is removed
+//
+TEST(FactDBTest, FailedSortedKBWriteRemovesFile) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  EXPECT_EXIT({
+    signal(SIGXFSZ, SIG_IGN);
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = 4096;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    SortedKBWriter writer(path);
+    for (uint64_t i = 1; i <= 10000; ++i) {
+      writer.append(i);
+    }
+    writer.close();
+    exit(0);
+  }, ::testing::ExitedWithCode(1), "KB file");
+  EXPECT_NE(0, access(path, F_OK));
+}
+
+//
+// Read a legacy (unsorted hash stream) KB
+//
+TEST(FactDBTest, ReadLegacyKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  uint64_t stream[] = { 44l, 42l, 43l };
+  FILE* file = fopen(path, "wb");
+  fwrite(stream, sizeof(uint64_t), 3, file);
+  fclose(file);
+  const FactDB* kb = readKB(string(path));
+  EXPECT_EQ(3, kb->size());
+  EXPECT_FALSE(kb->contains(41l));
+  EXPECT_TRUE(kb->contains(42l));
+  EXPECT_TRUE(kb->contains(44l));
+  delete kb;
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Bulk load a KB, with duplicates, across multiple sort threads
+//
+TEST(FactDBTest, BulkLoad) {
+  const uint64_t count = 3000000;
+  uint64_t* stream = (uint64_t*) malloc(count * sizeof(uint64_t));
+  for (uint64_t i = 0; i < count; ++i) {
+    stream[i] = ((i * 7919) % (count / 2)) * 2;  // every even number, twice
+  }
+  btree_set<uint64_t>* kb = bulkLoadKB(stream, count, 4);
+  free(stream);
+  EXPECT_EQ(count / 2, kb->size());
+  uint64_t expected = 0;
+  for (auto iter = kb->begin(); iter != kb->end(); ++iter) {
+    ASSERT_EQ(expected, *iter);
+    expected += 2;
+  }
+  EXPECT_FALSE(kb->find(1l) != kb->end());
+  EXPECT_TRUE(kb->find(count - 2) != kb->end());
+  delete kb;
+}
+
+//
+// Bloom filter: no false negatives, and a reasonable false positive rate
+//
+TEST(FactDBTest, BloomFilter) {
+  const uint64_t count = 100000;
+  BloomFilter filter(count, 10);
+  for (uint64_t i = 0; i < count; ++i) {
+    filter.add(i * 0x9e3779b97f4a7c15ul);
+  }
+  for (uint64_t i = 0; i < count; ++i) {
+    ASSERT_TRUE(filter.mayContain(i * 0x9e3779b97f4a7c15ul));
+  }
+  uint64_t falsePositives = 0;
+  for (uint64_t i = count; i < 2 * count; ++i) {
+    if (filter.mayContain(i * 0x9e3779b97f4a7c15ul)) { falsePositives += 1; }
+  }
+  EXPECT_LT(filter.expectedFalsePositiveRate(), 0.02);
+  EXPECT_LT(((double) falsePositives) / ((double) count), 0.03);
+}
+
+//
+// Bloom filter: write and read back
+//
+TEST(FactDBTest, BloomFilterWriteRead) {
+  char path[] = "/tmp/naturalli_test_bloom_XXXXXX";
+  close(mkstemp(path));
+  BloomFilter filter(1000, 8);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    filter.add(i * 31);
+  }
+  EXPECT_TRUE(filter.write(path, 12345));
+  // (mismatched KBs are rejected)
+  EXPECT_TRUE(BloomFilter::read(path, 1001, 12345, 8) == NULL);
+  EXPECT_TRUE(BloomFilter::read(path, 1000, 12346, 8) == NULL);
+  EXPECT_TRUE(BloomFilter::read(path, 1000, 12345, 16) == NULL);
+  // (the matching KB is read)
+  BloomFilter* read = BloomFilter::read(path, 1000, 12345, 8);
+  ASSERT_TRUE(read != NULL);
+  for (uint64_t i = 0; i < 100000; ++i) {
+    ASSERT_EQ(filter.mayContain(i), read->mayContain(i));
+  }
+  delete read;
+  unlink(path);
+}
+
+//
+// Bloom filter guarding a KB
+//
+TEST(FactDBTest, BloomFilteredFactDB) {
+  btree_set<uint64_t>* facts = new btree_set<uint64_t>();
+  facts->insert(42l);
+  facts->insert(43l);
+  const FactDB* impl = new BTreeFactDB(facts, true);
+  BloomFilter* filter = new BloomFilter(impl->size(), 16);
+  impl->forEach([filter](const uint64_t& fact) -> void { filter->add(fact); });
+  BloomFilteredFactDB kb(impl, filter);
+  EXPECT_EQ(2, kb.size());
+  EXPECT_TRUE(kb.mayContain(42l));
+  EXPECT_TRUE(kb.contains(42l));
+  EXPECT_TRUE(kb.contains(43l));
+  EXPECT_FALSE(kb.contains(44l));
+  // (one lookup answers both questions)
+  bool rejected = true;
+  EXPECT_TRUE(kb.filteredContains(42l, &rejected));
+  EXPECT_FALSE(rejected);
+  uint64_t rejects = 0;
+  for (uint64_t i = 1000; i < 2000; ++i) {
+    EXPECT_FALSE(kb.filteredContains(i, &rejected));
+    EXPECT_EQ(!filter->mayContain(i), rejected);
+    if (rejected) { rejects += 1; }
+  }
+  EXPECT_GT(rejects, 900);
+}
+
+//
+// Read an Elias-Fano encoded KB
+//
+TEST(FactDBTest, ReadEliasFanoKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  uint64_t stream[] = { 44l, 42l, 43l, 42l, 0xfffffffffffffffful, 0l };
+  EXPECT_EQ(5, writeKB(path, stream, 6, KB_FORMAT_ELIAS_FANO));
+  const FactDB* kb = readKB(string(path));
+  EXPECT_EQ(5, kb->size());
+  EXPECT_TRUE(kb->contains(0l));
+  EXPECT_FALSE(kb->contains(41l));
+  EXPECT_TRUE(kb->contains(42l));
+  EXPECT_TRUE(kb->contains(43l));
+  EXPECT_TRUE(kb->contains(44l));
+  EXPECT_FALSE(kb->contains(45l));
+  EXPECT_TRUE(kb->contains(0xfffffffffffffffful));
+  EXPECT_FALSE(kb->contains(0xfffffffffffffffeul));
+  vector<uint64_t> facts;
+  kb->forEach([&facts](const uint64_t& fact) -> void { facts.push_back(fact); });
+  ASSERT_EQ(5, facts.size());
+  EXPECT_EQ(0l, facts[0]);
+  EXPECT_EQ(42l, facts[1]);
+  EXPECT_EQ(0xfffffffffffffffful, facts[4]);
+  delete kb;
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Read a large Elias-Fano encoded KB, spanning many sampled buckets
+//
+TEST(FactDBTest, ReadEliasFanoKBManyBuckets) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  const uint64_t count = 100000;
+  uint64_t* stream = (uint64_t*) malloc(count * sizeof(uint64_t));
+  for (uint64_t i = 0; i < count; ++i) {
+    stream[i] = (2 * i) * 0x9e3779b97f4a7c15ul;
+  }
+  EXPECT_EQ(count, writeKB(path, stream, count, KB_FORMAT_ELIAS_FANO));
+  const FactDB* kb = readKB(string(path));
+  EXPECT_EQ(count, kb->size());
+  for (uint64_t i = 0; i < count; ++i) {
+    ASSERT_TRUE(kb->contains((2 * i) * 0x9e3779b97f4a7c15ul));
+    ASSERT_FALSE(kb->contains((2 * i + 1) * 0x9e3779b97f4a7c15ul));
+  }
+  uint64_t last = 0;
+  uint64_t seen = 0;
+  kb->forEach([&last, &seen](const uint64_t& fact) -> void {
+    EXPECT_TRUE(seen == 0 || fact > last);
+    last = fact;
+    seen += 1;
+  });
+  EXPECT_EQ(count, seen);
+  free(stream);
+  delete kb;
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// An Elias-Fano KB which cannot be written in full is removed
+//
+TEST(FactDBTest, FailedEliasFanoKBWriteRemovesFile) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  EXPECT_EXIT({
+    signal(SIGXFSZ, SIG_IGN);
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = 4096;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    EliasFanoKBWriter writer(path, 10000);
+    for (uint64_t i = 1; i <= 10000; ++i) {
+      writer.append(i * 0x100000001ul);
+    }
+    writer.close();
+    exit(0);
+  }, ::testing::ExitedWithCode(1), "KB file");
+  EXPECT_NE(0, access(path, F_OK));
+}
+
+//
+// Read an Eytzinger layout KB, for every tree shape up to a few levels
+//
+TEST(FactDBTest, ReadEytzingerKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  for (uint64_t count = 0; count < 70; ++count) {
+    uint64_t stream[70];
+    for (uint64_t i = 0; i < count; ++i) {
+      stream[i] = (count - i) * 10;  // 10, 20, ..., in reverse
+    }
+    EXPECT_EQ(count, writeKB(path, stream, count, KB_FORMAT_EYTZINGER));
+    const FactDB* kb = readKB(string(path));
+    EXPECT_EQ(count, kb->size());
+    for (uint64_t i = 0; i <= count + 1; ++i) {
+      ASSERT_EQ(i > 0 && i <= count, kb->contains(i * 10));
+      ASSERT_FALSE(kb->contains(i * 10 + 5));
+    }
+    uint64_t expected = 10;
+    kb->forEach([&expected](const uint64_t& fact) -> void {
+      EXPECT_EQ(expected, fact);
+      expected += 10;
+    });
+    EXPECT_EQ((count + 1) * 10, expected);
+    delete kb;
+  }
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Read a perfect hash KB, at each fingerprint width
+//
+TEST(FactDBTest, ReadPerfectHashKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  const uint64_t count = 100000;
+  uint64_t* stream = (uint64_t*) malloc(count * sizeof(uint64_t));
+  const uint32_t widths[] = { 8, 16, 32 };
+  for (uint32_t w = 0; w < 3; ++w) {
+    for (uint64_t i = 0; i < count; ++i) {
+      stream[i] = (2 * i) * 0x9e3779b97f4a7c15ul;
+    }
+    EXPECT_EQ(count, writeKB(path, stream, count, KB_FORMAT_PERFECT_HASH,
+                             widths[w]));
+    const FactDB* kb = readKB(string(path));
+    EXPECT_EQ(count, kb->size());
+    EXPECT_FALSE(kb->enumerable());
+    uint64_t falsePositives = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+      ASSERT_TRUE(kb->contains((2 * i) * 0x9e3779b97f4a7c15ul));
+      if (kb->contains((2 * i + 1) * 0x9e3779b97f4a7c15ul)) {
+        falsePositives += 1;
+      }
+    }
+    // (the expected rate is 2^-width)
+    EXPECT_LT(falsePositives, 2 * count / (0x1ul << widths[w]) + 10);
+    delete kb;
+  }
+  free(stream);
+  unlink(path);
+}
+
+//
+// A perfect hash KB over no facts
+//
+TEST(FactDBTest, ReadEmptyPerfectHashKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  EXPECT_EQ(0, writeKB(path, (uint64_t*) NULL, 0, KB_FORMAT_PERFECT_HASH));
+  const FactDB* kb = readKB(string(path));
+  EXPECT_EQ(0, kb->size());
+  EXPECT_FALSE(kb->contains(42l));
+  delete kb;
+  unlink(path);
+}
+
+//
+// External sort, entirely in memory
+//
+TEST(FactDBTest, ExternalSortInMemory) {
+  ExternalFactSorter sorter("/tmp/naturalli_test_sort", 100);
+  uint64_t stream[] = { 44l, 42l, 43l, 42l, 44l, 42l };
+  for (uint32_t i = 0; i < 6; ++i) {
+    sorter.add(stream[i]);
+  }
+  EXPECT_EQ(6, sorter.size());
+  vector<pair<uint64_t, uint64_t>> merged;
+  sorter.merge([&merged](const uint64_t& fact, const uint64_t& count) -> void {
+    merged.push_back(make_pair(fact, count));
+  });
+  EXPECT_EQ(0, sorter.numRuns());
+  ASSERT_EQ(3, merged.size());
+  EXPECT_EQ(make_pair(42ul, 3ul), merged[0]);
+  EXPECT_EQ(make_pair(43ul, 1ul), merged[1]);
+  EXPECT_EQ(make_pair(44ul, 2ul), merged[2]);
+}
+
+//
+// The sort buffer grows as facts are added, and spills only once it has
+// reached the run size
+//
+TEST(FactDBTest, ExternalSortGrowsBuffer) {
+  char prefix[] = "/tmp/naturalli_test_sort_XXXXXX";
+  close(mkstemp(prefix));
+  const uint64_t runSize = 3 * EXTERNAL_SORT_INITIAL_BUFFER_SIZE;
+  ExternalFactSorter sorter(prefix, runSize);
+  for (uint64_t i = 0; i < runSize - 1; ++i) {
+    sorter.add(runSize - i);
+  }
+  EXPECT_EQ(0, sorter.numRuns());
+  sorter.add(0l);
+  EXPECT_EQ(1, sorter.numRuns());
+  sorter.add(1l);
+  uint64_t total = 0;
+  uint64_t distinct = 0;
+  sorter.merge([&](const uint64_t& fact, const uint64_t& count) -> void {
+    EXPECT_EQ(distinct, fact);
+    EXPECT_EQ(1, count);
+    total += count;
+    distinct += 1;
+  });
+  EXPECT_EQ(runSize + 1, total);
+  EXPECT_EQ(runSize + 1, distinct);
+  unlink(prefix);
+}
+
+//
+// External sort, spilling many runs, with duplicates across runs
+//
+TEST(FactDBTest, ExternalSortSpill) {
+  char prefix[] = "/tmp/naturalli_test_sort_XXXXXX";
+  close(mkstemp(prefix));
+  const uint64_t count = 100000;
+  uint64_t expectedCount[1000];
+  memset(expectedCount, 0, sizeof(expectedCount));
+  {
+    ExternalFactSorter sorter(prefix, 1000, 2);
+    for (uint64_t i = 0; i < count; ++i) {
+      const uint64_t fact = (i * 7919) % 1000;
+      sorter.add(fact * 0x9e3779b97f4a7c15ul);
+      expectedCount[fact] += 1;
+    }
+    EXPECT_EQ(100, sorter.numRuns());
+    uint64_t last = 0;
+    uint64_t total = 0;
+    uint64_t distinct = 0;
+    sorter.merge([&](const uint64_t& fact, const uint64_t& count) -> void {
+      EXPECT_TRUE(distinct == 0 || fact > last);
+      last = fact;
+      total += count;
+      distinct += 1;
+    });
+    EXPECT_EQ(count, total);
+    EXPECT_EQ(1000, distinct);
+    EXPECT_EQ(0, access((string(prefix) + ".run.0").c_str(), F_OK));
+  }
+  // (the runs are cleaned up)
+  EXPECT_NE(0, access((string(prefix) + ".run.0").c_str(), F_OK));
+  unlink(prefix);
+}
+
+//
+// Write a KB from an external sort, dropping rare facts
+//
+TEST(FactDBTest, WriteKBMinCount) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  const kb_format formats[] = { KB_FORMAT_SORTED, KB_FORMAT_ELIAS_FANO,
+                                KB_FORMAT_EYTZINGER };
+  for (uint32_t f = 0; f < 3; ++f) {
+    ExternalFactSorter sorter(path, 4);
+    uint64_t stream[] = { 44l, 42l, 43l, 42l, 44l, 42l, 45l, 46l, 46l };
+    for (uint32_t i = 0; i < 9; ++i) {
+      sorter.add(stream[i]);
+    }
+    EXPECT_EQ(3, writeKB(path, &sorter, 2, formats[f]));
+    const FactDB* kb = readKB(string(path));
+    EXPECT_EQ(3, kb->size());
+    EXPECT_TRUE(kb->contains(42l));
+    EXPECT_FALSE(kb->contains(43l));
+    EXPECT_TRUE(kb->contains(44l));
+    EXPECT_FALSE(kb->contains(45l));
+    EXPECT_TRUE(kb->contains(46l));
+    delete kb;
+  }
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Writing a KB over one a server has mapped leaves the mapped KB intact
+//
+TEST(FactDBTest, ExternalSortReplacesMappedKB) {
+  char path[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(path));
+  {
+    ExternalFactSorter sorter(path);
+    sorter.add(42l);
+    sorter.add(43l);
+    EXPECT_EQ(2, writeKB(path, &sorter, 1));
+  }
+  const FactDB* mapped = readKB(string(path));
+  {
+    ExternalFactSorter sorter(path);
+    sorter.add(44l);
+    EXPECT_EQ(1, writeKB(path, &sorter, 1));
+  }
+  EXPECT_TRUE(mapped->contains(42l));
+  EXPECT_TRUE(mapped->contains(43l));
+  EXPECT_FALSE(mapped->contains(44l));
+  const FactDB* replaced = readKB(string(path));
+  EXPECT_FALSE(replaced->contains(42l));
+  EXPECT_TRUE(replaced->contains(44l));
+  EXPECT_NE(0, access((string(path) + ".writing").c_str(), F_OK));
+  delete mapped;
+  delete replaced;
+  unlink(path);
+  unlink((string(path) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Merge sorted KBs, by union, intersection and difference
+//
+TEST(FactDBTest, MergeKBs) {
+  char pathA[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(pathA));
+  char pathB[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(pathB));
+  char pathC[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(pathC));
+  char output[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(output));
+  uint64_t streamA[] = { 42l, 43l, 44l, 45l };
+  writeKB(pathA, streamA, 4);
+  uint64_t streamB[] = { 44l, 45l, 46l };
+  writeKB(pathB, streamB, 3);
+  uint64_t streamC[] = { 45l };
+  writeKB(pathC, streamC, 1);
+  vector<string> inputs;
+  inputs.push_back(pathA);
+  inputs.push_back(pathB);
+  inputs.push_back(pathC);
+
+  EXPECT_EQ(5, mergeKBs(inputs, output, KB_MERGE_UNION));
+  const FactDB* kb = readKB(string(output));
+  vector<uint64_t> facts;
+  kb->forEach([&facts](const uint64_t& fact) -> void { facts.push_back(fact); });
+  ASSERT_EQ(5, facts.size());
+  EXPECT_EQ(42l, facts[0]);
+  EXPECT_EQ(46l, facts[4]);
+  delete kb;
+
+  EXPECT_EQ(1, mergeKBs(inputs, output, KB_MERGE_INTERSECTION));
+  kb = readKB(string(output));
+  EXPECT_TRUE(kb->contains(45l));
+  EXPECT_FALSE(kb->contains(44l));
+  delete kb;
+
+  EXPECT_EQ(2, mergeKBs(inputs, output, KB_MERGE_DIFFERENCE,
+                        KB_FORMAT_ELIAS_FANO));
+  kb = readKB(string(output));
+  EXPECT_EQ(2, kb->size());
+  EXPECT_TRUE(kb->contains(42l));
+  EXPECT_TRUE(kb->contains(43l));
+  EXPECT_FALSE(kb->contains(44l));
+  delete kb;
+
+  unlink(pathA);
+  unlink(pathB);
+  unlink(pathC);
+  unlink(output);
+  unlink((string(output) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// Merge KBs spanning several read chunks, into one of the inputs
+//
+TEST(FactDBTest, MergeKBsInPlace) {
+  char pathA[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(pathA));
+  char pathB[] = "/tmp/naturalli_test_kb_XXXXXX";
+  close(mkstemp(pathB));
+  const uint64_t count = 200000;
+  vector<uint64_t> evens;
+  vector<uint64_t> odds;
+  for (uint64_t i = 0; i < count; ++i) {
+    evens.push_back(2 * i);
+    odds.push_back(2 * i + 1);
+  }
+  writeKB(pathA, evens.data(), count);
+  writeKB(pathB, odds.data(), count);
+  vector<string> inputs;
+  inputs.push_back(pathA);
+  inputs.push_back(pathB);
+  EXPECT_EQ(2 * count, mergeKBs(inputs, pathA));
+  const FactDB* kb = readKB(string(pathA));
+  uint64_t expected = 0;
+  kb->forEach([&expected](const uint64_t& fact) -> void {
+    ASSERT_EQ(expected, fact);
+    expected += 1;
+  });
+  EXPECT_EQ(2 * count, expected);
+  delete kb;
+  unlink(pathA);
+  unlink(pathB);
+  unlink((string(pathA) + BLOOM_FILTER_SUFFIX).c_str());
+}
+
+//
+// The premises of a query, inline
+//
+TEST(FactDBTest, PremiseKB) {
+  PremiseKB kb;
+  EXPECT_EQ(0, kb.size());
+  EXPECT_FALSE(kb.contains(42l));
+  kb.add(44l);
+  kb.add(42l);
+  kb.add(44l);
+  EXPECT_EQ(2, kb.size());
+  EXPECT_TRUE(kb.contains(42l));
+  EXPECT_FALSE(kb.contains(43l));
+  EXPECT_TRUE(kb.contains(44l));
+}
+
+//
+// The premises of a query, past the inline capacity
+//
+TEST(FactDBTest, PremiseKBManyFacts) {
+  PremiseKB kb;
+  const uint64_t count = 3 * PREMISE_KB_INLINE_CAPACITY;
+  for (uint64_t i = count; i > 0; --i) {
+    kb.add(i * 0x9e3779b97f4a7c15ul);
+  }
+  EXPECT_EQ(count, kb.size());
+  for (uint64_t i = 1; i <= count; ++i) {
+    ASSERT_TRUE(kb.contains(i * 0x9e3779b97f4a7c15ul));
+    ASSERT_FALSE(kb.contains(i * 0x9e3779b97f4a7c15ul + 1));
+  }
+}
@@ -1,4 +1,10 @@
 #include <limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 #include <config.h>
 #include "gtest/gtest.h"
@@ -7,21 +13,24 @@
 using namespace std;
 
 class GZipTest : public ::testing::Test {
- protected:
-  virtual void SetUp() {
-    FILE* f = fopen("../data/unittest_gzip.tab.gz", "r");
-    if (f != NULL) {
-      fclose(f);
-      iter = new GZIterator("../data/unittest_gzip.tab.gz");
+ public:
+  /**
+   * The path to the test data, from whichever directory the tests are run
+   * in.
+   */
+  static const char* dataPath() {
+    if (access("../data/unittest_gzip.tab.gz", R_OK) == 0) {
+      return "../data/unittest_gzip.tab.gz";
+    } else if (access("data/unittest_gzip.tab.gz", R_OK) == 0) {
+      return "data/unittest_gzip.tab.gz";
     } else {
-      f = fopen("data/unittest_gzip.tab.gz", "r");
-      if (f != NULL) {
-        fclose(f);
-        iter = new GZIterator("data/unittest_gzip.tab.gz");
-      } else {
-        iter = new GZIterator("test/data/unittest_gzip.tab.gz");
-      }
+      return "test/data/unittest_gzip.tab.gz";
     }
+  }
+
+ protected:
+  virtual void SetUp() {
+    iter = new GZIterator(dataPath());
     ASSERT_FALSE(iter == NULL);
   }
 
@@ -77,3 +86,137 @@ TEST_F(GZipTest, CanFinishFile) {
   EXPECT_EQ("4.2", string(row[1]));
   EXPECT_EQ("4.3", string(row[2]));
 }
+
+TEST_F(GZipTest, LineReaderReadsFields) {
+  GZLineReader reader(dataPath());
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(2, reader.size());
+  EXPECT_EQ("1.1", string(reader[0]));
+  EXPECT_EQ("1.2", string(reader[1]));
+  EXPECT_EQ(7, reader.lineLength());
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(2, reader.size());
+  EXPECT_EQ("2.1", string(reader[0]));
+  EXPECT_EQ("", string(reader[1]));
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(1, reader.size());
+  EXPECT_EQ("", string(reader[0]));
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(3, reader.size());
+  EXPECT_EQ("4.1", string(reader.row()[0]));
+  EXPECT_EQ("4.3", string(reader.row()[2]));
+  EXPECT_FALSE(reader.next());
+  EXPECT_FALSE(reader.next());
+}
+
+TEST(GZLineReaderTest, ReadsText) {
+  GZLineReader reader(string("a\tb\n\nc\td\te"));
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(2, reader.size());
+  EXPECT_EQ("a", string(reader[0]));
+  EXPECT_EQ("b", string(reader[1]));
+  ASSERT_TRUE(reader.next());
+  EXPECT_EQ(1, reader.size());
+  EXPECT_EQ(0, reader.lineLength());
+  // (the last line has no newline)
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(3, reader.size());
+  EXPECT_EQ("e", string(reader[2]));
+  EXPECT_FALSE(reader.next());
+
+  GZLineReader empty(string(""));
+  EXPECT_FALSE(empty.next());
+}
+
+TEST(GZLineReaderTest, GrowsForLongLines) {
+  char path[] = "/tmp/naturalli_test_gzip_XXXXXX";
+  close(mkstemp(path));
+  gzFile file = gzopen(path, "wb1");
+  ASSERT_TRUE(file != NULL);
+  const string longField(1000, 'x');
+  gzprintf(file, "1\t%s\n2\tshort\n3\t%s", longField.c_str(),
+           longField.c_str());
+  gzclose(file);
+
+  // (a buffer far smaller than a line)
+  GZLineReader reader(path, 4);
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(2, reader.size());
+  EXPECT_EQ("1", string(reader[0]));
+  EXPECT_EQ(longField, string(reader[1]));
+  ASSERT_TRUE(reader.next());
+  EXPECT_EQ("short", string(reader[1]));
+  ASSERT_TRUE(reader.next());
+  EXPECT_EQ("3", string(reader[0]));
+  EXPECT_EQ(longField, string(reader[1]));
+  EXPECT_FALSE(reader.next());
+  unlink(path);
+}
+
+TEST(GZLineReaderTest, SplitLine) {
+  char line[] = "a\tb\tc";
+  const char* fields[3];
+  ASSERT_EQ(3, splitLine(line, fields, 3));
+  EXPECT_EQ("c", string(fields[2]));
+  char tooLong[] = "a\tb\tc";
+  EXPECT_EQ(3, splitLine(tooLong, fields, 2));
+}
+
+TEST(ParallelGZipTest, ReadsEveryLine) {
+  // Write more than a few blocks of lines
+  char path[] = "/tmp/naturalli_test_gzip_XXXXXX";
+  close(mkstemp(path));
+  gzFile file = gzopen(path, "wb1");
+  ASSERT_TRUE(file != NULL);
+  const uint32_t numLines = 1000000;
+  for (uint32_t i = 0; i < numLines; ++i) {
+    gzprintf(file, "%u\tline number %u%s\n", i, i,
+             i % 1000 == 0 ? "\tand some padding to vary the length" : "");
+  }
+  // (no trailing newline on the last line)
+  gzprintf(file, "%u\tlast", numLines);
+  gzclose(file);
+
+  // Read it back
+  vector<atomic<uint32_t>> seen(numLines + 1);
+  for (uint32_t i = 0; i <= numLines; ++i) {
+    seen[i].store(0);
+  }
+  atomic<uint32_t> badLines(0);
+  atomic<uint32_t> badThreads(0);
+  parallelForEachLine(path, 4,
+      [&](const uint32_t& thread, char* line) -> void {
+    if (thread >= 4) { badThreads += 1; }
+    char* tab = strchr(line, '\t');
+    if (tab == NULL) { badLines += 1; return; }
+    *tab = '\0';
+    const uint32_t i = atoi(line);
+    if (i > numLines) { badLines += 1; return; }
+    if (i == numLines ? strcmp(tab + 1, "last") != 0
+                      : strncmp(tab + 1, "line number ", 12) != 0) {
+      badLines += 1;
+    }
+    seen[i] += 1;
+  });
+  unlink(path);
+  EXPECT_EQ(0, badLines.load());
+  EXPECT_EQ(0, badThreads.load());
+  for (uint32_t i = 0; i <= numLines; ++i) {
+    ASSERT_EQ(1, seen[i].load()) << "line " << i;
+  }
+}
+
+TEST(ParallelGZipTest, SkipsEmptyLines) {
+  vector<string> lines;
+  mutex lock;
+  parallelForEachLine(GZipTest::dataPath(), 2,
+                      [&](const uint32_t&, char* line) -> void {
+    lock_guard<mutex> guard(lock);
+    lines.push_back(string(line));
+  });
+  ASSERT_EQ(3, lines.size());
+  sort(lines.begin(), lines.end());
+  EXPECT_EQ("1.1\t1.2", lines[0]);
+  EXPECT_EQ("2.1\t", lines[1]);
+  EXPECT_EQ("4.1\t4.2\t4.3", lines[2]);
+}
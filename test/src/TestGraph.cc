@@ -1,4 +1,14 @@
 #include <limits.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
 
 #include <config.h>
 #include "gtest/gtest.h"
@@ -57,6 +67,24 @@ TEST_F(MockGraphTest, HasCorrectEdges) {
   EXPECT_EQ(0, mockGraph->incomingEdges(TAIL).size());
 }
 
+// Look up words by their gloss
+TEST_F(MockGraphTest, FindWord) {
+  word w = 0;
+  ASSERT_TRUE(mockGraph->findWord("lemur", &w));
+  EXPECT_EQ(LEMUR.word, w);
+  ASSERT_TRUE(mockGraph->findWord("furry", &w));
+  EXPECT_EQ(FURRY.word, w);
+  EXPECT_FALSE(mockGraph->findWord("lemurs", &w));
+  EXPECT_FALSE(mockGraph->findWord("", &w));
+  EXPECT_FALSE(mockGraph->findWord("<UNK>", &w));
+  for (word i = 0; i < mockGraph->vocabSize(); ++i) {
+    if (string(mockGraph->gloss(i)) != "<UNK>") {
+      ASSERT_TRUE(mockGraph->findWord(mockGraph->gloss(i), &w));
+      EXPECT_EQ(i, w);
+    }
+  }
+}
+
 // Check invalid deletions
 TEST_F(MockGraphTest, CheckInvalidDeletions) {
   // Initialize edge
@@ -75,3 +103,799 @@ TEST_F(MockGraphTest, CheckInvalidDeletions) {
   e.source_sense = 4;
   EXPECT_TRUE(mockGraph->containsDeletion(e));
 }
+
+/**
+ * The mock graph (with cycles), compiled to a graph image and mapped back
+ * in.
+ */
+class GraphImageTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char buffer[] = "/tmp/naturalli_test_graph_XXXXXX";
+    close(mkstemp(buffer));
+    path = string(buffer);
+    textGraph = ReadMockGraph(true);
+    writeGraphImage(*textGraph, path);
+    imageGraph = readGraphImage(path);
+  }
+
+  virtual void TearDown() {
+    delete textGraph;
+    delete imageGraph;
+    unlink(path.c_str());
+  }
+
+  string path;
+  Graph* textGraph;
+  Graph* imageGraph;
+};
+
+// The image has the same words, glosses and edges as the graph it was
+// compiled from
+TEST_F(GraphImageTest, SameAsTextGraph) {
+  ASSERT_EQ(textGraph->vocabSize(), imageGraph->vocabSize());
+  EXPECT_EQ(textGraph->keys(), imageGraph->keys());
+  for (word w = 0; w < textGraph->vocabSize(); ++w) {
+    EXPECT_EQ(string(textGraph->gloss(w)), string(imageGraph->gloss(w)));
+    const edge_list textEdges = textGraph->incomingEdgesFast(w);
+    const edge_list imageEdges = imageGraph->incomingEdgesFast(w);
+    ASSERT_EQ(textEdges.size(), imageEdges.size());
+    for (uint32_t i = 0; i < textEdges.size(); ++i) {
+      EXPECT_EQ(textEdges[i].source, imageEdges[i].source);
+      EXPECT_EQ(textEdges[i].source_sense, imageEdges[i].source_sense);
+      EXPECT_EQ(textEdges[i].sink, imageEdges[i].sink);
+      EXPECT_EQ(textEdges[i].sink_sense, imageEdges[i].sink_sense);
+      EXPECT_EQ(textEdges[i].type, imageEdges[i].type);
+      EXPECT_EQ(textEdges[i].cost, imageEdges[i].cost);
+    }
+  }
+  EXPECT_EQ(2, imageGraph->incomingEdges(ANIMAL).size());
+  EXPECT_EQ(string("<INVALID_WORD>"),
+            string(imageGraph->gloss((word) imageGraph->vocabSize())));
+}
+
+/**
+ * Asserts that two graphs return the same runs of edges for every word,
+ * sense and a few edge type masks.
+ */
+void expectSameRuns(const Graph& expected, const Graph& actual) {
+  const edge_type_mask masks[] = { ALL_EDGE_TYPES, edgeTypeBit(HYPERNYM),
+    edgeTypeBit(HYPONYM) | edgeTypeBit(SYNONYM) };
+  edge_list expectedRuns[MAX_EDGE_RUNS];
+  edge_list actualRuns[MAX_EDGE_RUNS];
+  for (word w = 0; w < expected.vocabSize(); ++w) {
+    EXPECT_EQ(expected.incomingEdgeTypes(w), actual.incomingEdgeTypes(w));
+    for (uint8_t sense = 0; sense < 5; ++sense) {
+      for (uint32_t m = 0; m < sizeof(masks) / sizeof(edge_type_mask); ++m) {
+        const uint32_t numRuns =
+          expected.incomingEdgesFor(w, sense, masks[m], expectedRuns);
+        ASSERT_EQ(numRuns,
+                  actual.incomingEdgesFor(w, sense, masks[m], actualRuns));
+        for (uint32_t run = 0; run < numRuns; ++run) {
+          ASSERT_EQ(expectedRuns[run].size(), actualRuns[run].size());
+          for (uint32_t i = 0; i < expectedRuns[run].size(); ++i) {
+            EXPECT_EQ(expectedRuns[run].source(i), actualRuns[run].source(i));
+            EXPECT_EQ(expectedRuns[run].sourceSense(i),
+                      actualRuns[run].sourceSense(i));
+            EXPECT_EQ(expectedRuns[run].sinkSense(i),
+                      actualRuns[run].sinkSense(i));
+            EXPECT_EQ(expectedRuns[run].type(i), actualRuns[run].type(i));
+            EXPECT_EQ(expectedRuns[run].cost(i), actualRuns[run].cost(i));
+          }
+        }
+      }
+    }
+  }
+}
+
+// The image returns the same sense + type runs as the graph it was
+// compiled from
+TEST_F(GraphImageTest, SameRunsAsTextGraph) {
+  expectSameRuns(*textGraph, *imageGraph);
+}
+
+// An edge from a specific sense is kept in its own run, even when an
+// agnostic edge into the same word costs more; else the search would
+// merge a run that is out of cost order
+TEST_F(GraphImageTest, SenseRunsInCostOrder) {
+  vector<edge> edges;
+  edge e;
+  memset(&e, 0, sizeof(edge));
+  e.sink = LEMUR.word;
+  e.type = HYPERNYM;
+  e.source = CAT.word;    e.source_sense = 1; e.sink_sense = 0; e.cost = 0.01;
+  edges.push_back(e);
+  e.source = ANIMAL.word; e.source_sense = 0; e.sink_sense = 0; e.cost = 5.0;
+  edges.push_back(e);
+  Graph* graph = ReadMockGraph(edges);
+  writeGraphImage(*graph, path);
+  Graph* image = readGraphImage(path);
+  expectSameRuns(*graph, *image);
+  edge_list runs[MAX_EDGE_RUNS];
+  ASSERT_EQ(2, image->incomingEdgesFor(LEMUR.word, 0, ALL_EDGE_TYPES, runs));
+  for (uint32_t run = 0; run < 2; ++run) {
+    for (uint32_t i = 1; i < runs[run].size(); ++i) {
+      EXPECT_LE(runs[run].cost(i - 1), runs[run].cost(i));
+    }
+  }
+  delete image;
+  delete graph;
+}
+
+// The image finds the same words by gloss as the graph it was compiled
+// from
+TEST_F(GraphImageTest, FindWord) {
+  for (word w = 0; w < textGraph->vocabSize(); ++w) {
+    const char* gloss = textGraph->gloss(w);
+    word fromText = 0;
+    word fromImage = 0;
+    ASSERT_EQ(textGraph->findWord(gloss, &fromText),
+              imageGraph->findWord(gloss, &fromImage));
+    EXPECT_EQ(fromText, fromImage);
+  }
+  word w = 0;
+  ASSERT_TRUE(imageGraph->findWord("cat", &w));
+  EXPECT_EQ(CAT.word, w);
+  EXPECT_FALSE(imageGraph->findWord("dogs", &w));
+}
+
+// Check invalid deletions in the image
+TEST_F(GraphImageTest, CheckInvalidDeletions) {
+  ASSERT_EQ(1, imageGraph->invalidDeletions().size());
+  EXPECT_EQ(textGraph->invalidDeletions()[0],
+            imageGraph->invalidDeletions()[0]);
+  edge e;
+  e.sink = 0;
+  e.sink_sense = 0;
+  e.type = 0;
+  e.source = HAVE.word;
+  e.source_sense = 0;
+  EXPECT_TRUE(imageGraph->containsDeletion(e));
+  e.source_sense = 3;
+  EXPECT_FALSE(imageGraph->containsDeletion(e));
+  e.source_sense = 4;
+  EXPECT_TRUE(imageGraph->containsDeletion(e));
+  e.source = CAT.word;
+  e.source_sense = 3;
+  EXPECT_TRUE(imageGraph->containsDeletion(e));
+}
+
+// An image whose offsets run backwards or out of their section is
+// rejected, rather than served
+TEST_F(GraphImageTest, RejectsCorruptOffsets) {
+  graph_image_header header;
+  FILE* file = fopen(path.c_str(), "rb");
+  ASSERT_EQ(1, fread(&header, sizeof(graph_image_header), 1, file));
+  fclose(file);
+  ASSERT_GT(header.numEdges, 0);
+  const uint64_t corruptions[3][2] = {
+    // (an edge offset past the edges, then back; a gloss offset past the
+    // glosses; a run starting outside its word's edges)
+    { header.edgeOffsetsOffset + sizeof(uint64_t), header.numEdges + 1 },
+    { header.glossOffsetsOffset + 2 * sizeof(uint64_t), header.glossBytes + 1 },
+    { header.runsOffset, header.numEdges } };
+  for (uint32_t c = 0; c < 3; ++c) {
+    const string corruptPath = path + ".corrupt";
+    writeGraphImage(*imageGraph, corruptPath);
+    file = fopen(corruptPath.c_str(), "r+b");
+    fseek(file, corruptions[c][0], SEEK_SET);
+    fwrite(&corruptions[c][1], sizeof(uint64_t), 1, file);
+    fclose(file);
+    EXPECT_EXIT(readGraphImage(corruptPath), ::testing::ExitedWithCode(1),
+                "Corrupt graph image");
+    unlink(corruptPath.c_str());
+  }
+}
+
+// An image whose edges leave the vocabulary or have no valid type is
+// rejected, rather than served
+TEST_F(GraphImageTest, RejectsCorruptEdges) {
+  graph_image_header header;
+  FILE* file = fopen(path.c_str(), "rb");
+  ASSERT_EQ(1, fread(&header, sizeof(graph_image_header), 1, file));
+  fclose(file);
+  ASSERT_GT(header.numEdges, 0);
+  const uint32_t badSource = header.numWords;
+  const uint8_t badType = 8 * sizeof(edge_type_mask);
+  // (a source past the vocabulary; a type past the type masks)
+  const uint64_t offsets[2] = {
+    header.edgesOffset + offsetof(edge, source),
+    header.edgesOffset + offsetof(edge, type) };
+  const void* values[2] = { &badSource, &badType };
+  const size_t sizes[2] = { sizeof(badSource), sizeof(badType) };
+  for (uint32_t c = 0; c < 2; ++c) {
+    const string corruptPath = path + ".corrupt";
+    writeGraphImage(*imageGraph, corruptPath);
+    file = fopen(corruptPath.c_str(), "r+b");
+    fseek(file, offsets[c], SEEK_SET);
+    fwrite(values[c], sizes[c], 1, file);
+    fclose(file);
+    EXPECT_TRUE(tryReadGraphImage(corruptPath) == NULL);
+    EXPECT_EXIT(readGraphImage(corruptPath), ::testing::ExitedWithCode(1),
+                "Corrupt graph image");
+    unlink(corruptPath.c_str());
+  }
+}
+
+// An image which cannot be written in full (here, past a file size limit)
+// is removed, and the old image kept
+TEST_F(GraphImageTest, FailedWriteRemovesImage) {
+  EXPECT_EXIT({
+    signal(SIGXFSZ, SIG_IGN);
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = sizeof(graph_image_header) + 64;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    writeGraphImage(*textGraph, path);
+  }, ::testing::ExitedWithCode(1), "graph image");
+  EXPECT_NE(0, access((path + ".compiling").c_str(), F_OK));
+  Graph* image = readGraphImage(path);
+  EXPECT_EQ(textGraph->vocabSize(), image->vocabSize());
+  delete image;
+}
+
+// Compiling an image is deterministic, and replaces the old image
+TEST_F(GraphImageTest, Recompile) {
+  writeGraphImage(*imageGraph, path + ".copy");
+  FILE* original = fopen(path.c_str(), "rb");
+  FILE* copy = fopen((path + ".copy").c_str(), "rb");
+  ASSERT_TRUE(original != NULL);
+  ASSERT_TRUE(copy != NULL);
+  int a, b;
+  uint64_t bytes = 0;
+  do {
+    a = fgetc(original);
+    b = fgetc(copy);
+    ASSERT_EQ(a, b) << "at byte " << bytes;
+    bytes += 1;
+  } while (a != EOF);
+  EXPECT_GT(bytes, sizeof(graph_image_header));
+  fclose(original);
+  fclose(copy);
+  unlink((path + ".copy").c_str());
+}
+
+// A shared image is built by exactly one of the readers racing to map it,
+// and then mapped by every later reader without being rebuilt
+TEST(SharedGraphImageTest, BuiltOnce) {
+  char buffer[] = "/tmp/naturalli_test_shared_XXXXXX";
+  ASSERT_TRUE(mkdtemp(buffer) != NULL);
+  const string directory(buffer);
+  const string path = directory + "/graph.img";
+  atomic<uint32_t> builds(0);
+  function<Graph*()> build = [&builds]() -> Graph* {
+    builds += 1;
+    return ReadMockGraph(true);
+  };
+
+  Graph* graphs[4];
+  vector<thread> threads;
+  for (uint32_t i = 0; i < 4; ++i) {
+    threads.push_back(thread([&graphs, &path, &build, i]() -> void {
+      graphs[i] = readSharedGraphImage(path, build);
+    }));
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  EXPECT_EQ(1, builds.load());
+  Graph* mock = ReadMockGraph(true);
+  for (uint32_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(graphs[i] != NULL);
+    EXPECT_EQ(mock->vocabSize(), graphs[i]->vocabSize());
+    EXPECT_EQ(string("lemur"), string(graphs[i]->gloss(LEMUR)));
+    EXPECT_EQ(mock->incomingEdgesFast(ANIMAL.word).size(),
+              graphs[i]->incomingEdgesFast(ANIMAL.word).size());
+    delete graphs[i];
+  }
+  Graph* later = readSharedGraphImage(path, build);
+  ASSERT_TRUE(later != NULL);
+  EXPECT_EQ(1, builds.load());
+  delete later;
+  delete mock;
+
+  // (no lock file, no sharing)
+  EXPECT_TRUE(readSharedGraphImage(directory + "/missing/graph.img",
+                                   build) == NULL);
+  EXPECT_EQ(1, builds.load());
+  unlink(path.c_str());
+  unlink((path + ".lock").c_str());
+  rmdir(directory.c_str());
+}
+
+// A shared image compiled with other graph settings is rebuilt, rather
+// than served in place of the graph those settings configure
+TEST(SharedGraphImageTest, RebuiltWithOtherSettings) {
+  char buffer[] = "/tmp/naturalli_test_shared_XXXXXX";
+  ASSERT_TRUE(mkdtemp(buffer) != NULL);
+  const string directory(buffer);
+  const string path = directory + "/graph.img";
+  EXPECT_FALSE(graphImageMatches(path, 0, 0, 0.0f));
+  uint8_t costBits = 0;
+  uint32_t builds = 0;
+  function<Graph*()> build = [&builds, &costBits]() -> Graph* {
+    builds += 1;
+    return ReadMockGraph(true, costBits);
+  };
+
+  delete readSharedGraphImage(path, build, costBits, 0, 0.0f);
+  EXPECT_EQ(1, builds);
+  EXPECT_TRUE(graphImageMatches(path, 0, 0, 0.0f));
+  EXPECT_FALSE(graphImageMatches(path, 8, 0, 0.0f));
+  EXPECT_FALSE(graphImageMatches(path, 0, 10, 0.0f));
+  EXPECT_FALSE(graphImageMatches(path, 0, 0, 1.5f));
+  costBits = 8;
+  Graph* image = readSharedGraphImage(path, build, costBits, 0, 0.0f);
+  EXPECT_EQ(2, builds);
+  EXPECT_TRUE(graphImageMatches(path, 8, 0, 0.0f));
+  // (the image holds the quantized costs)
+  Graph* compact = ReadMockGraph(true, 8);
+  const edge_list expected = compact->incomingEdgesFast(ANIMAL.word);
+  const edge_list actual = image->incomingEdgesFast(ANIMAL.word);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (uint32_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected.cost(i), actual.cost(i));
+  }
+  delete compact;
+  delete image;
+  delete readSharedGraphImage(path, build, costBits, 0, 0.0f);
+  EXPECT_EQ(2, builds);
+
+  unlink(path.c_str());
+  unlink((path + ".lock").c_str());
+  rmdir(directory.c_str());
+}
+
+// A shared image older than the graph's text files is rebuilt, rather than
+// served in place of the updated graph
+TEST(SharedGraphImageTest, RebuiltWhenStale) {
+  char buffer[] = "/tmp/naturalli_test_shared_XXXXXX";
+  ASSERT_TRUE(mkdtemp(buffer) != NULL);
+  const string directory(buffer);
+  const string path = directory + "/graph.img";
+  uint32_t builds = 0;
+  function<Graph*()> build = [&builds]() -> Graph* {
+    builds += 1;
+    return ReadMockGraph(true);
+  };
+  delete readSharedGraphImage(path, build);
+  EXPECT_EQ(1, builds);
+  delete readSharedGraphImage(path, build);
+  EXPECT_EQ(1, builds);
+
+  // (date the image back before a text file in a scratch working directory)
+  char cwd[PATH_MAX];
+  ASSERT_TRUE(getcwd(cwd, sizeof(cwd)) != NULL);
+  const string textFile = directory + "/" + GRAPH_FILE;
+  if (GRAPH_FILE[0] != '/' && chdir(directory.c_str()) == 0) {
+    const string textDirectory = textFile.substr(0, textFile.rfind('/'));
+    mkdir(textDirectory.c_str(), 0755);
+    fclose(fopen(textFile.c_str(), "w"));
+    struct utimbuf times;
+    times.actime = times.modtime = 0;
+    utime(path.c_str(), &times);
+    delete readSharedGraphImage(path, build);
+    EXPECT_EQ(2, builds);
+    delete readSharedGraphImage(path, build);
+    EXPECT_EQ(2, builds);
+    ASSERT_EQ(0, chdir(cwd));
+    unlink(textFile.c_str());
+    rmdir(textDirectory.c_str());
+  }
+
+  unlink(path.c_str());
+  unlink((path + ".lock").c_str());
+  rmdir(directory.c_str());
+}
+
+// A corrupt shared image is rebuilt, rather than taking the server down
+TEST(SharedGraphImageTest, RebuiltWhenCorrupt) {
+  char buffer[] = "/tmp/naturalli_test_shared_XXXXXX";
+  ASSERT_TRUE(mkdtemp(buffer) != NULL);
+  const string directory(buffer);
+  const string path = directory + "/graph.img";
+  uint32_t builds = 0;
+  function<Graph*()> build = [&builds]() -> Graph* {
+    builds += 1;
+    return ReadMockGraph(true);
+  };
+  delete readSharedGraphImage(path, build);
+  EXPECT_EQ(1, builds);
+
+  // (an edge whose type is past the type masks)
+  graph_image_header header;
+  FILE* file = fopen(path.c_str(), "r+b");
+  ASSERT_EQ(1, fread(&header, sizeof(graph_image_header), 1, file));
+  ASSERT_GT(header.numEdges, 0);
+  const uint8_t badType = 8 * sizeof(edge_type_mask);
+  fseek(file, header.edgesOffset + offsetof(edge, type), SEEK_SET);
+  fwrite(&badType, sizeof(badType), 1, file);
+  fclose(file);
+  Graph* image = readSharedGraphImage(path, build);
+  EXPECT_EQ(2, builds);
+  Graph* mock = ReadMockGraph(true);
+  EXPECT_EQ(mock->incomingEdgesFast(ANIMAL.word).size(),
+            image->incomingEdgesFast(ANIMAL.word).size());
+  delete mock;
+  delete image;
+  delete readSharedGraphImage(path, build);
+  EXPECT_EQ(2, builds);
+
+  unlink(path.c_str());
+  unlink((path + ".lock").c_str());
+  rmdir(directory.c_str());
+}
+
+// An edge list reads the same edges from packed arrays as from an array
+// of edges
+TEST(EdgeListTest, PackedAndUnpacked) {
+  edge edges[3];
+  memset(edges, 0, sizeof(edges));
+  const word sources[3] = { 7, 8, 1000000 };
+  const uint8_t sourceSenses[3] = { 0, 1, 2 };
+  const uint8_t sinkSenses[3] = { 3, 4, 5 };
+  const edge_type types[3] = { HYPERNYM, HYPONYM, HYPERNYM };
+  const float costs[3] = { 0.5f, 1.5f, 2.5f };
+  for (uint32_t i = 0; i < 3; ++i) {
+    edges[i].source = sources[i];
+    edges[i].source_sense = sourceSenses[i];
+    edges[i].sink = 42;
+    edges[i].sink_sense = sinkSenses[i];
+    edges[i].type = types[i];
+    edges[i].cost = costs[i];
+  }
+  const edge_list packed(42, 3, sources, sourceSenses, sinkSenses, types,
+                         costs);
+  const edge_list unpacked(42, edges, 3);
+  ASSERT_EQ(3, packed.size());
+  ASSERT_EQ(3, unpacked.size());
+  EXPECT_EQ(42, packed.sink());
+  EXPECT_EQ(42, unpacked.sink());
+  for (uint32_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(sources[i], packed.source(i));
+    EXPECT_EQ(sources[i], unpacked.source(i));
+    EXPECT_EQ(sourceSenses[i], packed.sourceSense(i));
+    EXPECT_EQ(sourceSenses[i], unpacked.sourceSense(i));
+    EXPECT_EQ(sinkSenses[i], packed.sinkSense(i));
+    EXPECT_EQ(sinkSenses[i], unpacked.sinkSense(i));
+    EXPECT_EQ(types[i], packed.type(i));
+    EXPECT_EQ(types[i], unpacked.type(i));
+    EXPECT_EQ(costs[i], packed.cost(i));
+    EXPECT_EQ(costs[i], unpacked.cost(i));
+    const edge e = packed[i];
+    EXPECT_EQ(42, e.sink);
+    EXPECT_EQ(sources[i], e.source);
+    EXPECT_EQ(costs[i], e.cost);
+  }
+  EXPECT_EQ(0, edge_list().size());
+}
+
+// The edges into a sink are partitioned into those valid for any sense,
+// and those into each sink sense, with a run per type; together these are
+// exactly the edges the search may take from that sense
+TEST(SensePartitionTest, EdgesForSense) {
+  vector<edge> edges;
+  edge e;
+  memset(&e, 0, sizeof(edge));
+  e.sink = LEMUR.word;
+  e.type = HYPERNYM;
+  e.source = POTTO.word;  e.source_sense = 0; e.sink_sense = 0; e.cost = 0.5;
+  edges.push_back(e);
+  e.source = ANIMAL.word; e.source_sense = 1; e.sink_sense = 1; e.cost = 0.2;
+  edges.push_back(e);
+  e.source = CAT.word;    e.source_sense = 2; e.sink_sense = 1; e.cost = 0.9;
+  edges.push_back(e);
+  e.source = FURRY.word;  e.source_sense = 1; e.sink_sense = 2; e.cost = 0.1;
+  edges.push_back(e);
+  e.source = TAIL.word;   e.source_sense = 0; e.sink_sense = 3; e.cost = 0.3;
+  edges.push_back(e);
+  e.source = HAVE.word;   e.source_sense = 1; e.sink_sense = 1; e.cost = 0.4;
+  e.type = SYNONYM;
+  edges.push_back(e);
+  Graph* graph = ReadMockGraph(edges);
+  ASSERT_EQ(6, graph->incomingEdgesFast(LEMUR.word).size());
+  EXPECT_EQ(edgeTypeBit(HYPERNYM) | edgeTypeBit(SYNONYM),
+            graph->incomingEdgeTypes(LEMUR.word));
+  EXPECT_EQ(0, graph->incomingEdgeTypes(ANIMAL.word));
+
+  edge_list runs[MAX_EDGE_RUNS];
+  ASSERT_EQ(3, graph->incomingEdgesFor(LEMUR.word, 1, ALL_EDGE_TYPES, runs));
+  ASSERT_EQ(2, runs[0].size());
+  EXPECT_EQ(TAIL.word, runs[0].source(0));
+  EXPECT_EQ(POTTO.word, runs[0].source(1));
+  ASSERT_EQ(2, runs[1].size());
+  EXPECT_EQ(ANIMAL.word, runs[1].source(0));
+  EXPECT_EQ(CAT.word, runs[1].source(1));
+  ASSERT_EQ(1, runs[2].size());
+  EXPECT_EQ(HAVE.word, runs[2].source(0));
+  ASSERT_EQ(2, graph->incomingEdgesFor(LEMUR.word, 1, edgeTypeBit(HYPERNYM),
+                                       runs));
+  EXPECT_EQ(TAIL.word, runs[0].source(0));
+  EXPECT_EQ(ANIMAL.word, runs[1].source(0));
+  ASSERT_EQ(1, graph->incomingEdgesFor(LEMUR.word, 1, edgeTypeBit(SYNONYM),
+                                       runs));
+  EXPECT_EQ(HAVE.word, runs[0].source(0));
+  EXPECT_EQ(0, graph->incomingEdgesFor(LEMUR.word, 1, edgeTypeBit(NN), runs));
+  ASSERT_EQ(2, graph->incomingEdgesFor(LEMUR.word, 2, ALL_EDGE_TYPES, runs));
+  ASSERT_EQ(1, runs[1].size());
+  EXPECT_EQ(FURRY.word, runs[1].source(0));
+  EXPECT_EQ(1, graph->incomingEdgesFor(LEMUR.word, 3, ALL_EDGE_TYPES, runs));
+  EXPECT_EQ(0, graph->incomingEdgesFor(ANIMAL.word, 1, ALL_EDGE_TYPES, runs));
+
+  // (the runs agree with filtering every edge on its senses and type)
+  const edge_list all = graph->incomingEdgesFast(LEMUR.word);
+  const edge_type_mask typeSets[3] = {
+    ALL_EDGE_TYPES, edgeTypeBit(HYPERNYM), edgeTypeBit(SYNONYM) };
+  for (uint8_t sense = 0; sense < 5; ++sense) {
+    for (uint32_t t = 0; t < 3; ++t) {
+      const uint32_t numRuns =
+        graph->incomingEdgesFor(LEMUR.word, sense, typeSets[t], runs);
+      uint32_t valid = 0;
+      for (uint32_t i = 0; i < all.size(); ++i) {
+        if ((all.sourceSense(i) == 0 || all.sinkSense(i) == sense) &&
+            (typeSets[t] & edgeTypeBit(all.type(i))) != 0) {
+          valid += 1;
+        }
+      }
+      uint32_t returned = 0;
+      for (uint32_t run = 0; run < numRuns; ++run) {
+        returned += runs[run].size();
+        for (uint32_t i = 0; i < runs[run].size(); ++i) {
+          EXPECT_TRUE(runs[run].sourceSense(i) == 0 ||
+                      runs[run].sinkSense(i) == sense);
+          EXPECT_NE(0, typeSets[t] & edgeTypeBit(runs[run].type(i)));
+          if (i > 0) {
+            EXPECT_TRUE(edgeCostOrder(runs[run][i - 1], runs[run][i]));
+          }
+        }
+      }
+      EXPECT_EQ(valid, returned);
+    }
+  }
+  delete graph;
+}
+
+// A run of compact edges reads back its packed sources and senses, the
+// fields it shares, and its dequantized costs
+TEST(EdgeListTest, CompactRun) {
+  const uint32_t packed[3] = {
+    (3u << PACKED_SOURCE_BITS) | 7,
+    (4u << PACKED_SOURCE_BITS) | 8,
+    (5u << PACKED_SOURCE_BITS) | 1000000 };
+  const uint8_t codes8[3] = { 0, 1, 255 };
+  const uint16_t codes16[3] = { 0, 1, 65535 };
+  const uint8_t sense = 2;
+  const uint8_t anySense = 0;
+  const edge_type type = HYPONYM;
+  const edge_list intoSense(42, 3, packed, false, &sense, &type,
+                            codes8, 8, 0.5f, 0.25f);
+  const edge_list intoAny(42, 3, packed, true, &anySense, &type,
+                          codes16, 16, 1.0f, 0.5f);
+  ASSERT_EQ(3, intoSense.size());
+  EXPECT_EQ(42, intoSense.sink());
+  const word sources[3] = { 7, 8, 1000000 };
+  for (uint32_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(sources[i], intoSense.source(i));
+    EXPECT_EQ(sources[i], intoAny.source(i));
+    EXPECT_EQ(3 + i, intoSense.sourceSense(i));
+    EXPECT_EQ(2, intoSense.sinkSense(i));
+    EXPECT_EQ(0, intoAny.sourceSense(i));
+    EXPECT_EQ(3 + i, intoAny.sinkSense(i));
+    EXPECT_EQ(HYPONYM, intoSense.type(i));
+    EXPECT_EQ(HYPONYM, intoAny[i].type);
+  }
+  EXPECT_FLOAT_EQ(0.5f, intoSense.cost(0));
+  EXPECT_FLOAT_EQ(0.75f, intoSense.cost(1));
+  EXPECT_FLOAT_EQ(64.25f, intoSense.cost(2));
+  EXPECT_FLOAT_EQ(1.0f, intoAny.cost(0));
+  EXPECT_FLOAT_EQ(1.5f, intoAny.cost(1));
+  EXPECT_FLOAT_EQ(32768.5f, intoAny[2].cost);
+}
+
+// A compact graph has the same edges as the float graph, in the same
+// runs, with each cost within the documented tolerance
+TEST(CompactGraphTest, MatchesFloatGraph) {
+  vector<edge> edges;
+  edge e;
+  memset(&e, 0, sizeof(edge));
+  const word sinks[3] = { LEMUR.word, ANIMAL.word, CAT.word };
+  const word sources[4] = { POTTO.word, TAIL.word, FURRY.word, HAVE.word };
+  const edge_type types[3] = { HYPERNYM, HYPONYM, SYNONYM };
+  for (uint32_t i = 0; i < 60; ++i) {
+    e.sink = sinks[i % 3];
+    e.source = sources[i % 4];
+    e.source_sense = (i / 4) % 3;
+    e.sink_sense = (i / 3) % 4;
+    e.type = types[(i / 5) % 3];
+    e.cost = 0.01f + (i * 37 % 61) * 0.173f;
+    edges.push_back(e);
+  }
+  // (the largest and smallest cost of each type bound the error)
+  float minCosts[3] = { 1e9, 1e9, 1e9 };
+  float maxCosts[3] = { 0.0, 0.0, 0.0 };
+  for (auto iter = edges.begin(); iter != edges.end(); ++iter) {
+    const uint32_t t = iter->type == HYPERNYM ? 0 : (iter->type == HYPONYM ? 1 : 2);
+    minCosts[t] = min(minCosts[t], iter->cost);
+    maxCosts[t] = max(maxCosts[t], iter->cost);
+  }
+
+  Graph* floats = ReadMockGraph(edges);
+  const uint8_t costBits[2] = { 8, 16 };
+  for (uint32_t b = 0; b < 2; ++b) {
+    Graph* compact = ReadMockGraph(edges, costBits[b]);
+    for (uint32_t s = 0; s < 3; ++s) {
+      for (uint8_t sense = 0; sense < 5; ++sense) {
+        edge_list floatRuns[MAX_EDGE_RUNS];
+        edge_list compactRuns[MAX_EDGE_RUNS];
+        const uint32_t numRuns = floats->incomingEdgesFor(
+            sinks[s], sense, ALL_EDGE_TYPES, floatRuns);
+        ASSERT_EQ(numRuns, compact->incomingEdgesFor(
+            sinks[s], sense, ALL_EDGE_TYPES, compactRuns));
+        for (uint32_t run = 0; run < numRuns; ++run) {
+          ASSERT_EQ(floatRuns[run].size(), compactRuns[run].size());
+          for (uint32_t i = 0; i < floatRuns[run].size(); ++i) {
+            const edge expected = floatRuns[run][i];
+            const edge actual = compactRuns[run][i];
+            EXPECT_EQ(expected.source, actual.source);
+            EXPECT_EQ(expected.source_sense, actual.source_sense);
+            EXPECT_EQ(expected.sink, actual.sink);
+            EXPECT_EQ(expected.sink_sense, actual.sink_sense);
+            EXPECT_EQ(expected.type, actual.type);
+            const uint32_t t = expected.type == HYPERNYM ? 0
+              : (expected.type == HYPONYM ? 1 : 2);
+            const float tolerance = (maxCosts[t] - minCosts[t]) /
+              (2 * ((0x1 << costBits[b]) - 1));
+            EXPECT_NEAR(expected.cost, actual.cost, tolerance * 1.001);
+            if (i > 0) {
+              EXPECT_LE(compactRuns[run].cost(i - 1), actual.cost);
+            }
+          }
+        }
+      }
+      // (every edge into the sink, unpacked)
+      const edge_list floatEdges = floats->incomingEdgesFast(sinks[s]);
+      const edge_list compactEdges = compact->incomingEdgesFast(sinks[s]);
+      ASSERT_EQ(floatEdges.size(), compactEdges.size());
+      for (uint32_t i = 0; i < floatEdges.size(); ++i) {
+        EXPECT_EQ(floatEdges.source(i), compactEdges.source(i));
+        EXPECT_EQ(floatEdges.sourceSense(i), compactEdges.sourceSense(i));
+        EXPECT_EQ(floatEdges.sinkSense(i), compactEdges.sinkSense(i));
+        EXPECT_EQ(floatEdges.type(i), compactEdges.type(i));
+        EXPECT_NEAR(floatEdges.cost(i), compactEdges.cost(i), 0.03);
+      }
+    }
+    delete compact;
+  }
+  delete floats;
+}
+
+// Pruning at load time keeps the edges the search would visit first into
+// each word, and drops the edges over the cost cutoff
+TEST(PruneGraphTest, TopKAndCostCutoff) {
+  vector<edge> edges;
+  edge e;
+  memset(&e, 0, sizeof(edge));
+  const word sources[4] = { POTTO.word, TAIL.word, FURRY.word, HAVE.word };
+  for (uint32_t i = 0; i < 8; ++i) {
+    e.sink = i % 2 == 0 ? LEMUR.word : ANIMAL.word;
+    e.source = sources[i / 2];
+    e.source_sense = i % 3;
+    e.sink_sense = 1;
+    e.type = i < 4 ? HYPERNYM : HYPONYM;
+    e.cost = 0.1f * (8 - i);
+    edges.push_back(e);
+  }
+  Graph* all = ReadMockGraph(edges);
+  ASSERT_EQ(4, all->incomingEdgesFast(LEMUR.word).size());
+
+  // (the kept edges are the first into each sink in edgeCostOrder)
+  for (uint32_t k = 1; k <= 5; ++k) {
+    Graph* pruned = ReadMockGraph(edges, 0, k);
+    const word sinks[2] = { LEMUR.word, ANIMAL.word };
+    for (uint32_t s = 0; s < 2; ++s) {
+      const edge_list before = all->incomingEdgesFast(sinks[s]);
+      vector<edge> expected;
+      for (uint32_t i = 0; i < before.size(); ++i) {
+        expected.push_back(before[i]);
+      }
+      sort(expected.begin(), expected.end(), edgeCostOrder);
+      expected.resize(min(k, (uint32_t) expected.size()));
+      const edge_list after = pruned->incomingEdgesFast(sinks[s]);
+      vector<edge> actual;
+      for (uint32_t i = 0; i < after.size(); ++i) {
+        actual.push_back(after[i]);
+      }
+      sort(actual.begin(), actual.end(), edgeCostOrder);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (uint32_t i = 0; i < actual.size(); ++i) {
+        EXPECT_EQ(expected[i].source, actual[i].source);
+        EXPECT_EQ(expected[i].cost, actual[i].cost);
+      }
+    }
+    EXPECT_EQ(0, pruned->incomingEdgesFast(CAT.word).size());
+    delete pruned;
+  }
+
+  // (the cost cutoff, alone and with a top-K)
+  Graph* cheap = ReadMockGraph(edges, 0, 0, 0.45f);
+  EXPECT_EQ(2, cheap->incomingEdgesFast(LEMUR.word).size());
+  EXPECT_EQ(2, cheap->incomingEdgesFast(ANIMAL.word).size());
+  const edge_list cheapEdges = cheap->incomingEdgesFast(LEMUR.word);
+  for (uint32_t i = 0; i < cheapEdges.size(); ++i) {
+    EXPECT_LE(cheapEdges.cost(i), 0.45f);
+  }
+  delete cheap;
+  Graph* cheapest = ReadMockGraph(edges, 16, 1, 0.45f);
+  ASSERT_EQ(1, cheapest->incomingEdgesFast(LEMUR.word).size());
+  EXPECT_EQ(HAVE.word, cheapest->incomingEdgesFast(LEMUR.word).source(0));
+  delete cheapest;
+  delete all;
+}
+
+// The outgoing edges of a BidirectionalGraph are exactly the incoming
+// edges of the graph it wraps, grouped by source, however many threads
+// build the index
+// The runs of a compact graph cover every edge into each word, in the
+// order incomingEdgesFast() lists them
+TEST(CompactGraphTest, RunsCoverEveryEdge) {
+  Graph* compact = ReadMockGraph(true, 8);
+  for (word w = 0; w < compact->vocabSize(); ++w) {
+    vector<edge> visited;
+    compact->forEachIncomingRun(w, [&visited](const edge_list& edges) -> void {
+      for (uint32_t i = 0; i < edges.size(); ++i) {
+        visited.push_back(edges[i]);
+      }
+    });
+    const edge_list edges = compact->incomingEdgesFast(w);
+    ASSERT_EQ(edges.size(), visited.size());
+    for (uint32_t i = 0; i < edges.size(); ++i) {
+      EXPECT_EQ(edges.source(i), visited[i].source);
+      EXPECT_EQ(edges.sourceSense(i), visited[i].source_sense);
+      EXPECT_EQ(edges.sinkSense(i), visited[i].sink_sense);
+      EXPECT_EQ(edges.type(i), visited[i].type);
+      EXPECT_EQ(edges.cost(i), visited[i].cost);
+    }
+  }
+  delete compact;
+}
+
+TEST(BidirectionalGraphTest, OutgoingEdges) {
+  for (uint32_t numThreads = 1; numThreads <= 4; numThreads += 3) {
+    BidirectionalGraph graph(ReadMockGraph(true), numThreads);
+    ASSERT_EQ(HIGHEST_MOCK_WORD_INDEX + 1, graph.vocabSize());
+    const vector<edge> fromLemur = graph.outgoingEdges(LEMUR);
+    ASSERT_EQ(2, fromLemur.size());
+    EXPECT_EQ(min(POTTO.word, ANIMAL.word), fromLemur[0].sink);
+    EXPECT_EQ(max(POTTO.word, ANIMAL.word), fromLemur[1].sink);
+    const vector<edge> fromCat = graph.outgoingEdges(CAT);
+    ASSERT_EQ(1, fromCat.size());
+    EXPECT_EQ(ANIMAL.word, fromCat[0].sink);
+    EXPECT_EQ(HYPERNYM, fromCat[0].type);
+    EXPECT_FLOAT_EQ(42.0, fromCat[0].cost);
+    EXPECT_EQ(0, graph.outgoingEdges(TAIL).size());
+
+    uint64_t numOutgoing = 0;
+    for (word source = 0; source < graph.vocabSize(); ++source) {
+      uint64_t length;
+      const edge* outgoing = graph.outgoingEdgesFast(source, &length);
+      numOutgoing += length;
+      for (uint64_t i = 0; i < length; ++i) {
+        EXPECT_EQ(source, outgoing[i].source);
+        const edge_list incoming = graph.incomingEdgesFast(outgoing[i].sink);
+        uint32_t matches = 0;
+        for (uint32_t k = 0; k < incoming.size(); ++k) {
+          if (incoming.source(k) == source &&
+              incoming.type(k) == outgoing[i].type) {
+            matches += 1;
+          }
+        }
+        EXPECT_EQ(1, matches);
+      }
+    }
+    uint64_t numIncoming = 0;
+    for (word sink = 0; sink < graph.vocabSize(); ++sink) {
+      numIncoming += graph.incomingEdgesFast(sink).size();
+    }
+    EXPECT_EQ(6, numIncoming);
+    EXPECT_EQ(numIncoming, numOutgoing);
+  }
+}
@@ -0,0 +1,175 @@
+#include <limits.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <atomic>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "KBRegistry.h"
+
+using namespace std;
+
+/**
+ * A directory of two sorted KBs, "evens" and "odds", with a loader which
+ * counts the KBs it reads.
+ */
+class KBRegistryTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char buffer[] = "/tmp/naturalli_test_kbs_XXXXXX";
+    ASSERT_TRUE(mkdtemp(buffer) != NULL);
+    directory = string(buffer);
+    vector<uint64_t> evens;
+    vector<uint64_t> odds;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+      evens.push_back(2 * i);
+      odds.push_back(2 * i + 1);
+    }
+    writeKB(directory + "/evens", evens.data(), evens.size());
+    writeKB(directory + "/odds", odds.data(), odds.size());
+    loads = 0;
+  }
+
+  virtual void TearDown() {
+    unlink((directory + "/evens").c_str());
+    unlink((directory + "/odds").c_str());
+    unlink((directory + "/bad").c_str());
+    unlink((directory + "/evens.delta").c_str());
+    rmdir(directory.c_str());
+  }
+
+  function<const FactDB*(const string&)> loader() {
+    return [this](const string& path) -> const FactDB* {
+      loads += 1;
+      return readKB(path);
+    };
+  }
+
+  string directory;
+  atomic<uint32_t> loads;
+};
+
+//
+// Names which could reach outside the directory are rejected
+//
+TEST(KBRegistryNameTest, IsValidName) {
+  EXPECT_TRUE(KBRegistry::isValidName("wiki"));
+  EXPECT_TRUE(KBRegistry::isValidName("wiki-2015_en.kb"));
+  EXPECT_FALSE(KBRegistry::isValidName(""));
+  EXPECT_FALSE(KBRegistry::isValidName(".."));
+  EXPECT_FALSE(KBRegistry::isValidName(".hidden"));
+  EXPECT_FALSE(KBRegistry::isValidName("../etc"));
+  EXPECT_FALSE(KBRegistry::isValidName("a/b"));
+  EXPECT_FALSE(KBRegistry::isValidName("a\\b"));
+  EXPECT_FALSE(KBRegistry::isValidName("a\"b"));
+  // (nor the files kept beside a KB)
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.delta"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.bloom"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.lock"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.staging"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.compacting.1234"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.compacting.1234.delta"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.run.0"));
+  EXPECT_FALSE(KBRegistry::isValidName("wiki.kb.run.12"));
+  EXPECT_TRUE(KBRegistry::isValidName("wiki.deltas"));
+}
+
+//
+// The empty name gets the default KB
+//
+TEST_F(KBRegistryTest, DefaultKB) {
+  BTreeFactDB* defaultKB = new BTreeFactDB();
+  KBRegistry kbs(defaultKB, "", loader());
+  EXPECT_EQ(defaultKB, kbs.get(""));
+  EXPECT_TRUE(kbs.isLoaded(""));
+  EXPECT_EQ(NULL, kbs.get("evens"));
+  EXPECT_EQ(1, kbs.size());
+  EXPECT_EQ(0, loads);
+}
+
+//
+// Registered KBs are loaded eagerly, and served by name
+//
+TEST_F(KBRegistryTest, AddAll) {
+  KBRegistry kbs(new BTreeFactDB(), "", loader());
+  kbs.addAll("evens=" + directory + "/evens," +
+             "odds=" + directory + "/odds");
+  EXPECT_EQ(3, kbs.size());
+  EXPECT_EQ(2, loads);
+  EXPECT_TRUE(kbs.isLoaded("evens"));
+  EXPECT_TRUE(kbs.isLoaded("odds"));
+  const FactDB* evens = kbs.get("evens");
+  const FactDB* odds = kbs.get("odds");
+  ASSERT_TRUE(evens != NULL);
+  ASSERT_TRUE(odds != NULL);
+  EXPECT_TRUE(evens->contains(42));
+  EXPECT_FALSE(evens->contains(43));
+  EXPECT_TRUE(odds->contains(43));
+  EXPECT_FALSE(odds->contains(42));
+  EXPECT_EQ(NULL, kbs.get("other"));
+  EXPECT_EQ(2, loads);
+}
+
+//
+// KBs in the directory are loaded on demand, exactly once
+//
+TEST_F(KBRegistryTest, LoadOnDemand) {
+  KBRegistry kbs(new BTreeFactDB(), directory, loader());
+  EXPECT_FALSE(kbs.isLoaded("evens"));
+  EXPECT_EQ(NULL, kbs.get("missing"));
+  EXPECT_EQ(NULL, kbs.get("../" + directory.substr(5) + "/evens"));
+  EXPECT_EQ(1, kbs.size());
+
+  const FactDB* found[8];
+  vector<thread> threads;
+  for (uint32_t i = 0; i < 8; ++i) {
+    threads.push_back(thread([&kbs, &found, i]() -> void {
+      found[i] = kbs.get("evens");
+    }));
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  EXPECT_EQ(1, loads);
+  EXPECT_TRUE(kbs.isLoaded("evens"));
+  EXPECT_FALSE(kbs.isLoaded("odds"));
+  for (uint32_t i = 0; i < 8; ++i) {
+    ASSERT_EQ(found[0], found[i]);
+  }
+  ASSERT_TRUE(found[0] != NULL);
+  EXPECT_TRUE(found[0]->contains(2000));
+  EXPECT_EQ(1000, found[0]->size());
+  EXPECT_TRUE(kbs.get("odds")->contains(2001));
+  EXPECT_EQ(2, loads);
+  EXPECT_EQ(3, kbs.size());
+}
+
+//
+// A KB which cannot be read fails only the queries asking for it
+//
+TEST_F(KBRegistryTest, LoadBadKB) {
+  KBRegistry kbs(new BTreeFactDB(), directory, loader());
+  // (a sorted KB with a bad version)
+  FILE* file = fopen((directory + "/bad").c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  sorted_kb_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SORTED_KB_MAGIC;
+  header.version = SORTED_KB_VERSION + 1;
+  fwrite(&header, sizeof(header), 1, file);
+  fclose(file);
+  // (and a good KB, named as the delta log of another)
+  uint64_t facts[] = { 42l };
+  writeKB(directory + "/evens.delta", facts, 1);
+
+  EXPECT_EQ(NULL, kbs.get("bad"));
+  EXPECT_EQ(NULL, kbs.get("bad"));
+  EXPECT_FALSE(kbs.isLoaded("bad"));
+  EXPECT_EQ(NULL, kbs.get("evens.delta"));
+  EXPECT_EQ(0, loads);
+  ASSERT_TRUE(kbs.get("evens") != NULL);
+  EXPECT_EQ(1, loads);
+}
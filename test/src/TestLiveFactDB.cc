@@ -0,0 +1,242 @@
+#include <limits.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "LiveFactDB.h"
+
+using namespace std;
+
+/**
+ * A sorted KB in a temporary file, along with its delta log.
+ */
+class LiveFactDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char buffer[] = "/tmp/naturalli_test_kb_XXXXXX";
+    close(mkstemp(buffer));
+    path = string(buffer);
+    uint64_t stream[] = { 42l, 44l, 46l };
+    writeKB(path, stream, 3);
+  }
+
+  virtual void TearDown() {
+    unlink(path.c_str());
+    unlink((path + KB_DELTA_LOG_SUFFIX).c_str());
+    unlink((path + BLOOM_FILTER_SUFFIX).c_str());
+  }
+
+  /** The size of the delta log, in bytes */
+  off_t logSize() {
+    struct stat stats;
+    if (stat((path + KB_DELTA_LOG_SUFFIX).c_str(), &stats) != 0) {
+      return -1;
+    }
+    return stats.st_size;
+  }
+
+  string path;
+};
+
+//
+// The delta set
+//
+TEST(DeltaFactSetTest, InsertAndContains) {
+  DeltaFactSet set(100);
+  EXPECT_EQ(128, set.capacity());
+  EXPECT_FALSE(set.contains(42l));
+  EXPECT_FALSE(set.contains(0l));
+  EXPECT_TRUE(set.insert(42l));
+  EXPECT_TRUE(set.insert(42l));
+  EXPECT_TRUE(set.insert(0l));
+  EXPECT_TRUE(set.contains(42l));
+  EXPECT_TRUE(set.contains(0l));
+  EXPECT_FALSE(set.contains(43l));
+  EXPECT_EQ(2, set.size());
+  vector<uint64_t> facts;
+  set.sortedFacts(&facts);
+  ASSERT_EQ(2, facts.size());
+  EXPECT_EQ(0l, facts[0]);
+  EXPECT_EQ(42l, facts[1]);
+}
+
+//
+// The delta set refuses facts once it is 3/4 full
+//
+TEST(DeltaFactSetTest, Full) {
+  DeltaFactSet set(64);
+  for (uint64_t i = 1; i <= 48; ++i) {
+    EXPECT_TRUE(set.insert(i * 7919));
+  }
+  EXPECT_FALSE(set.insert(49 * 7919));
+  EXPECT_TRUE(set.insert(7919));  // (already present)
+  for (uint64_t i = 1; i <= 48; ++i) {
+    EXPECT_TRUE(set.contains(i * 7919));
+  }
+  EXPECT_FALSE(set.contains(49 * 7919));
+}
+
+//
+// Concurrent inserts into the delta set
+//
+TEST(DeltaFactSetTest, ConcurrentInsert) {
+  DeltaFactSet set(1 << 16);
+  vector<thread> threads;
+  for (uint32_t t = 0; t < 4; ++t) {
+    threads.push_back(thread([&set, t]() -> void {
+      for (uint64_t i = 1; i <= 10000; ++i) {
+        set.insert(i * 0x9e3779b97f4a7c15ul + (t % 2));
+      }
+    }));
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  EXPECT_EQ(20000, set.size());
+  for (uint64_t i = 1; i <= 10000; ++i) {
+    ASSERT_TRUE(set.contains(i * 0x9e3779b97f4a7c15ul));
+    ASSERT_TRUE(set.contains(i * 0x9e3779b97f4a7c15ul + 1));
+  }
+}
+
+//
+// Inserted facts are visible immediately
+//
+TEST_F(LiveFactDBTest, Insert) {
+  LiveFactDB kb(path, readKB(path), 0, 0, 0);
+  EXPECT_TRUE(kb.contains(42l));
+  EXPECT_FALSE(kb.contains(43l));
+  kb.insert(43l);
+  EXPECT_TRUE(kb.contains(43l));
+  EXPECT_TRUE(kb.mayContain(43l));
+  bool rejected = true;
+  EXPECT_TRUE(kb.filteredContains(43l, &rejected));
+  EXPECT_FALSE(rejected);
+}
+
+//
+// Facts appended to the log by another writer are picked up on poll()
+//
+TEST_F(LiveFactDBTest, PollLog) {
+  uint64_t before[] = { 1l };
+  appendToDeltaLog(path, before, 1);
+  LiveFactDB kb(path, readKB(path), 0, 0, 0);
+  EXPECT_TRUE(kb.contains(1l));  // (read on startup)
+  uint64_t after[] = { 43l, 45l };
+  appendToDeltaLog(path, after, 2);
+  EXPECT_FALSE(kb.contains(43l));
+  kb.poll();
+  EXPECT_TRUE(kb.contains(43l));
+  EXPECT_TRUE(kb.contains(45l));
+  EXPECT_TRUE(kb.contains(46l));
+  vector<uint64_t> facts;
+  kb.forEach([&facts](const uint64_t& fact) -> void { facts.push_back(fact); });
+  ASSERT_EQ(6, facts.size());
+  EXPECT_EQ(1l, facts[0]);
+  EXPECT_EQ(42l, facts[1]);
+  EXPECT_EQ(43l, facts[2]);
+  EXPECT_EQ(46l, facts[5]);
+}
+
+//
+// A log replaced by a new file is read from its start, even once the new
+// log is longer than the part of the old one already read
+//
+TEST_F(LiveFactDBTest, ReplacedLog) {
+  uint64_t before[] = { 1l };
+  appendToDeltaLog(path, before, 1);
+  LiveFactDB kb(path, readKB(path), 0, 0, 0);
+  EXPECT_TRUE(kb.contains(1l));
+  unlink((path + KB_DELTA_LOG_SUFFIX).c_str());
+  uint64_t after[] = { 43l, 45l };
+  appendToDeltaLog(path, after, 2);
+  kb.poll();
+  EXPECT_TRUE(kb.contains(43l));
+  EXPECT_TRUE(kb.contains(45l));
+}
+
+//
+// The delta grows past its initial capacity
+//
+TEST_F(LiveFactDBTest, GrowDelta) {
+  const uint64_t count = 3 * KB_DELTA_INITIAL_CAPACITY;
+  vector<uint64_t> facts;
+  for (uint64_t i = 0; i < count; ++i) {
+    facts.push_back(1000 + i);
+  }
+  LiveFactDB kb(path, readKB(path), 0, 0, 0);
+  appendToDeltaLog(path, facts.data(), count);
+  kb.poll();
+  for (uint64_t i = 0; i < count; ++i) {
+    ASSERT_TRUE(kb.contains(1000 + i));
+  }
+  EXPECT_TRUE(kb.contains(42l));
+}
+
+//
+// Compaction merges the delta into the base file
+//
+TEST_F(LiveFactDBTest, Compact) {
+  {
+    LiveFactDB kb(path, readKB(path), 0, 0, 0);
+    kb.insert(43l);
+    kb.insert(42l);
+    kb.poll();
+    EXPECT_TRUE(kb.compact());
+    EXPECT_TRUE(kb.contains(43l));
+    // (the compacted facts are rotated out of the log)
+    EXPECT_EQ(0, logSize());
+    kb.insert(47l);
+    EXPECT_TRUE(kb.contains(47l));
+    EXPECT_EQ(sizeof(uint64_t), logSize());
+  }
+  // (the base file now has the compacted facts)
+  const FactDB* base = readKB(path);
+  EXPECT_EQ(4, base->size());
+  EXPECT_TRUE(base->contains(43l));
+  EXPECT_FALSE(base->contains(47l));
+  delete base;
+  // (and a restarted KB only replays the rest of the log)
+  LiveFactDB* restarted = readLiveKB(path);
+  EXPECT_TRUE(restarted->contains(43l));
+  EXPECT_TRUE(restarted->contains(47l));
+  EXPECT_EQ(5, restarted->size());
+  delete restarted;
+}
+
+//
+// Readers see a consistent KB while facts are ingested and compacted
+//
+TEST_F(LiveFactDBTest, ConcurrentReaders) {
+  LiveFactDB kb(path, readKB(path), 0, 0, 0);
+  atomic<bool> done(false);
+  atomic<uint64_t> errors(0);
+  vector<thread> readers;
+  for (uint32_t t = 0; t < 2; ++t) {
+    readers.push_back(thread([&kb, &done, &errors]() -> void {
+      while (!done.load()) {
+        if (!kb.contains(42l) || !kb.contains(46l) || kb.contains(43l)) {
+          errors.fetch_add(1);
+        }
+      }
+    }));
+  }
+  for (uint64_t round = 0; round < 3; ++round) {
+    vector<uint64_t> facts;
+    for (uint64_t i = 0; i < 10000; ++i) {
+      facts.push_back(1000 + round * 10000 + i);
+    }
+    appendToDeltaLog(path, facts.data(), facts.size());
+    kb.poll();
+    EXPECT_TRUE(kb.compact());
+  }
+  done.store(true);
+  for (auto iter = readers.begin(); iter != readers.end(); ++iter) {
+    iter->join();
+  }
+  EXPECT_EQ(0, errors.load());
+  EXPECT_TRUE(kb.contains(1000l));
+  EXPECT_TRUE(kb.contains(30999l));
+}
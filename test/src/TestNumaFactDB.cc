@@ -0,0 +1,141 @@
+#include <limits.h>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "NumaFactDB.h"
+
+using namespace std;
+
+/**
+ * A topology with two nodes, which both have every CPU; so, every thread
+ * runs on node 0, and reads node 1's shards remotely.
+ */
+numa_topology twoNodeTopology() {
+  vector<uint32_t> cpus;
+  for (uint32_t cpu = 0; cpu < max(1u, thread::hardware_concurrency());
+       ++cpu) {
+    cpus.push_back(cpu);
+  }
+  numa_topology topology;
+  topology.nodeCpus.push_back(cpus);
+  topology.nodeCpus.push_back(cpus);
+  topology.cpuNode = vector<uint32_t>(cpus.size() + 1024, 0);
+  return topology;
+}
+
+/** A KB of facts spread across the whole hash space */
+BTreeFactDB* spreadFacts(const uint64_t& count) {
+  btree::btree_set<uint64_t>* facts = new btree::btree_set<uint64_t>();
+  for (uint64_t i = 0; i < count; ++i) {
+    facts->insert(i * 0x9e3779b97f4a7c15ul);
+  }
+  return new BTreeFactDB(facts, true);
+}
+
+//
+// Parse sysfs CPU lists
+//
+TEST(NumaFactDBTest, ParseCpuList) {
+  vector<uint32_t> cpus = parseCpuList("0-3,8,10-11\n");
+  ASSERT_EQ(7, cpus.size());
+  EXPECT_EQ(0, cpus[0]);
+  EXPECT_EQ(3, cpus[3]);
+  EXPECT_EQ(8, cpus[4]);
+  EXPECT_EQ(11, cpus[6]);
+  EXPECT_EQ(0, parseCpuList("").size());
+}
+
+//
+// Read the topology from a (fake) sysfs directory
+//
+TEST(NumaFactDBTest, ReadTopology) {
+  char root[] = "/tmp/naturalli_test_numa_XXXXXX";
+  ASSERT_TRUE(mkdtemp(root) != NULL);
+  const string node0 = string(root) + "/node0";
+  const string node1 = string(root) + "/node1";
+  mkdir(node0.c_str(), 0755);
+  mkdir(node1.c_str(), 0755);
+  FILE* file = fopen((node0 + "/cpulist").c_str(), "w");
+  fprintf(file, "0-1,4\n");
+  fclose(file);
+  file = fopen((node1 + "/cpulist").c_str(), "w");
+  fprintf(file, "2-3\n");
+  fclose(file);
+
+  numa_topology topology = readNumaTopology(root);
+  ASSERT_EQ(2, topology.nodeCpus.size());
+  EXPECT_EQ(3, topology.nodeCpus[0].size());
+  ASSERT_EQ(5, topology.cpuNode.size());
+  EXPECT_EQ(0, topology.cpuNode[1]);
+  EXPECT_EQ(1, topology.cpuNode[2]);
+  EXPECT_EQ(0, topology.cpuNode[4]);
+
+  unlink((node0 + "/cpulist").c_str());
+  unlink((node1 + "/cpulist").c_str());
+  rmdir(node0.c_str());
+  rmdir(node1.c_str());
+  // (no sysfs: one node)
+  topology = readNumaTopology(root);
+  EXPECT_EQ(1, topology.nodeCpus.size());
+  rmdir(root);
+}
+
+//
+// A sharded KB has the same facts as the KB it was built from
+//
+TEST(NumaFactDBTest, Contains) {
+  NumaShardedFactDB kb(spreadFacts(10000), 4, 0, twoNodeTopology());
+  EXPECT_EQ(16, kb.shards());
+  EXPECT_EQ(10000, kb.size());
+  EXPECT_EQ(0, kb.homeNode(0));
+  EXPECT_EQ(1, kb.homeNode(15));
+  for (uint64_t i = 0; i < 10000; ++i) {
+    ASSERT_TRUE(kb.contains(i * 0x9e3779b97f4a7c15ul));
+    ASSERT_FALSE(kb.contains(i * 0x9e3779b97f4a7c15ul + 1));
+  }
+  uint64_t last = 0;
+  uint64_t count = 0;
+  kb.forEach([&last, &count](const uint64_t& fact) -> void {
+    EXPECT_TRUE(count == 0 || fact > last);
+    last = fact;
+    count += 1;
+  });
+  EXPECT_EQ(10000, count);
+}
+
+//
+// Shards read remotely are replicated, and dropped once they cool off
+//
+TEST(NumaFactDBTest, ReplicateHotShards) {
+  NumaShardedFactDB kb(spreadFacts(10000), 4, 1, twoNodeTopology(), 0);
+  // (read a fact in a remote shard, repeatedly)
+  const uint64_t remoteFact = 9999 * 0x9e3779b97f4a7c15ul;
+  const uint64_t remoteShard = kb.shardOf(remoteFact);
+  ASSERT_EQ(1, kb.homeNode(remoteShard));
+  EXPECT_FALSE(kb.isReplicated(remoteShard));
+  for (uint32_t i = 0; i < 100 * KB_NUMA_SAMPLE_INTERVAL; ++i) {
+    ASSERT_TRUE(kb.contains(remoteFact));
+  }
+  kb.rebalance();
+  EXPECT_TRUE(kb.isReplicated(remoteShard));
+  EXPECT_TRUE(kb.contains(remoteFact));
+  EXPECT_FALSE(kb.contains(remoteFact + 1));
+  // (read another remote shard instead)
+  const uint64_t otherFact = 8001 * 0x9e3779b97f4a7c15ul;
+  const uint64_t otherShard = kb.shardOf(otherFact);
+  ASSERT_EQ(1, kb.homeNode(otherShard));
+  ASSERT_NE(remoteShard, otherShard);
+  for (uint32_t r = 0; r < 10; ++r) {
+    for (uint32_t i = 0; i < 100 * KB_NUMA_SAMPLE_INTERVAL; ++i) {
+      ASSERT_TRUE(kb.contains(otherFact));
+    }
+    kb.rebalance();
+  }
+  EXPECT_FALSE(kb.isReplicated(remoteShard));
+  EXPECT_TRUE(kb.isReplicated(otherShard));
+  EXPECT_TRUE(kb.contains(remoteFact));
+  EXPECT_TRUE(kb.contains(otherFact));
+}
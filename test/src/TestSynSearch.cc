@@ -1540,6 +1540,62 @@ TEST_F(SynSearchTest, LemursToAnimalsStrict) {
   EXPECT_EQ(lemursHaveTails->hash(), response.paths[0].front().factHash());
 }
 
+//
+// Real Search (restricted edge types)
+//
+TEST_F(SynSearchTest, LemursToCatsEdgeTypes) {
+  opts.edgeTypes = edgeTypeBit(HYPERNYM) | edgeTypeBit(HYPONYM);
+  syn_search_response response = SynSearch(graph, &factdb, lemursHaveTails, costs, true, opts);
+  ASSERT_EQ(1, response.paths.size());
+  EXPECT_EQ(catsHaveTails->hash(), response.paths[0].front().factHash());
+  opts.edgeTypes = ALL_EDGE_TYPES & ~edgeTypeBit(HYPERNYM);
+  response = SynSearch(graph, &factdb, lemursHaveTails, costs, true, opts);
+  EXPECT_EQ(0, response.paths.size());
+}
+
+//
+// Real Search (compact graph)
+//
+TEST_F(SynSearchTest, LemursToAnimalsCompact) {
+  btree_set<uint64_t> factdb;
+  factdb.insert(lemursHaveTails->hash());
+  syn_search_response expected = SynSearch(cyclicGraph, &factdb, animalsHaveTails, costs, true, opts);
+  for (uint8_t costBits = 8; costBits <= 16; costBits += 8) {
+    Graph* compactGraph = ReadMockGraph(true, costBits);
+    syn_search_response response = SynSearch(compactGraph, &factdb, animalsHaveTails, costs, true, opts);
+    ASSERT_EQ(expected.paths.size(), response.paths.size());
+    for (uint32_t i = 0; i < response.paths.size(); ++i) {
+      EXPECT_EQ(expected.paths[i].size(), response.paths[i].size());
+      EXPECT_EQ(expected.paths[i].front().factHash(), response.paths[i].front().factHash());
+      // (each edge cost is within 42 / (2 * (2^costBits - 1)), as 42 is the
+      // widest range of costs of any type in the mock graph)
+      const float tolerance = (response.paths[i].size() - 1) * 42.0f /
+        (2 * ((0x1 << costBits) - 1));
+      EXPECT_NEAR(expected.paths[i].cost, response.paths[i].cost, tolerance);
+    }
+    EXPECT_EQ(expected.totalTicks, response.totalTicks);
+    delete compactGraph;
+  }
+}
+
+//
+// Parse the %edgeTypes directive
+//
+TEST(ParseEdgeTypesTest, AllowAndExclude) {
+  edge_type_mask edgeTypes = 0x0;
+  EXPECT_TRUE(parseEdgeTypes("hypernym,hyponym", &edgeTypes));
+  EXPECT_EQ(edgeTypeBit(HYPERNYM) | edgeTypeBit(HYPONYM), edgeTypes);
+  EXPECT_TRUE(parseEdgeTypes("-nn,-similar", &edgeTypes));
+  EXPECT_EQ(ALL_EDGE_TYPES & ~(edgeTypeBit(NN) | edgeTypeBit(SIMILAR)),
+            edgeTypes);
+  EXPECT_TRUE(parseEdgeTypes("Synonym,hypernym,-hypernym", &edgeTypes));
+  EXPECT_EQ(edgeTypeBit(SYNONYM), edgeTypes);
+  edgeTypes = 0x42;
+  EXPECT_FALSE(parseEdgeTypes("hypernym,nosuchtype", &edgeTypes));
+  EXPECT_FALSE(parseEdgeTypes("", &edgeTypes));
+  EXPECT_EQ(0x42, edgeTypes);
+}
+
 //
 // No DB Given
 //
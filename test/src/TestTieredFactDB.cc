@@ -0,0 +1,94 @@
+#include <limits.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "TieredFactDB.h"
+
+using namespace std;
+
+/**
+ * A sorted KB in a temporary file, served as the cold tier of a
+ * TieredFactDB.
+ */
+class TieredFactDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char buffer[] = "/tmp/naturalli_test_kb_XXXXXX";
+    close(mkstemp(buffer));
+    path = string(buffer);
+    vector<uint64_t> facts;
+    for (uint64_t i = 1; i <= 10000; ++i) {
+      facts.push_back(2 * i);
+    }
+    writeKB(path, facts.data(), facts.size());
+  }
+
+  virtual void TearDown() {
+    unlink(path.c_str());
+    unlink((path + BLOOM_FILTER_SUFFIX).c_str());
+  }
+
+  string path;
+};
+
+//
+// The hot set
+//
+TEST(HotFactSetTest, Lookup) {
+  HotFactSet set(3);
+  set.insert(42l, true);
+  set.insert(43l, false);
+  set.insert(0l, true);
+  EXPECT_EQ(3, set.size());
+  bool present = false;
+  EXPECT_TRUE(set.lookup(42l, &present));
+  EXPECT_TRUE(present);
+  EXPECT_TRUE(set.lookup(43l, &present));
+  EXPECT_FALSE(present);
+  EXPECT_TRUE(set.lookup(0l, &present));
+  EXPECT_TRUE(present);
+  EXPECT_FALSE(set.lookup(44l, &present));
+}
+
+//
+// Before any rebuild, everything is answered by the cold tier
+//
+TEST_F(TieredFactDBTest, Cold) {
+  TieredFactDB kb(readKB(path), 16, 0);
+  EXPECT_EQ(0, kb.hotSetSize());
+  EXPECT_EQ(10000, kb.size());
+  for (uint64_t i = 1; i <= 10000; ++i) {
+    ASSERT_TRUE(kb.contains(2 * i));
+    ASSERT_FALSE(kb.contains(2 * i + 1));
+  }
+}
+
+//
+// Frequent hits and misses are promoted to the hot set
+//
+TEST_F(TieredFactDBTest, RebuildHotSet) {
+  TieredFactDB kb(readKB(path), 2, 0);
+  for (uint64_t round = 0; round < 1000; ++round) {
+    EXPECT_TRUE(kb.contains(42l));
+    EXPECT_FALSE(kb.contains(43l));
+    // (and a long tail of one-off lookups)
+    kb.contains(1000 + round);
+  }
+  kb.rebuildHotSet();
+  EXPECT_EQ(2, kb.hotSetSize());
+  EXPECT_TRUE(kb.isHot(42l));
+  EXPECT_TRUE(kb.isHot(43l));
+  EXPECT_FALSE(kb.isHot(44l));
+  // (the hot tier gives the same answers)
+  EXPECT_TRUE(kb.contains(42l));
+  EXPECT_TRUE(kb.mayContain(42l));
+  EXPECT_FALSE(kb.contains(43l));
+  EXPECT_FALSE(kb.mayContain(43l));
+  EXPECT_TRUE(kb.contains(44l));
+  bool rejected = false;
+  EXPECT_FALSE(kb.filteredContains(43l, &rejected));
+  EXPECT_TRUE(rejected);
+  EXPECT_TRUE(kb.filteredContains(42l, &rejected));
+  EXPECT_FALSE(rejected);
+}
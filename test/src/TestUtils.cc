@@ -133,6 +133,20 @@ TEST_F(UtilsTest, FastATOIPeculiarities) {
   EXPECT_EQ(104235, fast_atoi("104235}"));
 }
 
+TEST_F(UtilsTest, FastATOF) {
+  const char* values[] = { "0", "1", "-1", "0.01", "0.42", "42.00", "+3.5",
+    "-0.0001", "1e3", "2.5E-4", "123456.789", ".5", "5.", "0.30000001",
+    "1e-30", "inf", "-nan", "12345678901234567890" };
+  for (uint32_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    const float expected = strtof(values[i], NULL);
+    if (expected != expected) {
+      EXPECT_TRUE(fast_atof(values[i]) != fast_atof(values[i]));
+    } else {
+      EXPECT_FLOAT_EQ(expected, fast_atof(values[i])) << values[i];
+    }
+  }
+}
+
 
 //
 // Apparently the Regex library isn't so mature yet.